@@ -4,11 +4,20 @@
 #define _MCUFONT_H_
 
 #include "mf_config.h"
+#include "mf_atlasfont.h"
+#include "mf_cachedfont.h"
 #include "mf_encoding.h"
+#include "mf_fallbackfont.h"
+#include "mf_framebuffer.h"
 #include "mf_justify.h"
 #include "mf_kerning.h"
+#include "mf_metrics.h"
 #include "mf_rlefont.h"
 #include "mf_scaledfont.h"
+#include "mf_spans.h"
+#include "mf_stats.h"
+#include "mf_streamfont.h"
+#include "mf_update.h"
 #include "mf_wordwrap.h"
 
 #endif
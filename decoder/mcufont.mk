@@ -9,11 +9,20 @@ MFINC = $(MFDIR)
 
 # Source code files to include
 MFSRC = \
+    $(MFDIR)/mf_atlasfont.c \
+    $(MFDIR)/mf_cachedfont.c \
     $(MFDIR)/mf_encoding.c \
+    $(MFDIR)/mf_fallbackfont.c \
     $(MFDIR)/mf_font.c \
+    $(MFDIR)/mf_framebuffer.c \
     $(MFDIR)/mf_justify.c \
     $(MFDIR)/mf_kerning.c \
+    $(MFDIR)/mf_metrics.c \
     $(MFDIR)/mf_rlefont.c \
     $(MFDIR)/mf_bwfont.c \
     $(MFDIR)/mf_scaledfont.c \
+    $(MFDIR)/mf_spans.c \
+    $(MFDIR)/mf_stats.c \
+    $(MFDIR)/mf_streamfont.c \
+    $(MFDIR)/mf_update.c \
     $(MFDIR)/mf_wordwrap.c
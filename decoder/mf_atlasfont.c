@@ -0,0 +1,224 @@
+#include "mf_atlasfont.h"
+#include "mf_stats.h"
+#define MF_FRAMEBUFFER_INTERNALS
+#include "mf_framebuffer.h"
+
+/* Find the glyph of a character. Uses a binary search if the ranges are
+ * known to be sorted. */
+static const struct mf_atlasfont_glyph_s *find_glyph(
+    const struct mf_atlasfont_s *font, uint16_t character)
+{
+    unsigned i, index, low, high, mid;
+    const struct mf_atlasfont_char_range_s *range = 0;
+
+    MF_STATS_ADD(glyph_lookups, 1);
+
+    if (font->font.flags & MF_FONT_FLAG_SORTED_RANGES)
+    {
+        low = 0;
+        high = font->char_range_count;
+        while (high - low > 1)
+        {
+            MF_STATS_ADD(range_scans, 1);
+            mid = (low + high) / 2;
+            if (font->char_ranges[mid].first_char <= character)
+                low = mid;
+            else
+                high = mid;
+        }
+
+        if (high > low)
+            range = &font->char_ranges[low];
+    }
+    else
+    {
+        for (i = 0; i < font->char_range_count; i++)
+        {
+            MF_STATS_ADD(range_scans, 1);
+            if (character >= font->char_ranges[i].first_char &&
+                (unsigned)(character - font->char_ranges[i].first_char) <
+                    font->char_ranges[i].char_count)
+            {
+                range = &font->char_ranges[i];
+                break;
+            }
+        }
+    }
+
+    if (!range)
+        return 0;
+
+    index = character - range->first_char;
+    if (character < range->first_char || index >= range->char_count ||
+        !range->glyphs[index].advance)
+    {
+        return 0;
+    }
+
+    return &range->glyphs[index];
+}
+
+/* Limit a span of the clip rectangle to begin..end, relative to the start
+ * of the bitmap. */
+static void clip_span(int32_t clip_begin, int32_t clip_end,
+                      uint8_t *begin, uint8_t *end)
+{
+    if (clip_end < *end)
+        *end = (clip_end > 0) ? clip_end : 0;
+    if (clip_begin > *begin)
+        *begin = (clip_begin < *end) ? clip_begin : *end;
+}
+
+/* Write out a run of pixels with the same alpha. */
+static void write_run(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
+                      mf_pixel_callback_t callback, void *state)
+{
+    MF_STATS_ADD(pixel_callbacks, 1);
+
+#if MF_USE_FRAMEBUFFER
+    /* Skip the indirect call for the built-in render targets. */
+    if (callback == mf_framebuffer_callback)
+    {
+        mf_framebuffer_write(state, x, y, count, alpha);
+        return;
+    }
+#endif
+
+    callback(x, y, count, alpha, state);
+}
+
+/* Get the alpha of a pixel on a row of the atlas. */
+static uint8_t pixel_alpha(const struct mf_atlasfont_atlas_s *atlas,
+                           const uint8_t *row, uint16_t x)
+{
+    uint8_t byte;
+
+    if (atlas->bits_per_pixel == 8)
+        return pgm_read_byte(row + x);
+
+    byte = pgm_read_byte(row + x / 2);
+    return ((x & 1) ? (byte & 0x0F) : (byte >> 4)) * 0x11;
+}
+
+static uint8_t render_glyph(const struct mf_atlasfont_s *font,
+                            const struct mf_atlasfont_glyph_s *glyph,
+                            int16_t x0, int16_t y0,
+                            const struct mf_rect_s *clip,
+                            mf_pixel_callback_t callback,
+                            void *state)
+{
+    const struct mf_atlasfont_atlas_s *atlas = font->atlas;
+    const uint8_t *row;
+    uint8_t x, y, x_begin, x_end, y_begin, y_end;
+    uint8_t alpha, run_alpha, run_begin;
+
+    x0 += glyph->offset_x;
+    y0 += glyph->offset_y;
+    x_begin = 0;
+    y_begin = 0;
+    x_end = glyph->width;
+    y_end = glyph->height;
+
+    if (clip)
+    {
+        clip_span((int32_t)clip->x - x0, (int32_t)clip->x + clip->width - x0,
+                  &x_begin, &x_end);
+        clip_span((int32_t)clip->y - y0, (int32_t)clip->y + clip->height - y0,
+                  &y_begin, &y_end);
+    }
+
+    /* Each row is read straight from the atlas, and the pixels with the
+     * same alpha are written as a single run. */
+    for (y = y_begin; y < y_end; y++)
+    {
+        row = atlas->data + (uint32_t)(glyph->y + y) * atlas->stride;
+        run_alpha = 0;
+        run_begin = x_begin;
+
+        for (x = x_begin; x < x_end; x++)
+        {
+            alpha = pixel_alpha(atlas, row, glyph->x + x);
+            if (alpha != run_alpha)
+            {
+                if (run_alpha)
+                {
+                    write_run(x0 + run_begin, y0 + y, x - run_begin,
+                              run_alpha, callback, state);
+                }
+
+                run_alpha = alpha;
+                run_begin = x;
+            }
+        }
+
+        if (run_alpha)
+        {
+            write_run(x0 + run_begin, y0 + y, x_end - run_begin, run_alpha,
+                      callback, state);
+        }
+    }
+
+    return glyph->advance;
+}
+
+uint8_t mf_atlasfont_render_character_clipped(const struct mf_font_s *font,
+                                              int16_t x0, int16_t y0,
+                                              mf_char character,
+                                              const struct mf_rect_s *clip,
+                                              mf_pixel_callback_t callback,
+                                              void *state)
+{
+    const struct mf_atlasfont_s *afont = (const struct mf_atlasfont_s*)font;
+    const struct mf_atlasfont_glyph_s *glyph;
+
+    glyph = find_glyph(afont, character);
+    if (!glyph)
+        return 0;
+
+    return render_glyph(afont, glyph, x0, y0, clip, callback, state);
+}
+
+uint8_t mf_atlasfont_render_character(const struct mf_font_s *font,
+                                      int16_t x0, int16_t y0,
+                                      mf_char character,
+                                      mf_pixel_callback_t callback,
+                                      void *state)
+{
+    return mf_atlasfont_render_character_clipped(font, x0, y0, character, 0,
+                                                 callback, state);
+}
+
+uint8_t mf_atlasfont_character_width(const struct mf_font_s *font,
+                                     mf_char character)
+{
+    const struct mf_atlasfont_glyph_s *glyph;
+
+    glyph = find_glyph((const struct mf_atlasfont_s*)font, character);
+    if (!glyph)
+        return 0;
+
+    return glyph->advance;
+}
+
+uint8_t mf_atlasfont_get_bitmap(const struct mf_font_s *font,
+                                mf_char character,
+                                struct mf_atlasfont_bitmap_s *bitmap)
+{
+    const struct mf_atlasfont_s *afont = (const struct mf_atlasfont_s*)font;
+    const struct mf_atlasfont_atlas_s *atlas = afont->atlas;
+    const struct mf_atlasfont_glyph_s *glyph;
+
+    glyph = find_glyph(afont, character);
+    if (!glyph)
+        return 0;
+
+    bitmap->data = atlas->data + (uint32_t)glyph->y * atlas->stride +
+                   (uint32_t)glyph->x * atlas->bits_per_pixel / 8;
+    bitmap->stride = atlas->stride;
+    bitmap->bits_per_pixel = atlas->bits_per_pixel;
+    bitmap->width = glyph->width;
+    bitmap->height = glyph->height;
+    bitmap->offset_x = glyph->offset_x;
+    bitmap->offset_y = glyph->offset_y;
+    return glyph->advance;
+}
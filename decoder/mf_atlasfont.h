@@ -0,0 +1,137 @@
+/* Uncompressed antialiased fonts, stored as prerendered alpha bitmaps in a
+ * single atlas image. Takes a lot more space than the rlefont format, but
+ * rendering only reads the pixels, so it is meant for targets with plenty
+ * of memory and a tight frame budget. Several fonts, e.g. different sizes
+ * of a typeface, can share one atlas.
+ */
+
+#ifndef _MF_ATLASFONT_H_
+#define _MF_ATLASFONT_H_
+
+#include "mf_font.h"
+
+/* Versions of the atlas font format that are supported. */
+#define MF_ATLASFONT_VERSION_1_SUPPORTED 1
+
+/* Position of a single glyph. */
+struct mf_atlasfont_glyph_s
+{
+    /* Upper left corner of the bitmap in the atlas, in pixels. */
+    uint16_t x;
+    uint16_t y;
+
+    /* Size of the bitmap, cropped to the visible pixels. */
+    uint8_t width;
+    uint8_t height;
+
+    /* Position of the bitmap relative to the upper left corner of the
+     * character. */
+    uint8_t offset_x;
+    uint8_t offset_y;
+
+    /* Width of the character, or 0 if the font does not have it. */
+    uint8_t advance;
+};
+
+/* Structure for a range of characters. */
+struct mf_atlasfont_char_range_s
+{
+    /* The number of the first character in this range. */
+    uint16_t first_char;
+
+    /* The total count of characters in this range. */
+    uint16_t char_count;
+
+    /* The glyphs of the characters in this range. */
+    const struct mf_atlasfont_glyph_s *glyphs;
+};
+
+/* The atlas image shared by the fonts. */
+struct mf_atlasfont_atlas_s
+{
+    /* The pixels row by row. With 8 bits per pixel, each byte is the alpha
+     * of a pixel. With 4 bits, each byte has two pixels with the left one
+     * in the high nibble, and the glyphs start on whole bytes. */
+    const uint8_t *data;
+
+    /* Bytes per row. */
+    uint16_t stride;
+
+    /* Size of the atlas in pixels. */
+    uint16_t width;
+    uint16_t height;
+
+    /* Either 4 or 8. */
+    uint8_t bits_per_pixel;
+};
+
+/* Structure for the font */
+struct mf_atlasfont_s
+{
+    struct mf_font_s font;
+
+    /* Version of the font format. */
+    const uint8_t version;
+
+    /* The atlas that has the glyphs. */
+    const struct mf_atlasfont_atlas_s *atlas;
+
+    /* Number of character ranges. */
+    const uint16_t char_range_count;
+
+    /* Array of the character ranges */
+    const struct mf_atlasfont_char_range_s *char_ranges;
+};
+
+/* A glyph in the atlas, for copying it row by row with memcpy, DMA or a
+ * GPU instead of going through the pixel callback. */
+struct mf_atlasfont_bitmap_s
+{
+    /* The first byte of the top row. Each row starts on a whole byte. */
+    const uint8_t *data;
+
+    /* Bytes from the start of a row to the next one. */
+    uint16_t stride;
+
+    /* Number of bits per pixel, as in the atlas. */
+    uint8_t bits_per_pixel;
+
+    /* Size of the bitmap in pixels. Can be 0 for e.g. the space. */
+    uint8_t width;
+    uint8_t height;
+
+    /* Position of the bitmap relative to the upper left corner of the
+     * character, as passed to mf_render_character. */
+    uint8_t offset_x;
+    uint8_t offset_y;
+};
+
+/* Find the bitmap of a character in an atlas font.
+ *
+ * font:      Pointer to the font definition. Must be a mf_atlasfont_s.
+ * character: The character code (unicode) to look up.
+ * bitmap:    Filled in with the location of the glyph.
+ *
+ * Returns width of the character, or 0 if it is not found.
+ */
+MF_EXTERN uint8_t mf_atlasfont_get_bitmap(const struct mf_font_s *font,
+                                          mf_char character,
+                                          struct mf_atlasfont_bitmap_s *bitmap);
+
+#ifdef MF_ATLASFONT_INTERNALS
+/* Internal functions, don't use these directly. */
+MF_EXTERN uint8_t mf_atlasfont_render_character(const struct mf_font_s *font,
+                                                int16_t x0, int16_t y0,
+                                                mf_char character,
+                                                mf_pixel_callback_t callback,
+                                                void *state);
+
+MF_EXTERN uint8_t mf_atlasfont_render_character_clipped(
+    const struct mf_font_s *font, int16_t x0, int16_t y0, mf_char character,
+    const struct mf_rect_s *clip, mf_pixel_callback_t callback, void *state);
+
+MF_EXTERN uint8_t mf_atlasfont_character_width(const struct mf_font_s *font,
+                                               mf_char character);
+#endif
+
+#endif
@@ -1,14 +1,50 @@
 #include "mf_bwfont.h"
+#include "mf_stats.h"
+#define MF_FRAMEBUFFER_INTERNALS
+#include "mf_framebuffer.h"
 #include <stdbool.h>
 
-/* Find the character range and index that contains a given glyph.. */
+/* Find the character range and index that contains a given glyph. Uses a
+ * binary search if the ranges are known to be sorted. */
 static const struct mf_bwfont_char_range_s *find_char_range(
     const struct mf_bwfont_s *font, uint16_t character, uint16_t *index_ret)
 {
-    unsigned i, index;
+    unsigned i, index, low, high, mid;
     const struct mf_bwfont_char_range_s *range;
+
+    MF_STATS_ADD(glyph_lookups, 1);
+
+    if (font->font.flags & MF_FONT_FLAG_SORTED_RANGES)
+    {
+        low = 0;
+        high = font->char_range_count;
+        while (high - low > 1)
+        {
+            MF_STATS_ADD(range_scans, 1);
+            mid = (low + high) / 2;
+            if (font->char_ranges[mid].first_char <= character)
+                low = mid;
+            else
+                high = mid;
+        }
+
+        if (high == low)
+            return 0;
+
+        range = &font->char_ranges[low];
+        index = character - range->first_char;
+        if (character >= range->first_char && index < range->char_count)
+        {
+            *index_ret = index;
+            return range;
+        }
+
+        return 0;
+    }
+
     for (i = 0; i < font->char_range_count; i++)
     {
+        MF_STATS_ADD(range_scans, 1);
         range = &font->char_ranges[i];
         index = character - range->first_char;
         if (character >= range->first_char && index < range->char_count)
@@ -33,50 +69,93 @@ static uint8_t get_width(const struct mf_bwfont_char_range_s *r, uint16_t index)
     }
 }
 
+/* Limit a span of the clip rectangle to begin..end, relative to the start
+ * of the glyph data. */
+static void clip_span(int32_t clip_begin, int32_t clip_end,
+                      uint8_t *begin, uint8_t *end)
+{
+    if (clip_end < *end)
+        *end = (clip_end > 0) ? clip_end : 0;
+    if (clip_begin > *begin)
+        *begin = (clip_begin < *end) ? clip_begin : *end;
+}
+
+/* Write out a run of set pixels. */
+static void write_run(int16_t x, int16_t y, uint8_t count,
+                      mf_pixel_callback_t callback, void *state)
+{
+    MF_STATS_ADD(pixel_callbacks, 1);
+
+#if MF_USE_FRAMEBUFFER
+    /* Skip the indirect call for the built-in render targets. */
+    if (callback == mf_framebuffer_callback)
+    {
+        mf_framebuffer_write(state, x, y, count, 255);
+        return;
+    }
+#endif
+
+    callback(x, y, count, 255, state);
+}
+
 static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
                            int16_t x0, int16_t y0, uint16_t index,
+                           const struct mf_rect_s *clip,
                            mf_pixel_callback_t callback,
                            void *state)
 {
     const uint8_t *data, *p;
     uint8_t stride, runlen;
-    uint8_t x, y, height, num_cols;
+    uint8_t x, y, x_begin, x_end, y_begin, y_end;
     uint8_t bit, byte, mask;
     bool oldstate, newstate;
 
     if (r->width)
     {
         data = r->glyph_data + r->width * index * r->height_bytes;
-        num_cols = r->width;
+        x_end = r->width;
     }
     else
     {
         data = r->glyph_data + r->glyph_offsets[index] * r->height_bytes;
-        num_cols = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+        x_end = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
     }
 
     stride = r->height_bytes;
-    height = r->height_pixels;
+    y_end = r->height_pixels;
     y0 += r->offset_y;
     x0 += r->offset_x;
-    bit = 0;
-    byte = 0;
+    x_begin = 0;
+    y_begin = 0;
+
+    /* The data is stored column by column, so only the columns and rows
+     * inside the clip rectangle are read at all. */
+    if (clip)
+    {
+        clip_span((int32_t)clip->x - x0, (int32_t)clip->x + clip->width - x0,
+                  &x_begin, &x_end);
+        clip_span((int32_t)clip->y - y0, (int32_t)clip->y + clip->height - y0,
+                  &y_begin, &y_end);
+    }
 
-    for (y = 0; y < height; y++)
+    bit = y_begin & 7;
+    byte = y_begin >> 3;
+
+    for (y = y_begin; y < y_end; y++)
     {
         mask = (1 << bit);
 
         oldstate = false;
         runlen = 0;
-        p = data + byte;
-        for (x = 0; x < num_cols; x++, p += stride)
+        p = data + byte + x_begin * stride;
+        for (x = x_begin; x < x_end; x++, p += stride)
         {
             newstate = pgm_read_byte(p) & mask;
             if (newstate != oldstate)
             {
                 if (oldstate && runlen)
                 {
-                    callback(x0 + x - runlen, y0 + y, runlen, 255, state);
+                    write_run(x0 + x - runlen, y0 + y, runlen, callback, state);
                 }
 
                 oldstate = newstate;
@@ -88,7 +167,7 @@ static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
 
         if (oldstate && runlen)
         {
-            callback(x0 + x - runlen, y0 + y, runlen, 255, state);
+            write_run(x0 + x - runlen, y0 + y, runlen, callback, state);
         }
 
         bit++;
@@ -102,11 +181,159 @@ static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
     return get_width(r, index);
 }
 
+uint8_t mf_bwfont_render_character_clipped(const struct mf_font_s *font,
+                                           int16_t x0, int16_t y0,
+                                           mf_char character,
+                                           const struct mf_rect_s *clip,
+                                           mf_pixel_callback_t callback,
+                                           void *state)
+{
+    const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
+    const struct mf_bwfont_char_range_s *range;
+    uint16_t index;
+
+    range = find_char_range(bwfont, character, &index);
+    if (!range)
+        return 0;
+
+    return render_char(range, x0, y0, index, clip, callback, state);
+}
+
 uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
                                    int16_t x0, int16_t y0,
                                    uint16_t character,
                                    mf_pixel_callback_t callback,
                                    void *state)
+{
+    return mf_bwfont_render_character_clipped(font, x0, y0, character, 0,
+                                              callback, state);
+}
+
+/* Number of zero bits below the lowest set bit. The value must not be 0. */
+#if defined(__GNUC__)
+#define count_trailing_zeros(x) ((uint8_t)__builtin_ctzl(x))
+#else
+static uint8_t count_trailing_zeros(uint32_t x)
+{
+    uint8_t n = 0;
+    if (!(x & 0xFFFF)) { n += 16; x >>= 16; }
+    if (!(x & 0xFF)) { n += 8; x >>= 8; }
+    if (!(x & 0xF)) { n += 4; x >>= 4; }
+    if (!(x & 0x3)) { n += 2; x >>= 2; }
+    if (!(x & 0x1)) { n += 1; }
+    return n;
+}
+#endif
+
+/* Read up to 32 pixels of a row, starting at the given byte, as a word. */
+static uint32_t load_bits(const uint8_t *row, uint8_t byte, uint8_t stride)
+{
+    uint32_t bits = 0;
+    uint8_t i;
+
+    for (i = 0; i < 4 && byte + i < stride; i++)
+        bits |= (uint32_t)pgm_read_byte(row + byte + i) << (8 * i);
+
+    return bits;
+}
+
+static uint8_t render_char_rows(const struct mf_bwfont_char_range_s *r,
+                                int16_t x0, int16_t y0, uint16_t index,
+                                const struct mf_rect_s *clip,
+                                mf_pixel_callback_t callback,
+                                void *state)
+{
+    const uint8_t *data, *row;
+    uint8_t stride, pos, n;
+    uint8_t x_begin, x_end, y, y_begin, y_end;
+    int16_t chunk, run_begin;
+    uint32_t bits;
+
+    if (r->width)
+    {
+        stride = (r->width + 7) / 8;
+        data = r->glyph_data + (uint32_t)index * stride * r->height_pixels;
+        x_end = r->width;
+    }
+    else
+    {
+        stride = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+        data = r->glyph_data + (uint32_t)r->glyph_offsets[index] * r->height_pixels;
+        x_end = (stride < 32) ? stride * 8 : 255;
+    }
+
+    y_end = r->height_pixels;
+    y0 += r->offset_y;
+    x0 += r->offset_x;
+    x_begin = 0;
+    y_begin = 0;
+
+    if (clip)
+    {
+        clip_span((int32_t)clip->x - x0, (int32_t)clip->x + clip->width - x0,
+                  &x_begin, &x_end);
+        clip_span((int32_t)clip->y - y0, (int32_t)clip->y + clip->height - y0,
+                  &y_begin, &y_end);
+    }
+
+    for (y = y_begin; y < y_end; y++)
+    {
+        row = data + (uint16_t)y * stride;
+        run_begin = -1;
+
+        /* Find the runs 32 pixels at a time, by counting the zero bits
+         * before each change between set and unset pixels. */
+        for (chunk = x_begin & ~31; chunk < x_end; chunk += 32)
+        {
+            bits = load_bits(row, chunk / 8, stride);
+
+            if (x_begin > chunk)
+                bits &= 0xFFFFFFFFUL << (x_begin - chunk);
+            if (x_end - chunk < 32)
+                bits &= (1UL << (x_end - chunk)) - 1;
+
+            pos = 0;
+            while (pos < 32)
+            {
+                if (run_begin < 0)
+                {
+                    if (!(bits >> pos))
+                        break;
+
+                    pos += count_trailing_zeros(bits >> pos);
+                    run_begin = chunk + pos;
+                }
+                else
+                {
+                    if (!(~bits >> pos))
+                        break;
+
+                    n = count_trailing_zeros(~bits >> pos);
+                    pos += n;
+                    write_run(x0 + run_begin, y0 + y, chunk + pos - run_begin,
+                              callback, state);
+                    run_begin = -1;
+                }
+            }
+        }
+
+        /* A run that continues to the end of the last word. */
+        if (run_begin >= 0)
+        {
+            write_run(x0 + run_begin, y0 + y, x_end - run_begin,
+                      callback, state);
+        }
+    }
+
+    return get_width(r, index);
+}
+
+uint8_t mf_bwfont_render_character_rows_clipped(const struct mf_font_s *font,
+                                                int16_t x0, int16_t y0,
+                                                mf_char character,
+                                                const struct mf_rect_s *clip,
+                                                mf_pixel_callback_t callback,
+                                                void *state)
 {
     const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
     const struct mf_bwfont_char_range_s *range;
@@ -116,7 +343,17 @@ uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
     if (!range)
         return 0;
 
-    return render_char(range, x0, y0, index, callback, state);
+    return render_char_rows(range, x0, y0, index, clip, callback, state);
+}
+
+uint8_t mf_bwfont_render_character_rows(const struct mf_font_s *font,
+                                        int16_t x0, int16_t y0,
+                                        mf_char character,
+                                        mf_pixel_callback_t callback,
+                                        void *state)
+{
+    return mf_bwfont_render_character_rows_clipped(font, x0, y0, character, 0,
+                                                   callback, state);
 }
 
 uint8_t mf_bwfont_character_width(const struct mf_font_s *font,
@@ -10,6 +10,9 @@
 /* Versions of the BW font format that are supported. */
 #define MF_BWFONT_VERSION_4_SUPPORTED 1
 
+/* Fonts exported with the row by row glyph layout are supported. */
+#define MF_BWFONT_ROWS_SUPPORTED 1
+
 /* Structure for a range of characters. */
 struct mf_bwfont_char_range_s
 {
@@ -43,6 +46,11 @@ struct mf_bwfont_char_range_s
     /* Table for the glyph data.
      * The data for each glyph is column-by-column, with N bytes per each
      * column. The LSB of the first byte is the top left pixel.
+     *
+     * In fonts that use mf_bwfont_render_character_rows, the data is
+     * instead row-by-row, with each row padded to whole bytes. The glyph
+     * offsets are then in units of height_pixels bytes, so that the
+     * difference of two offsets is the number of bytes per row.
      */
     const uint8_t *glyph_data;
 };
@@ -56,7 +64,7 @@ struct mf_bwfont_s
     const uint8_t version;
 
     /* Number of character ranges. */
-    const uint8_t char_range_count;
+    const uint16_t char_range_count;
 
     /* Array of the character ranges */
     const struct mf_bwfont_char_range_s *char_ranges;
@@ -70,8 +78,23 @@ MF_EXTERN uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
                                              mf_pixel_callback_t callback,
                                              void *state);
 
+MF_EXTERN uint8_t mf_bwfont_render_character_clipped(
+    const struct mf_font_s *font, int16_t x0, int16_t y0, mf_char character,
+    const struct mf_rect_s *clip, mf_pixel_callback_t callback, void *state);
+
 MF_EXTERN uint8_t mf_bwfont_character_width(const struct mf_font_s *font,
                                             mf_char character);
+
+/* Same as above, for fonts that store the glyphs row by row. */
+MF_EXTERN uint8_t mf_bwfont_render_character_rows(const struct mf_font_s *font,
+                                                  int16_t x0, int16_t y0,
+                                                  mf_char character,
+                                                  mf_pixel_callback_t callback,
+                                                  void *state);
+
+MF_EXTERN uint8_t mf_bwfont_render_character_rows_clipped(
+    const struct mf_font_s *font, int16_t x0, int16_t y0, mf_char character,
+    const struct mf_rect_s *clip, mf_pixel_callback_t callback, void *state);
 #endif
 
 #endif
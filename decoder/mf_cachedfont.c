@@ -0,0 +1,328 @@
+#define MF_FRAMEBUFFER_INTERNALS
+#include "mf_cachedfont.h"
+#include "mf_framebuffer.h"
+#include "mf_metrics.h"
+#include <string.h>
+
+/* Values of state in the cache entries. */
+#define ENTRY_EMPTY  0
+#define ENTRY_CACHED 1
+#define ENTRY_DIRECT 2 /* Does not fit in the mask, rendered directly. */
+
+/* Header of a single cache slot. The headers are stored at the start of
+ * the arena, followed by the alpha masks of the slots and a spare mask
+ * that new glyphs are decoded to. */
+struct cache_entry
+{
+    mf_char character;
+    uint16_t last_use;
+    uint8_t state;
+    uint8_t width;
+
+    /* Area of the mask that has visible pixels. */
+    uint8_t x_min, y_min, x_max, y_max;
+};
+
+static struct cache_entry *get_entry(const struct mf_cachedfont_s *cfont,
+                                     uint16_t index)
+{
+    return (struct cache_entry*)cfont->arena + index;
+}
+
+/* The masks cover the font bounding box, one row after another. The index
+ * slot_count gives the spare mask. */
+static uint8_t *get_mask(const struct mf_cachedfont_s *cfont, uint16_t index)
+{
+    return cfont->arena + cfont->slot_count * sizeof(struct cache_entry)
+                        + (uint32_t)index * cfont->mask_size;
+}
+
+static uint8_t max_value(const struct mf_cachedfont_s *cfont)
+{
+    return (1 << cfont->bits) - 1;
+}
+
+struct capture_state
+{
+    const struct mf_cachedfont_s *cfont;
+    struct cache_entry entry;
+    uint8_t *mask;
+    bool overflow;
+};
+
+/* Pixel callback for storing the glyph to the mask. */
+static void capture_callback(int16_t x, int16_t y, uint8_t count,
+                             uint8_t alpha, void *state)
+{
+    struct capture_state *s = state;
+    const struct mf_cachedfont_s *cfont = s->cfont;
+    struct cache_entry *e = &s->entry;
+    uint8_t max = max_value(cfont);
+    uint8_t value, shift;
+    uint32_t pos;
+
+    if (x < 0 || y < 0 || x + count > cfont->font.width ||
+        y >= cfont->font.height)
+    {
+        /* Can not be cached, the glyph is rendered directly instead. */
+        s->overflow = true;
+        return;
+    }
+
+    value = ((uint16_t)alpha * max + 127) / 255;
+    if (!value || !count)
+        return;
+
+    if (e->x_min > x) e->x_min = x;
+    if (e->y_min > y) e->y_min = y;
+    if (e->x_max < x + count - 1) e->x_max = x + count - 1;
+    if (e->y_max < y) e->y_max = y;
+
+    pos = ((uint32_t)y * cfont->font.width + x) * cfont->bits;
+    while (count--)
+    {
+        shift = pos & 7;
+        s->mask[pos >> 3] = (s->mask[pos >> 3] & ~(max << shift))
+                            | (value << shift);
+        pos += cfont->bits;
+    }
+}
+
+/* Find the glyph in the cache, decoding it if necessary. Returns the index
+ * of the slot, or -1 if the glyph is to be rendered directly. */
+static int32_t find_entry(struct mf_cachedfont_s *cfont, mf_char character)
+{
+    struct cache_entry *e;
+    struct capture_state s;
+    uint16_t i, index, age, max_age;
+
+    cfont->use_counter++;
+
+    for (i = 0; i < cfont->slot_count; i++)
+    {
+        e = get_entry(cfont, i);
+        if (e->state != ENTRY_EMPTY && e->character == character)
+        {
+            e->last_use = cfont->use_counter;
+            if (e->state == ENTRY_DIRECT)
+            {
+                cfont->misses++;
+                return -1;
+            }
+
+            cfont->hits++;
+            return i;
+        }
+    }
+
+    if (!cfont->slot_count)
+        return -1;
+
+    /* Decode to the spare mask first, so that a glyph that does not fit
+     * does not replace a cached one. */
+    s.cfont = cfont;
+    s.mask = get_mask(cfont, cfont->slot_count);
+    s.overflow = false;
+    s.entry.character = character;
+    s.entry.state = ENTRY_CACHED;
+    s.entry.x_min = s.entry.y_min = 255;
+    s.entry.x_max = s.entry.y_max = 0;
+    memset(s.mask, 0, cfont->mask_size);
+    s.entry.width = cfont->basefont->render_character(cfont->basefont, 0, 0,
+                                         character, capture_callback, &s);
+
+    /* Replace the entry that has been unused for the longest time. A glyph
+     * that does not fit takes a slot as well, so that the later calls
+     * render it directly without decoding it twice. */
+    index = 0;
+    max_age = 0;
+    for (i = 0; i < cfont->slot_count; i++)
+    {
+        e = get_entry(cfont, i);
+        if (e->state == ENTRY_EMPTY)
+        {
+            index = i;
+            break;
+        }
+
+        age = cfont->use_counter - e->last_use;
+        if (age > max_age)
+        {
+            max_age = age;
+            index = i;
+        }
+    }
+
+    cfont->misses++;
+    e = get_entry(cfont, index);
+    *e = s.entry;
+    e->last_use = cfont->use_counter;
+
+    if (s.overflow)
+    {
+        e->state = ENTRY_DIRECT;
+        return -1;
+    }
+
+    memcpy(get_mask(cfont, index), s.mask, cfont->mask_size);
+    return index;
+}
+
+/* Write out a run of pixels from the mask. */
+static void write_run(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
+                      mf_pixel_callback_t callback, void *state)
+{
+#if MF_USE_FRAMEBUFFER
+    /* Skip the indirect call for the built-in render targets. */
+    if (callback == mf_framebuffer_callback)
+    {
+        mf_framebuffer_write(state, x, y, count, alpha);
+        return;
+    }
+#endif
+
+    callback(x, y, count, alpha, state);
+}
+
+/* Replay the stored mask as runs of equal alpha, limited to the clip
+ * rectangle if given. */
+static void replay(const struct mf_cachedfont_s *cfont, uint16_t index,
+                   int16_t x0, int16_t y0, const struct mf_rect_s *clip,
+                   mf_pixel_callback_t callback, void *state)
+{
+    const struct cache_entry *e = get_entry(cfont, index);
+    const uint8_t *mask = get_mask(cfont, index);
+    uint8_t max = max_value(cfont);
+    uint8_t scale = 255 / max;
+    int16_t x, y, x_begin, x_end, y_begin, y_end, run_start;
+    uint8_t value, run_value;
+    uint32_t pos;
+
+    x_begin = e->x_min;
+    x_end = e->x_max + 1;
+    y_begin = e->y_min;
+    y_end = e->y_max + 1;
+
+    if (clip)
+    {
+        if (x_begin < clip->x - x0) x_begin = clip->x - x0;
+        if (x_end > clip->x + clip->width - x0) x_end = clip->x + clip->width - x0;
+        if (y_begin < clip->y - y0) y_begin = clip->y - y0;
+        if (y_end > clip->y + clip->height - y0) y_end = clip->y + clip->height - y0;
+    }
+
+    for (y = y_begin; y < y_end; y++)
+    {
+        pos = ((uint32_t)y * cfont->font.width + x_begin) * cfont->bits;
+        run_start = x_begin;
+        run_value = 0;
+
+        for (x = x_begin; x <= x_end; x++)
+        {
+            value = 0;
+            if (x < x_end)
+            {
+                value = (mask[pos >> 3] >> (pos & 7)) & max;
+                pos += cfont->bits;
+            }
+
+            if (value != run_value)
+            {
+                if (run_value)
+                {
+                    write_run(x0 + run_start, y0 + y, x - run_start,
+                              run_value * scale, callback, state);
+                }
+
+                run_start = x;
+                run_value = value;
+            }
+        }
+    }
+}
+
+static uint8_t cached_character_width(const struct mf_font_s *font,
+                                      mf_char character)
+{
+    struct mf_cachedfont_s *cfont = (struct mf_cachedfont_s*)font;
+    return cfont->basefont->character_width(cfont->basefont, character);
+}
+
+static uint8_t cached_render_character_clipped(const struct mf_font_s *font,
+                                               int16_t x0, int16_t y0,
+                                               mf_char character,
+                                               const struct mf_rect_s *clip,
+                                               mf_pixel_callback_t callback,
+                                               void *state)
+{
+    struct mf_cachedfont_s *cfont = (struct mf_cachedfont_s*)font;
+    const struct mf_font_s *basefont = cfont->basefont;
+    int32_t index;
+
+    index = find_entry(cfont, character);
+
+    if (index < 0)
+    {
+        if (clip)
+        {
+            return mf_render_character_clipped(basefont, x0, y0, character,
+                                               clip, callback, state);
+        }
+
+        return basefont->render_character(basefont, x0, y0, character,
+                                          callback, state);
+    }
+
+    replay(cfont, index, x0, y0, clip, callback, state);
+    return get_entry(cfont, index)->width;
+}
+
+static uint8_t cached_render_character(const struct mf_font_s *font,
+                                       int16_t x0, int16_t y0,
+                                       mf_char character,
+                                       mf_pixel_callback_t callback,
+                                       void *state)
+{
+    return cached_render_character_clipped(font, x0, y0, character, 0,
+                                           callback, state);
+}
+
+void mf_clear_font_cache(struct mf_cachedfont_s *font)
+{
+    uint16_t i;
+
+    for (i = 0; i < font->slot_count; i++)
+        get_entry(font, i)->state = ENTRY_EMPTY;
+}
+
+void mf_cache_font(struct mf_cachedfont_s *newfont,
+                   const struct mf_font_s *basefont,
+                   uint8_t bits, void *arena, uint16_t arena_size)
+{
+    newfont->font = *basefont;
+    newfont->basefont = basefont;
+
+    newfont->font.character_width = &cached_character_width;
+    newfont->font.render_character = &cached_render_character;
+    newfont->font.render_character_clipped = &cached_render_character_clipped;
+    newfont->font.render_string = 0; /* Must go through the cache. */
+
+    newfont->arena = arena;
+    newfont->bits = bits;
+    newfont->mask_size = ((uint32_t)basefont->width * basefont->height * bits
+                          + 7) / 8;
+    newfont->slot_count = 0;
+    if (arena_size > newfont->mask_size)
+    {
+        newfont->slot_count = (arena_size - newfont->mask_size) /
+                              (sizeof(struct cache_entry) + newfont->mask_size);
+    }
+    newfont->use_counter = 0;
+    newfont->hits = 0;
+    newfont->misses = 0;
+
+    mf_clear_font_cache(newfont);
+
+    /* The cache may have entries for an earlier font at the same address. */
+    mf_clear_metrics_cache();
+}
@@ -0,0 +1,56 @@
+/* Cache the decoded glyphs of any font in RAM. This speeds up rendering of
+ * characters that are drawn over and over, such as the digits of a clock,
+ * at the cost of the memory for the cache.
+ */
+
+#ifndef _MF_CACHEDFONT_H_
+#define _MF_CACHEDFONT_H_
+
+#include "mf_font.h"
+
+struct mf_cachedfont_s
+{
+    struct mf_font_s font;
+
+    const struct mf_font_s *basefont;
+
+    /* Memory area supplied by the caller, split into equal sized slots
+     * for the glyphs. */
+    uint8_t *arena;
+    uint16_t slot_count;
+    uint16_t mask_size;
+
+    /* Bits per pixel in the stored alpha masks: 1, 2, 4 or 8. */
+    uint8_t bits;
+
+    uint16_t use_counter;
+
+    /* Number of characters rendered from the cache and number of
+     * characters that had to be decoded, for tuning the arena size. */
+    uint32_t hits;
+    uint32_t misses;
+};
+
+/* Create a font that renders the characters of basefont through a cache.
+ * When the cache is full, the least recently used glyph is replaced.
+ *
+ * newfont:    Font structure to initialize.
+ * basefont:   Font to decode the glyphs from.
+ * bits:       Bits per pixel of the stored glyphs: 1, 2, 4 or 8. Use 4 for
+ *             rlefont and 1 for bwfont fonts to store them without loss.
+ * arena:      Memory for the cache, aligned as for a uint32_t. Must stay
+ *             valid as long as the font is used.
+ * arena_size: Size of the arena in bytes. Each glyph takes the space of
+ *             the font bounding box at the given bits per pixel, plus a
+ *             few bytes. The space of one more glyph is used for decoding.
+ *             Glyphs that extend outside the bounding box are not stored,
+ *             but a slot remembers to render them directly.
+ */
+MF_EXTERN void mf_cache_font(struct mf_cachedfont_s *newfont,
+                             const struct mf_font_s *basefont,
+                             uint8_t bits, void *arena, uint16_t arena_size);
+
+/* Forget all the cached glyphs, e.g. if the base font was modified. */
+MF_EXTERN void mf_clear_font_cache(struct mf_cachedfont_s *font);
+
+#endif
@@ -12,6 +12,7 @@
  #define PROGMEM
  #define pgm_read_byte(addr) (*(const unsigned char *)(addr))
  #define pgm_read_word(addr) (*(const uint16_t *)(addr))
+ #define pgm_read_dword(addr) (*(const uint32_t *)(addr))
 #endif /* __AVR__ */
 
 
@@ -122,6 +123,25 @@
 #define MF_USE_TABS 1
 #endif
 
+/* Enable or disable the built-in framebuffer render targets.
+ * If disabled, the decoders only write through the pixel callbacks.
+ */
+#ifndef MF_USE_FRAMEBUFFER
+#define MF_USE_FRAMEBUFFER 1
+#endif
+
+/* Enable or disable the fonts read from external storage, see
+ * mf_streamfont.h. Not available on AVR, where the decoders read the glyph
+ * data from the program memory only.
+ */
+#ifndef MF_USE_STREAMFONT
+#ifdef __AVR__
+#define MF_USE_STREAMFONT 0
+#else
+#define MF_USE_STREAMFONT 1
+#endif
+#endif
+
 /* Number of vertical zones to use when computing kerning.
  * Larger values give more accurate kerning, but are slower and use somewhat
  * more memory. There is no point to increase this beyond the height of the
@@ -131,6 +151,30 @@
 #define MF_KERNING_ZONES 16
 #endif
 
+/* Enable or disable the profiling counters, see mf_stats.h.
+ * Enabling them adds a little overhead to the inner loops of the decoders.
+ */
+#ifndef MF_ENABLE_STATS
+#define MF_ENABLE_STATS 0
+#endif
+
+/* Number of characters to keep in the RAM cache of character metrics, see
+ * mf_metrics.h. Each entry takes 2 * MF_KERNING_ZONES + 16 bytes or so.
+ * Speeds up layout and kerning for fonts that do not have precomputed
+ * kerning tables. Set to 0 to disable the cache.
+ */
+#ifndef MF_METRICS_CACHE_SIZE
+#define MF_METRICS_CACHE_SIZE 0
+#endif
+
+/* Number of characters to remember in each font created with
+ * mf_fallback_font, see mf_fallbackfont.h. Each entry takes 4 bytes.
+ * A power of two makes finding the slot of a character faster. Set to 0
+ * to disable the cache.
+ */
+#ifndef MF_FALLBACKFONT_CACHE_SIZE
+#define MF_FALLBACKFONT_CACHE_SIZE 32
+#endif
 
 
 /* Add extern "C" when used from C++. */
@@ -0,0 +1,191 @@
+#include "mf_fallbackfont.h"
+#include "mf_metrics.h"
+
+/* Values of font_index for cache slots without a font. */
+#define SLOT_EMPTY   0xFF
+#define SLOT_MISSING 0xFE
+
+/* Find the font that has a character, first from the cache and then by
+ * asking each font in turn. */
+static const struct mf_fallbackfont_entry_s *lookup(
+    struct mf_fallbackfont_s *font, mf_char character)
+{
+    struct mf_fallbackfont_entry_s *entry;
+    const struct mf_font_s *f;
+    uint8_t i, width;
+
+#if MF_FALLBACKFONT_CACHE_SIZE > 0
+    /* With MF_ENCODING_ASCII the characters are plain chars, which can be
+     * negative. */
+    entry = &font->cache[(uint16_t)character % MF_FALLBACKFONT_CACHE_SIZE];
+    if (entry->font_index != SLOT_EMPTY && entry->character == character)
+    {
+        font->hits++;
+        return entry;
+    }
+#else
+    entry = &font->last;
+#endif
+
+    font->misses++;
+    entry->character = character;
+    entry->font_index = SLOT_MISSING;
+    entry->width = 0;
+
+    for (i = 0; i < font->font_count; i++)
+    {
+        f = font->fonts[i];
+        width = f->character_width(f, character);
+        if (width)
+        {
+            entry->font_index = i;
+            entry->width = width;
+            break;
+        }
+    }
+
+    return entry;
+}
+
+static uint8_t fallback_character_width(const struct mf_font_s *font,
+                                        mf_char character)
+{
+    struct mf_fallbackfont_s *ffont = (struct mf_fallbackfont_s*)font;
+    return lookup(ffont, character)->width;
+}
+
+static uint8_t fallback_render_character_clipped(const struct mf_font_s *font,
+                                                 int16_t x0, int16_t y0,
+                                                 mf_char character,
+                                                 const struct mf_rect_s *clip,
+                                                 mf_pixel_callback_t callback,
+                                                 void *state)
+{
+    struct mf_fallbackfont_s *ffont = (struct mf_fallbackfont_s*)font;
+    const struct mf_fallbackfont_entry_s *entry;
+    const struct mf_font_s *f;
+
+    entry = lookup(ffont, character);
+    if (entry->font_index == SLOT_MISSING)
+        return 0;
+
+    /* Align the baselines of the fonts. */
+    f = ffont->fonts[entry->font_index];
+    x0 += font->baseline_x - f->baseline_x;
+    y0 += font->baseline_y - f->baseline_y;
+
+    if (clip)
+    {
+        return mf_render_character_clipped(f, x0, y0, character,
+                                           clip, callback, state);
+    }
+
+    return f->render_character(f, x0, y0, character, callback, state);
+}
+
+static uint8_t fallback_render_character(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         mf_char character,
+                                         mf_pixel_callback_t callback,
+                                         void *state)
+{
+    return fallback_render_character_clipped(font, x0, y0, character, 0,
+                                             callback, state);
+}
+
+const struct mf_font_s *mf_fallback_font_for(struct mf_fallbackfont_s *font,
+                                             mf_char character)
+{
+    const struct mf_fallbackfont_entry_s *entry;
+
+    entry = lookup(font, character);
+    if (entry->font_index == SLOT_MISSING)
+        return 0;
+
+    return font->fonts[entry->font_index];
+}
+
+void mf_clear_fallback_cache(struct mf_fallbackfont_s *font)
+{
+#if MF_FALLBACKFONT_CACHE_SIZE > 0
+    uint16_t i;
+
+    for (i = 0; i < MF_FALLBACKFONT_CACHE_SIZE; i++)
+        font->cache[i].font_index = SLOT_EMPTY;
+#else
+    font->last.font_index = SLOT_EMPTY;
+#endif
+}
+
+/* Limit a metric to the range of the font structure. */
+static uint8_t clamp_u8(int16_t value)
+{
+    if (value < 0)
+        return 0;
+    if (value > 255)
+        return 255;
+    return (uint8_t)value;
+}
+
+void mf_fallback_font(struct mf_fallbackfont_s *newfont,
+                      const struct mf_font_s * const *fonts,
+                      uint8_t font_count)
+{
+    struct mf_font_s *font = &newfont->font;
+    const struct mf_font_s *f;
+    int16_t width = 0, height = 0;
+    uint8_t i, flags;
+
+    *font = *fonts[0];
+    newfont->fonts = fonts;
+    newfont->font_count = font_count;
+
+    /* The baseline is placed so that every font fits above and left of
+     * it, and the bounding box is extended to cover them all. */
+    flags = MF_FONT_FLAG_MONOSPACE | MF_FONT_FLAG_BW;
+    for (i = 0; i < font_count; i++)
+    {
+        f = fonts[i];
+        if (f->baseline_x > font->baseline_x)
+            font->baseline_x = f->baseline_x;
+        if (f->baseline_y > font->baseline_y)
+            font->baseline_y = f->baseline_y;
+        if (f->line_height > font->line_height)
+            font->line_height = f->line_height;
+        if (f->min_x_advance < font->min_x_advance)
+            font->min_x_advance = f->min_x_advance;
+        if (f->max_x_advance > font->max_x_advance)
+            font->max_x_advance = f->max_x_advance;
+        flags &= f->flags;
+    }
+
+    for (i = 0; i < font_count; i++)
+    {
+        f = fonts[i];
+        if (font->baseline_x - f->baseline_x + f->width > width)
+            width = font->baseline_x - f->baseline_x + f->width;
+        if (font->baseline_y - f->baseline_y + f->height > height)
+            height = font->baseline_y - f->baseline_y + f->height;
+    }
+
+    font->width = clamp_u8(width);
+    font->height = clamp_u8(height);
+
+    /* The other flags describe the storage of a single font. */
+    if (font->min_x_advance != font->max_x_advance)
+        flags &= ~MF_FONT_FLAG_MONOSPACE;
+    font->flags = flags;
+
+    font->character_width = &fallback_character_width;
+    font->render_character = &fallback_render_character;
+    font->render_character_clipped = &fallback_render_character_clipped;
+    font->kerning_table = 0; /* Each font has its own table. */
+    font->render_string = 0;
+
+    newfont->hits = 0;
+    newfont->misses = 0;
+    mf_clear_fallback_cache(newfont);
+
+    /* The cache may have entries for an earlier font at the same address. */
+    mf_clear_metrics_cache();
+}
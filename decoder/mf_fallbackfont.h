@@ -0,0 +1,69 @@
+/* Combine several fonts into one, e.g. a Latin font with a CJK font. Each
+ * character is rendered with the first font in the list that has it, placed
+ * on a common baseline. The font that supplies a character is remembered in
+ * a small direct-mapped cache, so that text mixing several scripts does not
+ * search the character ranges of each font again for every character.
+ */
+
+#ifndef _MF_FALLBACKFONT_H_
+#define _MF_FALLBACKFONT_H_
+
+#include "mf_font.h"
+
+/* Cache slot for a single character. */
+struct mf_fallbackfont_entry_s
+{
+    mf_char character;
+
+    /* Index of the font that has the character, or one of the special
+     * values in mf_fallbackfont.c for unused slots and characters that are
+     * in none of the fonts. */
+    uint8_t font_index;
+
+    /* Width of the character in that font. */
+    uint8_t width;
+};
+
+struct mf_fallbackfont_s
+{
+    struct mf_font_s font;
+
+    /* The fonts to search, in order of preference. */
+    const struct mf_font_s * const *fonts;
+    uint8_t font_count;
+
+#if MF_FALLBACKFONT_CACHE_SIZE > 0
+    struct mf_fallbackfont_entry_s cache[MF_FALLBACKFONT_CACHE_SIZE];
+#else
+    /* Result of the last lookup, when the cache is disabled. */
+    struct mf_fallbackfont_entry_s last;
+#endif
+
+    /* Number of characters found in the cache and number of characters
+     * that had to be looked up from the fonts, for tuning the cache size. */
+    uint32_t hits;
+    uint32_t misses;
+};
+
+/* Create a font that renders each character with the first font in the
+ * list that has it. The metrics of the new font cover all the fonts, and
+ * the fallback character is taken from the first font.
+ *
+ * newfont:    Font structure to initialize.
+ * fonts:      Array of 1 to 254 fonts, in order of preference. Must stay
+ *             valid as long as the font is used.
+ * font_count: Number of fonts in the array.
+ */
+MF_EXTERN void mf_fallback_font(struct mf_fallbackfont_s *newfont,
+                                const struct mf_font_s * const *fonts,
+                                uint8_t font_count);
+
+/* Get the font that renders a character, or NULL if none of the fonts
+ * has it. */
+MF_EXTERN const struct mf_font_s *mf_fallback_font_for(
+    struct mf_fallbackfont_s *font, mf_char character);
+
+/* Forget the cached characters, e.g. if one of the fonts was modified. */
+MF_EXTERN void mf_clear_fallback_cache(struct mf_fallbackfont_s *font);
+
+#endif
@@ -1,4 +1,5 @@
 #include "mf_font.h"
+#include "mf_metrics.h"
 #include <stdbool.h>
 
 /* This will be made into a list of included fonts using macro magic. */
@@ -26,16 +27,110 @@ uint8_t mf_render_character(const struct mf_font_s *font,
     return width;
 }
 
+bool mf_character_clipped(const struct mf_font_s *font,
+                          int16_t x0, int16_t y0,
+                          const struct mf_rect_s *clip)
+{
+    if (!clip)
+        return false;
+
+    return (int32_t)x0 + font->width <= clip->x ||
+           (int32_t)y0 + font->height <= clip->y ||
+           x0 >= (int32_t)clip->x + clip->width ||
+           y0 >= (int32_t)clip->y + clip->height;
+}
+
+struct clip_state
+{
+    const struct mf_rect_s *clip;
+    mf_pixel_callback_t callback;
+    void *state;
+};
+
+/* Filters the runs for fonts that do not support clipping themselves. */
+static void clip_callback(int16_t x, int16_t y, uint8_t count,
+                          uint8_t alpha, void *state)
+{
+    struct clip_state *s = state;
+    int16_t x_end = x + count;
+    int16_t clip_x_end = s->clip->x + s->clip->width;
+
+    if (y < s->clip->y || y >= s->clip->y + s->clip->height)
+        return;
+
+    if (x < s->clip->x)
+        x = s->clip->x;
+    if (x_end > clip_x_end)
+        x_end = clip_x_end;
+
+    if (x < x_end)
+        s->callback(x, y, x_end - x, alpha, s->state);
+}
+
+static uint8_t render_clipped(const struct mf_font_s *font,
+                              int16_t x0, int16_t y0,
+                              mf_char character,
+                              const struct mf_rect_s *clip,
+                              mf_pixel_callback_t callback,
+                              void *state)
+{
+    struct clip_state cstate;
+
+    if (font->render_character_clipped)
+    {
+        return font->render_character_clipped(font, x0, y0, character,
+                                              clip, callback, state);
+    }
+
+    cstate.clip = clip;
+    cstate.callback = callback;
+    cstate.state = state;
+    return font->render_character(font, x0, y0, character,
+                                  clip_callback, &cstate);
+}
+
+uint8_t mf_render_character_clipped(const struct mf_font_s *font,
+                                    int16_t x0, int16_t y0,
+                                    mf_char character,
+                                    const struct mf_rect_s *clip,
+                                    mf_pixel_callback_t callback,
+                                    void *state)
+{
+    uint8_t width;
+
+    if (!clip)
+        return mf_render_character(font, x0, y0, character, callback, state);
+
+    /* Nothing to decode, only the width is needed. */
+    if (mf_character_clipped(font, x0, y0, clip))
+        return mf_character_width(font, character);
+
+    width = render_clipped(font, x0, y0, character, clip, callback, state);
+
+    if (!width)
+    {
+        width = render_clipped(font, x0, y0, font->fallback_character,
+                               clip, callback, state);
+    }
+
+    return width;
+}
+
 uint8_t mf_character_width(const struct mf_font_s *font,
                            mf_char character)
 {
     uint8_t width;
+
+#if MF_METRICS_CACHE_SIZE
+    width = mf_get_metrics(font, character, MF_METRICS_WIDTH)->width;
+#else
     width = font->character_width(font, character);
 
     if (!width)
     {
         width = font->character_width(font, font->fallback_character);
     }
+#endif
 
     return width;
 }
@@ -46,6 +141,7 @@ struct whitespace_state
     uint8_t max_x, max_y;
 };
 
+#if !MF_METRICS_CACHE_SIZE
 static void whitespace_callback(int16_t x, int16_t y, uint8_t count,
                                 uint8_t alpha, void *state)
 {
@@ -59,6 +155,7 @@ static void whitespace_callback(int16_t x, int16_t y, uint8_t count,
         if (s->max_y < y) s->max_y = y;
     }
 }
+#endif
 
 MF_EXTERN void mf_character_whitespace(const struct mf_font_s *font,
                                        mf_char character,
@@ -66,7 +163,17 @@ MF_EXTERN void mf_character_whitespace(const struct mf_font_s *font,
                                        uint8_t *right, uint8_t *bottom)
 {
     struct whitespace_state state = {255, 255, 0, 0};
+
+#if MF_METRICS_CACHE_SIZE
+    const struct mf_metrics_s *m;
+    m = mf_get_metrics(font, character, MF_METRICS_SHAPE);
+    state.min_x = m->min_x;
+    state.min_y = m->min_y;
+    state.max_x = m->max_x;
+    state.max_y = m->max_y;
+#else
     mf_render_character(font, 0, 0, character, whitespace_callback, &state);
+#endif
 
     if (state.min_x == 255 && state.min_y == 255)
     {
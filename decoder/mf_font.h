@@ -6,6 +6,7 @@
 #define _MF_FONT_H_
 
 #include "mf_encoding.h"
+#include <stdbool.h>
 
 /* Callback function that writes pixels to screen / buffer / whatever.
  *
@@ -18,6 +19,42 @@
 typedef void (*mf_pixel_callback_t) (int16_t x, int16_t y, uint8_t count,
                                      uint8_t alpha, void *state);
 
+/* Rectangular area of the target, in the same coordinates as the pixels
+ * passed to the callback. Contains the pixels x <= px < x + width and
+ * y <= py < y + height. */
+struct mf_rect_s
+{
+    int16_t x;
+    int16_t y;
+    int16_t width;
+    int16_t height;
+};
+
+/* Precomputed edge profiles of the characters in one character range, used
+ * by the kerning. For each character, there are first the x coordinates of
+ * the leftmost visible pixel in each kerning zone (255 if none), and then
+ * those of the rightmost visible pixel (0 if none). Only the zones that
+ * overlap the font height are stored. */
+struct mf_kerning_range_s
+{
+    uint16_t first_char;
+    uint16_t char_count;
+    const uint8_t *edges;
+};
+
+/* Table of the edge profiles of all characters in a font. */
+struct mf_kerning_table_s
+{
+    /* Value of MF_KERNING_ZONES that the table was computed for. The table
+     * is not used if the decoder is configured differently. */
+    uint8_t zones;
+
+    /* Number of character ranges, in increasing order. */
+    uint16_t range_count;
+
+    const struct mf_kerning_range_s *ranges;
+};
+
 /* General information about a font. */
 struct mf_font_s
 {
@@ -59,12 +96,47 @@ struct mf_font_s
                                 mf_char character,
                                 mf_pixel_callback_t callback,
                                 void *state);
+
+    /* Function to render the part of a character that is inside the clip
+     * rectangle. Returns the character width or 0 if character is not
+     * found. Can be NULL for fonts generated by older encoders. */
+    uint8_t (*render_character_clipped)(const struct mf_font_s *font,
+                                        int16_t x0, int16_t y0,
+                                        mf_char character,
+                                        const struct mf_rect_s *clip,
+                                        mf_pixel_callback_t callback,
+                                        void *state);
+
+    /* Precomputed edge profiles for kerning, or NULL to compute them by
+     * rendering the characters. */
+    const struct mf_kerning_table_s *kerning_table;
+
+    /* Function to render a run of characters left to right, with the upper
+     * left corner of the first one at x0, y0. Missing characters are
+     * replaced by the fallback character, and tabs are rendered as spaces.
+     * Kerning is applied between the characters if kern is true. Returns
+     * the total advance of the run. Can be NULL, in which case
+     * mf_render_string renders the characters one at a time. */
+    int16_t (*render_string)(const struct mf_font_s *font,
+                             int16_t x0, int16_t y0,
+                             mf_str text, uint16_t count, bool kern,
+                             const struct mf_rect_s *clip,
+                             mf_pixel_callback_t callback,
+                             void *state);
 };
 
 /* The flag definitions for the font.flags field. */
 #define MF_FONT_FLAG_MONOSPACE 0x01
 #define MF_FONT_FLAG_BW        0x02
 
+/* The character ranges of the font are in increasing order, which lets the
+ * decoder find them with a binary search. Set by the encoder. */
+#define MF_FONT_FLAG_SORTED_RANGES 0x04
+
+/* An rlefont dictionary has more entries than fit in a byte, and uses
+ * two-byte codewords, see struct mf_rlefont_s. Set by the encoder. */
+#define MF_FONT_FLAG_WIDE_CODES 0x08
+
 /* Lookup structure for searching fonts by name. */
 struct mf_font_list_s
 {
@@ -89,6 +161,40 @@ MF_EXTERN uint8_t mf_render_character(const struct mf_font_s *font,
                                       mf_pixel_callback_t callback,
                                       void *state);
 
+/* Same as mf_render_character, but only writes out the pixels that are
+ * inside the clip rectangle. Rows and runs outside of it are skipped
+ * without calling the callback.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * clip:      Area to render to, or NULL to render the whole character.
+ * callback:  Callback function to write out the pixels.
+ * state:     Free variable for caller to use (can be NULL).
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_character_clipped(const struct mf_font_s *font,
+                                              int16_t x0, int16_t y0,
+                                              mf_char character,
+                                              const struct mf_rect_s *clip,
+                                              mf_pixel_callback_t callback,
+                                              void *state);
+
+/* Check if the bounding box of a character placed at x0, y0 is completely
+ * outside the clip rectangle, so that rendering it would not write any
+ * pixels.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the character.
+ * clip:      Area to check against, or NULL for no clipping.
+ *
+ * Returns true if the character can be skipped.
+ */
+MF_EXTERN bool mf_character_clipped(const struct mf_font_s *font,
+                                    int16_t x0, int16_t y0,
+                                    const struct mf_rect_s *clip);
+
 /* Function to get the width of a single character.
  * This is not necessarily the bounding box of the character
  * data, but rather the tracking width.
@@ -0,0 +1,27 @@
+#define MF_FRAMEBUFFER_INTERNALS
+#include "mf_framebuffer.h"
+
+#if MF_USE_FRAMEBUFFER
+
+void mf_framebuffer_callback(int16_t x, int16_t y, uint8_t count,
+                             uint8_t alpha, void *state)
+{
+    mf_framebuffer_write(state, x, y, count, alpha);
+}
+
+uint8_t mf_render_character_fb(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               mf_char character,
+                               const struct mf_framebuffer_s *fb)
+{
+    struct mf_rect_s area;
+    area.x = 0;
+    area.y = 0;
+    area.width = fb->width;
+    area.height = fb->height;
+
+    return mf_render_character_clipped(font, x0, y0, character, &area,
+                                       mf_framebuffer_callback, (void*)fb);
+}
+
+#endif
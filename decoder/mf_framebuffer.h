@@ -0,0 +1,203 @@
+/* Built-in render targets for common framebuffer formats. Rendering to these
+ * does not need a pixel callback: the rlefont and bwfont decoders recognize
+ * mf_framebuffer_callback and write the runs directly to the memory.
+ */
+
+#ifndef _MF_FRAMEBUFFER_H_
+#define _MF_FRAMEBUFFER_H_
+
+#include "mf_font.h"
+
+/* The supported pixel formats. */
+enum mf_framebuffer_format_t
+{
+    /* 1 bit per pixel, with each byte holding a column of 8 pixels, LSB at
+     * the top (SSD1306 style). Pixels with alpha of at least 128 are set
+     * to the color, others are left untouched. */
+    MF_FRAMEBUFFER_MONO_PAGED = 0,
+
+    /* 4 bits per pixel grayscale, the left pixel in the high nibble. */
+    MF_FRAMEBUFFER_GRAY4,
+
+    /* 8 bits per pixel grayscale. */
+    MF_FRAMEBUFFER_GRAY8,
+
+    /* 16 bits per pixel RGB565, in the native byte order. The data must be
+     * aligned to 2 bytes. */
+    MF_FRAMEBUFFER_RGB565
+};
+
+/* Description of a framebuffer in memory. */
+struct mf_framebuffer_s
+{
+    /* Pixel data, starting from the upper left corner. */
+    uint8_t *data;
+
+    /* Number of bytes between the start of two rows, or two pages of 8 rows
+     * for MF_FRAMEBUFFER_MONO_PAGED. */
+    uint16_t stride;
+
+    /* Size of the framebuffer in pixels. Nothing is drawn outside it. */
+    int16_t width;
+    int16_t height;
+
+    /* Pixel format, one of enum mf_framebuffer_format_t. */
+    uint8_t format;
+
+    /* Color of the text in the pixel format: 0 or 1 for MONO_PAGED, 0-15
+     * for GRAY4, 0-255 for GRAY8. The text is alpha blended on top of the
+     * existing pixels, except for MONO_PAGED. */
+    uint16_t color;
+};
+
+/* Pixel callback that writes to a framebuffer. The state must be a pointer
+ * to struct mf_framebuffer_s. Can be passed to any of the rendering
+ * functions, and the built-in decoders then skip the callback and write
+ * to the framebuffer directly.
+ */
+MF_EXTERN void mf_framebuffer_callback(int16_t x, int16_t y, uint8_t count,
+                                       uint8_t alpha, void *state);
+
+/* Render a single character directly to a framebuffer.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * fb:        Framebuffer to render to.
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_character_fb(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         mf_char character,
+                                         const struct mf_framebuffer_s *fb);
+
+#endif
+
+/* Internal functions for the decoders. They are defined here, so that they
+ * can be inlined into the inner loops of each decoder. They have their own
+ * include guard, so that the font files with a specialized decoder get them
+ * even if the header was already included without them. */
+#if defined(MF_FRAMEBUFFER_INTERNALS) && MF_USE_FRAMEBUFFER && \
+    !defined(_MF_FRAMEBUFFER_INTERNALS_H_)
+#define _MF_FRAMEBUFFER_INTERNALS_H_
+
+/* Blend a 8-bit value, with the same rounding as value / 255. */
+static uint8_t mf_blend8(uint8_t bg, uint8_t fg, uint8_t alpha)
+{
+    uint16_t t = bg * (255 - alpha) + fg * alpha + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/* Blend a 4-bit value, with the same rounding as value / 15. */
+static uint8_t mf_blend4(uint8_t bg, uint8_t fg, uint8_t alpha)
+{
+    uint16_t t = bg * (15 - alpha) + fg * alpha;
+    return (t * 273 + 2048) >> 12;
+}
+
+/* Write a horizontal run of pixels to the framebuffer. */
+static void mf_framebuffer_write(const struct mf_framebuffer_s *fb,
+                                 int16_t x, int16_t y, uint8_t count,
+                                 uint8_t alpha)
+{
+    int16_t x_end = x + count;
+    uint8_t *p;
+
+    if (y < 0 || y >= fb->height || alpha == 0)
+        return;
+    if (x < 0)
+        x = 0;
+    if (x_end > fb->width)
+        x_end = fb->width;
+    if (x >= x_end)
+        return;
+    count = x_end - x;
+
+    if (fb->format == MF_FRAMEBUFFER_MONO_PAGED)
+    {
+        uint8_t mask = 1 << (y & 7);
+        if (alpha < 128)
+            return;
+
+        p = fb->data + (uint32_t)(y >> 3) * fb->stride + x;
+        if (fb->color)
+        {
+            while (count--) *p++ |= mask;
+        }
+        else
+        {
+            mask = ~mask;
+            while (count--) *p++ &= mask;
+        }
+    }
+    else if (fb->format == MF_FRAMEBUFFER_GRAY4)
+    {
+        uint8_t a = alpha >> 4;
+        uint8_t c = fb->color;
+
+        p = fb->data + (uint32_t)y * fb->stride + (x >> 1);
+        if (a == 0)
+            return;
+
+        while (count--)
+        {
+            if (x & 1)
+            {
+                *p = (*p & 0xF0) | mf_blend4(*p & 0x0F, c, a);
+                p++;
+            }
+            else
+            {
+                *p = (*p & 0x0F) | (mf_blend4(*p >> 4, c, a) << 4);
+            }
+            x++;
+        }
+    }
+    else if (fb->format == MF_FRAMEBUFFER_GRAY8)
+    {
+        uint8_t c = fb->color;
+
+        p = fb->data + (uint32_t)y * fb->stride + x;
+        if (alpha == 255)
+        {
+            while (count--) *p++ = c;
+        }
+        else
+        {
+            while (count--)
+            {
+                *p = mf_blend8(*p, c, alpha);
+                p++;
+            }
+        }
+    }
+    else if (fb->format == MF_FRAMEBUFFER_RGB565)
+    {
+        uint16_t *q = (uint16_t*)(fb->data + (uint32_t)y * fb->stride) + x;
+        uint16_t c = fb->color;
+
+        if (alpha == 255)
+        {
+            while (count--) *q++ = c;
+        }
+        else
+        {
+            /* Spread the channels apart, so that all of them can be
+             * multiplied by the 5-bit alpha at once. The constant rounds
+             * each channel to nearest. */
+            uint32_t a = (alpha + 4) >> 3;
+            uint32_t fg = (c | ((uint32_t)c << 16)) & 0x07E0F81F;
+            uint32_t bg, t;
+
+            fg = fg * a + 0x02008010;
+            while (count--)
+            {
+                bg = (*q | ((uint32_t)*q << 16)) & 0x07E0F81F;
+                t = ((fg + bg * (32 - a)) >> 5) & 0x07E0F81F;
+                *q++ = (uint16_t)(t | (t >> 16));
+            }
+        }
+    }
+}
+#endif
@@ -104,10 +104,33 @@ static uint16_t strip_spaces(mf_str text, uint16_t count, mf_char *last_char)
     return result;
 }
 
+/* Check if a whole line of text at y0 is outside the clip rectangle. */
+static bool line_clipped(const struct mf_font_s *font, int16_t y0,
+                         const struct mf_rect_s *clip)
+{
+    return clip && ((int32_t)y0 + font->height <= clip->y ||
+                    y0 >= (int32_t)clip->y + clip->height);
+}
+
+/* Call the callback for a character, unless it is outside the clip
+ * rectangle. Returns the width of the character in either case. */
+static uint8_t render_char(const struct mf_font_s *font,
+                           int16_t x0, int16_t y0, mf_char character,
+                           const struct mf_rect_s *clip,
+                           mf_character_callback_t callback,
+                           void *state)
+{
+    if (mf_character_clipped(font, x0, y0, clip))
+        return mf_character_width(font, character);
+
+    return callback(x0, y0, character, state);
+}
+
 /* Render left-aligned string, left edge at x0. */
 static void render_left(const struct mf_font_s *font,
                         int16_t x0, int16_t y0,
                         mf_str text, uint16_t count,
+                        const struct mf_rect_s *clip,
                         mf_character_callback_t callback,
                         void *state)
 {
@@ -133,23 +156,26 @@ static void render_left(const struct mf_font_s *font,
         if (c1 != 0)
             x += mf_compute_kerning(font, c1, c2);
 
-        x += callback(x, y0, c2, state);
+        x += render_char(font, x, y0, c2, clip, callback, state);
         c1 = c2;
     }
 }
 
 #if !MF_USE_ALIGN
 
-void mf_render_aligned(const struct mf_font_s *font,
-                       int16_t x0, int16_t y0,
-                       enum mf_align_t align,
-                       mf_str text, uint16_t count,
-                       mf_character_callback_t callback,
-                       void *state)
+void mf_render_aligned_clipped(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               enum mf_align_t align,
+                               mf_str text, uint16_t count,
+                               const struct mf_rect_s *clip,
+                               mf_character_callback_t callback,
+                               void *state)
 {
-    int16_t string_width;
+    if (line_clipped(font, y0, clip))
+        return;
+
     count = strip_spaces(text, count, 0);
-    render_left(font, x0, y0, text, count, callback, state);
+    render_left(font, x0, y0, text, count, clip, callback, state);
 }
 
 #else
@@ -158,6 +184,7 @@ void mf_render_aligned(const struct mf_font_s *font,
 static void render_right(const struct mf_font_s *font,
                          int16_t x0, int16_t y0,
                          mf_str text, uint16_t count,
+                         const struct mf_rect_s *clip,
                          mf_character_callback_t callback,
                          void *state)
 {
@@ -196,49 +223,67 @@ static void render_right(const struct mf_font_s *font,
         if (c2 != 0)
             x -= mf_compute_kerning(font, c1, c2);
 
-        callback(x, y0, c1, state);
+        render_char(font, x, y0, c1, clip, callback, state);
         c2 = c1;
     }
 }
 
-void mf_render_aligned(const struct mf_font_s *font,
-                       int16_t x0, int16_t y0,
-                       enum mf_align_t align,
-                       mf_str text, uint16_t count,
-                       mf_character_callback_t callback,
-                       void *state)
+void mf_render_aligned_clipped(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               enum mf_align_t align,
+                               mf_str text, uint16_t count,
+                               const struct mf_rect_s *clip,
+                               mf_character_callback_t callback,
+                               void *state)
 {
     int16_t string_width;
+
+    if (line_clipped(font, y0, clip))
+        return;
+
     count = strip_spaces(text, count, 0);
 
     if (align == MF_ALIGN_LEFT)
     {
-        render_left(font, x0, y0, text, count, callback, state);
+        render_left(font, x0, y0, text, count, clip, callback, state);
     }
     if (align == MF_ALIGN_CENTER)
     {
         string_width = mf_get_string_width(font, text, count, false);
         x0 -= string_width / 2;
-        render_left(font, x0, y0, text, count, callback, state);
+        render_left(font, x0, y0, text, count, clip, callback, state);
     }
     else if (align == MF_ALIGN_RIGHT)
     {
-        render_right(font, x0, y0, text, count, callback, state);
+        render_right(font, x0, y0, text, count, clip, callback, state);
     }
 }
 
 #endif
 
 
+void mf_render_aligned(const struct mf_font_s *font,
+                       int16_t x0, int16_t y0,
+                       enum mf_align_t align,
+                       mf_str text, uint16_t count,
+                       mf_character_callback_t callback,
+                       void *state)
+{
+    mf_render_aligned_clipped(font, x0, y0, align, text, count, 0,
+                              callback, state);
+}
+
 #if !MF_USE_JUSTIFY
 
-void mf_render_justified(const struct mf_font_s *font,
-                         int16_t x0, int16_t y0, int16_t width,
-                         mf_str text, uint16_t count,
-                         mf_character_callback_t callback,
-                         void *state)
+void mf_render_justified_clipped(const struct mf_font_s *font,
+                                 int16_t x0, int16_t y0, int16_t width,
+                                 mf_str text, uint16_t count,
+                                 const struct mf_rect_s *clip,
+                                 mf_character_callback_t callback,
+                                 void *state)
 {
-    mf_render_aligned(font, x0, y0, MF_ALIGN_LEFT, text, count, callback, state);
+    mf_render_aligned_clipped(font, x0, y0, MF_ALIGN_LEFT, text, count, clip,
+                              callback, state);
 }
 
 #else
@@ -262,22 +307,26 @@ static uint16_t count_spaces(mf_str text, uint16_t count)
     return spaces;
 }
 
-void mf_render_justified(const struct mf_font_s *font,
-                         int16_t x0, int16_t y0, int16_t width,
-                         mf_str text, uint16_t count,
-                         mf_character_callback_t callback,
-                         void *state)
+void mf_render_justified_clipped(const struct mf_font_s *font,
+                                 int16_t x0, int16_t y0, int16_t width,
+                                 mf_str text, uint16_t count,
+                                 const struct mf_rect_s *clip,
+                                 mf_character_callback_t callback,
+                                 void *state)
 {
     int16_t string_width, adjustment;
     uint16_t num_spaces;
     mf_char last_char;
 
+    if (line_clipped(font, y0, clip))
+        return;
+
     count = strip_spaces(text, count, &last_char);
 
     if (last_char == '\n' || last_char == 0)
     {
         /* Line ends in linefeed, do not justify. */
-        render_left(font, x0, y0, text, count, callback, state);
+        render_left(font, x0, y0, text, count, clip, callback, state);
         return;
     }
 
@@ -322,7 +371,7 @@ void mf_render_justified(const struct mf_font_s *font,
                 adjustment -= tmp;
             }
 
-            x += callback(x, y0, c2, state);
+            x += render_char(font, x, y0, c2, clip, callback, state);
             c1 = c2;
         }
     }
@@ -330,3 +379,354 @@ void mf_render_justified(const struct mf_font_s *font,
 
 #endif
 
+void mf_render_justified(const struct mf_font_s *font,
+                         int16_t x0, int16_t y0, int16_t width,
+                         mf_str text, uint16_t count,
+                         mf_character_callback_t callback,
+                         void *state)
+{
+    mf_render_justified_clipped(font, x0, y0, width, text, count, 0,
+                                callback, state);
+}
+
+/* Render a run of characters that contains no tab stops. */
+static int16_t render_run(const struct mf_font_s *font,
+                          int16_t x0, int16_t y0,
+                          mf_str text, uint16_t count, bool kern,
+                          const struct mf_rect_s *clip,
+                          mf_pixel_callback_t callback,
+                          void *state)
+{
+    int16_t x;
+    mf_char c1 = 0, c2;
+
+    if (font->render_string)
+    {
+        return font->render_string(font, x0, y0, text, count, kern,
+                                   clip, callback, state);
+    }
+
+    x = x0;
+    while (count--)
+    {
+        c2 = mf_getchar(&text);
+
+        if (c2 == '\t')
+            c2 = ' ';
+
+        if (kern && c1 != 0)
+            x += mf_compute_kerning(font, c1, c2);
+
+        x += mf_render_character_clipped(font, x, y0, c2, clip,
+                                         callback, state);
+        c1 = c2;
+    }
+
+    return x - x0;
+}
+
+int16_t mf_render_string(const struct mf_font_s *font,
+                         int16_t x0, int16_t y0,
+                         mf_str text, uint16_t count, bool kern,
+                         const struct mf_rect_s *clip,
+                         mf_pixel_callback_t callback,
+                         void *state)
+{
+    int16_t x;
+    uint16_t run;
+    mf_str end, tmp;
+    mf_char c = 0;
+
+    if (!count)
+        count = 0xFFFF;
+
+    x = x0 - font->baseline_x;
+    while (count && *text)
+    {
+        /* Find the characters up to the next tab stop or line feed. */
+        run = 0;
+        end = text;
+        while (run < count && *end)
+        {
+            tmp = end;
+            c = mf_getchar(&tmp);
+            if (c == '\n' || (MF_USE_TABS && c == '\t'))
+                break;
+
+            end = tmp;
+            run++;
+        }
+
+        if (run)
+        {
+            x += render_run(font, x, y0, text, run, kern, clip,
+                            callback, state);
+            text = end;
+            count -= run;
+        }
+
+        if (!count || !*text || c == '\n')
+            break;
+
+#if MF_USE_TABS
+        mf_getchar(&text);
+        count--;
+        x = mf_round_to_tab(font, x0, x);
+#endif
+    }
+
+    return x - (x0 - font->baseline_x);
+}
+
+/* Store the characters of a line with their widths. The kerning against
+ * the previous character is stored temporarily in the x field, until the
+ * final positions are known. Returns the number of characters stored. */
+static uint16_t measure_line(const struct mf_font_s *font,
+                             mf_str text, uint16_t count,
+                             struct mf_glyph_pos_s *glyphs)
+{
+    uint16_t i;
+    mf_char c1 = 0, c2;
+
+    for (i = 0; i < count; i++)
+    {
+        c2 = mf_getchar(&text);
+        glyphs[i].x = 0;
+
+        if (c2 == '\t')
+        {
+#if MF_USE_TABS
+            glyphs[i].character = c2;
+            glyphs[i].width = 0;
+            c1 = 0;
+            continue;
+#else
+            c2 = ' ';
+#endif
+        }
+
+        if (c1 != 0)
+            glyphs[i].x = mf_compute_kerning(font, c1, c2);
+
+        glyphs[i].character = c2;
+        glyphs[i].width = mf_character_width(font, c2);
+        c1 = c2;
+    }
+
+    return count;
+}
+
+/* Same as mf_get_string_width without kerning, but for a measured line. */
+static int16_t measured_width(const struct mf_font_s *font,
+                              const struct mf_glyph_pos_s *glyphs,
+                              uint16_t count)
+{
+    int16_t result = 0;
+
+    while (count--)
+    {
+#if MF_USE_TABS
+        if (glyphs->character == '\t')
+            result = mf_round_to_tab(font, 0, result);
+#endif
+        result += glyphs->width;
+        glyphs++;
+    }
+
+    return result;
+}
+
+/* Position a measured line the same way as render_left. */
+static void place_left(const struct mf_font_s *font,
+                       struct mf_glyph_pos_s *glyphs, uint16_t count,
+                       int16_t x0)
+{
+    int16_t x;
+
+    x = x0 - font->baseline_x;
+    while (count--)
+    {
+#if MF_USE_TABS
+        if (glyphs->character == '\t')
+        {
+            glyphs->x = x;
+            x = mf_round_to_tab(font, x0, x);
+            glyphs++;
+            continue;
+        }
+#endif
+
+        x += glyphs->x;
+        glyphs->x = x;
+        x += glyphs->width;
+        glyphs++;
+    }
+}
+
+#if MF_USE_ALIGN
+/* Position a measured line the same way as render_right. */
+static void place_right(const struct mf_font_s *font,
+                        struct mf_glyph_pos_s *glyphs, uint16_t count)
+{
+    int16_t x, kerning, next_kerning = 0;
+
+    x = -font->baseline_x;
+    glyphs += count;
+    while (count--)
+    {
+        glyphs--;
+
+#if MF_USE_TABS
+        if (glyphs->character == '\t')
+        {
+            x = mf_round_to_prev_tab(font, 0, x);
+            glyphs->x = x;
+            next_kerning = 0;
+            continue;
+        }
+#endif
+
+        kerning = glyphs->x;
+        x -= glyphs->width;
+        x -= next_kerning;
+        glyphs->x = x;
+        next_kerning = kerning;
+    }
+}
+#endif
+
+uint16_t mf_layout_aligned(const struct mf_font_s *font,
+                           enum mf_align_t align,
+                           mf_str text, uint16_t count,
+                           struct mf_glyph_pos_s *glyphs,
+                           uint16_t max_glyphs)
+{
+    count = strip_spaces(text, count, 0);
+    if (count > max_glyphs)
+        count = max_glyphs;
+
+    count = measure_line(font, text, count, glyphs);
+
+#if MF_USE_ALIGN
+    if (align == MF_ALIGN_CENTER)
+    {
+        place_left(font, glyphs, count,
+                   -(measured_width(font, glyphs, count) / 2));
+        return count;
+    }
+    else if (align == MF_ALIGN_RIGHT)
+    {
+        place_right(font, glyphs, count);
+        return count;
+    }
+#else
+    (void)align;
+#endif
+
+    place_left(font, glyphs, count, 0);
+    return count;
+}
+
+#if !MF_USE_JUSTIFY
+
+uint16_t mf_layout_justified(const struct mf_font_s *font,
+                             int16_t width,
+                             mf_str text, uint16_t count,
+                             struct mf_glyph_pos_s *glyphs,
+                             uint16_t max_glyphs)
+{
+    return mf_layout_aligned(font, MF_ALIGN_LEFT, text, count,
+                             glyphs, max_glyphs);
+}
+
+#else
+
+uint16_t mf_layout_justified(const struct mf_font_s *font,
+                             int16_t width,
+                             mf_str text, uint16_t count,
+                             struct mf_glyph_pos_s *glyphs,
+                             uint16_t max_glyphs)
+{
+    int16_t x, tmp, adjustment;
+    uint16_t i, num_spaces;
+    mf_char last_char;
+
+    count = strip_spaces(text, count, &last_char);
+    if (count > max_glyphs)
+        count = max_glyphs;
+
+    count = measure_line(font, text, count, glyphs);
+
+    if (last_char == '\n' || last_char == 0)
+    {
+        /* Line ends in linefeed, do not justify. */
+        place_left(font, glyphs, count, 0);
+        return count;
+    }
+
+    /* Distribute the extra space the same way as
+     * mf_render_justified_clipped. */
+    adjustment = width - measured_width(font, glyphs, count);
+    num_spaces = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (is_justify_space(glyphs[i].character))
+            num_spaces++;
+    }
+
+    x = -font->baseline_x;
+    for (i = 0; i < count; i++)
+    {
+#if MF_USE_TABS
+        if (glyphs[i].character == '\t')
+        {
+            glyphs[i].x = x;
+            x = mf_round_to_tab(font, 0, x);
+            adjustment -= x - glyphs[i].x - mf_character_width(font, '\t');
+            continue;
+        }
+#endif
+
+        if (is_justify_space(glyphs[i].character))
+        {
+            tmp = (adjustment + num_spaces / 2) / num_spaces;
+            adjustment -= tmp;
+            num_spaces--;
+            x += tmp;
+        }
+
+        /* Apply the kerning stored by measure_line. */
+        tmp = glyphs[i].x;
+        x += tmp;
+        adjustment -= tmp;
+
+        glyphs[i].x = x;
+        x += glyphs[i].width;
+    }
+
+    return count;
+}
+
+#endif
+
+void mf_render_layout(const struct mf_font_s *font,
+                      int16_t x0, int16_t y0,
+                      const struct mf_glyph_pos_s *glyphs,
+                      uint16_t count,
+                      const struct mf_rect_s *clip,
+                      mf_character_callback_t callback,
+                      void *state)
+{
+    if (line_clipped(font, y0, clip))
+        return;
+
+    while (count--)
+    {
+        if (glyphs->character != '\t')
+        {
+            render_char(font, x0 + glyphs->x, y0, glyphs->character,
+                        clip, callback, state);
+        }
+        glyphs++;
+    }
+}
@@ -70,5 +70,128 @@ MF_EXTERN void mf_render_justified(const struct mf_font_s *font,
                                    mf_character_callback_t callback,
                                    void *state);
 
+/* Same as mf_render_aligned, but skips the characters that are completely
+ * outside the clip rectangle. The callback is still responsible for
+ * clipping the characters it renders, e.g. with
+ * mf_render_character_clipped.
+ *
+ * clip:     Area to render to, or NULL to render everything.
+ * Other parameters are the same as for mf_render_aligned.
+ */
+MF_EXTERN void mf_render_aligned_clipped(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         enum mf_align_t align,
+                                         mf_str text, uint16_t count,
+                                         const struct mf_rect_s *clip,
+                                         mf_character_callback_t callback,
+                                         void *state);
+
+/* Same as mf_render_justified, but skips the characters that are
+ * completely outside the clip rectangle.
+ *
+ * clip:     Area to render to, or NULL to render everything.
+ * Other parameters are the same as for mf_render_justified.
+ */
+MF_EXTERN void mf_render_justified_clipped(const struct mf_font_s *font,
+                                           int16_t x0, int16_t y0,
+                                           int16_t width,
+                                           mf_str text, uint16_t count,
+                                           const struct mf_rect_s *clip,
+                                           mf_character_callback_t callback,
+                                           void *state);
+
+/* Render a string left to right in one call, with the pixel callback. With
+ * kern set, gives the same output as mf_render_aligned with MF_ALIGN_LEFT
+ * and a callback that renders each character with
+ * mf_render_character_clipped, including the tab stops. The font is called
+ * once for each run of characters between tabs, so that it can keep its
+ * lookup state from one character to the next.
+ *
+ * font:     Pointer to the font definition.
+ * x0:       Left edge of the text.
+ * y0:       Upper edge of the target area.
+ * text:     Pointer to start of the text to render.
+ * count:    Number of characters to render or 0 to read until end of string.
+ *           Rendering also stops at a line feed.
+ * kern:     True to apply kerning between the characters.
+ * clip:     Area to render to, or NULL to render everything.
+ * callback: Callback to write out the pixels.
+ * state:    Free variable for use in the callback.
+ *
+ * Returns the width of the rendered text.
+ */
+MF_EXTERN int16_t mf_render_string(const struct mf_font_s *font,
+                                   int16_t x0, int16_t y0,
+                                   mf_str text, uint16_t count, bool kern,
+                                   const struct mf_rect_s *clip,
+                                   mf_pixel_callback_t callback,
+                                   void *state);
+
+/* Position of a single character on a laid out line. */
+struct mf_glyph_pos_s
+{
+    /* Character to render. Tab stops are stored as '\t' and are not
+     * rendered. */
+    mf_char character;
+
+    /* Left edge of the character, relative to the x0 of the line. */
+    int16_t x;
+
+    /* Width of the character, 0 for tab stops. */
+    uint8_t width;
+};
+
+/* Compute the positions of the characters on a single line of aligned
+ * text, including kerning and tab stops. The result can be rendered with
+ * mf_render_layout as many times as needed, and gives the same output as
+ * mf_render_aligned. The font is accessed only once for each character.
+ *
+ * font:       Pointer to the font definition.
+ * align:      Type of alignment.
+ * text:       Pointer to start of the text to lay out.
+ * count:      Number of characters on the line or 0 to read until end of
+ *             string.
+ * glyphs:     Array to store the positions to.
+ * max_glyphs: Size of the array. Longer lines are truncated.
+ *
+ * Returns the number of positions stored.
+ */
+MF_EXTERN uint16_t mf_layout_aligned(const struct mf_font_s *font,
+                                     enum mf_align_t align,
+                                     mf_str text, uint16_t count,
+                                     struct mf_glyph_pos_s *glyphs,
+                                     uint16_t max_glyphs);
+
+/* Same as mf_layout_aligned, but for justified text like
+ * mf_render_justified.
+ *
+ * width:      Width of the target area.
+ * Other parameters are the same as for mf_layout_aligned.
+ */
+MF_EXTERN uint16_t mf_layout_justified(const struct mf_font_s *font,
+                                       int16_t width,
+                                       mf_str text, uint16_t count,
+                                       struct mf_glyph_pos_s *glyphs,
+                                       uint16_t max_glyphs);
+
+/* Render a line that was laid out by mf_layout_aligned or
+ * mf_layout_justified.
+ *
+ * font:     Pointer to the font definition, same as for the layout.
+ * x0:       The x0 of the line, as for mf_render_aligned.
+ * y0:       Upper edge of the target area.
+ * glyphs:   Positions of the characters.
+ * count:    Number of positions.
+ * clip:     Area to render to, or NULL to render everything.
+ * callback: Callback to call for each character.
+ * state:    Free variable for use in the callback.
+ */
+MF_EXTERN void mf_render_layout(const struct mf_font_s *font,
+                                int16_t x0, int16_t y0,
+                                const struct mf_glyph_pos_s *glyphs,
+                                uint16_t count,
+                                const struct mf_rect_s *clip,
+                                mf_character_callback_t callback,
+                                void *state);
 
 #endif
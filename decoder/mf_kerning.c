@@ -1,4 +1,6 @@
 #include "mf_kerning.h"
+#include "mf_metrics.h"
+#include "mf_stats.h"
 #include <stdbool.h>
 
 #if MF_USE_KERNING
@@ -10,6 +12,7 @@ struct kerning_state_s
     uint8_t zoneheight;
 };
 
+#if !MF_METRICS_CACHE_SIZE
 /* Pixel callback for analyzing the left edge of a glyph. */
 static void fit_leftedge(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
                          void *state)
@@ -39,6 +42,81 @@ static void fit_rightedge(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
             s->edgepos[zone] = x;
     }
 }
+#endif
+
+/* Copy the edge profile of a character from the precomputed table. Returns
+ * false if the character is not in the table. */
+static bool lookup_edges(const struct mf_kerning_table_s *table,
+                         mf_char c, uint8_t zone_count, bool right,
+                         struct kerning_state_s *s)
+{
+    unsigned low, high, mid, index;
+    const struct mf_kerning_range_s *range;
+    const uint8_t *p;
+
+    low = 0;
+    high = table->range_count;
+    while (high - low > 1)
+    {
+        mid = (low + high) / 2;
+        if (table->ranges[mid].first_char <= c)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    if (high == low)
+        return false;
+
+    range = &table->ranges[low];
+    index = c - range->first_char;
+    if (c < range->first_char || index >= range->char_count)
+        return false;
+
+    p = range->edges + (uint32_t)index * 2 * zone_count;
+    if (right)
+        p += zone_count;
+
+    for (index = 0; index < zone_count; index++)
+        s->edgepos[index] = pgm_read_byte(p + index);
+
+    return true;
+}
+
+/* Find the edge profile of a character and return its width. Uses the
+ * precomputed table if the font has one, otherwise the metrics cache or
+ * renders the character.
+ * The fallback character and zero-width characters are always rendered,
+ * to get exactly the same result as mf_render_character would. */
+static uint8_t get_edges(const struct mf_font_s *font, mf_char c,
+                         uint8_t zone_count, bool right,
+                         struct kerning_state_s *s)
+{
+    const struct mf_kerning_table_s *table = font->kerning_table;
+    uint8_t width;
+#if MF_METRICS_CACHE_SIZE
+    const struct mf_metrics_s *m;
+    uint8_t i;
+#endif
+
+    if (table && table->zones == MF_KERNING_ZONES)
+    {
+        width = font->character_width(font, c);
+        if (width && lookup_edges(table, c, zone_count, right, s))
+            return width;
+    }
+
+#if MF_METRICS_CACHE_SIZE
+    m = mf_get_metrics(font, c, MF_METRICS_SHAPE);
+    for (i = 0; i < MF_KERNING_ZONES; i++)
+        s->edgepos[i] = right ? m->rightedge[i] : m->leftedge[i];
+    return m->width;
+#else
+    MF_STATS_ADD(kerning_renders, 1);
+    return mf_render_character(font, 0, 0, c,
+                               right ? fit_rightedge : fit_leftedge, s);
+#endif
+}
 
 /* Should kerning be done against this character? */
 static bool do_kerning(mf_char c)
@@ -63,7 +141,7 @@ int8_t mf_compute_kerning(const struct mf_font_s *font,
                           mf_char c1, mf_char c2)
 {
     struct kerning_state_s leftedge, rightedge;
-    uint8_t w1, w2, i, min_space;
+    uint8_t w1, w2, i, min_space, zone_count;
     int16_t normal_space, adjust, max_adjust;
 
     if (font->flags & MF_FONT_FLAG_MONOSPACE)
@@ -72,12 +150,15 @@ int8_t mf_compute_kerning(const struct mf_font_s *font,
     if (!do_kerning(c1) || !do_kerning(c2))
         return 0;
 
+    MF_STATS_ADD(kerning_pairs, 1);
+
     /* Compute the height of one kerning zone in pixels */
     i = (font->height + MF_KERNING_ZONES - 1) / MF_KERNING_ZONES;
     if (i < 1) i = 1;
 
     /* Initialize structures */
     leftedge.zoneheight = rightedge.zoneheight = i;
+    zone_count = (font->height + i - 1) / i;
     for (i = 0; i < MF_KERNING_ZONES; i++)
     {
         leftedge.edgepos[i] = 255;
@@ -85,8 +166,8 @@ int8_t mf_compute_kerning(const struct mf_font_s *font,
     }
 
     /* Analyze the edges of both glyphs. */
-    w1 = mf_render_character(font, 0, 0, c1, fit_rightedge, &rightedge);
-    w2 = mf_render_character(font, 0, 0, c2, fit_leftedge, &leftedge);
+    w1 = get_edges(font, c1, zone_count, true, &rightedge);
+    w2 = get_edges(font, c2, zone_count, false, &leftedge);
 
     /* Find the minimum horizontal space between the glyphs. */
     min_space = 255;
@@ -0,0 +1,139 @@
+#include "mf_metrics.h"
+
+#if MF_METRICS_CACHE_SIZE
+
+static struct mf_metrics_s cache[MF_METRICS_CACHE_SIZE];
+static uint16_t use_counter;
+
+void mf_clear_metrics_cache(void)
+{
+    uint16_t i;
+    for (i = 0; i < MF_METRICS_CACHE_SIZE; i++)
+    {
+        cache[i].font = 0;
+        cache[i].valid = 0;
+    }
+}
+
+struct shape_state
+{
+    struct mf_metrics_s *m;
+    uint8_t zoneheight;
+};
+
+/* Pixel callback for finding the bounding box and the edges of the glyph,
+ * in the same way as mf_character_whitespace and mf_compute_kerning. */
+static void shape_callback(int16_t x, int16_t y, uint8_t count,
+                           uint8_t alpha, void *state)
+{
+    struct shape_state *s = state;
+    struct mf_metrics_s *m = s->m;
+    int16_t x_last = x + count - 1;
+
+    if (alpha > 7)
+    {
+        if (m->min_x > x) m->min_x = x;
+        if (m->min_y > y) m->min_y = y;
+        if (m->max_x < x_last) m->max_x = x_last;
+        if (m->max_y < y) m->max_y = y;
+
+#if MF_USE_KERNING
+        {
+            uint8_t zone = y / s->zoneheight;
+            if (x < m->leftedge[zone])
+                m->leftedge[zone] = x;
+            if (x_last > m->rightedge[zone])
+                m->rightedge[zone] = x_last;
+        }
+#endif
+    }
+}
+
+/* Render the character once to find all of its shape metrics. */
+static void compute_shape(struct mf_metrics_s *m)
+{
+    struct shape_state s;
+    uint16_t i;
+
+    m->min_x = m->min_y = 255;
+    m->max_x = m->max_y = 0;
+    s.m = m;
+    s.zoneheight = 1;
+
+#if MF_USE_KERNING
+    for (i = 0; i < MF_KERNING_ZONES; i++)
+    {
+        m->leftedge[i] = 255;
+        m->rightedge[i] = 0;
+    }
+
+    i = (m->font->height + MF_KERNING_ZONES - 1) / MF_KERNING_ZONES;
+    if (i > 1) s.zoneheight = i;
+#endif
+
+    m->width = mf_render_character(m->font, 0, 0, m->character,
+                                   shape_callback, &s);
+    m->valid |= MF_METRICS_WIDTH | MF_METRICS_SHAPE;
+}
+
+const struct mf_metrics_s *mf_get_metrics(const struct mf_font_s *font,
+                                          mf_char character, uint8_t needed)
+{
+    struct mf_metrics_s *m = 0;
+    uint16_t i;
+
+    use_counter++;
+
+    for (i = 0; i < MF_METRICS_CACHE_SIZE; i++)
+    {
+        if (cache[i].font == font && cache[i].character == character)
+        {
+            m = &cache[i];
+            break;
+        }
+    }
+
+    if (!m)
+    {
+        /* Replace the entry that has been unused for the longest time. */
+        uint16_t age, max_age = 0;
+        m = &cache[0];
+        for (i = 0; i < MF_METRICS_CACHE_SIZE; i++)
+        {
+            if (!cache[i].font)
+            {
+                m = &cache[i];
+                break;
+            }
+
+            age = use_counter - cache[i].last_use;
+            if (age > max_age)
+            {
+                max_age = age;
+                m = &cache[i];
+            }
+        }
+
+        m->font = font;
+        m->character = character;
+        m->valid = 0;
+    }
+
+    m->last_use = use_counter;
+
+    if ((needed & MF_METRICS_SHAPE) && !(m->valid & MF_METRICS_SHAPE))
+    {
+        compute_shape(m);
+    }
+    else if ((needed & MF_METRICS_WIDTH) && !(m->valid & MF_METRICS_WIDTH))
+    {
+        m->width = font->character_width(font, character);
+        if (!m->width)
+            m->width = font->character_width(font, font->fallback_character);
+        m->valid |= MF_METRICS_WIDTH;
+    }
+
+    return m;
+}
+
+#endif
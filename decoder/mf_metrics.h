@@ -0,0 +1,67 @@
+/* Small RAM cache of character metrics: the width, the whitespace around
+ * the character and the edge profiles used for kerning. Enabled by setting
+ * MF_METRICS_CACHE_SIZE in mf_config.h. When enabled, mf_character_width,
+ * mf_character_whitespace and mf_compute_kerning use it automatically, so
+ * repeated layout of the same text does not render the glyphs again.
+ *
+ * The entries are identified by the font pointer. If a font structure is
+ * modified or reused for another font, call mf_clear_metrics_cache().
+ * mf_scale_font() does this automatically.
+ */
+
+#ifndef _MF_METRICS_H_
+#define _MF_METRICS_H_
+
+#include "mf_font.h"
+
+#if MF_METRICS_CACHE_SIZE
+
+/* Cached information about a single character. */
+struct mf_metrics_s
+{
+    const struct mf_font_s *font;
+    mf_char character;
+
+    /* Which of the fields below are valid, MF_METRICS_* flags. */
+    uint8_t valid;
+
+    /* Same as mf_character_width(). */
+    uint8_t width;
+
+    /* Bounding box of the visible pixels. 255, 255, 0, 0 if none. */
+    uint8_t min_x, min_y, max_x, max_y;
+
+#if MF_USE_KERNING
+    /* Leftmost and rightmost visible pixel in each kerning zone. */
+    uint8_t leftedge[MF_KERNING_ZONES];
+    uint8_t rightedge[MF_KERNING_ZONES];
+#endif
+
+    /* Value of the use counter when the entry was last accessed. */
+    uint16_t last_use;
+};
+
+/* Flags for the valid field. */
+#define MF_METRICS_WIDTH 0x01
+#define MF_METRICS_SHAPE 0x02 /* Bounding box and edges */
+
+/* Get the metrics of a character, computing and storing them in the cache
+ * if needed. Evicts the least recently used entry when the cache is full.
+ *
+ * font:      Pointer to the font definition.
+ * character: The character code (unicode).
+ * needed:    MF_METRICS_* flags for the fields that must be valid.
+ *
+ * Returns a pointer to the cache entry, valid until the next call.
+ */
+MF_EXTERN const struct mf_metrics_s *mf_get_metrics(
+    const struct mf_font_s *font, mf_char character, uint8_t needed);
+
+/* Forget all the cached metrics. */
+MF_EXTERN void mf_clear_metrics_cache(void);
+
+#else
+#define mf_clear_metrics_cache()
+#endif
+
+#endif
@@ -10,6 +10,27 @@
 /* Versions of the RLE font format that are supported. */
 #define MF_RLEFONT_VERSION_4_SUPPORTED 1
 
+/* Fonts with the MF_FONT_FLAG_WIDE_CODES flag are supported. */
+#define MF_RLEFONT_WIDE_SUPPORTED 1
+
+/* Character ranges with delta coded glyph offsets are supported. */
+#define MF_RLEFONT_DELTA_OFFSETS_SUPPORTED 1
+
+/* Fonts can have a decoder specialized for them, see mf_rlefont_decoder.h. */
+#define MF_RLEFONT_SPECIALIZED_SUPPORTED 1
+
+/* Separate dictionary for a block of the characters. Large fonts can be
+ * split into blocks that are optimized independently, so that each glyph
+ * only refers to a smaller dictionary. The fields are the same as the ones
+ * in struct mf_rlefont_s. */
+struct mf_rlefont_dict_s
+{
+    const uint8_t *dictionary_data;
+    const uint16_t *dictionary_offsets;
+    uint16_t rle_entry_count;
+    uint16_t dict_entry_count;
+};
+
 /* Structure for a range of characters. This implements a sparse storage of
  * character indices, so that you can e.g. pick a 100 characters in the middle
  * of the UTF16 range and just store them. */
@@ -21,11 +42,23 @@ struct mf_rlefont_char_range_s
     /* The total count of characters in this range. */
     uint16_t char_count;
 
-    /* Lookup table with the start indices into glyph_data. */
+    /* Lookup table with the start indices into glyph_data, or NULL if
+     * glyph_bases and glyph_deltas are used instead. */
     const uint16_t *glyph_offsets;
 
     /* The encoded glyph data for glyphs in this range. */
     const uint8_t *glyph_data;
+
+    /* Dictionary used by the glyphs in this range, or NULL for the one in
+     * the font structure. */
+    const struct mf_rlefont_dict_s *dictionary;
+
+    /* Delta coded lookup table, which takes less space and allows more
+     * than 64 kB of glyph data in a range. The start index of character i
+     * is glyph_bases[i >> group_shift] + glyph_deltas[i]. */
+    const uint32_t *glyph_bases;
+    const uint8_t *glyph_deltas;
+    uint8_t group_shift;
 };
 
 /* Structure for a single encoded font. */
@@ -34,7 +67,7 @@ struct mf_rlefont_s
     struct mf_font_s font;
 
     /* Version of the font definition used. */
-    const uint8_t version;
+    uint8_t version;
 
     /* Big array of the data for all the dictionary entries. */
     const uint8_t *dictionary_data;
@@ -46,19 +79,53 @@ struct mf_rlefont_s
 
     /* Number of dictionary entries using the RLE encoding.
      * Entries starting at this index use the dictionary encoding. */
-    const uint8_t rle_entry_count;
+    uint16_t rle_entry_count;
 
     /* Total number of dictionary entries.
-     * Entries after this are nonexistent. */
-    const uint8_t dict_entry_count;
+     * Entries after this are nonexistent. If there are more than 232 in
+     * any of the dictionaries, the font has MF_FONT_FLAG_WIDE_CODES set.
+     * In such dictionaries the single byte codes reach only the first 216
+     * entries, and the rest are referred to by an escape byte 0xF0 + n
+     * followed by a byte b, for the entry 216 + n * 256 + b. */
+    uint16_t dict_entry_count;
 
     /* Number of discontinuous character ranges */
-    const uint8_t char_range_count;
+    uint16_t char_range_count;
 
     /* Array of the character ranges */
     const struct mf_rlefont_char_range_s *char_ranges;
+
+    /* Number of rows between the restart points stored at the beginning of
+     * each glyph, or 0 if the glyphs have no restart points. Each restart
+     * point is 4 bytes: the 16-bit offset of the codeword that contains the
+     * first pixel of the row, counted from the first codeword, followed by
+     * the 16-bit index of the first pixel of that codeword. Both are little
+     * endian. There are (height - 1) / restart_rows of them, for rows
+     * restart_rows, 2 * restart_rows etc. */
+    uint8_t restart_rows;
 };
 
+/* Render only the rows row_begin to row_end - 1 of a character. If the font
+ * has restart points, the decoding starts from the closest one above
+ * row_begin. In any case, it stops after row_end.
+ *
+ * font:      Pointer to the font definition. Must be a mf_rlefont_s.
+ * x0, y0:    Upper left corner of the whole character.
+ * character: The character code (unicode) to render.
+ * row_begin: First row to render, relative to the top of the character.
+ * row_end:   Row after the last one to render.
+ * callback:  Callback function to write out the pixels.
+ * state:     Free variable for caller to use (can be NULL).
+ *
+ * Returns width of the character, or 0 if it is not found.
+ */
+MF_EXTERN uint8_t mf_rlefont_render_rows(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         mf_char character,
+                                         uint8_t row_begin, uint8_t row_end,
+                                         mf_pixel_callback_t callback,
+                                         void *state);
+
 #ifdef MF_RLEFONT_INTERNALS
 /* Internal functions, don't use these directly. */
 MF_EXTERN uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
@@ -67,8 +134,17 @@ MF_EXTERN uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
                                               mf_pixel_callback_t callback,
                                               void *state);
 
+MF_EXTERN uint8_t mf_rlefont_render_character_clipped(
+    const struct mf_font_s *font, int16_t x0, int16_t y0, mf_char character,
+    const struct mf_rect_s *clip, mf_pixel_callback_t callback, void *state);
+
 MF_EXTERN uint8_t mf_rlefont_character_width(const struct mf_font_s *font,
                                              mf_char character);
+
+MF_EXTERN int16_t mf_rlefont_render_string(
+    const struct mf_font_s *font, int16_t x0, int16_t y0,
+    mf_str text, uint16_t count, bool kern, const struct mf_rect_s *clip,
+    mf_pixel_callback_t callback, void *state);
 #endif
 
 #endif
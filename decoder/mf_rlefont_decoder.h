@@ -0,0 +1,784 @@
+/* Decoder for the mf_rlefont format, written so that it can be compiled
+ * for a specific font. mf_rlefont.c includes this as is, and gets the
+ * generic decoder that reads the dictionary sizes etc. from the font
+ * structure. Fonts exported with --specialize include it again after
+ * defining the parameters below as constants, so that the compiler can
+ * resolve the codeword dispatch at compile time.
+ *
+ * Parameters, all optional:
+ * MF_RLEFONT_DECODER(name):     Name for the functions of the decoder. If
+ *                               defined, the entry points are static.
+ * MF_RLEFONT_RLE_COUNT(dict):   Number of RLE dictionary entries.
+ * MF_RLEFONT_DICT_COUNT(dict):  Total number of dictionary entries.
+ * MF_RLEFONT_WIDTH(font):       Width of the font.
+ * MF_RLEFONT_HEIGHT(font):      Height of the font.
+ * MF_RLEFONT_RESTART_ROWS(rlefont): Rows between the restart points.
+ * MF_RLEFONT_BIN_RUNS:          Table of the pixel runs of the fill entries,
+ *                               4 bytes for each code from
+ * MF_RLEFONT_BIN_START:         up to 255. Each byte is the number of
+ *                               transparent pixels in the high nibble and
+ *                               the number of opaque pixels after them in
+ *                               the low nibble, and 0 ends the list.
+ *
+ * The parameters are undefined at the end.
+ */
+
+/* Number of reserved codes before the dictionary entries. */
+#define DICT_START 24
+
+/* Special reference to mean "fill with zeros to the end of the glyph" */
+#define REF_FILLZEROS 16
+
+/* RLE codes */
+#define RLE_CODEMASK    0xC0
+#define RLE_VALMASK     0x3F
+#define RLE_ZEROS       0x00
+#define RLE_64ZEROS     0x40
+#define RLE_ONES        0x80
+#define RLE_SHADE       0xC0
+
+/* Dictionary "fill entries" for encoding bits directly. */
+#define DICT_START7BIT  4
+#define DICT_START6BIT  132
+#define DICT_START5BIT  196
+#define DICT_START4BIT  228
+#define DICT_START3BIT  244
+#define DICT_START2BIT  252
+
+/* First escape byte of the two-byte codewords, used by dictionaries with
+ * more than DICT_SINGLE_COUNT entries. These have no fill entries. */
+#define ESCAPE_START      0xF0
+#define DICT_SINGLE_COUNT 232
+
+#ifndef _MF_RLEFONT_DECODER_H_
+#define _MF_RLEFONT_DECODER_H_
+
+/* The parts that do not depend on the parameters are only included once. */
+
+#ifndef MF_RLEFONT_INTERNALS
+#define MF_RLEFONT_INTERNALS
+#endif
+#include "mf_rlefont.h"
+#include "mf_kerning.h"
+#include "mf_stats.h"
+#ifndef MF_FRAMEBUFFER_INTERNALS
+#define MF_FRAMEBUFFER_INTERNALS
+#endif
+#include "mf_framebuffer.h"
+
+/* Find the character range that could contain a given character: the last
+ * one that starts at or before it. Uses a binary search if the ranges are
+ * known to be sorted, otherwise returns the first one that contains it.
+ */
+static const struct mf_rlefont_char_range_s *find_char_range(
+    const struct mf_rlefont_s *font, uint16_t character)
+{
+    unsigned i, low, high, mid;
+    const struct mf_rlefont_char_range_s *range;
+
+    if (font->font.flags & MF_FONT_FLAG_SORTED_RANGES)
+    {
+        low = 0;
+        high = font->char_range_count;
+        while (high - low > 1)
+        {
+            MF_STATS_ADD(range_scans, 1);
+            mid = (low + high) / 2;
+            if (font->char_ranges[mid].first_char <= character)
+                low = mid;
+            else
+                high = mid;
+        }
+        return (high > low) ? &font->char_ranges[low] : 0;
+    }
+
+    for (i = 0; i < font->char_range_count; i++)
+    {
+        MF_STATS_ADD(range_scans, 1);
+        range = &font->char_ranges[i];
+        if (character >= range->first_char &&
+            (unsigned)(character - range->first_char) < range->char_count)
+        {
+            return range;
+        }
+    }
+
+    return 0;
+}
+
+/* Get a pointer to the glyph at index in a character range. */
+static const uint8_t *glyph_in_range(
+    const struct mf_rlefont_char_range_s *range, unsigned index)
+{
+    uint32_t offset;
+
+    if (range->glyph_offsets)
+    {
+        offset = pgm_read_word(range->glyph_offsets + index);
+    }
+    else
+    {
+        offset = pgm_read_dword(range->glyph_bases +
+                                (index >> range->group_shift));
+        offset += pgm_read_byte(range->glyph_deltas + index);
+    }
+
+    return &range->glyph_data[offset];
+}
+
+/* Get the dictionary that the glyphs in a character range use. */
+static void range_dictionary(const struct mf_rlefont_s *font,
+                             const struct mf_rlefont_char_range_s *range,
+                             struct mf_rlefont_dict_s *dict)
+{
+    if (range->dictionary)
+    {
+        *dict = *range->dictionary;
+    }
+    else
+    {
+        dict->dictionary_data = font->dictionary_data;
+        dict->dictionary_offsets = font->dictionary_offsets;
+        dict->rle_entry_count = font->rle_entry_count;
+        dict->dict_entry_count = font->dict_entry_count;
+    }
+}
+
+/* Find a pointer to the glyph matching a given character by searching
+ * through the character ranges. If the character is not found, return
+ * a null pointer. If dict is not null, it is set to the dictionary that
+ * the glyph uses.
+ */
+static const uint8_t *find_glyph(const struct mf_rlefont_s *font,
+                                 uint16_t character,
+                                 struct mf_rlefont_dict_s *dict)
+{
+   unsigned index;
+   const struct mf_rlefont_char_range_s *range;
+
+   MF_STATS_ADD(glyph_lookups, 1);
+   range = find_char_range(font, character);
+   if (!range)
+       return 0;
+
+   index = character - range->first_char;
+   if (character >= range->first_char && index < range->char_count)
+   {
+       if (dict)
+           range_dictionary(font, range, dict);
+
+       return glyph_in_range(range, index);
+   }
+
+   return 0;
+}
+
+/* Find the glyph of a character, starting from the range of the previous
+ * character. The range and its dictionary are only looked up again when the
+ * character is not in it. */
+static const uint8_t *find_glyph_near(
+    const struct mf_rlefont_s *font, uint16_t character,
+    const struct mf_rlefont_char_range_s **range,
+    struct mf_rlefont_dict_s *dict)
+{
+    const struct mf_rlefont_char_range_s *r = *range;
+
+    MF_STATS_ADD(glyph_lookups, 1);
+    if (!r || character < r->first_char ||
+        (unsigned)(character - r->first_char) >= r->char_count)
+    {
+        r = find_char_range(font, character);
+        if (!r || character < r->first_char ||
+            (unsigned)(character - r->first_char) >= r->char_count)
+        {
+            return 0;
+        }
+
+        range_dictionary(font, r, dict);
+        *range = r;
+    }
+
+    return glyph_in_range(r, character - r->first_char);
+}
+
+/* Structure to keep track of coordinates of the next pixel to be written,
+ * and also the bounds of the character. Pixels outside the clip area
+ * (clip_x_begin to clip_x_end, y_begin to y_end) are decoded but not
+ * written. */
+struct renderstate_r
+{
+    int16_t x_begin;
+    int16_t x_end;
+    int16_t x;
+    int16_t y;
+    int16_t y_begin;
+    int16_t y_end;
+    int16_t clip_x_begin;
+    int16_t clip_x_end;
+    mf_pixel_callback_t callback;
+    void *state;
+};
+
+/* Call the callback for the part of a run on the current row that is
+ * inside the clip area. */
+static void clip_pixels(struct renderstate_r *rstate, uint8_t count,
+                        uint8_t alpha)
+{
+    int16_t x = rstate->x;
+    int16_t x_end = x + count;
+
+    if (rstate->y < rstate->y_begin || rstate->y >= rstate->y_end)
+        return;
+
+    if (x < rstate->clip_x_begin)
+        x = rstate->clip_x_begin;
+    if (x_end > rstate->clip_x_end)
+        x_end = rstate->clip_x_end;
+
+    if (x >= x_end)
+        return;
+
+    MF_STATS_ADD(pixel_callbacks, 1);
+
+#if MF_USE_FRAMEBUFFER
+    /* Skip the indirect call for the built-in render targets. */
+    if (rstate->callback == mf_framebuffer_callback)
+    {
+        mf_framebuffer_write(rstate->state, x, rstate->y, x_end - x, alpha);
+        return;
+    }
+#endif
+
+    rstate->callback(x, rstate->y, x_end - x, alpha, rstate->state);
+}
+
+/* Call the callback to write one pixel to screen, and advance to next
+ * pixel position. */
+static void write_pixels(struct renderstate_r *rstate, uint16_t count,
+                         uint8_t alpha)
+{
+    uint8_t rowlen;
+
+    /* Write row-by-row if the run spans multiple rows. */
+    while ((int32_t)rstate->x + count >= rstate->x_end)
+    {
+        rowlen = rstate->x_end - rstate->x;
+        clip_pixels(rstate, rowlen, alpha);
+        count -= rowlen;
+        rstate->x = rstate->x_begin;
+        rstate->y++;
+    }
+
+    /* Write the remaining part */
+    if (count)
+    {
+        clip_pixels(rstate, count, alpha);
+        rstate->x += count;
+    }
+}
+
+/* Skip the given number of pixels (0 alpha) */
+static void skip_pixels(struct renderstate_r *rstate, uint16_t count)
+{
+    rstate->x += count;
+    while (rstate->x >= rstate->x_end)
+    {
+        rstate->x -= rstate->x_end - rstate->x_begin;
+        rstate->y++;
+    }
+}
+
+/* Decode and write out a RLE-encoded dictionary entry. */
+static void write_rle_dictentry(const struct mf_rlefont_dict_s *dict,
+                                struct renderstate_r *rstate,
+                                uint16_t index)
+{
+    uint16_t offset = pgm_read_word(dict->dictionary_offsets + index);
+    uint16_t length = pgm_read_word(dict->dictionary_offsets + index + 1) - offset;
+    uint16_t i;
+
+    MF_STATS_ADD(rle_dictentries, 1);
+
+    for (i = 0; i < length; i++)
+    {
+        uint8_t code = pgm_read_byte(dict->dictionary_data + offset + i);
+        if ((code & RLE_CODEMASK) == RLE_ZEROS)
+        {
+            skip_pixels(rstate, code & RLE_VALMASK);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_64ZEROS)
+        {
+            skip_pixels(rstate, ((code & RLE_VALMASK) + 1) * 64);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_ONES)
+        {
+            write_pixels(rstate, (code & RLE_VALMASK) + 1, 255);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_SHADE)
+        {
+            uint8_t count, alpha;
+            count = ((code & RLE_VALMASK) >> 4) + 1;
+            alpha = ((code & RLE_VALMASK) & 0xF) * 0x11;
+            write_pixels(rstate, count, alpha);
+        }
+    }
+}
+
+/* Read a 16-bit little endian value from the glyph data. */
+static uint16_t read_le16(const uint8_t *p)
+{
+    return pgm_read_byte(p) | ((uint16_t)pgm_read_byte(p + 1) << 8);
+}
+
+/* Limit a span of the clip rectangle to 0..size, relative to the start of
+ * the character. */
+static uint8_t clip_to_glyph(int32_t pos, uint8_t size)
+{
+    if (pos < 0)
+        return 0;
+    if (pos > size)
+        return size;
+    return (uint8_t)pos;
+}
+
+#endif
+
+/* The parts below are compiled for each set of parameters. */
+
+#ifdef MF_RLEFONT_DECODER
+#define MF_RLEFONT_ENTRY static
+#else
+#define MF_RLEFONT_DECODER(name) mf_rlefont_ ## name
+#define MF_RLEFONT_ENTRY
+#define MF_RLEFONT_GENERIC
+#endif
+
+#ifndef MF_RLEFONT_RLE_COUNT
+#define MF_RLEFONT_RLE_COUNT(dict) ((dict)->rle_entry_count)
+#endif
+
+#ifndef MF_RLEFONT_DICT_COUNT
+#define MF_RLEFONT_DICT_COUNT(dict) ((dict)->dict_entry_count)
+#endif
+
+#ifndef MF_RLEFONT_WIDTH
+#define MF_RLEFONT_WIDTH(font) ((font)->width)
+#endif
+
+#ifndef MF_RLEFONT_HEIGHT
+#define MF_RLEFONT_HEIGHT(font) ((font)->height)
+#endif
+
+#ifndef MF_RLEFONT_RESTART_ROWS
+#define MF_RLEFONT_RESTART_ROWS(rlefont) ((rlefont)->restart_rows)
+#endif
+
+#ifdef MF_RLEFONT_BIN_RUNS
+
+/* Write out a direct binary codeword from the precomputed runs. Codes
+ * below MF_RLEFONT_BIN_START are dictionary entries, and the encoder does
+ * not write them here. */
+static void MF_RLEFONT_DECODER(write_bin_codeword)(
+    struct renderstate_r *rstate, uint8_t code)
+{
+    const uint8_t *runs;
+    uint8_t i, run;
+
+    if (code < MF_RLEFONT_BIN_START)
+        return;
+
+    MF_STATS_ADD(bin_codewords, 1);
+
+    runs = MF_RLEFONT_BIN_RUNS + 4 * (code - MF_RLEFONT_BIN_START);
+    for (i = 0; i < 4; i++)
+    {
+        run = pgm_read_byte(runs + i);
+        if (!run)
+            break;
+
+        if (run >> 4)
+            skip_pixels(rstate, run >> 4);
+        if (run & 0xF)
+            write_pixels(rstate, run & 0xF, 255);
+    }
+}
+
+#else
+
+/* Get bit count for the "fill entries" */
+static uint8_t MF_RLEFONT_DECODER(fillentry_bitcount)(uint8_t index)
+{
+    if (index >= DICT_START2BIT)
+        return 2;
+    else if (index >= DICT_START3BIT)
+        return 3;
+    else if (index >= DICT_START4BIT)
+        return 4;
+    else if (index >= DICT_START5BIT)
+        return 5;
+    else if (index >= DICT_START6BIT)
+        return 6;
+    else
+        return 7;
+}
+
+/* Decode and write out a direct binary codeword */
+static void MF_RLEFONT_DECODER(write_bin_codeword)(
+    struct renderstate_r *rstate, uint8_t code)
+{
+    uint8_t bitcount = MF_RLEFONT_DECODER(fillentry_bitcount)(code);
+    uint8_t byte = code - DICT_START7BIT;
+    uint8_t runlen = 0;
+
+    MF_STATS_ADD(bin_codewords, 1);
+
+    while (bitcount--)
+    {
+        if (byte & 1)
+        {
+            runlen++;
+        }
+        else
+        {
+            if (runlen)
+            {
+                write_pixels(rstate, runlen, 255);
+                runlen = 0;
+            }
+
+            skip_pixels(rstate, 1);
+        }
+
+        byte >>= 1;
+    }
+
+    if (runlen)
+        write_pixels(rstate, runlen, 255);
+}
+
+#endif
+
+/* Read a codeword and advance the pointer past it. The two-byte codewords
+ * are returned as DICT_START + dictionary index, same as the others. */
+static uint16_t MF_RLEFONT_DECODER(read_codeword)(
+    const struct mf_rlefont_dict_s *dict, const uint8_t **p)
+{
+    uint16_t code = pgm_read_byte((*p)++);
+
+    if (code >= ESCAPE_START && MF_RLEFONT_DICT_COUNT(dict) > DICT_SINGLE_COUNT)
+    {
+        code = ESCAPE_START + ((code - ESCAPE_START) << 8);
+        code += pgm_read_byte((*p)++);
+    }
+
+    return code;
+}
+
+/* Decode and write out a reference codeword */
+static void MF_RLEFONT_DECODER(write_ref_codeword)(
+    const struct mf_rlefont_dict_s *dict, struct renderstate_r *rstate,
+    uint16_t code)
+{
+    if (code == 0)
+    {
+        skip_pixels(rstate, 1);
+    }
+    else if (code <= 15)
+    {
+        write_pixels(rstate, 1, 0x11 * code);
+    }
+    else if (code == REF_FILLZEROS)
+    {
+        /* Fill with zeroes to end */
+        MF_STATS_ADD(fill_zeros, 1);
+        rstate->y = rstate->y_end;
+    }
+    else if (code < DICT_START)
+    {
+        /* Reserved */
+    }
+    else if (code < DICT_START + MF_RLEFONT_RLE_COUNT(dict))
+    {
+        write_rle_dictentry(dict, rstate, code - DICT_START);
+    }
+    else if (code < 256)
+    {
+        MF_RLEFONT_DECODER(write_bin_codeword)(rstate, (uint8_t)code);
+    }
+}
+
+/* Decode and write out a reference encoded dictionary entry. */
+static void MF_RLEFONT_DECODER(write_ref_dictentry)(
+    const struct mf_rlefont_dict_s *dict, struct renderstate_r *rstate,
+    uint16_t index)
+{
+    uint16_t offset = pgm_read_word(dict->dictionary_offsets + index);
+    uint16_t end = pgm_read_word(dict->dictionary_offsets + index + 1);
+    const uint8_t *p = dict->dictionary_data + offset;
+    const uint8_t *p_end = dict->dictionary_data + end;
+
+    MF_STATS_ADD(ref_dictentries, 1);
+
+    while (p < p_end)
+    {
+        MF_RLEFONT_DECODER(write_ref_codeword)(
+            dict, rstate, MF_RLEFONT_DECODER(read_codeword)(dict, &p));
+    }
+}
+
+/* Decode and write out an arbitrary glyph codeword */
+static void MF_RLEFONT_DECODER(write_glyph_codeword)(
+    const struct mf_rlefont_dict_s *dict, struct renderstate_r *rstate,
+    uint16_t code)
+{
+    if (code >= DICT_START + MF_RLEFONT_RLE_COUNT(dict) &&
+        code < DICT_START + MF_RLEFONT_DICT_COUNT(dict))
+    {
+        MF_RLEFONT_DECODER(write_ref_dictentry)(dict, rstate,
+                                                code - DICT_START);
+    }
+    else
+    {
+        MF_RLEFONT_DECODER(write_ref_codeword)(dict, rstate, code);
+    }
+}
+
+/* Decode the rows row_begin to row_end - 1 of a glyph, starting after its
+ * width byte, and write out the pixels between clip_x_begin and
+ * clip_x_end. */
+static void MF_RLEFONT_DECODER(decode_glyph)(
+    const struct mf_rlefont_s *rlefont, const uint8_t *p,
+    const struct mf_rlefont_dict_s *dict, int16_t x0, int16_t y0,
+    uint8_t row_begin, uint8_t row_end,
+    int16_t clip_x_begin, int16_t clip_x_end,
+    mf_pixel_callback_t callback, void *state)
+{
+    uint8_t width = MF_RLEFONT_WIDTH(&rlefont->font);
+    uint8_t height = MF_RLEFONT_HEIGHT(&rlefont->font);
+    uint8_t restart_rows = MF_RLEFONT_RESTART_ROWS(rlefont);
+    struct renderstate_r rstate;
+    rstate.x_begin = x0;
+    rstate.x_end = x0 + width;
+    rstate.x = x0;
+    rstate.y = y0;
+    rstate.y_begin = y0 + row_begin;
+    rstate.y_end = y0 + (row_end < height ? row_end : height);
+    rstate.clip_x_begin = clip_x_begin;
+    rstate.clip_x_end = clip_x_end;
+    rstate.callback = callback;
+    rstate.state = state;
+
+    if (restart_rows)
+    {
+        /* Skip over the restart points, but first seek to the last one
+         * at or above row_begin. */
+        uint8_t count = (height - 1) / restart_rows;
+        uint8_t index = row_begin / restart_rows;
+        const uint8_t *codewords = p + 4 * count;
+
+        if (index > count)
+            index = count;
+
+        if (index > 0)
+        {
+            const uint8_t *restart = p + 4 * (index - 1);
+            uint16_t pixel = read_le16(restart + 2);
+            codewords += read_le16(restart);
+            rstate.x = x0 + pixel % width;
+            rstate.y = y0 + pixel / width;
+        }
+
+        p = codewords;
+    }
+
+    while (rstate.y < rstate.y_end)
+    {
+        MF_RLEFONT_DECODER(write_glyph_codeword)(
+            dict, &rstate, MF_RLEFONT_DECODER(read_codeword)(dict, &p));
+    }
+}
+
+/* Decode the rows row_begin to row_end - 1 of a character, and write out
+ * the pixels between clip_x_begin and clip_x_end. */
+static uint8_t MF_RLEFONT_DECODER(render_glyph)(
+    const struct mf_rlefont_s *rlefont, int16_t x0, int16_t y0,
+    mf_char character, uint8_t row_begin, uint8_t row_end,
+    int16_t clip_x_begin, int16_t clip_x_end,
+    mf_pixel_callback_t callback, void *state)
+{
+    struct mf_rlefont_dict_s dict;
+    const uint8_t *p;
+    uint8_t width;
+
+    p = find_glyph(rlefont, character, &dict);
+    if (!p)
+        return 0;
+
+    width = pgm_read_byte(p++);
+
+    if (clip_x_begin < clip_x_end)
+    {
+        MF_RLEFONT_DECODER(decode_glyph)(rlefont, p, &dict, x0, y0,
+                                         row_begin, row_end,
+                                         clip_x_begin, clip_x_end,
+                                         callback, state);
+    }
+
+    return width;
+}
+
+#ifdef MF_RLEFONT_GENERIC
+/* These do not depend on the parameters, and are only compiled into the
+ * generic decoder. */
+
+uint8_t mf_rlefont_render_rows(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               mf_char character,
+                               uint8_t row_begin, uint8_t row_end,
+                               mf_pixel_callback_t callback,
+                               void *state)
+{
+    return mf_rlefont_render_glyph((const struct mf_rlefont_s*)font,
+                                   x0, y0, character, row_begin, row_end,
+                                   x0, x0 + font->width, callback, state);
+}
+
+uint8_t mf_rlefont_character_width(const struct mf_font_s *font,
+                                   mf_char character)
+{
+    const uint8_t *p;
+    p = find_glyph((struct mf_rlefont_s*)font, character, 0);
+    if (!p)
+        return 0;
+
+    return pgm_read_byte(p);
+}
+#endif
+
+MF_RLEFONT_ENTRY uint8_t MF_RLEFONT_DECODER(render_character)(
+    const struct mf_font_s *font, int16_t x0, int16_t y0,
+    mf_char character, mf_pixel_callback_t callback, void *state)
+{
+    return MF_RLEFONT_DECODER(render_glyph)(
+        (const struct mf_rlefont_s*)font, x0, y0, character,
+        0, MF_RLEFONT_HEIGHT(font), x0, x0 + MF_RLEFONT_WIDTH(font),
+        callback, state);
+}
+
+MF_RLEFONT_ENTRY uint8_t MF_RLEFONT_DECODER(render_character_clipped)(
+    const struct mf_font_s *font, int16_t x0, int16_t y0,
+    mf_char character, const struct mf_rect_s *clip,
+    mf_pixel_callback_t callback, void *state)
+{
+    uint8_t row_begin, row_end, col_begin, col_end;
+
+    row_begin = clip_to_glyph((int32_t)clip->y - y0, MF_RLEFONT_HEIGHT(font));
+    row_end = clip_to_glyph((int32_t)clip->y + clip->height - y0,
+                            MF_RLEFONT_HEIGHT(font));
+    col_begin = clip_to_glyph((int32_t)clip->x - x0, MF_RLEFONT_WIDTH(font));
+    col_end = clip_to_glyph((int32_t)clip->x + clip->width - x0,
+                            MF_RLEFONT_WIDTH(font));
+
+    /* Nothing visible, only look up the width. */
+    if (row_begin >= row_end)
+        col_end = col_begin;
+
+    return MF_RLEFONT_DECODER(render_glyph)(
+        (const struct mf_rlefont_s*)font, x0, y0, character,
+        row_begin, row_end, x0 + col_begin, x0 + col_end, callback, state);
+}
+
+MF_RLEFONT_ENTRY int16_t MF_RLEFONT_DECODER(render_string)(
+    const struct mf_font_s *font, int16_t x0, int16_t y0,
+    mf_str text, uint16_t count, bool kern, const struct mf_rect_s *clip,
+    mf_pixel_callback_t callback, void *state)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    const struct mf_rlefont_char_range_s *range = 0;
+    struct mf_rlefont_dict_s dict;
+    const uint8_t *p;
+    uint8_t row_begin = 0, row_end = MF_RLEFONT_HEIGHT(font);
+    uint8_t col_begin = 0, col_end = MF_RLEFONT_WIDTH(font);
+    uint8_t width;
+    int16_t x = x0;
+    mf_char c1 = 0, c2;
+
+    /* The rows to decode are the same for the whole run. */
+    if (clip)
+    {
+        row_begin = clip_to_glyph((int32_t)clip->y - y0,
+                                  MF_RLEFONT_HEIGHT(font));
+        row_end = clip_to_glyph((int32_t)clip->y + clip->height - y0,
+                                MF_RLEFONT_HEIGHT(font));
+    }
+
+    while (count--)
+    {
+        c2 = mf_getchar(&text);
+
+        if (c2 == '\t')
+            c2 = ' ';
+
+        if (kern && c1 != 0)
+            x += mf_compute_kerning(font, c1, c2);
+
+        p = find_glyph_near(rlefont, c2, &range, &dict);
+        if (!p)
+            p = find_glyph_near(rlefont, font->fallback_character,
+                                &range, &dict);
+
+        c1 = c2;
+        if (!p)
+            continue;
+
+        width = pgm_read_byte(p++);
+
+        if (clip)
+        {
+            col_begin = clip_to_glyph((int32_t)clip->x - x,
+                                      MF_RLEFONT_WIDTH(font));
+            col_end = clip_to_glyph((int32_t)clip->x + clip->width - x,
+                                    MF_RLEFONT_WIDTH(font));
+        }
+
+        if (row_begin < row_end && col_begin < col_end)
+        {
+            MF_RLEFONT_DECODER(decode_glyph)(rlefont, p, &dict, x, y0,
+                                             row_begin, row_end,
+                                             x + col_begin, x + col_end,
+                                             callback, state);
+        }
+
+        x += width;
+    }
+
+    return x - x0;
+}
+
+#undef MF_RLEFONT_DECODER
+#undef MF_RLEFONT_ENTRY
+#undef MF_RLEFONT_GENERIC
+#undef MF_RLEFONT_RLE_COUNT
+#undef MF_RLEFONT_DICT_COUNT
+#undef MF_RLEFONT_WIDTH
+#undef MF_RLEFONT_HEIGHT
+#undef MF_RLEFONT_RESTART_ROWS
+#undef MF_RLEFONT_BIN_RUNS
+#undef MF_RLEFONT_BIN_START
+
+#undef DICT_START
+#undef REF_FILLZEROS
+#undef RLE_CODEMASK
+#undef RLE_VALMASK
+#undef RLE_ZEROS
+#undef RLE_64ZEROS
+#undef RLE_ONES
+#undef RLE_SHADE
+#undef DICT_START7BIT
+#undef DICT_START6BIT
+#undef DICT_START5BIT
+#undef DICT_START4BIT
+#undef DICT_START3BIT
+#undef DICT_START2BIT
+#undef ESCAPE_START
+#undef DICT_SINGLE_COUNT
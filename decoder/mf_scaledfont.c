@@ -1,28 +1,93 @@
+#define MF_FRAMEBUFFER_INTERNALS
 #include "mf_scaledfont.h"
+#include "mf_framebuffer.h"
+#include "mf_metrics.h"
 
 struct scaled_renderstate
 {
     mf_pixel_callback_t orig_callback;
+    mf_block_callback_t block_callback;
     void *orig_state;
     uint8_t x_scale;
     uint8_t y_scale;
     int16_t x0;
     int16_t y0;
+    const struct mf_rect_s *clip;
 };
 
+/* Write one scaled row. The count is split for the 8-bit count of the pixel
+ * callback. */
+static void write_row(const struct scaled_renderstate *rstate,
+                      int16_t x, int16_t y, uint16_t count, uint8_t alpha)
+{
+    uint8_t n;
+
+    while (count)
+    {
+        n = (count > 255) ? 255 : count;
+        count -= n;
+
+#if MF_USE_FRAMEBUFFER
+        /* Skip the indirect call for the built-in render targets. */
+        if (rstate->orig_callback == mf_framebuffer_callback)
+        {
+            mf_framebuffer_write(rstate->orig_state, x, y, n, alpha);
+            x += n;
+            continue;
+        }
+#endif
+
+        rstate->orig_callback(x, y, n, alpha, rstate->orig_state);
+        x += n;
+    }
+}
+
 static void scaled_pixel_callback(int16_t x, int16_t y, uint8_t count,
                                   uint8_t alpha, void *state)
 {
     struct scaled_renderstate *rstate = state;
-    uint8_t dy;
+    uint8_t dy, dy_begin, dy_end;
+    uint16_t width;
+    int16_t x_end;
 
-    count *= rstate->x_scale;
+    width = (uint16_t)count * rstate->x_scale;
     x = rstate->x0 + x * rstate->x_scale;
     y = rstate->y0 + y * rstate->y_scale;
+    dy_begin = 0;
+    dy_end = rstate->y_scale;
+
+    if (rstate->clip)
+    {
+        const struct mf_rect_s *clip = rstate->clip;
+
+        x_end = x + width;
+        if (x < clip->x)
+            x = clip->x;
+        if (x_end > clip->x + clip->width)
+            x_end = clip->x + clip->width;
+        if (x >= x_end)
+            return;
+        width = x_end - x;
+
+        if (y < clip->y)
+            dy_begin = (clip->y - y < dy_end) ? clip->y - y : dy_end;
+        if (y + dy_end > clip->y + clip->height)
+            dy_end = (clip->y + clip->height > y) ? clip->y + clip->height - y : 0;
+    }
 
-    for (dy = 0; dy < rstate->y_scale; dy++)
+    if (rstate->block_callback)
     {
-        rstate->orig_callback(x, y + dy, count, alpha, rstate->orig_state);
+        if (dy_begin < dy_end)
+        {
+            rstate->block_callback(x, y + dy_begin, width, dy_end - dy_begin,
+                                   alpha, rstate->orig_state);
+        }
+        return;
+    }
+
+    for (dy = dy_begin; dy < dy_end; dy++)
+    {
+        write_row(rstate, x, y + dy, width, alpha);
     }
 }
 
@@ -37,29 +102,108 @@ static uint8_t scaled_character_width(const struct mf_font_s *font,
     return sfont->x_scale * basewidth;
 }
 
-static uint8_t scaled_render_character(const struct mf_font_s *font,
-                                       int16_t x0, int16_t y0,
-                                       mf_char character,
-                                       mf_pixel_callback_t callback,
-                                       void *state)
+/* Convert a coordinate of the clip rectangle relative to the character to
+ * base font pixels, rounding down or up. */
+static int16_t unscale(int32_t pos, uint8_t scale, bool round_up)
 {
-    struct mf_scaledfont_s *sfont = (struct mf_scaledfont_s*)font;
+    if (pos <= 0)
+        return 0;
+    if (round_up)
+        pos += scale - 1;
+    return pos / scale;
+}
+
+/* Render a character of the base font through scaled_pixel_callback.
+ * Either callback or block_callback is used for the output. */
+static uint8_t render_scaled(const struct mf_scaledfont_s *sfont,
+                             int16_t x0, int16_t y0,
+                             mf_char character,
+                             const struct mf_rect_s *clip,
+                             mf_pixel_callback_t callback,
+                             mf_block_callback_t block_callback,
+                             void *state)
+{
+    const struct mf_font_s *basefont = sfont->basefont;
     struct scaled_renderstate rstate;
+    struct mf_rect_s baseclip;
     uint8_t basewidth;
 
     rstate.orig_callback = callback;
+    rstate.block_callback = block_callback;
     rstate.orig_state = state;
     rstate.x_scale = sfont->x_scale;
     rstate.y_scale = sfont->y_scale;
     rstate.x0 = x0;
     rstate.y0 = y0;
+    rstate.clip = clip;
 
-    basewidth = sfont->basefont->render_character(sfont->basefont, 0, 0,
+    /* The base font only has to render the pixels that are at least
+     * partially visible, the rest is clipped in the callback. */
+    if (clip && basefont->render_character_clipped)
+    {
+        baseclip.x = unscale((int32_t)clip->x - x0, sfont->x_scale, false);
+        baseclip.y = unscale((int32_t)clip->y - y0, sfont->y_scale, false);
+        baseclip.width = unscale((int32_t)clip->x + clip->width - x0,
+                                 sfont->x_scale, true) - baseclip.x;
+        baseclip.height = unscale((int32_t)clip->y + clip->height - y0,
+                                  sfont->y_scale, true) - baseclip.y;
+
+        basewidth = basefont->render_character_clipped(basefont, 0, 0,
+                            character, &baseclip, scaled_pixel_callback, &rstate);
+    }
+    else
+    {
+        basewidth = basefont->render_character(basefont, 0, 0,
                             character, scaled_pixel_callback, &rstate);
+    }
 
     return sfont->x_scale * basewidth;
 }
 
+static uint8_t scaled_render_character(const struct mf_font_s *font,
+                                       int16_t x0, int16_t y0,
+                                       mf_char character,
+                                       mf_pixel_callback_t callback,
+                                       void *state)
+{
+    return render_scaled((const struct mf_scaledfont_s*)font, x0, y0,
+                         character, 0, callback, 0, state);
+}
+
+static uint8_t scaled_render_character_clipped(const struct mf_font_s *font,
+                                               int16_t x0, int16_t y0,
+                                               mf_char character,
+                                               const struct mf_rect_s *clip,
+                                               mf_pixel_callback_t callback,
+                                               void *state)
+{
+    return render_scaled((const struct mf_scaledfont_s*)font, x0, y0,
+                         character, clip, callback, 0, state);
+}
+
+uint8_t mf_render_scaled_blocks(const struct mf_scaledfont_s *font,
+                                int16_t x0, int16_t y0,
+                                mf_char character,
+                                const struct mf_rect_s *clip,
+                                mf_block_callback_t callback,
+                                void *state)
+{
+    uint8_t width;
+
+    if (mf_character_clipped(&font->font, x0, y0, clip))
+        return mf_character_width(&font->font, character);
+
+    width = render_scaled(font, x0, y0, character, clip, 0, callback, state);
+
+    if (!width)
+    {
+        width = render_scaled(font, x0, y0, font->font.fallback_character,
+                              clip, 0, callback, state);
+    }
+
+    return width;
+}
+
 void mf_scale_font(struct mf_scaledfont_s *newfont,
                    const struct mf_font_s *basefont,
                    uint8_t x_scale, uint8_t y_scale)
@@ -76,8 +220,14 @@ void mf_scale_font(struct mf_scaledfont_s *newfont,
     newfont->font.line_height *= y_scale;
     newfont->font.character_width = &scaled_character_width;
     newfont->font.render_character = &scaled_render_character;
+    newfont->font.render_character_clipped = &scaled_render_character_clipped;
+    newfont->font.kerning_table = 0; /* The edges would need scaling too. */
+    newfont->font.render_string = 0;
 
     newfont->x_scale = x_scale;
     newfont->y_scale = y_scale;
+
+    /* The cache may have entries for an earlier font at the same address. */
+    mf_clear_metrics_cache();
 }
 
@@ -20,4 +20,36 @@ MF_EXTERN void mf_scale_font(struct mf_scaledfont_s *newfont,
                              const struct mf_font_s *basefont,
                              uint8_t x_scale, uint8_t y_scale);
 
+/* Callback for writing a rectangle of pixels with the same alpha, e.g. with
+ * the fill operation of a display controller.
+ * x, y:    Upper left corner of the rectangle.
+ * width:   Width of the rectangle.
+ * height:  Height of the rectangle.
+ * alpha:   The "opaqueness" of the pixels, 0 for background, 255 for text.
+ * state:   Free variable that was passed to the render function.
+ */
+typedef void (*mf_block_callback_t) (int16_t x, int16_t y,
+                                     uint16_t width, uint8_t height,
+                                     uint8_t alpha, void *state);
+
+/* Render a character of a scaled font as one rectangle per run of the base
+ * font, instead of y_scale rows of pixels. This keeps the number of calls
+ * the same as at the native size.
+ *
+ * font:      Pointer to the scaled font.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * clip:      Area to render to, or NULL to render everything.
+ * callback:  Callback function to write out the rectangles.
+ * state:     Free variable for caller to use (can be NULL).
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_scaled_blocks(const struct mf_scaledfont_s *font,
+                                          int16_t x0, int16_t y0,
+                                          mf_char character,
+                                          const struct mf_rect_s *clip,
+                                          mf_block_callback_t callback,
+                                          void *state);
+
 #endif
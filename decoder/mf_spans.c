@@ -0,0 +1,68 @@
+#include "mf_spans.h"
+
+void mf_span_buffer_init(struct mf_span_buffer_s *buffer,
+                         struct mf_span_s *spans, uint8_t size,
+                         bool per_character,
+                         mf_span_callback_t callback, void *state)
+{
+    buffer->spans = spans;
+    buffer->size = size;
+    buffer->count = 0;
+    buffer->per_character = per_character;
+    buffer->callback = callback;
+    buffer->state = state;
+}
+
+void mf_span_flush(struct mf_span_buffer_s *buffer)
+{
+    if (buffer->count)
+    {
+        buffer->callback(buffer->spans, buffer->count, buffer->state);
+        buffer->count = 0;
+    }
+}
+
+void mf_span_pixel_callback(int16_t x, int16_t y, uint8_t count,
+                            uint8_t alpha, void *state)
+{
+    struct mf_span_buffer_s *buffer = state;
+    struct mf_span_s *span;
+
+    if (buffer->count)
+    {
+        span = &buffer->spans[buffer->count - 1];
+
+        /* Continue the previous span if possible. */
+        if (span->y == y && span->alpha == alpha &&
+            span->x + span->count == x && span->count + count <= 255)
+        {
+            span->count += count;
+            return;
+        }
+
+        if (buffer->count == buffer->size ||
+            (!buffer->per_character && span->y != y))
+        {
+            mf_span_flush(buffer);
+        }
+    }
+
+    span = &buffer->spans[buffer->count++];
+    span->x = x;
+    span->y = y;
+    span->count = count;
+    span->alpha = alpha;
+}
+
+uint8_t mf_render_character_spans(const struct mf_font_s *font,
+                                  int16_t x0, int16_t y0,
+                                  mf_char character,
+                                  const struct mf_rect_s *clip,
+                                  struct mf_span_buffer_s *buffer)
+{
+    uint8_t width;
+    width = mf_render_character_clipped(font, x0, y0, character, clip,
+                                        mf_span_pixel_callback, buffer);
+    mf_span_flush(buffer);
+    return width;
+}
@@ -0,0 +1,84 @@
+/* Collects the pixel runs of a character into a small buffer and delivers
+ * them in batches, either once per row or once per character. This suits
+ * displays where each write has a high fixed cost, e.g. setting the address
+ * window of a SPI-attached TFT controller.
+ */
+
+#ifndef _MF_SPANS_H_
+#define _MF_SPANS_H_
+
+#include "mf_font.h"
+
+/* A single horizontal run of pixels. */
+struct mf_span_s
+{
+    int16_t x;
+    int16_t y;
+    uint8_t count;
+    uint8_t alpha;
+};
+
+/* Callback function that receives a batch of spans.
+ *
+ * spans: Array of spans, in the order they were rendered.
+ * count: Number of spans in the array.
+ * state: Free variable that was passed to mf_span_buffer_init().
+ */
+typedef void (*mf_span_callback_t) (const struct mf_span_s *spans,
+                                    uint8_t count, void *state);
+
+/* State of the span collection. Initialize with mf_span_buffer_init(). */
+struct mf_span_buffer_s
+{
+    struct mf_span_s *spans;
+    uint8_t size;
+    uint8_t count;
+    bool per_character;
+    mf_span_callback_t callback;
+    void *state;
+};
+
+/* Initialize the span buffer.
+ *
+ * buffer:        Span buffer to initialize.
+ * spans:         Storage for the spans, provided by the caller.
+ * size:          Number of spans that fit in the storage, at least 1.
+ * per_character: If false, the spans are delivered once per row, and all
+ *                spans in a batch have the same y. If true, they are
+ *                delivered once per character or when the storage fills up.
+ * callback:      Function to call with the spans.
+ * state:         Free variable for caller to use (can be NULL).
+ */
+MF_EXTERN void mf_span_buffer_init(struct mf_span_buffer_s *buffer,
+                                   struct mf_span_s *spans, uint8_t size,
+                                   bool per_character,
+                                   mf_span_callback_t callback, void *state);
+
+/* Pixel callback that adds the run to the span buffer given as the state.
+ * Adjacent runs with the same alpha are merged. Can be passed to any of the
+ * rendering functions, followed by mf_span_flush() when done.
+ */
+MF_EXTERN void mf_span_pixel_callback(int16_t x, int16_t y, uint8_t count,
+                                      uint8_t alpha, void *state);
+
+/* Deliver any spans that are still in the buffer. */
+MF_EXTERN void mf_span_flush(struct mf_span_buffer_s *buffer);
+
+/* Render a single character through the span buffer, and deliver the last
+ * spans before returning.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * clip:      Area to render to, or NULL to render the whole character.
+ * buffer:    Initialized span buffer.
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_character_spans(const struct mf_font_s *font,
+                                            int16_t x0, int16_t y0,
+                                            mf_char character,
+                                            const struct mf_rect_s *clip,
+                                            struct mf_span_buffer_s *buffer);
+
+#endif
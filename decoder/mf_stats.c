@@ -0,0 +1,18 @@
+#include "mf_stats.h"
+
+#if MF_ENABLE_STATS
+
+struct mf_stats_s mf_stats_counters;
+
+void mf_get_stats(struct mf_stats_s *stats)
+{
+    *stats = mf_stats_counters;
+}
+
+void mf_reset_stats(void)
+{
+    struct mf_stats_s zero = {0};
+    mf_stats_counters = zero;
+}
+
+#endif
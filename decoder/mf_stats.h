@@ -0,0 +1,62 @@
+/* Counters for profiling the decoder on targets where a profiler can not be
+ * used. Enabled by setting MF_ENABLE_STATS in mf_config.h. The decoders
+ * then count the work they do, and the totals can be read with
+ * mf_get_stats(). For example, render a string between mf_reset_stats()
+ * and mf_get_stats() to see what it costs with a given font.
+ *
+ * The counters are global and not protected against concurrent use.
+ */
+
+#ifndef _MF_STATS_H_
+#define _MF_STATS_H_
+
+#include "mf_config.h"
+
+#if MF_ENABLE_STATS
+
+struct mf_stats_s
+{
+    /* Codewords decoded by the rlefont decoder, per type. */
+    uint32_t rle_dictentries;
+    uint32_t ref_dictentries;
+    uint32_t bin_codewords;
+    uint32_t fill_zeros;
+
+    /* Runs of pixels written by the rlefont and bwfont decoders, either
+     * through the pixel callback or directly to a framebuffer. */
+    uint32_t pixel_callbacks;
+
+    /* Glyphs looked up from the character ranges, and the number of ranges
+     * examined while doing so. */
+    uint32_t glyph_lookups;
+    uint32_t range_scans;
+
+    /* Character pairs analyzed by mf_compute_kerning, and the glyphs it
+     * had to render because they were not in a kerning table. */
+    uint32_t kerning_pairs;
+    uint32_t kerning_renders;
+
+    /* Lines passed to the callback by the word wrap, and words measured by
+     * the advanced word wrap algorithm. */
+    uint32_t wordwrap_lines;
+    uint32_t wordwrap_words;
+};
+
+/* The counters, updated by the decoders. Use the functions below instead of
+ * accessing this directly. */
+MF_EXTERN struct mf_stats_s mf_stats_counters;
+
+/* Copy the current values of the counters to stats. */
+MF_EXTERN void mf_get_stats(struct mf_stats_s *stats);
+
+/* Set all the counters to zero. */
+MF_EXTERN void mf_reset_stats(void);
+
+#define MF_STATS_ADD(counter, n) (mf_stats_counters.counter += (n))
+
+#else
+#define mf_reset_stats()
+#define MF_STATS_ADD(counter, n) ((void)0)
+#endif
+
+#endif
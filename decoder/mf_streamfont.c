@@ -0,0 +1,374 @@
+#ifndef MF_RLEFONT_INTERNALS
+#define MF_RLEFONT_INTERNALS
+#endif
+#include "mf_streamfont.h"
+#include "mf_metrics.h"
+#include <string.h>
+
+#if MF_USE_STREAMFONT
+
+/* Layout of the font image. All the values are little endian.
+ *
+ * Header:
+ *    0  4  Magic "MFSF"
+ *    4  1  Image format version, 1
+ *    5  1  Version of the rlefont glyph encoding, 4
+ *    6  8  Width, height, min and max x advance, baseline x and y, line
+ *          height and flags, as in struct mf_font_s
+ *   14  2  Fallback character
+ *   16  1  Restart rows, as in struct mf_rlefont_s
+ *   17  1  Reserved, 0
+ *   18  2  Number of character ranges
+ *   20  2  Number of dictionaries
+ *   22  2  Size of the largest glyph, for the glyph buffer
+ *   24  2  Largest number of entries in a dictionary
+ *   26  2  Size of the largest dictionary data
+ *   28  4  Position of the character range table
+ *   32  4  Position of the dictionary table
+ *   36  4  Position of the font names: full name and short name, both
+ *          terminated by a zero byte
+ *
+ * Character range table, sorted by the first character:
+ *    0  2  First character
+ *    2  2  Number of characters
+ *    4  2  Index of the dictionary
+ *    6  2  Reserved, 0
+ *    8  4  Position of the glyph offsets, count + 1 16-bit values
+ *   12  4  Position of the glyph data that the offsets refer to
+ *
+ * Dictionary table:
+ *    0  2  Number of RLE entries
+ *    2  2  Total number of entries
+ *    4  4  Position of the entry offsets, total + 1 16-bit values
+ *    8  4  Position of the entry data
+ *   12  4  Size of the entry data
+ */
+#define HEADER_SIZE     40
+#define RANGE_SIZE      16
+#define DICT_SIZE       16
+#define IMAGE_VERSION   1
+#define GLYPH_VERSION   4
+
+/* Appended after the glyph data, so that a glyph that is cut short still
+ * ends the decoding. */
+#define REF_FILLZEROS   16
+
+#define NO_DICT         0xFFFF
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+/* Size of the arena for the given header, from the layout used by
+ * mf_streamfont_open. */
+static uint32_t arena_size_for(const uint8_t *header)
+{
+    uint32_t size;
+    size = (uint32_t)RANGE_SIZE * get_le16(header + 18);
+    size += 2 * ((uint32_t)get_le16(header + 24) + 1);
+    size += get_le16(header + 26);
+    size += (uint32_t)get_le16(header + 22) + 1;
+    return size;
+}
+
+static bool read_header(mf_stream_read_t read, void *read_state,
+                        uint8_t *header)
+{
+    if (!read(0, header, HEADER_SIZE, read_state))
+        return false;
+
+    return memcmp(header, "MFSF", 4) == 0 &&
+           header[4] == IMAGE_VERSION &&
+           header[5] == GLYPH_VERSION;
+}
+
+/* Read a zero terminated string, truncated to MF_STREAMFONT_NAME_SIZE.
+ * Returns the position after it. */
+static uint32_t read_name(struct mf_streamfont_s *sfont, uint32_t pos,
+                          char *name)
+{
+    uint8_t i;
+    for (i = 0; i < MF_STREAMFONT_NAME_SIZE; i++)
+    {
+        if (!sfont->read(pos + i, (uint8_t*)name + i, 1, sfont->read_state))
+            name[i] = 0;
+
+        if (!name[i])
+            return pos + i + 1;
+    }
+
+    /* Too long, skip the rest. */
+    name[MF_STREAMFONT_NAME_SIZE - 1] = 0;
+    pos += MF_STREAMFONT_NAME_SIZE;
+    while (sfont->read(pos, (uint8_t*)&i, 1, sfont->read_state) && i)
+        pos++;
+    return pos + 1;
+}
+
+/* Make the given dictionary the one used by the rlefont decoder. */
+static bool load_dictionary(struct mf_streamfont_s *sfont, uint16_t index)
+{
+    uint8_t d[DICT_SIZE];
+    uint16_t i, count, size;
+    uint8_t *p;
+
+    if (sfont->loaded_dict == index)
+        return true;
+
+    sfont->loaded_dict = NO_DICT;
+    if (index >= sfont->dict_count ||
+        !sfont->read(sfont->dicts_offset + (uint32_t)index * DICT_SIZE,
+                     d, DICT_SIZE, sfont->read_state))
+    {
+        return false;
+    }
+
+    count = get_le16(d + 2);
+    size = (uint16_t)get_le32(d + 12);
+    if (count > sfont->dict_entry_capacity ||
+        get_le32(d + 12) > sfont->dict_data_capacity)
+    {
+        return false;
+    }
+
+    p = (uint8_t*)sfont->dictionary_offsets;
+    if (!sfont->read(get_le32(d + 4), p, 2 * (count + 1), sfont->read_state) ||
+        !sfont->read(get_le32(d + 8), sfont->dictionary_data, size,
+                     sfont->read_state))
+    {
+        return false;
+    }
+
+    /* Convert the offsets to the native byte order in place. */
+    for (i = 0; i <= count; i++)
+        sfont->dictionary_offsets[i] = get_le16(p + 2 * i);
+
+    sfont->dictionary.rle_entry_count = get_le16(d);
+    sfont->dictionary.dict_entry_count = count;
+    sfont->loaded_dict = index;
+    return true;
+}
+
+/* Find the range that could contain the character: the last one that
+ * starts at or before it. */
+static const uint8_t *find_range(const struct mf_streamfont_s *sfont,
+                                 mf_char character)
+{
+    uint16_t low = 0, high = sfont->char_range_count, mid;
+
+    while (high - low > 1)
+    {
+        mid = (low + high) / 2;
+        if (get_le16(sfont->ranges + (uint32_t)mid * RANGE_SIZE) <= character)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    return (high > low) ? sfont->ranges + (uint32_t)low * RANGE_SIZE : 0;
+}
+
+/* Read the glyph of the character to the glyph buffer, together with the
+ * dictionary it uses. Returns false if the character is not in the font. */
+static bool load_glyph(struct mf_streamfont_s *sfont, mf_char character)
+{
+    const uint8_t *range;
+    uint8_t offsets[4];
+    uint16_t index, start, end;
+
+    if (sfont->buffered_valid && sfont->buffered_char == character)
+        return true;
+
+    sfont->buffered_valid = false;
+
+    range = find_range(sfont, character);
+    if (!range)
+        return false;
+
+    if (character < get_le16(range))
+        return false;
+    index = character - get_le16(range);
+    if (index >= get_le16(range + 2))
+        return false;
+
+    /* Both ends of the glyph data in one read, then the data itself. */
+    if (!sfont->read(get_le32(range + 8) + 2 * (uint32_t)index, offsets, 4,
+                     sfont->read_state))
+    {
+        return false;
+    }
+
+    start = get_le16(offsets);
+    end = get_le16(offsets + 2);
+    if (end <= start || end - start > sfont->glyph_buffer_size)
+        return false;
+
+    if (!sfont->read(get_le32(range + 12) + start, sfont->glyph_buffer,
+                     end - start, sfont->read_state) ||
+        !load_dictionary(sfont, get_le16(range + 4)))
+    {
+        return false;
+    }
+
+    sfont->glyph_buffer[end - start] = REF_FILLZEROS;
+    sfont->range.first_char = character;
+    sfont->buffered_char = character;
+    sfont->buffered_valid = true;
+    return true;
+}
+
+static uint8_t streamfont_character_width(const struct mf_font_s *font,
+                                          mf_char character)
+{
+    struct mf_streamfont_s *sfont = (struct mf_streamfont_s*)font;
+
+    if (!load_glyph(sfont, character))
+        return 0;
+
+    return mf_rlefont_character_width(&sfont->rlefont.font, character);
+}
+
+static uint8_t streamfont_render_character(const struct mf_font_s *font,
+                                           int16_t x0, int16_t y0,
+                                           mf_char character,
+                                           mf_pixel_callback_t callback,
+                                           void *state)
+{
+    struct mf_streamfont_s *sfont = (struct mf_streamfont_s*)font;
+
+    if (!load_glyph(sfont, character))
+        return 0;
+
+    return mf_rlefont_render_character(&sfont->rlefont.font, x0, y0,
+                                       character, callback, state);
+}
+
+static uint8_t streamfont_render_character_clipped(
+    const struct mf_font_s *font, int16_t x0, int16_t y0, mf_char character,
+    const struct mf_rect_s *clip, mf_pixel_callback_t callback, void *state)
+{
+    struct mf_streamfont_s *sfont = (struct mf_streamfont_s*)font;
+
+    if (!load_glyph(sfont, character))
+        return 0;
+
+    return mf_rlefont_render_character_clipped(&sfont->rlefont.font, x0, y0,
+                                               character, clip, callback,
+                                               state);
+}
+
+uint32_t mf_streamfont_arena_size(mf_stream_read_t read, void *read_state)
+{
+    uint8_t header[HEADER_SIZE];
+
+    if (!read_header(read, read_state, header))
+        return 0;
+
+    return arena_size_for(header);
+}
+
+bool mf_streamfont_open(struct mf_streamfont_s *newfont,
+                        mf_stream_read_t read, void *read_state,
+                        void *arena, uint32_t arena_size)
+{
+    uint8_t header[HEADER_SIZE];
+    struct mf_font_s *font = &newfont->font;
+    uint32_t pos;
+    uint16_t i;
+
+    if (!read_header(read, read_state, header) ||
+        arena_size_for(header) > arena_size)
+    {
+        return false;
+    }
+
+    newfont->read = read;
+    newfont->read_state = read_state;
+    newfont->char_range_count = get_le16(header + 18);
+    newfont->dict_count = get_le16(header + 20);
+    newfont->glyph_buffer_size = get_le16(header + 22);
+    newfont->dict_entry_capacity = get_le16(header + 24);
+    newfont->dict_data_capacity = get_le16(header + 26);
+    newfont->dicts_offset = get_le32(header + 32);
+
+    /* Split the arena, see arena_size_for. */
+    newfont->ranges = arena;
+    pos = (uint32_t)RANGE_SIZE * newfont->char_range_count;
+    newfont->dictionary_offsets = (uint16_t*)(newfont->ranges + pos);
+    pos += 2 * ((uint32_t)newfont->dict_entry_capacity + 1);
+    newfont->dictionary_data = newfont->ranges + pos;
+    pos += newfont->dict_data_capacity;
+    newfont->glyph_buffer = newfont->ranges + pos;
+
+    /* The table can be larger than a single read allows, so it is read
+     * a range at a time. */
+    for (i = 0; i < newfont->char_range_count; i++)
+    {
+        pos = (uint32_t)RANGE_SIZE * i;
+        if (!read(get_le32(header + 28) + pos, newfont->ranges + pos,
+                  RANGE_SIZE, read_state))
+        {
+            return false;
+        }
+    }
+
+    pos = read_name(newfont, get_le32(header + 36), newfont->full_name);
+    read_name(newfont, pos, newfont->short_name);
+
+    font->full_name = newfont->full_name;
+    font->short_name = newfont->short_name;
+    font->width = header[6];
+    font->height = header[7];
+    font->min_x_advance = header[8];
+    font->max_x_advance = header[9];
+    font->baseline_x = (int8_t)header[10];
+    font->baseline_y = header[11];
+    font->line_height = header[12];
+    font->flags = header[13];
+    font->fallback_character = get_le16(header + 14);
+    font->character_width = &streamfont_character_width;
+    font->render_character = &streamfont_render_character;
+    font->render_character_clipped = &streamfont_render_character_clipped;
+    font->kerning_table = 0;
+    font->render_string = 0;
+
+    /* The rlefont decoder sees a font with just the buffered glyph. */
+    newfont->glyph_offset = 0;
+    newfont->dictionary.dictionary_data = newfont->dictionary_data;
+    newfont->dictionary.dictionary_offsets = newfont->dictionary_offsets;
+    newfont->dictionary.rle_entry_count = 0;
+    newfont->dictionary.dict_entry_count = 0;
+    newfont->range.first_char = 0;
+    newfont->range.char_count = 1;
+    newfont->range.glyph_offsets = &newfont->glyph_offset;
+    newfont->range.glyph_data = newfont->glyph_buffer;
+    newfont->range.dictionary = &newfont->dictionary;
+    newfont->range.glyph_bases = 0;
+    newfont->range.glyph_deltas = 0;
+    newfont->range.group_shift = 0;
+
+    newfont->rlefont.font = *font;
+    newfont->rlefont.version = header[5];
+    newfont->rlefont.dictionary_data = newfont->dictionary_data;
+    newfont->rlefont.dictionary_offsets = newfont->dictionary_offsets;
+    newfont->rlefont.rle_entry_count = 0;
+    newfont->rlefont.dict_entry_count = 0;
+    newfont->rlefont.char_range_count = 1;
+    newfont->rlefont.char_ranges = &newfont->range;
+    newfont->rlefont.restart_rows = header[16];
+
+    newfont->loaded_dict = NO_DICT;
+    newfont->buffered_valid = false;
+
+    /* The structure may be reused for a different image. */
+    mf_clear_metrics_cache();
+    return true;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/* Fonts that are stored outside of the addressable memory, such as in an
+ * external SPI flash or on a SD card. The font is exported as a binary image
+ * with 'mcufont rlefont_export_blob', and the decoder reads it through a
+ * callback. Only the header and the character range table are kept in RAM,
+ * and each glyph is fetched in one read just before it is rendered.
+ */
+
+#ifndef _MF_STREAMFONT_H_
+#define _MF_STREAMFONT_H_
+
+#include "mf_font.h"
+#include "mf_rlefont.h"
+
+/* Version of the binary image format that is supported. */
+#define MF_STREAMFONT_VERSION_1_SUPPORTED 1
+
+/* Maximum length of the stored font names, including the terminator.
+ * Longer names are truncated. */
+#define MF_STREAMFONT_NAME_SIZE 32
+
+/* Callback for reading from the font image.
+ *
+ * offset: Position in the image to read from.
+ * buffer: Memory to store the data to.
+ * length: Number of bytes to read.
+ * state:  Free variable that was passed to mf_streamfont_open.
+ *
+ * Returns true if all the bytes were read.
+ */
+typedef bool (*mf_stream_read_t)(uint32_t offset, uint8_t *buffer,
+                                 uint16_t length, void *state);
+
+struct mf_streamfont_s
+{
+    struct mf_font_s font;
+
+    mf_stream_read_t read;
+    void *read_state;
+
+    char full_name[MF_STREAMFONT_NAME_SIZE];
+    char short_name[MF_STREAMFONT_NAME_SIZE];
+
+    /* Memory area supplied by the caller. It holds the character range
+     * table of the image, the dictionary that is currently loaded and the
+     * data of the last glyph that was read. */
+    uint8_t *ranges;
+    uint16_t *dictionary_offsets;
+    uint8_t *dictionary_data;
+    uint8_t *glyph_buffer;
+
+    /* Sizes of the buffers, from the image header. */
+    uint16_t glyph_buffer_size;
+    uint16_t dict_entry_capacity;
+    uint16_t dict_data_capacity;
+
+    uint16_t char_range_count;
+    uint16_t dict_count;
+    uint32_t dicts_offset;
+
+    /* Index of the loaded dictionary, or 0xFFFF if none. */
+    uint16_t loaded_dict;
+
+    /* Character in glyph_buffer, so that rendering a character right after
+     * asking its width does not read it again. */
+    mf_char buffered_char;
+    bool buffered_valid;
+
+    /* Font structure for the rlefont decoder, with a single character range
+     * that points to the glyph buffer. */
+    struct mf_rlefont_s rlefont;
+    struct mf_rlefont_char_range_s range;
+    struct mf_rlefont_dict_s dictionary;
+    uint16_t glyph_offset;
+};
+
+/* Open a font image through the read callback.
+ *
+ * newfont:    Font structure to initialize.
+ * read:       Callback for reading the image.
+ * read_state: Free variable for the callback (can be NULL).
+ * arena:      Memory for the tables, aligned as for a uint16_t. Must stay
+ *             valid as long as the font is used.
+ * arena_size: Size of the arena in bytes. The exporter prints the size
+ *             that the image needs.
+ *
+ * Returns false if the image could not be read, is not in a supported
+ * format, or does not fit in the arena.
+ */
+MF_EXTERN bool mf_streamfont_open(struct mf_streamfont_s *newfont,
+                                  mf_stream_read_t read, void *read_state,
+                                  void *arena, uint32_t arena_size);
+
+/* Get the size of the arena needed for the image that is read through the
+ * callback, or 0 if the header can not be read. */
+MF_EXTERN uint32_t mf_streamfont_arena_size(mf_stream_read_t read,
+                                            void *read_state);
+
+#endif
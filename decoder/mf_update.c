@@ -0,0 +1,277 @@
+#include "mf_update.h"
+
+/* Extend the rectangle to cover the cell of a character at x, y. */
+static void add_cell(const struct mf_font_s *font, int16_t x, int16_t y,
+                     struct mf_rect_s *dirty)
+{
+    int32_t x_end, y_end;
+
+    if (dirty->width <= 0 || dirty->height <= 0)
+    {
+        dirty->x = x;
+        dirty->y = y;
+        dirty->width = font->width;
+        dirty->height = font->height;
+        return;
+    }
+
+    x_end = (int32_t)dirty->x + dirty->width;
+    y_end = (int32_t)dirty->y + dirty->height;
+
+    if ((int32_t)x + font->width > x_end)
+        x_end = (int32_t)x + font->width;
+    if ((int32_t)y + font->height > y_end)
+        y_end = (int32_t)y + font->height;
+    if (x < dirty->x)
+        dirty->x = x;
+    if (y < dirty->y)
+        dirty->y = y;
+
+    dirty->width = x_end - dirty->x;
+    dirty->height = y_end - dirty->y;
+}
+
+/* Check if the same character is in the list at the same position. */
+static bool has_glyph(const struct mf_glyph_pos_s *glyphs, uint16_t count,
+                      const struct mf_glyph_pos_s *glyph)
+{
+    while (count--)
+    {
+        if (glyphs->character == glyph->character && glyphs->x == glyph->x)
+            return true;
+        glyphs++;
+    }
+
+    return false;
+}
+
+/* Add the cells of the characters in a that are not in b. */
+static void add_changed(const struct mf_font_s *font, int16_t x0, int16_t y0,
+                        const struct mf_glyph_pos_s *a, uint16_t a_count,
+                        const struct mf_glyph_pos_s *b, uint16_t b_count,
+                        struct mf_rect_s *dirty)
+{
+    while (a_count--)
+    {
+        /* Tab stops are not rendered, they only move the characters. */
+        if (a->character != '\t' && !has_glyph(b, b_count, a))
+            add_cell(font, x0 + a->x, y0, dirty);
+        a++;
+    }
+}
+
+void mf_diff_layout(const struct mf_font_s *font,
+                    int16_t x0, int16_t y0,
+                    const struct mf_glyph_pos_s *old_glyphs,
+                    uint16_t old_count,
+                    const struct mf_glyph_pos_s *new_glyphs,
+                    uint16_t new_count,
+                    struct mf_rect_s *dirty)
+{
+    add_changed(font, x0, y0, old_glyphs, old_count, new_glyphs, new_count,
+                dirty);
+    add_changed(font, x0, y0, new_glyphs, new_count, old_glyphs, old_count,
+                dirty);
+}
+
+struct find_line_s
+{
+    uint16_t index;
+    mf_str line;
+    uint16_t count;
+    bool found;
+};
+
+/* Stops the word wrap at the line that is searched for, after skipping
+ * index lines. */
+static bool find_line_callback(mf_str line, uint16_t count, void *state)
+{
+    struct find_line_s *s = state;
+
+    if (s->index)
+    {
+        s->index--;
+        return true;
+    }
+
+    s->line = line;
+    s->count = count;
+    s->found = true;
+    return false;
+}
+
+struct diff_state_s
+{
+    const struct mf_font_s *font;
+    int16_t x0;
+    int16_t y0;
+    int16_t width;
+    enum mf_align_t align;
+    struct mf_glyph_pos_s *old_glyphs;
+    struct mf_glyph_pos_s *new_glyphs;
+    uint16_t max_glyphs;
+    struct mf_rect_s *dirty;
+
+    /* Word wrap of the old text, kept at or before the line that was
+     * compared last, so that each line of it is wrapped only once. */
+    struct mf_wordwrap_state_s old_wrap;
+
+    /* Index of the next line, and number of lines to skip before it. */
+    uint16_t line;
+    uint16_t skip;
+};
+
+/* Upper edge of a line of the text box. */
+static int16_t line_y(const struct diff_state_s *s)
+{
+    return s->y0 + s->line * s->font->line_height;
+}
+
+/* Compares each line of the new text with the same line of the old text. */
+static bool diff_line_callback(mf_str line, uint16_t count, void *state)
+{
+    struct diff_state_s *s = state;
+    struct find_line_s old_line;
+    uint16_t old_count = 0, new_count;
+
+    old_line.index = s->line - s->old_wrap.line;
+    old_line.found = false;
+    mf_wordwrap_resume(s->font, s->width, &s->old_wrap, find_line_callback,
+                       &old_line);
+
+    if (old_line.found)
+    {
+        old_count = mf_layout_aligned(s->font, s->align,
+                                      old_line.line, old_line.count,
+                                      s->old_glyphs, s->max_glyphs);
+    }
+
+    new_count = mf_layout_aligned(s->font, s->align, line, count,
+                                  s->new_glyphs, s->max_glyphs);
+
+    mf_diff_layout(s->font, s->x0, line_y(s), s->old_glyphs, old_count,
+                   s->new_glyphs, new_count, s->dirty);
+    s->line++;
+    return true;
+}
+
+/* Adds the lines of the old text that are past the end of the new text. */
+static bool removed_line_callback(mf_str line, uint16_t count, void *state)
+{
+    struct diff_state_s *s = state;
+
+    if (s->skip)
+    {
+        s->skip--;
+        return true;
+    }
+
+    count = mf_layout_aligned(s->font, s->align, line, count,
+                              s->old_glyphs, s->max_glyphs);
+    mf_diff_layout(s->font, s->x0, line_y(s), s->old_glyphs, count,
+                   s->new_glyphs, 0, s->dirty);
+    s->line++;
+    return true;
+}
+
+bool mf_diff_text(const struct mf_font_s *font,
+                  int16_t x0, int16_t y0, int16_t width,
+                  enum mf_align_t align,
+                  mf_str old_text, mf_str new_text,
+                  struct mf_glyph_pos_s *glyphs,
+                  uint16_t max_glyphs,
+                  struct mf_rect_s *dirty)
+{
+    struct diff_state_s s;
+
+    dirty->x = x0;
+    dirty->y = y0;
+    dirty->width = 0;
+    dirty->height = 0;
+
+    s.font = font;
+    s.x0 = x0;
+    s.y0 = y0;
+    s.width = width;
+    s.align = align;
+    s.old_glyphs = glyphs;
+    s.new_glyphs = glyphs + max_glyphs;
+    s.max_glyphs = max_glyphs;
+    s.dirty = dirty;
+    s.line = 0;
+    mf_wordwrap_init(&s.old_wrap, old_text);
+
+    mf_wordwrap(font, width, new_text, diff_line_callback, &s);
+
+    s.skip = s.line - s.old_wrap.line;
+    mf_wordwrap_resume(font, width, &s.old_wrap, removed_line_callback, &s);
+
+    return dirty->width > 0 && dirty->height > 0;
+}
+
+struct render_state_s
+{
+    const struct mf_font_s *font;
+    int16_t x0;
+    int16_t y;
+    enum mf_align_t align;
+    struct mf_glyph_pos_s *glyphs;
+    uint16_t max_glyphs;
+    const struct mf_rect_s *dirty;
+    mf_character_callback_t callback;
+    void *state;
+};
+
+/* Renders the part of each line of the new text inside the dirty area. */
+static bool render_line_callback(mf_str line, uint16_t count, void *state)
+{
+    struct render_state_s *s = state;
+
+    /* Lines above the area are not laid out at all. */
+    if ((int32_t)s->y + s->font->height > s->dirty->y)
+    {
+        count = mf_layout_aligned(s->font, s->align, line, count,
+                                  s->glyphs, s->max_glyphs);
+        mf_render_layout(s->font, s->x0, s->y, s->glyphs, count, s->dirty,
+                         s->callback, s->state);
+    }
+
+    s->y += s->font->line_height;
+    return s->y < (int32_t)s->dirty->y + s->dirty->height;
+}
+
+bool mf_update_text(const struct mf_font_s *font,
+                    int16_t x0, int16_t y0, int16_t width,
+                    enum mf_align_t align,
+                    mf_str old_text, mf_str new_text,
+                    struct mf_glyph_pos_s *glyphs,
+                    uint16_t max_glyphs,
+                    mf_clear_callback_t clear,
+                    mf_character_callback_t callback,
+                    void *state,
+                    struct mf_rect_s *dirty)
+{
+    struct render_state_s s;
+
+    if (!mf_diff_text(font, x0, y0, width, align, old_text, new_text,
+                      glyphs, max_glyphs, dirty))
+    {
+        return false;
+    }
+
+    if (clear)
+        clear(dirty, state);
+
+    s.font = font;
+    s.x0 = x0;
+    s.y = y0;
+    s.align = align;
+    s.glyphs = glyphs;
+    s.max_glyphs = max_glyphs;
+    s.dirty = dirty;
+    s.callback = callback;
+    s.state = state;
+    mf_wordwrap(font, width, new_text, render_line_callback, &s);
+
+    return true;
+}
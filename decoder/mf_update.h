@@ -0,0 +1,100 @@
+/* Partial updates of text on displays that are slow to write to, such as
+ * e-paper and SPI LCDs. The old and the new text are laid out the same way
+ * as mf_render_aligned would render them, and only the character cells that
+ * changed, including neighbours moved by kerning, need to be drawn again.
+ */
+
+#ifndef _MF_UPDATE_H_
+#define _MF_UPDATE_H_
+
+#include "mf_justify.h"
+#include "mf_wordwrap.h"
+
+/* Callback for clearing an area to the background color before the text in
+ * it is drawn again.
+ *
+ * rect:  Area to clear.
+ * state: Free variable that was passed to mf_update_text.
+ */
+typedef void (*mf_clear_callback_t) (const struct mf_rect_s *rect,
+                                     void *state);
+
+/* Compare two laid out versions of a line and extend the dirty rectangle
+ * to cover the cells of the characters that differ. A character is
+ * unchanged if the other version has the same character at the same
+ * position.
+ *
+ * font:      Pointer to the font definition, same as for the layout.
+ * x0:        The x0 of the line, as for mf_render_layout.
+ * y0:        Upper edge of the line.
+ * old_glyphs, old_count: Positions of the characters before the change.
+ * new_glyphs, new_count: Positions of the characters after the change.
+ * dirty:     Area to extend. A width or height of 0 means empty.
+ */
+MF_EXTERN void mf_diff_layout(const struct mf_font_s *font,
+                              int16_t x0, int16_t y0,
+                              const struct mf_glyph_pos_s *old_glyphs,
+                              uint16_t old_count,
+                              const struct mf_glyph_pos_s *new_glyphs,
+                              uint16_t new_count,
+                              struct mf_rect_s *dirty);
+
+/* Find the area that changes when a word wrapped text box is changed from
+ * old_text to new_text. The lines are wrapped with mf_wordwrap and aligned
+ * like mf_render_aligned does, starting at y0 and advancing by the line
+ * height of the font. The old text is wrapped along with the new text, so
+ * both are read only once, except for the lines near the end of the old
+ * text. There the word wrap may have to read ahead to the end of the
+ * string, and the last lines are wrapped again for each line of the new
+ * text.
+ *
+ * font:       Pointer to the font definition.
+ * x0:         Depending on align, either left, center or right edge of the
+ *             lines, as for mf_render_aligned.
+ * y0:         Upper edge of the text box.
+ * width:      Maximum line width for the word wrap.
+ * align:      Type of alignment.
+ * old_text:   The text currently on the display.
+ * new_text:   The text to display.
+ * glyphs:     Work area of 2 * max_glyphs positions.
+ * max_glyphs: Maximum number of characters on a line. Longer lines are
+ *             truncated.
+ * dirty:      Set to the area that must be drawn again.
+ *
+ * Returns false if nothing changed.
+ */
+MF_EXTERN bool mf_diff_text(const struct mf_font_s *font,
+                            int16_t x0, int16_t y0, int16_t width,
+                            enum mf_align_t align,
+                            mf_str old_text, mf_str new_text,
+                            struct mf_glyph_pos_s *glyphs,
+                            uint16_t max_glyphs,
+                            struct mf_rect_s *dirty);
+
+/* Update a text box from old_text to new_text. Finds the dirty area with
+ * mf_diff_text, clears it and draws the new text inside it only. The dirty
+ * rectangle is stored before the area is cleared, so the callbacks can use
+ * it to clip what they draw.
+ *
+ * clear:      Callback to clear the dirty area, or NULL if the caller
+ *             handles that.
+ * callback:   Callback to render each character. It must only draw the
+ *             pixels inside the dirty area, e.g. with
+ *             mf_render_character_clipped.
+ * state:      Free variable for use in the callbacks.
+ * Other parameters are the same as for mf_diff_text.
+ *
+ * Returns false if nothing changed, and nothing was drawn.
+ */
+MF_EXTERN bool mf_update_text(const struct mf_font_s *font,
+                              int16_t x0, int16_t y0, int16_t width,
+                              enum mf_align_t align,
+                              mf_str old_text, mf_str new_text,
+                              struct mf_glyph_pos_s *glyphs,
+                              uint16_t max_glyphs,
+                              mf_clear_callback_t clear,
+                              mf_character_callback_t callback,
+                              void *state,
+                              struct mf_rect_s *dirty);
+
+#endif
@@ -1,4 +1,5 @@
 #include "mf_wordwrap.h"
+#include "mf_stats.h"
 
 /* Returns true if the line can be broken at this character. */
 static bool is_wrap_space(uint16_t c)
@@ -8,22 +9,16 @@ static bool is_wrap_space(uint16_t c)
 
 #if MF_USE_ADVANCED_WORDWRAP
 
-/* Represents a single word and the whitespace after it. */
-struct wordlen_s
-{
-    int16_t word; /* Length of the word in pixels. */
-    int16_t space; /* Length of the whitespace in pixels. */
-    uint16_t chars; /* Number of characters in word + space, combined. */
-};
-
 /* Take the next word from the string and compute its width.
  * Returns true if the word ends in a linebreak. */
 static bool get_wordlen(const struct mf_font_s *font, mf_str *text,
-                        struct wordlen_s *result)
+                        struct mf_wordlen_s *result)
 {
     mf_char c;
     mf_str prev = *text;
 
+    MF_STATS_ADD(wordwrap_words, 1);
+
     result->word = 0;
     result->space = 0;
     result->chars = 0;
@@ -63,24 +58,13 @@ static bool get_wordlen(const struct mf_font_s *font, mf_str *text,
     return (c == '\0' || c == '\n');
 }
 
-/* Represents the rendered length for a single line. */
-struct linelen_s
-{
-    mf_str start; /* Start of the text for line. */
-    uint16_t chars; /* Total number of characters on the line. */
-    int16_t width; /* Total length of all words + whitespace on the line in pixels. */
-    bool linebreak; /* True if line ends in a linebreak */
-    struct wordlen_s last_word; /* Last word on the line. */
-    struct wordlen_s last_word_2; /* Second to last word on the line. */
-};
-
 /* Append word onto the line if it fits. If it would overflow, don't add and
  * return false. */
 static bool append_word(const struct mf_font_s *font, int16_t width,
-                        struct linelen_s *current, mf_str *text)
+                        struct mf_linelen_s *current, mf_str *text)
 {
     mf_str tmp = *text;
-    struct wordlen_s wordlen;
+    struct mf_wordlen_s wordlen;
     bool linebreak;
 
     linebreak = get_wordlen(font, &tmp, &wordlen);
@@ -103,7 +87,7 @@ static bool append_word(const struct mf_font_s *font, int16_t width,
 
 /* Append a character to the line if it fits. */
 static bool append_char(const struct mf_font_s *font, int16_t width,
-                        struct linelen_s *current, mf_str *text)
+                        struct mf_linelen_s *current, mf_str *text)
 {
     mf_str tmp = *text;
     mf_char c;
@@ -130,7 +114,7 @@ static int32_t sq16(int16_t x) { return (int32_t)x * x; }
 
 /* Try to balance the lines by potentially moving one word from the previous
  * line to the the current one. */
-static void tune_lines(struct linelen_s *current, struct linelen_s *previous,
+static void tune_lines(struct mf_linelen_s *current, struct mf_linelen_s *previous,
                        int16_t max_width)
 {
     int16_t curw1, prevw1;
@@ -165,14 +149,48 @@ static void tune_lines(struct linelen_s *current, struct linelen_s *previous,
     }
 }
 
-void mf_wordwrap(const struct mf_font_s *font, int16_t width,
-                 mf_str text, mf_line_callback_t callback, void *state)
+/* Check that the first word of the text and the whitespace after it end
+ * before the end of the string, i.e. that get_wordlen would give the same
+ * result even if more text was appended. */
+static bool word_complete(mf_str text)
 {
-    struct linelen_s current = { 0 };
-    struct linelen_s previous = { 0 };
-    bool full;
+    mf_char c;
+
+    c = mf_getchar(&text);
+    while (c && !is_wrap_space(c))
+        c = mf_getchar(&text);
 
-    current.start = text;
+    while (c && is_wrap_space(c))
+    {
+        if (c == '\n')
+            return true;
+
+        c = mf_getchar(&text);
+    }
+
+    return c != 0;
+}
+
+void mf_wordwrap_init(struct mf_wordwrap_state_s *wrap, mf_str text)
+{
+    struct mf_linelen_s empty = { 0 };
+
+    wrap->text = text;
+    wrap->line = 0;
+    wrap->current = empty;
+    wrap->current.start = text;
+    wrap->previous = empty;
+}
+
+void mf_wordwrap_resume(const struct mf_font_s *font, int16_t width,
+                        struct mf_wordwrap_state_s *wrap,
+                        mf_line_callback_t callback, void *state)
+{
+    struct mf_linelen_s current = wrap->current;
+    struct mf_linelen_s previous = wrap->previous;
+    mf_str text = wrap->text;
+    uint16_t line = wrap->line;
+    bool full;
 
     while (*text)
     {
@@ -193,6 +211,8 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
                 if (!previous.linebreak && !current.linebreak)
                     tune_lines(&current, &previous, width);
 
+                line++;
+                MF_STATS_ADD(wordwrap_lines, 1);
                 if (!callback(previous.start, previous.chars, state))
                     return;
             }
@@ -205,27 +225,50 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
             current.last_word.word = 0;
             current.last_word.space = 0;
             current.last_word.chars = 0;
+
+            /* The lines so far can not change when text is appended, unless
+             * the reading went up to the end of the string. */
+            if (*text && (previous.linebreak || word_complete(text)))
+            {
+                wrap->text = text;
+                wrap->line = line;
+                wrap->current = current;
+                wrap->previous = previous;
+            }
         }
     }
 
     /* Dispatch the last lines. */
     if (previous.chars)
     {
+        MF_STATS_ADD(wordwrap_lines, 1);
         if (!callback(previous.start, previous.chars, state))
             return;
     }
 
     if (current.chars)
+    {
+        MF_STATS_ADD(wordwrap_lines, 1);
         callback(current.start, current.chars, state);
+    }
 }
 
 #else
 
-void mf_wordwrap(const struct mf_font_s *font, int16_t width,
-                 mf_str text, mf_line_callback_t callback, void *state)
+void mf_wordwrap_init(struct mf_wordwrap_state_s *wrap, mf_str text)
 {
-    mf_str orig = text;
+    wrap->text = text;
+    wrap->line = 0;
+}
+
+void mf_wordwrap_resume(const struct mf_font_s *font, int16_t width,
+                        struct mf_wordwrap_state_s *wrap,
+                        mf_line_callback_t callback, void *state)
+{
+    mf_str text = wrap->text;
     mf_str linestart;
+    uint16_t line = wrap->line;
+    bool stable;
 
     /* Current line width and character count */
     int16_t lw_cur = 0, cc_cur = 0;
@@ -240,6 +283,7 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
     {
         cc_prev = 0;
         ls_prev = text;
+        stable = false;
 
         while (*text)
         {
@@ -255,12 +299,14 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
             {
                 cc_prev = cc_cur + 1;
                 ls_prev = text;
+                stable = true;
                 break;
             }
 
             if (new_width > width)
             {
                 text = tmp;
+                stable = true;
                 break;
             }
 
@@ -281,6 +327,8 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
             ls_prev = text;
         }
 
+        line++;
+        MF_STATS_ADD(wordwrap_lines, 1);
         if (!callback(linestart, cc_prev, state))
             return;
 
@@ -288,7 +336,24 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
         text = linestart;
         lw_cur = 0;
         cc_cur = 0;
+
+        /* The line did not reach the end of the string, so appending text
+         * can not change it. */
+        if (stable && *text)
+        {
+            wrap->text = text;
+            wrap->line = line;
+        }
     }
 }
 
 #endif
+
+void mf_wordwrap(const struct mf_font_s *font, int16_t width,
+                 mf_str text, mf_line_callback_t callback, void *state)
+{
+    struct mf_wordwrap_state_s wrap;
+
+    mf_wordwrap_init(&wrap, text);
+    mf_wordwrap_resume(font, width, &wrap, callback, state);
+}
@@ -29,4 +29,66 @@ typedef bool (*mf_line_callback_t) (mf_str line, uint16_t count,
 MF_EXTERN void mf_wordwrap(const struct mf_font_s *font, int16_t width,
                            mf_str text, mf_line_callback_t callback, void *state);
 
+#if MF_USE_ADVANCED_WORDWRAP
+/* Represents a single word and the whitespace after it. */
+struct mf_wordlen_s
+{
+    int16_t word; /* Length of the word in pixels. */
+    int16_t space; /* Length of the whitespace in pixels. */
+    uint16_t chars; /* Number of characters in word + space, combined. */
+};
+
+/* Represents the rendered length for a single line. */
+struct mf_linelen_s
+{
+    mf_str start; /* Start of the text for line. */
+    uint16_t chars; /* Total number of characters on the line. */
+    int16_t width; /* Total length of all words + whitespace on the line in pixels. */
+    bool linebreak; /* True if line ends in a linebreak */
+    struct mf_wordlen_s last_word; /* Last word on the line. */
+    struct mf_wordlen_s last_word_2; /* Second to last word on the line. */
+};
+#endif
+
+/* State for word wrapping text that grows at the end, such as a log console
+ * or a text field being typed into. Stores the last line break that can not
+ * be affected by appending more text, so that the word wrap can continue
+ * from there instead of from the start of the text. */
+struct mf_wordwrap_state_s
+{
+    mf_str text; /* Position to continue reading the text from. */
+    uint16_t line; /* Index of the next line to be dispatched. */
+#if MF_USE_ADVANCED_WORDWRAP
+    struct mf_linelen_s current; /* Line being collected at text. */
+    struct mf_linelen_s previous; /* Line waiting to be dispatched. */
+#endif
+};
+
+/* Initialize the state for word wrapping text from the beginning.
+ *
+ * wrap:  State to initialize.
+ * text:  Pointer to the start of the text to process.
+ */
+MF_EXTERN void mf_wordwrap_init(struct mf_wordwrap_state_s *wrap,
+                                mf_str text);
+
+/* Continue word wrapping from the last stable line break stored in the
+ * state. Calls the callback for that line and every line after it, giving
+ * the same lines as mf_wordwrap would from the start. The value of
+ * wrap->line before the call is the index of the first line dispatched.
+ * Afterwards the state is updated to the last stable line break.
+ *
+ * The text before the end of the string must not change between the calls,
+ * and neither may the font or the width. After other edits, start again
+ * from mf_wordwrap_init.
+ *
+ * font:  Font to use for metrics.
+ * width: Maximum line width in pixels.
+ * wrap:  State from mf_wordwrap_init or an earlier call.
+ * state: Free variable for caller to use (can be NULL).
+ */
+MF_EXTERN void mf_wordwrap_resume(const struct mf_font_s *font, int16_t width,
+                                  struct mf_wordwrap_state_s *wrap,
+                                  mf_line_callback_t callback, void *state);
+
 #endif
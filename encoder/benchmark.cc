@@ -0,0 +1,284 @@
+// Benchmark for the encoder and the optimizer. Imports the given fonts and
+// measures the time and memory allocations taken by the steps of the rlefont
+// compression, to compare changes of the algorithms between builds.
+
+#include "datafile.hh"
+#include "bdf_import.hh"
+#include "freetype_import.hh"
+#include "encode_rlefont.hh"
+#include "optimize_rlefont.hh"
+#include "threadpool.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "ccfixes.hh"
+
+using namespace mcufont;
+
+// Count all the allocations done through operator new, on any thread.
+static std::atomic<size_t> g_alloc_count(0);
+static std::atomic<size_t> g_alloc_bytes(0);
+
+void *operator new(size_t size)
+{
+    g_alloc_count++;
+    g_alloc_bytes += size;
+
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+struct measurement_t
+{
+    size_t rounds;
+    double wall;    // Seconds per round
+    double cpu;     // CPU seconds per round, summed over all threads
+    double allocs;  // Allocations per round
+    double bytes;   // Allocated bytes per round
+};
+
+// Run func repeatedly until at least min_time seconds have passed.
+static measurement_t measure(const std::function<void()> &func, double min_time)
+{
+    typedef std::chrono::steady_clock clock;
+    size_t allocs = g_alloc_count, bytes = g_alloc_bytes;
+    std::clock_t cpu = std::clock();
+    clock::time_point start = clock::now();
+
+    measurement_t m = {};
+    std::chrono::duration<double> elapsed;
+    do
+    {
+        func();
+        m.rounds++;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < min_time);
+
+    m.wall = elapsed.count() / m.rounds;
+    m.cpu = (double)(std::clock() - cpu) / CLOCKS_PER_SEC / m.rounds;
+    m.allocs = (double)(g_alloc_count - allocs) / m.rounds;
+    m.bytes = (double)(g_alloc_bytes - bytes) / m.rounds;
+    return m;
+}
+
+static void print_header()
+{
+    std::cout << std::left << std::setw(24) << "Font"
+              << std::setw(16) << "Step" << std::right
+              << std::setw(10) << "wall ms"
+              << std::setw(10) << "cpu ms"
+              << std::setw(10) << "allocs"
+              << std::setw(10) << "alloc kB"
+              << std::setw(10) << "saved B"
+              << std::setw(12) << "B/cpu-s" << std::endl;
+}
+
+// Print one result. Saved is the number of bytes that the step reduced the
+// encoded size by, or negative if the step does not change the size.
+static void print_result(const std::string &font, const std::string &step,
+                         const measurement_t &m, int saved = -1)
+{
+    std::cout << std::left << std::setw(24) << font
+              << std::setw(16) << step << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << m.wall * 1000
+              << std::setw(10) << m.cpu * 1000
+              << std::setprecision(0)
+              << std::setw(10) << m.allocs
+              << std::setw(10) << m.bytes / 1024;
+
+    if (saved >= 0)
+    {
+        std::cout << std::setw(10) << saved << std::setw(12)
+                  << (m.cpu > 0 ? saved / m.cpu : 0);
+    }
+
+    std::cout << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// Run all the steps on a single imported font.
+static void benchmark_font(const std::string &name, DataFile &f,
+                           ThreadPool &pool, size_t iterations,
+                           double min_time,
+                           const rlefont::optimize_options_t &options)
+{
+    measurement_t m;
+    rlefont::tree_layout_t layout = options.tree_layout;
+
+    m = measure([&]() { rlefont::encode_font(f, true, nullptr, layout); },
+                min_time);
+    print_result(name, "encode_fast", m);
+
+    m = measure([&]() { rlefont::encode_font(f, false, nullptr, layout); },
+                min_time);
+    print_result(name, "encode_slow", m);
+
+    m = measure([&]() { rlefont::get_encoded_size(f, true, layout); },
+                min_time);
+    print_result(name, "encoded_size", m);
+
+    // The remaining steps modify the font, so they are run only once, in
+    // the same order as rlefont_optimize does.
+    size_t oldsize = rlefont::get_encoded_size(f);
+    m = measure([&]() {
+        rlefont::SizeEvaluator eval(f, true, 0, layout);
+        rlefont::update_scores(f, eval, pool, false);
+    }, 0);
+    size_t newsize = rlefont::get_encoded_size(f);
+    print_result(name, "update_scores", m, oldsize - newsize);
+
+    oldsize = newsize;
+    m = measure([&]() { rlefont::optimize(f, pool, options, iterations); }, 0);
+    newsize = rlefont::get_encoded_size(f);
+    print_result(name, "optimize", m, oldsize - newsize);
+}
+
+// Parse a comma separated list of sizes, each optionally followed by "bw".
+static bool parse_sizes(const std::string &value,
+                        std::vector<import_size_t> &sizes)
+{
+    sizes.clear();
+
+    size_t start = 0;
+    while (start < value.size())
+    {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos)
+            end = value.size();
+
+        std::string item = value.substr(start, end - start);
+        size_t pos;
+        int size = std::stoi(item, &pos);
+        std::string suffix = item.substr(pos);
+        if (size <= 0 || (suffix != "" && suffix != "bw"))
+            return false;
+
+        sizes.push_back({size, suffix == "bw"});
+        start = end + 1;
+    }
+
+    return !sizes.empty();
+}
+
+static const char *usage_msg =
+    "Usage: mfbenchmark [options] <fontfile> ...\n"
+    "Imports each .bdf font, and each .ttf font at several sizes, and\n"
+    "measures the rlefont encoder and optimizer on the results.\n"
+    "Options:\n"
+    "   --sizes 12,16,32bw                   Sizes to import .ttf fonts at,\n"
+    "                                        default 12,16.\n"
+    "   --threads N                          Threads for the optimizer, default 4.\n"
+    "   --iterations N                       Iterations of optimize(), default 10.\n"
+    "   --min-time S                         Repeat the encoding steps for at\n"
+    "                                        least S seconds, default 0.5.\n"
+    "   --tree-layout pointers|flat          Layout of the dictionary tree.\n"
+    "";
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> files;
+    std::string sizes_arg = "12,16";
+    size_t threads = 4, iterations = 10;
+    std::string layout_arg = "pointers";
+    double min_time = 0.5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (arg == "--sizes" && has_value)
+            sizes_arg = argv[++i];
+        else if (arg == "--threads" && has_value)
+            threads = std::stoi(argv[++i]);
+        else if (arg == "--iterations" && has_value)
+            iterations = std::stoi(argv[++i]);
+        else if (arg == "--min-time" && has_value)
+            min_time = std::stod(argv[++i]);
+        else if (arg == "--tree-layout" && has_value)
+            layout_arg = argv[++i];
+        else if (arg.size() > 0 && arg[0] != '-')
+            files.push_back(arg);
+        else
+        {
+            files.clear();
+            break;
+        }
+    }
+
+    rlefont::optimize_options_t options;
+    if (layout_arg == "flat")
+        options.tree_layout = rlefont::TREE_FLAT;
+
+    std::vector<import_size_t> sizes;
+    if (files.empty() || !parse_sizes(sizes_arg, sizes) ||
+        (layout_arg != "flat" && layout_arg != "pointers"))
+    {
+        std::cout << usage_msg << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    std::cout << "Using " << pool.GetThreadCount() << " threads, "
+              << iterations << " iterations per optimize()" << std::endl;
+    print_header();
+
+    for (const std::string &file : files)
+    {
+        std::ifstream infile(file, std::ios::binary);
+        if (!infile.good())
+        {
+            std::cerr << "Could not open " << file << std::endl;
+            return 2;
+        }
+
+        std::string base = file.substr(file.find_last_of('/') + 1);
+        base = base.substr(0, base.find_last_of('.'));
+        bool bdf = (file.size() >= 4 && file.substr(file.size() - 4) == ".bdf");
+
+        std::vector<std::string> names;
+        std::vector<std::unique_ptr<DataFile> > fonts;
+        if (bdf)
+        {
+            names.push_back(base);
+            fonts.push_back(LoadBDF(infile));
+        }
+        else
+        {
+            for (const import_size_t &s : sizes)
+                names.push_back(base + std::to_string(s.size) + (s.bw ? "bw" : ""));
+            fonts = LoadFreetype(infile, sizes, &pool);
+        }
+
+        for (size_t i = 0; i < fonts.size(); i++)
+        {
+            if (!fonts.at(i))
+            {
+                std::cerr << "Could not import " << file << std::endl;
+                return 2;
+            }
+
+            rlefont::init_dictionary(*fonts.at(i));
+            benchmark_font(names.at(i), *fonts.at(i), pool, iterations,
+                           min_time, options);
+        }
+    }
+
+    return 0;
+}
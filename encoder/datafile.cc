@@ -5,14 +5,108 @@
 #include <stdexcept>
 #include "ccfixes.hh"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define DATAFILE_FORMAT_VERSION 1
 
 namespace mcufont {
 
+// Convert the hex digits at the start of [p, end) to pixel values, stopping
+// at the first other character. Returns a pointer to that character.
+static const char *parse_pixels(const char *p, const char *end,
+                                DataFile::pixels_t &result)
+{
+    result.clear();
+    result.reserve(end - p);
+
+#if defined(__SSE2__)
+    // 16 digits at a time, until a block contains something else.
+    const __m128i below_0 = _mm_set1_epi8('0' - 1);
+    const __m128i above_9 = _mm_set1_epi8('9' + 1);
+    const __m128i below_A = _mm_set1_epi8('A' - 1);
+    const __m128i above_F = _mm_set1_epi8('F' + 1);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i letter_gap = _mm_set1_epi8('A' - '9' - 1);
+
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)p);
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, below_0),
+                                      _mm_cmplt_epi8(c, above_9));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(c, below_A),
+                                       _mm_cmplt_epi8(c, above_F));
+        if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xFFFF)
+            break;
+
+        __m128i v = _mm_sub_epi8(_mm_sub_epi8(c, zero),
+                                 _mm_and_si128(letter, letter_gap));
+        size_t pos = result.size();
+        result.resize(pos + 16);
+        _mm_storeu_si128((__m128i*)&result[pos], v);
+        p += 16;
+    }
+#endif
+
+    for (; p != end; p++)
+    {
+        if (*p >= '0' && *p <= '9')
+            result.push_back(*p - '0');
+        else if (*p >= 'A' && *p <= 'F')
+            result.push_back(*p - 'A' + 10);
+        else
+            break;
+    }
+
+    return p;
+}
+
+// Append the pixels to text as hex digits.
+static void format_pixels(const DataFile::pixels_t &pixels, std::string &text)
+{
+    size_t pos = text.size();
+    size_t count = pixels.size();
+    size_t i = 0;
+    text.resize(pos + count);
+
+#if defined(__SSE2__)
+    const __m128i fifteen = _mm_set1_epi8(15);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i letter_gap = _mm_set1_epi8('A' - '9' - 1);
+
+    for (; i + 16 <= count; i += 16)
+    {
+        // Invalid values are left for the scalar loop to report.
+        __m128i v = _mm_loadu_si128((const __m128i*)&pixels[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, fifteen), v)) != 0xFFFF)
+            break;
+
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(v, nine), letter_gap);
+        _mm_storeu_si128((__m128i*)&text[pos + i],
+                         _mm_add_epi8(_mm_add_epi8(v, zero), letter));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        uint8_t p = pixels[i];
+        if (p <= 9)
+            text[pos + i] = (char)(p + '0');
+        else if (p <= 15)
+            text[pos + i] = (char)(p - 10 + 'A');
+        else
+            throw std::logic_error("invalid pixel alpha: " + std::to_string(p));
+    }
+}
+
 DataFile::DataFile(const std::vector<dictentry_t> &dictionary,
                    const std::vector<glyphentry_t> &glyphs,
                    const fontinfo_t &fontinfo):
-    m_dictionary(dictionary), m_glyphtable(glyphs), m_fontinfo(fontinfo)
+    m_dictionary(dictionary),
+    m_glyphtable(std::make_shared<const std::vector<glyphentry_t> >(glyphs)),
+    m_fontinfo(fontinfo), m_seed(1234)
 {
     dictentry_t dummy = {};
     while (m_dictionary.size() < dictionarysize)
@@ -33,42 +127,369 @@ void DataFile::Save(std::ostream &file) const
     file << "Flags " << m_fontinfo.flags << std::endl;
     file << "RandomSeed " << m_seed << std::endl;
 
+    if (m_dictionary.size() != dictionarysize)
+        file << "DictSize " << m_dictionary.size() << std::endl;
+
+    // The records are collected into one buffer, as the pixel data makes up
+    // most of the file.
+    std::string text;
     for (const dictentry_t &d : m_dictionary)
     {
         if (d.replacement.size() != 0)
         {
-            file << "DictEntry " << d.score << " ";
-            file << d.ref_encode << " " << d.replacement << std::endl;
+            text += "DictEntry " + std::to_string(d.score) + " ";
+            text += std::to_string((int)d.ref_encode) + " ";
+            format_pixels(d.replacement, text);
+            text += '\n';
         }
     }
 
-    for (const glyphentry_t &g : m_glyphtable)
+    for (const glyphentry_t &g : *m_glyphtable)
     {
-        file << "Glyph ";
+        text += "Glyph ";
         for (size_t i = 0; i < g.chars.size(); i++)
         {
-            if (i != 0) file << ',';
-            file << g.chars.at(i);
+            if (i != 0) text += ',';
+            text += std::to_string(g.chars.at(i));
         }
-        file << " " << g.width << " " << g.data << std::endl;
+        text += " " + std::to_string(g.width) + " ";
+        format_pixels(g.data, text);
+        text += '\n';
+    }
+
+    file.write(text.data(), text.size());
+    file.flush();
+}
+
+// Binary format. All integers are little-endian 32-bit values and all
+// records are aligned to 4 bytes. Offsets are from the start of the file.
+//
+// Header:
+//   char[8]  BINARY_MAGIC
+//   uint32   format version
+//   int32    max_width, max_height, baseline_x, baseline_y, line_height, flags
+//   uint32   random seed
+//   uint32   offset and length of the font name
+//   uint32   offset and count of the dictionary records
+//   uint32   offset and count of the glyph records
+//   uint32   offset and count of the character codes
+//
+// Dictionary record: int32 score, uint32 ref_encode, uint32 length,
+//                    uint32 offset of the pixels
+// Glyph record:      int32 width, uint32 index and count of its characters,
+//                    uint32 offset of the pixels (max_width * max_height)
+// Character code:    int32
+// Pixels:            one byte per pixel, stored after all the tables.
+static const char BINARY_MAGIC[8] = {'M', 'C', 'U', 'F', 'D', 'A', 'T', 0};
+static const size_t BINARY_HEADER_SIZE = 8 + 4 * 16;
+static const size_t BINARY_RECORD_SIZE = 16;
+
+static void put_u32(std::string &buf, size_t pos, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        buf[pos + i] = (char)((value >> (8 * i)) & 0xFF);
+}
+
+static void append_u32(std::string &buf, uint32_t value)
+{
+    buf.resize(buf.size() + 4);
+    put_u32(buf, buf.size() - 4, value);
+}
+
+// Reads values from the binary format, checking that they are in range.
+class BinaryReader
+{
+public:
+    BinaryReader(const std::string &buf): m_buf(buf) {}
+
+    bool Check(size_t pos, size_t length) const
+    {
+        return pos <= m_buf.size() && length <= m_buf.size() - pos;
+    }
+
+    uint32_t U32(size_t pos) const
+    {
+        if (!Check(pos, 4))
+            throw std::out_of_range("binary datafile truncated");
+
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= (uint32_t)(uint8_t)m_buf[pos + i] << (8 * i);
+        return value;
+    }
+
+    int32_t I32(size_t pos) const { return (int32_t)U32(pos); }
+
+    const uint8_t *Bytes(size_t pos, size_t length) const
+    {
+        if (!Check(pos, length))
+            throw std::out_of_range("binary datafile truncated");
+
+        return (const uint8_t*)m_buf.data() + pos;
+    }
+
+    bool Pixels(size_t pos, size_t length, DataFile::pixels_t &result) const
+    {
+        const uint8_t *p = Bytes(pos, length);
+        result.assign(p, p + length);
+        return std::all_of(p, p + length, [](uint8_t v) { return v <= 15; });
+    }
+
+private:
+    const std::string &m_buf;
+};
+
+void DataFile::SaveBinary(std::ostream &file) const
+{
+    // Tables are written first, followed by the name and the pixels.
+    std::string tables;
+    std::string data;
+    size_t chars_count = 0;
+
+    for (const glyphentry_t &g : *m_glyphtable)
+        chars_count += g.chars.size();
+
+    size_t dict_offset = BINARY_HEADER_SIZE;
+    size_t glyph_offset = dict_offset + m_dictionary.size() * BINARY_RECORD_SIZE;
+    size_t chars_offset = glyph_offset + m_glyphtable->size() * BINARY_RECORD_SIZE;
+    size_t data_offset = chars_offset + chars_count * 4;
+
+    size_t name_offset = data_offset + data.size();
+    data += m_fontinfo.name;
+
+    for (const dictentry_t &d : m_dictionary)
+    {
+        append_u32(tables, d.score);
+        append_u32(tables, d.ref_encode);
+        append_u32(tables, d.replacement.size());
+        append_u32(tables, data_offset + data.size());
+        data.append(d.replacement.begin(), d.replacement.end());
+    }
+
+    size_t chars_index = 0;
+    for (const glyphentry_t &g : *m_glyphtable)
+    {
+        append_u32(tables, g.width);
+        append_u32(tables, chars_index);
+        append_u32(tables, g.chars.size());
+        append_u32(tables, data_offset + data.size());
+        data.append(g.data.begin(), g.data.end());
+        chars_index += g.chars.size();
+    }
+
+    for (const glyphentry_t &g : *m_glyphtable)
+    {
+        for (int c : g.chars)
+            append_u32(tables, c);
     }
+
+    std::string header(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    append_u32(header, DATAFILE_FORMAT_VERSION);
+    append_u32(header, m_fontinfo.max_width);
+    append_u32(header, m_fontinfo.max_height);
+    append_u32(header, m_fontinfo.baseline_x);
+    append_u32(header, m_fontinfo.baseline_y);
+    append_u32(header, m_fontinfo.line_height);
+    append_u32(header, m_fontinfo.flags);
+    append_u32(header, m_seed);
+    append_u32(header, name_offset);
+    append_u32(header, m_fontinfo.name.size());
+    append_u32(header, dict_offset);
+    append_u32(header, m_dictionary.size());
+    append_u32(header, glyph_offset);
+    append_u32(header, m_glyphtable->size());
+    append_u32(header, chars_offset);
+    append_u32(header, chars_count);
+
+    file.write(header.data(), header.size());
+    file.write(tables.data(), tables.size());
+    file.write(data.data(), data.size());
+}
+
+bool DataFile::IsBinary(std::istream &file)
+{
+    char magic[sizeof(BINARY_MAGIC)] = {};
+    std::streampos pos = file.tellg();
+    file.read(magic, sizeof(magic));
+    bool result = file.gcount() == sizeof(magic) &&
+        std::equal(magic, magic + sizeof(magic), BINARY_MAGIC);
+
+    file.clear();
+    file.seekg(pos);
+    return result;
 }
 
 std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
+{
+    if (IsBinary(file))
+        return LoadBinary(file);
+    else
+        return LoadText(file);
+}
+
+std::unique_ptr<DataFile> DataFile::LoadBinary(std::istream &file)
+{
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string buf = contents.str();
+    BinaryReader r(buf);
+
+    try
+    {
+        if (r.U32(8) != DATAFILE_FORMAT_VERSION)
+            return std::unique_ptr<DataFile>(nullptr);
+
+        fontinfo_t fontinfo = {};
+        fontinfo.max_width = r.I32(12);
+        fontinfo.max_height = r.I32(16);
+        fontinfo.baseline_x = r.I32(20);
+        fontinfo.baseline_y = r.I32(24);
+        fontinfo.line_height = r.I32(28);
+        fontinfo.flags = r.I32(32);
+        uint32_t seed = r.U32(36);
+
+        size_t name_length = r.U32(44);
+        fontinfo.name.assign((const char*)r.Bytes(r.U32(40), name_length), name_length);
+
+        size_t dict_offset = r.U32(48);
+        size_t dict_count = r.U32(52);
+        if (dict_count > maxdictionarysize)
+            dict_count = maxdictionarysize;
+        std::vector<dictentry_t> dictionary(dict_count);
+        for (size_t i = 0; i < dict_count; i++)
+        {
+            size_t pos = dict_offset + i * BINARY_RECORD_SIZE;
+            dictentry_t &d = dictionary[i];
+            d.score = r.I32(pos);
+            d.ref_encode = r.U32(pos + 4);
+            if (!r.Pixels(r.U32(pos + 12), r.U32(pos + 8), d.replacement))
+                return std::unique_ptr<DataFile>(nullptr);
+        }
+
+        size_t glyph_offset = r.U32(56);
+        size_t glyph_count = r.U32(60);
+        size_t chars_offset = r.U32(64);
+        size_t chars_count = r.U32(68);
+        size_t glyph_size = fontinfo.max_width * fontinfo.max_height;
+
+        if (!r.Check(glyph_offset, glyph_count * BINARY_RECORD_SIZE))
+            return std::unique_ptr<DataFile>(nullptr);
+
+        std::vector<glyphentry_t> glyphtable(glyph_count);
+        for (size_t i = 0; i < glyph_count; i++)
+        {
+            size_t pos = glyph_offset + i * BINARY_RECORD_SIZE;
+            glyphentry_t &g = glyphtable[i];
+            g.width = r.I32(pos);
+
+            size_t index = r.U32(pos + 4);
+            size_t count = r.U32(pos + 8);
+            if (index > chars_count || count > chars_count - index)
+                return std::unique_ptr<DataFile>(nullptr);
+
+            for (size_t j = 0; j < count; j++)
+                g.chars.push_back(r.I32(chars_offset + (index + j) * 4));
+
+            if (!r.Pixels(r.U32(pos + 12), glyph_size, g.data))
+                return std::unique_ptr<DataFile>(nullptr);
+        }
+
+        std::unique_ptr<DataFile> result(new DataFile(dictionary, glyphtable, fontinfo));
+        result->SetSeed(seed);
+        return result;
+    }
+    catch (std::out_of_range &)
+    {
+        return std::unique_ptr<DataFile>(nullptr);
+    }
+}
+
+// Helpers for parsing the fields of one line of the text format.
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p != end && std::isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char *read_token(const char *p, const char *end, std::string &token)
+{
+    p = skip_space(p, end);
+    const char *start = p;
+    while (p != end && !std::isspace((unsigned char)*p)) p++;
+    token.assign(start, p);
+    return p;
+}
+
+static const char *read_int(const char *p, const char *end, int &value)
+{
+    std::string token;
+    p = read_token(p, end, token);
+    std::istringstream(token) >> value;
+    return p;
+}
+
+std::unique_ptr<DataFile> DataFile::LoadText(std::istream &file)
 {
     fontinfo_t fontinfo = {};
     std::vector<dictentry_t> dictionary;
     std::vector<glyphentry_t> glyphtable;
     uint32_t seed = 1234;
+    size_t dict_size = dictionarysize;
     int version = -1;
 
-    std::string line;
-    while (std::getline(file, line))
+    // The whole file is read at once, and the pixel data is parsed directly
+    // from the buffer.
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string buf = contents.str();
+
+    std::string tag;
+    const char *next = buf.data();
+    const char *buf_end = buf.data() + buf.size();
+    while (next != buf_end)
     {
-        std::istringstream input(line);
-        std::string tag;
+        const char *p = next;
+        const char *end = std::find(p, buf_end, '\n');
+        next = (end == buf_end) ? end : end + 1;
+
+        p = read_token(p, end, tag);
+
+        if (tag == "DictEntry" && dictionary.size() < maxdictionarysize)
+        {
+            dictentry_t d = {};
+            int ref_encode = 0;
+            p = read_int(p, end, d.score);
+            p = read_int(p, end, ref_encode);
+            d.ref_encode = ref_encode;
+            parse_pixels(skip_space(p, end), end, d.replacement);
+            dictionary.push_back(d);
+            continue;
+        }
+
+        if (tag == "Glyph")
+        {
+            glyphentry_t g = {};
+            std::string chars;
+            p = read_token(p, end, chars);
+            p = read_int(p, end, g.width);
+            parse_pixels(skip_space(p, end), end, g.data);
+
+            if ((int)g.data.size() != fontinfo.max_width * fontinfo.max_height)
+                throw std::runtime_error("wrong glyph data length: " + std::to_string(g.data.size()));
+
+            size_t pos = 0;
+            while (pos < chars.size()) {
+                size_t length;
+                g.chars.push_back(std::stoi(chars.substr(pos), &length));
+                pos += length + 1;
+            }
 
-        input >> tag;
+            glyphtable.push_back(g);
+            continue;
+        }
+
+        // The header lines are few, so they are parsed with streams.
+        std::istringstream input(std::string(p, end));
 
         if (tag == "Version")
         {
@@ -107,29 +528,13 @@ std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
         {
             input >> fontinfo.flags;
         }
-        else if (tag == "DictEntry" && dictionary.size() < dictionarysize)
-        {
-            dictentry_t d = {};
-            input >> d.score >> d.ref_encode >> d.replacement;
-            dictionary.push_back(d);
-        }
-        else if (tag == "Glyph")
+        else if (tag == "DictSize")
         {
-            glyphentry_t g = {};
-            std::string chars;
-            input >> chars >> g.width >> g.data;
-
-            if ((int)g.data.size() != fontinfo.max_width * fontinfo.max_height)
-                throw std::runtime_error("wrong glyph data length: " + std::to_string(g.data.size()));
-
-            size_t pos = 0;
-            while (pos < chars.size()) {
-                size_t p;
-                g.chars.push_back(std::stoi(chars.substr(pos), &p));
-                pos += p + 1;
-            }
-
-            glyphtable.push_back(g);
+            input >> dict_size;
+            if (dict_size < dictionarysize)
+                dict_size = dictionarysize;
+            if (dict_size > maxdictionarysize)
+                dict_size = maxdictionarysize;
         }
     }
 
@@ -140,9 +545,21 @@ std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
 
     std::unique_ptr<DataFile> result(new DataFile(dictionary, glyphtable, fontinfo));
     result->SetSeed(seed);
+    if (dict_size > result->GetDictionarySize())
+        result->SetDictionarySize(dict_size);
     return result;
 }
 
+void DataFile::SetDictionarySize(size_t size)
+{
+    if (size < dictionarysize || size > maxdictionarysize)
+        throw std::out_of_range("invalid dictionary size: " + std::to_string(size));
+
+    dictentry_t dummy = {};
+    m_dictionary.resize(size, dummy);
+    UpdateLowScoreIndex();
+}
+
 void DataFile::SetDictionaryEntry(size_t index, const dictentry_t &value)
 {
     m_dictionary.at(index) = value;
@@ -154,13 +571,20 @@ void DataFile::SetDictionaryEntry(size_t index, const dictentry_t &value)
     }
 }
 
+DataFile DataFile::MakeTrial(size_t index, const dictentry_t &value) const
+{
+    DataFile trial(*this);
+    trial.SetDictionaryEntry(index, value);
+    return trial;
+}
+
 std::map<size_t, size_t> DataFile::GetCharToGlyphMap() const
 {
     std::map<size_t, size_t> char_to_glyph;
 
-    for (size_t i = 0; i < m_glyphtable.size(); i++)
+    for (size_t i = 0; i < m_glyphtable->size(); i++)
     {
-        for (size_t c: m_glyphtable[i].chars)
+        for (size_t c: m_glyphtable->at(i).chars)
         {
             char_to_glyph[c] = i;
         }
@@ -180,7 +604,7 @@ std::string DataFile::GlyphToText(size_t index) const
         for (int x = 0; x < m_fontinfo.max_width; x++)
         {
             size_t pos = y * m_fontinfo.max_width + x;
-            os << glyphchars[m_glyphtable.at(index).data.at(pos)];
+            os << glyphchars[m_glyphtable->at(index).data.at(pos)];
         }
         os << std::endl;
     }
@@ -204,35 +628,30 @@ void DataFile::UpdateLowScoreIndex()
 
 std::ostream& operator<<(std::ostream& os, const DataFile::pixels_t& str)
 {
-    for (uint8_t p: str)
-    {
-        if (p <= 9)
-            os << (char)(p + '0');
-        else if (p <= 15)
-            os << (char)(p - 10 + 'A');
-        else
-            throw std::logic_error("invalid pixel alpha: " + std::to_string(p));
-    }
+    std::string text;
+    format_pixels(str, text);
+    os.write(text.data(), text.size());
     return os;
 }
 
 std::istream& operator>>(std::istream& is, DataFile::pixels_t& str)
 {
-    char c;
+    std::string text;
     str.clear();
 
     while (isspace(is.peek())) is.get();
 
+    // Read the run of digits and the character that ends it.
+    char c;
     while (is.get(c))
     {
-        if (c >= '0' && c <= '9')
-            str.push_back(c - '0');
-        else if (c >= 'A' && c <= 'F')
-            str.push_back(c - 'A' + 10);
+        if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F'))
+            text.push_back(c);
         else
             break;
     }
 
+    parse_pixels(text.data(), text.data() + text.size(), str);
     return is;
 }
 
@@ -1,5 +1,7 @@
 // Class to store the data of a font while it is being processed.
 // This class can be safely cloned using the default copy constructor.
+// The glyph table is immutable and shared between the copies, so cloning
+// only costs as much as copying the dictionary.
 
 #pragma once
 #include <cstdint>
@@ -52,33 +54,58 @@ public:
              const std::vector<glyphentry_t> &glyphs,
              const fontinfo_t &fontinfo);
 
-    // Save to a file (custom format)
+    // Save to a file (custom text format)
     void Save(std::ostream &file) const;
 
-    // Load from a file (custom format)
+    // Save to a file (binary format). The binary format consists of fixed
+    // size records with absolute offsets and has the glyph pixels stored
+    // contiguously, so it can be used directly from a memory-mapped file.
+    // The layout is described in datafile.cc.
+    void SaveBinary(std::ostream &file) const;
+
+    // Load from a file in either the text or the binary format.
     // Returns nullptr if load fails.
     static std::unique_ptr<DataFile> Load(std::istream &file);
 
-    // Get or set an entry in the dictionary. The size of the dictionary
-    // is constant. Entries 0 to 23 are reserved for special purposes.
+    // Check if the file starts with the binary format header.
+    // Does not consume any data from the stream.
+    static bool IsBinary(std::istream &file);
+
+    // Get or set an entry in the dictionary. The default size of the
+    // dictionary fills the single byte codewords of the rlefont format, of
+    // which 0 to 23 are reserved for special purposes. Larger dictionaries
+    // are encoded with two-byte codewords for the entries that do not fit,
+    // up to maxdictionarysize entries.
     static const size_t dictionarysize = 256 - 24;
+    static const size_t maxdictionarysize = 256 - 24 - 16 + 16 * 256;
+    size_t GetDictionarySize() const
+        { return m_dictionary.size(); }
+
+    // Change the number of entries, between dictionarysize and
+    // maxdictionarysize. New entries are empty.
+    void SetDictionarySize(size_t size);
+
     const dictentry_t &GetDictionaryEntry(size_t index) const
         { return m_dictionary.at(index); }
     void SetDictionaryEntry(size_t index, const dictentry_t &value);
     const std::vector<dictentry_t> &GetDictionary() const
         { return m_dictionary; }
 
+    // Create a trial copy that differs from this one only by the given
+    // dictionary entry.
+    DataFile MakeTrial(size_t index, const dictentry_t &value) const;
+
     // Get the index of the dictionary entry with the lowest score.
     size_t GetLowScoreIndex() const
         { return m_lowscoreindex; }
 
     // Get an entry in the glyph table.
     size_t GetGlyphCount() const
-        { return m_glyphtable.size(); }
+        { return m_glyphtable->size(); }
     const glyphentry_t &GetGlyphEntry(size_t index) const
-        { return m_glyphtable.at(index); }
+        { return m_glyphtable->at(index); }
     const std::vector<glyphentry_t> &GetGlyphTable() const
-        { return m_glyphtable; }
+        { return *m_glyphtable; }
 
     // Create a map of char indices to glyph indices
     std::map<size_t, size_t> GetCharToGlyphMap() const;
@@ -98,13 +125,16 @@ public:
 
 private:
     std::vector<dictentry_t> m_dictionary;
-    std::vector<glyphentry_t> m_glyphtable;
+    std::shared_ptr<const std::vector<glyphentry_t> > m_glyphtable;
     fontinfo_t m_fontinfo;
     uint32_t m_seed;
 
     size_t m_lowscoreindex;
 
     void UpdateLowScoreIndex();
+
+    static std::unique_ptr<DataFile> LoadText(std::istream &file);
+    static std::unique_ptr<DataFile> LoadBinary(std::istream &file);
 };
 
 std::ostream& operator<<(std::ostream& os, const DataFile::pixels_t& str);
@@ -155,6 +185,100 @@ public:
         TS_ASSERT(f1->GetGlyphEntry(0).data == f2->GetGlyphEntry(0).data);
     }
 
+    void testHexPixels()
+    {
+        // Longer than one vector block, with a partial block at the end.
+        DataFile::pixels_t pixels;
+        for (int i = 0; i < 37; i++)
+            pixels.push_back((i * 7) % 16);
+
+        std::ostringstream os;
+        os << pixels;
+        TS_ASSERT_EQUALS(os.str(), "07E5C3A18F6D4B2907E5C3A18F6D4B2907E5C");
+
+        std::istringstream is(" " + os.str() + "x5");
+        DataFile::pixels_t result;
+        is >> result;
+        TS_ASSERT(result == pixels);
+        TS_ASSERT_EQUALS(is.get(), '5');
+
+        pixels.at(20) = 16;
+        TS_ASSERT_THROWS(os << pixels, const std::logic_error &);
+    }
+
+    void testBinaryFormat()
+    {
+        std::istringstream is1(testfile);
+        std::unique_ptr<DataFile> f1 = DataFile::Load(is1);
+        f1->SetSeed(4321);
+
+        std::ostringstream os;
+        f1->SaveBinary(os);
+
+        std::string data = os.str();
+        std::istringstream is2(data);
+        TS_ASSERT(DataFile::IsBinary(is2));
+        std::unique_ptr<DataFile> f2 = DataFile::Load(is2);
+
+        TS_ASSERT_EQUALS(f2->GetFontInfo().name, "Sans Serif");
+        TS_ASSERT_EQUALS(f2->GetFontInfo().max_width, 4);
+        TS_ASSERT_EQUALS(f2->GetSeed(), 4321);
+        TS_ASSERT_EQUALS(f2->GetDictionaryEntry(1).score, 13);
+        TS_ASSERT(f2->GetDictionaryEntry(1).replacement ==
+                  f1->GetDictionaryEntry(1).replacement);
+        TS_ASSERT_EQUALS(f2->GetGlyphCount(), 3);
+        TS_ASSERT(f2->GetGlyphEntry(0).chars == f1->GetGlyphEntry(0).chars);
+        TS_ASSERT(f2->GetGlyphEntry(2).data == f1->GetGlyphEntry(2).data);
+
+        // Both formats must give the same text output.
+        std::ostringstream text1, text2;
+        f1->Save(text1);
+        f2->Save(text2);
+        TS_ASSERT_EQUALS(text1.str(), text2.str());
+
+        // Truncated files are rejected.
+        std::istringstream is3(data.substr(0, data.size() - 1));
+        TS_ASSERT(!DataFile::Load(is3));
+
+        std::istringstream is4(testfile);
+        TS_ASSERT(!DataFile::IsBinary(is4));
+    }
+
+    void testDictionarySize()
+    {
+        std::istringstream is1(testfile);
+        std::unique_ptr<DataFile> f1 = DataFile::Load(is1);
+        TS_ASSERT_EQUALS(f1->GetDictionarySize(), DataFile::dictionarysize);
+
+        f1->SetDictionarySize(1000);
+        TS_ASSERT_EQUALS(f1->GetDictionarySize(), 1000);
+        TS_ASSERT_THROWS(f1->SetDictionarySize(DataFile::maxdictionarysize + 1),
+                         const std::out_of_range &);
+
+        // The size is kept in both formats.
+        std::ostringstream text, binary;
+        f1->Save(text);
+        f1->SaveBinary(binary);
+
+        std::istringstream is2(text.str()), is3(binary.str());
+        TS_ASSERT_EQUALS(DataFile::Load(is2)->GetDictionarySize(), 1000);
+        TS_ASSERT_EQUALS(DataFile::Load(is3)->GetDictionarySize(), 1000);
+    }
+
+    void testMakeTrial()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+
+        DataFile::dictentry_t d = {};
+        d.replacement = {15, 15, 0};
+        DataFile trial = f->MakeTrial(1, d);
+
+        TS_ASSERT(trial.GetDictionaryEntry(1).replacement == d.replacement);
+        TS_ASSERT_EQUALS(f->GetDictionaryEntry(1).score, 13);
+        TS_ASSERT_EQUALS(&trial.GetGlyphTable(), &f->GetGlyphTable());
+    }
+
 private:
     static constexpr const char *testfile =
         "Version 1\n"
@@ -1,6 +1,8 @@
 #include "encode_rlefont.hh"
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
+#include <unordered_map>
 #include "ccfixes.hh"
 
 // Number of reserved codes before the dictionary entries.
@@ -25,9 +27,77 @@
 #define DICT_START3BIT  244
 #define DICT_START2BIT  252
 
+// Two-byte codewords, used when the dictionary has more entries than fit in
+// a single byte. Codes from ESCAPE_START up are followed by a second byte,
+// and together refer to the dictionary entry WIDE_SINGLE_COUNT +
+// (code - ESCAPE_START) * 256 + byte. The codewords are handled as values
+// of 256 and above, and written out as the two bytes.
+#define ESCAPE_START      0xF0
+#define WIDE_SINGLE_COUNT (ESCAPE_START - DICT_START)
+#define WIDE_FIRST_VALUE  256
+
 namespace mcufont {
 namespace rlefont {
 
+// Check if the dictionary needs the two-byte codewords.
+static bool is_wide(size_t dict_count)
+{
+    return dict_count > DataFile::dictionarysize;
+}
+
+// Get the codeword value for the dictionary entry at index, counting the
+// entries in the sorted order.
+static int entry_codeword(size_t index, bool wide)
+{
+    if (!wide || index < WIDE_SINGLE_COUNT)
+        return DICT_START + index;
+    else
+        return WIDE_FIRST_VALUE + (index - WIDE_SINGLE_COUNT);
+}
+
+// Get the dictionary index for a codeword value of DICT_START or above.
+static size_t codeword_entry(int code)
+{
+    if (code < WIDE_FIRST_VALUE)
+        return code - DICT_START;
+    else
+        return WIDE_SINGLE_COUNT + (code - WIDE_FIRST_VALUE);
+}
+
+// Number of bytes taken by the codeword value.
+static size_t codeword_size(int code)
+{
+    return (code >= WIDE_FIRST_VALUE) ? 2 : 1;
+}
+
+// Append the bytes of a codeword value to a refstring or a byte counter.
+template <typename output_t>
+static void push_codeword(output_t &result, int code)
+{
+    if (code >= WIDE_FIRST_VALUE)
+    {
+        result.push_back(ESCAPE_START + ((code - WIDE_FIRST_VALUE) >> 8));
+        result.push_back((code - WIDE_FIRST_VALUE) & 0xFF);
+    }
+    else
+    {
+        result.push_back(code);
+    }
+}
+
+// Read the codeword value at pos in the encoded data and advance pos.
+static int read_codeword(const encoded_font_t::refstring_t &refstring,
+                         size_t &pos, bool wide)
+{
+    int code = refstring.at(pos++);
+    if (wide && code >= ESCAPE_START)
+    {
+        code = WIDE_FIRST_VALUE + ((code - ESCAPE_START) << 8);
+        code += refstring.at(pos++);
+    }
+    return code;
+}
+
 // Get bit count for the "fill entries"
 static size_t fillentry_bitcount(size_t index)
 {
@@ -58,11 +128,38 @@ static size_t prefix_length(const DataFile::pixels_t &pixels, size_t pos)
     return count;
 }
 
-// Perform the RLE encoding for a dictionary entry.
-static encoded_font_t::rlestring_t encode_rle(const DataFile::pixels_t &pixels)
+// Output for the encoding functions that only counts the emitted bytes.
+struct byte_counter_t
 {
-    encoded_font_t::rlestring_t result;
+    size_t count;
+
+    byte_counter_t(): count(0) {}
+    void push_back(uint8_t) { count++; }
+};
+
+// Output for the encoding functions that counts the emitted bytes and sums up
+// their decoding costs, given as a table indexed by the codeword.
+struct cost_counter_t
+{
+    const size_t *costs;
+    size_t count;
+    size_t cost;
+
+    explicit cost_counter_t(const size_t *c): costs(c), count(0), cost(0) {}
+    void push_back(uint8_t code) { count++; cost += costs[code]; }
+};
 
+static void push_codeword(cost_counter_t &result, int code)
+{
+    result.count += codeword_size(code);
+    result.cost += result.costs[code];
+}
+
+// Perform the RLE encoding for a dictionary entry.
+// The output can be either a rlestring_t or a byte_counter_t.
+template <typename output_t>
+static void encode_rle(const DataFile::pixels_t &pixels, output_t &result)
+{
     size_t pos = 0;
     while (pos < pixels.size())
     {
@@ -107,7 +204,12 @@ static encoded_font_t::rlestring_t encode_rle(const DataFile::pixels_t &pixels)
             }
         }
     }
+}
 
+static encoded_font_t::rlestring_t encode_rle(const DataFile::pixels_t &pixels)
+{
+    encoded_font_t::rlestring_t result;
+    encode_rle(pixels, result);
     return result;
 }
 
@@ -123,6 +225,7 @@ public:
         m_length(0),
         m_child0(nullptr),
         m_child15(nullptr),
+        m_children(nullptr),
         m_suffix(nullptr)
         {}
 
@@ -134,14 +237,10 @@ public:
             m_child15 = child;
         else if (p > 15)
             throw std::logic_error("invalid pixel alpha: " + std::to_string(p));
+        else if (!m_children)
+            throw std::logic_error("child array has not been allocated");
         else
-        {
-            if (!m_children)
-            {
-                m_children.reset(new DictTreeNode*[14]());
-            }
             m_children[p - 1] = child;
-        }
     }
 
     DictTreeNode* GetChild(uint8_t p) const
@@ -158,6 +257,10 @@ public:
             return m_children[p - 1];
     }
 
+    // Array of 14 pointers for the intermediate alphas, owned by the
+    // TreeAllocator.
+    void SetChildArray(DictTreeNode **children) { m_children = children; }
+
     bool HasIntermediateChildren() const { return m_children != nullptr; }
 
     int GetIndex() const { return m_index; }
@@ -185,39 +288,87 @@ private:
     // Therefore the array for other nodes is allocated only on demand.
     DictTreeNode *m_child0;
     DictTreeNode *m_child15;
-    std::unique_ptr<DictTreeNode*[]> m_children;
+    DictTreeNode **m_children;
 
     // Pointer to the longest suffix of this entry that exists in the
     // dictionary.
     DictTreeNode *m_suffix;
 };
 
-// Preallocated array for tree nodes
+// Preallocated array for tree nodes and their child arrays. The storage is
+// kept over Reset(), so that building trees repeatedly does not need to
+// allocate memory once the arena has grown large enough.
 class TreeAllocator
 {
 public:
-    TreeAllocator(size_t count)
+    TreeAllocator(): m_capacity(0), m_used(0), m_count(0), m_blocksused(0) {}
+
+    // Release all the nodes and reserve space for count new nodes.
+    void Reset(size_t count)
     {
-        m_storage.reset(new DictTreeNode[count]);
-        m_next = m_storage.get();
-        m_left = count;
+        if (count > m_capacity)
+        {
+            m_storage.reset(new DictTreeNode[count]);
+            m_capacity = count;
+        }
+        else
+        {
+            std::fill(m_storage.get(), m_storage.get() + m_used, DictTreeNode());
+        }
+
+        m_used = 0;
+        m_count = count;
+        m_blocksused = 0;
     }
 
     DictTreeNode *allocate()
     {
-        if (m_left == 0)
+        if (m_used == m_count)
             throw std::logic_error("Ran out of preallocated entries");
 
-        m_left--;
-        return m_next++;
+        return &m_storage[m_used++];
+    }
+
+    // Number of nodes allocated since the last Reset().
+    size_t GetUsed() const { return m_used; }
+
+    // Sequence number of an allocated node, in the range 0 to GetUsed() - 1.
+    size_t GetNumber(const DictTreeNode *node) const
+    {
+        return node - m_storage.get();
+    }
+
+    // Allocate a zeroed array of children for the intermediate alphas.
+    DictTreeNode **allocate_children()
+    {
+        if (m_blocksused == m_blocks.size())
+            m_blocks.emplace_back(new DictTreeNode*[14]);
+
+        DictTreeNode **block = m_blocks[m_blocksused++].get();
+        std::fill(block, block + 14, nullptr);
+        return block;
     }
 
 private:
     std::unique_ptr<DictTreeNode[]> m_storage;
-    DictTreeNode *m_next;
-    size_t m_left;
+    size_t m_capacity;
+    size_t m_used;
+    size_t m_count;
+
+    std::vector<std::unique_ptr<DictTreeNode*[]> > m_blocks;
+    size_t m_blocksused;
 };
 
+// Set a child of the node, allocating the child array when needed.
+static void set_tree_child(DictTreeNode *node, uint8_t p, DictTreeNode *child,
+                           TreeAllocator &storage)
+{
+    if (p != 0 && p != 15 && !node->HasIntermediateChildren())
+        node->SetChildArray(storage.allocate_children());
+
+    node->SetChild(p, child);
+}
+
 // Add a new dictionary entry to the tree. Adds the intermediate nodes, but
 // does not yet fill the suffix pointers.
 static DictTreeNode* add_tree_entry(const DataFile::pixels_t &entry, int index,
@@ -231,7 +382,7 @@ static DictTreeNode* add_tree_entry(const DataFile::pixels_t &entry, int index,
         if (!branch)
         {
             branch = storage.allocate();
-            node->SetChild(p, branch);
+            set_tree_child(node, p, branch, storage);
         }
 
         node = branch;
@@ -304,7 +455,7 @@ static void fill_tree_suffixes(DictTreeNode *root, DictTreeNode *subtree,
 
 // Construct a lookup tree from the dictionary entries.
 static DictTreeNode* construct_tree(const std::vector<DataFile::dictentry_t> &dictionary,
-                                    TreeAllocator &storage, bool fast)
+                                    TreeAllocator &storage, bool fast, bool wide)
 {
     DictTreeNode* root = storage.allocate();
 
@@ -315,24 +466,26 @@ static DictTreeNode* construct_tree(const std::vector<DataFile::dictentry_t> &di
         node->SetIndex(j);
         node->SetRef(false);
         node->SetLength(1);
-        root->SetChild(j, node);
+        set_tree_child(root, j, node, storage);
     }
 
     // Populate the actual dictionary entries
-    size_t i = DICT_START;
-    for (DataFile::dictentry_t d : dictionary)
+    size_t count = 0;
+    for (const DataFile::dictentry_t &d : dictionary)
     {
         if (!d.replacement.size())
             break;
 
-        add_tree_entry(d.replacement, i, d.ref_encode, root, storage);
-        i++;
+        add_tree_entry(d.replacement, entry_codeword(count, wide),
+                       d.ref_encode, root, storage);
+        count++;
     }
 
     if (!fast)
     {
-        // Populate the fill entries for rest of dictionary
-        for (; i < 256; i++)
+        // Populate the fill entries for rest of the single byte codewords.
+        // A wide dictionary uses all of them.
+        for (size_t i = wide ? 256 : DICT_START + count; i < 256; i++)
         {
             DataFile::pixels_t pixels;
             size_t bitcount = fillentry_bitcount(i);
@@ -354,6 +507,137 @@ static DictTreeNode* construct_tree(const std::vector<DataFile::dictentry_t> &di
     return root;
 }
 
+// Access to the pointer-based tree for the templated search functions below.
+class PointerTree
+{
+public:
+    typedef const DictTreeNode *node_t;
+
+    explicit PointerTree(const DictTreeNode *root): m_root(root) {}
+
+    node_t GetRoot() const { return m_root; }
+    static bool IsValid(node_t node) { return node != nullptr; }
+    node_t GetChild(node_t node, uint8_t p) const { return node->GetChild(p); }
+    node_t GetSuffix(node_t node) const { return node->GetSuffix(); }
+    int GetIndex(node_t node) const { return node->GetIndex(); }
+    bool GetRef(node_t node) const { return node->GetRef(); }
+    size_t GetLength(node_t node) const { return node->GetLength(); }
+
+private:
+    const DictTreeNode *m_root;
+};
+
+// Copy of the tree in flat arrays, with the nodes in breadth-first order and
+// 32-bit indices instead of pointers. As in DictTreeNode, the children for
+// 0 and 15 alpha are stored in the node itself and the nodes that have other
+// children get a contiguous block of 14 child slots. This halves the size of
+// the nodes and keeps the nodes that the searches visit close to each other.
+static const uint32_t FLAT_NONE = 0xFFFFFFFF;
+
+class FlatTree
+{
+public:
+    typedef uint32_t node_t;
+
+    // Flatten the tree whose nodes have been allocated from storage.
+    void Build(const DictTreeNode *root, const TreeAllocator &storage)
+    {
+        // Number the nodes in breadth-first order.
+        m_order.clear();
+        m_numbers.assign(storage.GetUsed(), FLAT_NONE);
+        m_order.push_back(root);
+        m_numbers[storage.GetNumber(root)] = 0;
+
+        for (size_t i = 0; i < m_order.size(); i++)
+        {
+            const DictTreeNode *node = m_order[i];
+            for (uint8_t p = 0; p < 16; p++)
+            {
+                // Speed-up for the common case of 0 and 15 alphas.
+                if (p == 1 && !node->HasIntermediateChildren())
+                    p += 14;
+
+                const DictTreeNode *child = node->GetChild(p);
+                if (child)
+                {
+                    m_numbers[storage.GetNumber(child)] = m_order.size();
+                    m_order.push_back(child);
+                }
+            }
+        }
+
+        m_nodes.resize(m_order.size());
+        m_children.clear();
+
+        for (size_t i = 0; i < m_order.size(); i++)
+        {
+            const DictTreeNode *node = m_order[i];
+            flat_node_t &f = m_nodes[i];
+            f.child0 = Number(node->GetChild(0), storage);
+            f.child15 = Number(node->GetChild(15), storage);
+            f.suffix = Number(node->GetSuffix(), storage);
+            f.children = FLAT_NONE;
+            f.index = node->GetIndex();
+            f.ref = node->GetRef();
+            f.length = node->GetLength();
+
+            if (node->HasIntermediateChildren())
+            {
+                f.children = m_children.size();
+                for (uint8_t p = 1; p < 15; p++)
+                    m_children.push_back(Number(node->GetChild(p), storage));
+            }
+        }
+    }
+
+    node_t GetRoot() const { return 0; }
+    static bool IsValid(node_t node) { return node != FLAT_NONE; }
+
+    node_t GetChild(node_t node, uint8_t p) const
+    {
+        const flat_node_t &f = m_nodes[node];
+        if (p == 0)
+            return f.child0;
+        else if (p == 15)
+            return f.child15;
+        else if (p > 15)
+            throw std::logic_error("invalid pixel alpha: " + std::to_string(p));
+        else if (f.children == FLAT_NONE)
+            return FLAT_NONE;
+        else
+            return m_children[f.children + p - 1];
+    }
+
+    node_t GetSuffix(node_t node) const { return m_nodes[node].suffix; }
+    int GetIndex(node_t node) const { return m_nodes[node].index; }
+    bool GetRef(node_t node) const { return m_nodes[node].ref; }
+    size_t GetLength(node_t node) const { return m_nodes[node].length; }
+
+private:
+    struct flat_node_t
+    {
+        node_t child0;
+        node_t child15;
+        node_t children; // First of the 14 intermediate child slots, or FLAT_NONE.
+        node_t suffix; // Longest suffix in the tree, or FLAT_NONE if not filled.
+        uint32_t length; // Length of the dictionary entry.
+        int16_t index; // Dictionary index or -1.
+        bool ref; // True for ref-encoded dictionary entries.
+    };
+
+    std::vector<flat_node_t> m_nodes;
+    std::vector<node_t> m_children;
+
+    // Temporary storage for Build().
+    std::vector<const DictTreeNode*> m_order;
+    std::vector<node_t> m_numbers;
+
+    node_t Number(const DictTreeNode *node, const TreeAllocator &storage) const
+    {
+        return node ? m_numbers[storage.GetNumber(node)] : FLAT_NONE;
+    }
+};
+
 // Structure for keeping track of the shortest encoding to reach particular
 // point of the pixel string.
 struct encoding_link_t
@@ -364,59 +648,66 @@ struct encoding_link_t
     // Index of the dictionary entry that brings us to this point.
     int index;
 
-    // Number of links to get here from the start of the string.
+    // Number of bytes to get here from the start of the string.
     size_t length;
 
     constexpr encoding_link_t(): previous(0), index(-1), length(9999999) {}
 };
 
-// Perform the reference encoding for a glyph entry (optimal version).
+// Find the shortest reference encoding for a glyph entry (optimal version).
 // Uses a modified Aho-Corasick algorithm combined with breadth first search
-// to find the shortest representation.
-static encoded_font_t::refstring_t encode_ref_slow(const DataFile::pixels_t &pixels,
-                                                   const DictTreeNode *root,
-                                                   bool is_glyph)
+// to find the shortest representation. Each entry of the chain corresponds
+// to a position in the pixel string; the returned chain is valid until the
+// next call from the same thread.
+template <typename tree_t>
+static const encoding_link_t *find_ref_chain(const DataFile::pixels_t &pixels,
+                                             const tree_t &tree,
+                                             bool is_glyph)
 {
-    // Chain of encodings. Each entry in this array corresponds to a position
-    // in the pixel string.
-    std::unique_ptr<encoding_link_t[]> chain(new encoding_link_t[pixels.size() + 1]);
+    typedef typename tree_t::node_t node_t;
+
+    static thread_local std::vector<encoding_link_t> buffer;
+    buffer.assign(pixels.size() + 1, encoding_link_t());
+    encoding_link_t *chain = buffer.data();
 
     chain[0].previous = 0;
     chain[0].index = 0;
     chain[0].length = 0;
 
     // Read the pixels one-by-one and update the encoding links accordingly.
-    const DictTreeNode *node = root;
+    const node_t root = tree.GetRoot();
+    node_t node = root;
     for (size_t pos = 0; pos < pixels.size(); pos++)
     {
         uint8_t pixel = pixels.at(pos);
-        const DictTreeNode *branch = node->GetChild(pixel);
+        node_t branch = tree.GetChild(node, pixel);
 
-        while (!branch)
+        while (!tree.IsValid(branch))
         {
             // Cannot expand this sequence, defer to suffix.
-            node = node->GetSuffix();
-            branch = node->GetChild(pixel);
+            node = tree.GetSuffix(node);
+            branch = tree.GetChild(node, pixel);
         }
 
         node = branch;
 
         // We have arrived at a new node, add it and any proper suffixes to
         // the link chain.
-        const DictTreeNode *suffix = node;
+        node_t suffix = node;
         while (suffix != root)
         {
-            if (suffix->GetIndex() >= 0 && (is_glyph || !suffix->GetRef()))
+            if (tree.GetIndex(suffix) >= 0 && (is_glyph || !tree.GetRef(suffix)))
             {
                 encoding_link_t link;
-                link.previous = pos + 1 - suffix->GetLength();
-                link.index = suffix->GetIndex();
-                link.length = chain[link.previous].length + 1;
+                link.previous = pos + 1 - tree.GetLength(suffix);
+                link.index = tree.GetIndex(suffix);
+                link.length = chain[link.previous].length +
+                              codeword_size(link.index);
 
                 if (link.length < chain[pos + 1].length)
                     chain[pos + 1] = link;
             }
-            suffix = suffix->GetSuffix();
+            suffix = tree.GetSuffix(suffix);
         }
     }
 
@@ -438,25 +729,34 @@ static encoded_font_t::refstring_t encode_ref_slow(const DataFile::pixels_t &pix
         }
     }
 
+    return chain;
+}
+
+// Perform the reference encoding for a glyph entry (optimal version).
+template <typename tree_t>
+static encoded_font_t::refstring_t encode_ref_slow(const DataFile::pixels_t &pixels,
+                                                   const tree_t &tree,
+                                                   bool is_glyph)
+{
+    const encoding_link_t *chain = find_ref_chain(pixels, tree, is_glyph);
+
     // Backtrack from the final link back to the start and construct the
     // encoded string.
-    encoded_font_t::refstring_t result;
-    size_t len = chain[pixels.size()].length;
-    result.resize(len);
+    std::vector<int> codes;
+    for (size_t pos = pixels.size(); pos > 0; pos = chain[pos].previous)
+        codes.push_back(chain[pos].index);
 
-    size_t pos = pixels.size();
-    for (size_t i = len; i > 0; i--)
-    {
-        result.at(i - 1) = chain[pos].index;
-        pos = chain[pos].previous;
-    }
+    encoded_font_t::refstring_t result;
+    for (size_t i = codes.size(); i > 0; i--)
+        push_codeword(result, codes.at(i - 1));
 
     return result;
 }
 
 // Walk the tree as far as possible following the given pixel string iterator.
 // Returns number of pixels encoded, and index is set to the dictionary reference.
-static size_t walk_tree(const DictTreeNode *tree,
+template <typename tree_t>
+static size_t walk_tree(const tree_t &tree,
                         DataFile::pixels_t::const_iterator pixels,
                         DataFile::pixels_t::const_iterator pixelsend,
                         int &index, bool is_glyph)
@@ -465,22 +765,22 @@ static size_t walk_tree(const DictTreeNode *tree,
     size_t length = 0;
     index = -1;
 
-    const DictTreeNode* node = tree;
+    typename tree_t::node_t node = tree.GetRoot();
     while (pixels != pixelsend)
     {
         uint8_t pixel = *pixels++;
-        node = node->GetChild(pixel);
+        node = tree.GetChild(node, pixel);
 
-        if (!node)
+        if (!tree.IsValid(node))
             break;
 
         length++;
 
-        if (is_glyph || !node->GetRef())
+        if (is_glyph || !tree.GetRef(node))
         {
-            if (node->GetIndex() >= 0)
+            if (tree.GetIndex(node) >= 0)
             {
-                index = node->GetIndex();
+                index = tree.GetIndex(node);
                 best_length = length;
             }
         }
@@ -494,12 +794,12 @@ static size_t walk_tree(const DictTreeNode *tree,
 
 // Perform the reference encoding for a glyph entry (fast version).
 // Uses a simple greedy search to find select the encodings.
-static encoded_font_t::refstring_t encode_ref_fast(const DataFile::pixels_t &pixels,
-                                                   const DictTreeNode *tree,
-                                                   bool is_glyph)
+// The output can be either a refstring_t or a byte_counter_t.
+template <typename tree_t, typename output_t>
+static void encode_ref_fast(const DataFile::pixels_t &pixels,
+                            const tree_t &tree,
+                            bool is_glyph, output_t &result)
 {
-    encoded_font_t::refstring_t result;
-
     // Strip any zeroes from end
     size_t end = pixels.size();
 
@@ -513,23 +813,71 @@ static encoded_font_t::refstring_t encode_ref_fast(const DataFile::pixels_t &pix
     {
         int index;
         i += walk_tree(tree, pixels.begin() + i, pixels.end(), index, is_glyph);
-        result.push_back(index);
+        push_codeword(result, index);
     }
 
     if (i < pixels.size())
         result.push_back(REF_FILLZEROS);
-
-    return result;
 }
 
+template <typename tree_t>
 static encoded_font_t::refstring_t encode_ref(const DataFile::pixels_t &pixels,
-                                              const DictTreeNode *tree,
+                                              const tree_t &tree,
                                               bool is_glyph, bool fast)
 {
     if (fast)
-        return encode_ref_fast(pixels, tree, is_glyph);
+    {
+        encoded_font_t::refstring_t result;
+        encode_ref_fast(pixels, tree, is_glyph, result);
+        return result;
+    }
     else
+    {
         return encode_ref_slow(pixels, tree, is_glyph);
+    }
+}
+
+// Same as encode_ref(), but only computes the length of the result.
+template <typename tree_t>
+static size_t count_ref(const DataFile::pixels_t &pixels, const tree_t &tree,
+                        bool is_glyph, bool fast)
+{
+    if (fast)
+    {
+        byte_counter_t counter;
+        encode_ref_fast(pixels, tree, is_glyph, counter);
+        return counter.count;
+    }
+    else
+    {
+        return find_ref_chain(pixels, tree, is_glyph)[pixels.size()].length;
+    }
+}
+
+// Same as count_ref(), but also sums up the decoding costs of the codewords
+// in the result.
+template <typename tree_t>
+static size_t count_ref_cost(const DataFile::pixels_t &pixels,
+                             const tree_t &tree, bool is_glyph, bool fast,
+                             const std::vector<size_t> &costs, size_t &cost)
+{
+    if (fast)
+    {
+        cost_counter_t counter(costs.data());
+        encode_ref_fast(pixels, tree, is_glyph, counter);
+        cost = counter.cost;
+        return counter.count;
+    }
+    else
+    {
+        const encoding_link_t *chain = find_ref_chain(pixels, tree, is_glyph);
+
+        cost = 0;
+        for (size_t pos = pixels.size(); pos > 0; pos = chain[pos].previous)
+            cost += costs.at(chain[pos].index);
+
+        return chain[pixels.size()].length;
+    }
 }
 
 // Compare dictionary entries by their coding type.
@@ -547,6 +895,15 @@ static bool cmp_dict_coding(const DataFile::dictentry_t &a,
         return false;
 }
 
+// Check if the dictionary needs the two-byte codewords, counting only the
+// entries that are in use.
+static bool is_wide(const std::vector<DataFile::dictentry_t> &dictionary)
+{
+    return is_wide(std::count_if(dictionary.begin(), dictionary.end(),
+                                 [](const DataFile::dictentry_t &d)
+                                 { return d.replacement.size() != 0; }));
+}
+
 size_t estimate_tree_node_count(const std::vector<DataFile::dictentry_t> &dict)
 {
     size_t count = DICT_START; // Preallocated entries
@@ -558,23 +915,206 @@ size_t estimate_tree_node_count(const std::vector<DataFile::dictentry_t> &dict)
     return count;
 }
 
-std::unique_ptr<encoded_font_t> encode_font(const DataFile &datafile,
-                                            bool fast)
+// Sorted dictionary and the lookup tree constructed from it.
+struct dict_tree_t
 {
-    std::unique_ptr<encoded_font_t> result(new encoded_font_t);
+    std::vector<DataFile::dictentry_t> sorted_dict;
+    TreeAllocator allocator;
+    DictTreeNode *tree;
 
+    // Flattened copy of the tree, filled if layout is TREE_FLAT.
+    FlatTree flat;
+    tree_layout_t layout;
+
+    // The dictionary that the tree was built from.
+    std::vector<DataFile::dictentry_t> source;
+
+    // True if the dictionary uses the two-byte codewords.
+    bool wide;
+
+    // Decoding cost of each codeword, see compute_codeword_costs(). Empty
+    // until requested from get_dict_tree().
+    std::vector<size_t> costs;
+
+    dict_tree_t(): tree(nullptr), layout(TREE_POINTERS), wide(false) {}
+};
+
+// Check if two dictionaries produce the same tree. Scores do not matter.
+static bool same_dictionary(const std::vector<DataFile::dictentry_t> &a,
+                            const std::vector<DataFile::dictentry_t> &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].ref_encode != b[i].ref_encode ||
+            a[i].replacement != b[i].replacement)
+            return false;
+    }
+
+    return true;
+}
+
+static void build_dict_tree(const std::vector<DataFile::dictentry_t> &dictionary,
+                            bool fast, tree_layout_t layout,
+                            dict_tree_t &result)
+{
     // Sort the dictionary so that RLE-coded entries come first.
     // This way the two are easy to distinguish based on index.
-    std::vector<DataFile::dictentry_t> sorted_dict = datafile.GetDictionary();
-    std::stable_sort(sorted_dict.begin(), sorted_dict.end(), cmp_dict_coding);
+    result.source = dictionary;
+    result.sorted_dict = dictionary;
+    std::stable_sort(result.sorted_dict.begin(), result.sorted_dict.end(),
+                     cmp_dict_coding);
+
+    result.wide = is_wide(result.sorted_dict);
 
     // Build the binary tree for looking up references.
-    size_t count = estimate_tree_node_count(sorted_dict);
-    TreeAllocator allocator(count);
-    DictTreeNode* tree = construct_tree(sorted_dict, allocator, fast);
+    result.allocator.Reset(estimate_tree_node_count(result.sorted_dict));
+    result.tree = construct_tree(result.sorted_dict, result.allocator, fast,
+                                 result.wide);
+
+    result.layout = layout;
+    if (result.layout == TREE_FLAT)
+        result.flat.Build(result.tree, result.allocator);
+
+    result.costs.clear();
+}
+
+static void compute_codeword_costs(dict_tree_t &dict, bool fast);
+
+// Get the tree for the dictionary from the per-thread encoder context.
+// The tree is rebuilt only when the dictionary has changed since the previous
+// call, and the node storage is reused. The returned reference stays valid
+// until the next call from the same thread.
+// If costs is true, the decoding costs of the codewords are also computed.
+static const dict_tree_t &get_dict_tree(
+    const std::vector<DataFile::dictentry_t> &dictionary, bool fast,
+    tree_layout_t layout, bool costs = false)
+{
+    static thread_local dict_tree_t contexts[2];
+    dict_tree_t &dict = contexts[fast ? 1 : 0];
+
+    if (!dict.tree || dict.layout != layout ||
+        !same_dictionary(dict.source, dictionary))
+    {
+        build_dict_tree(dictionary, fast, layout, dict);
+    }
+
+    if (costs && dict.costs.empty())
+        compute_codeword_costs(dict, fast);
+
+    return dict;
+}
+
+// Encode using the tree layout that was selected when building the tree.
+static encoded_font_t::refstring_t encode_ref(const DataFile::pixels_t &pixels,
+                                              const dict_tree_t &dict,
+                                              bool is_glyph, bool fast)
+{
+    if (dict.layout == TREE_FLAT)
+        return encode_ref(pixels, dict.flat, is_glyph, fast);
+    else
+        return encode_ref(pixels, PointerTree(dict.tree), is_glyph, fast);
+}
+
+static size_t count_ref(const DataFile::pixels_t &pixels,
+                        const dict_tree_t &dict, bool is_glyph, bool fast)
+{
+    if (dict.layout == TREE_FLAT)
+        return count_ref(pixels, dict.flat, is_glyph, fast);
+    else
+        return count_ref(pixels, PointerTree(dict.tree), is_glyph, fast);
+}
+
+static size_t count_ref_cost(const DataFile::pixels_t &pixels,
+                             const dict_tree_t &dict, bool is_glyph,
+                             bool fast, size_t &cost)
+{
+    if (dict.layout == TREE_FLAT)
+        return count_ref_cost(pixels, dict.flat, is_glyph, fast, dict.costs, cost);
+    else
+        return count_ref_cost(pixels, PointerTree(dict.tree), is_glyph, fast,
+                              dict.costs, cost);
+}
+
+// Number of separate runs of set bits in a binary fill codeword.
+static size_t count_bit_runs(size_t code)
+{
+    size_t bitcount = fillentry_bitcount(code);
+    uint8_t byte = code - DICT_START7BIT;
+    size_t runs = 0;
+    bool previous = false;
+
+    for (size_t i = 0; i < bitcount; i++)
+    {
+        bool bit = (byte >> i) & 1;
+        if (bit && !previous)
+            runs++;
+        previous = bit;
+    }
 
-    // Encode the dictionary entries, using either RLE or reference method.
-    for (const DataFile::dictentry_t &d : sorted_dict)
+    return runs;
+}
+
+// Number of pixel callbacks done for an RLE-encoded dictionary entry.
+static size_t count_rle_runs(const encoded_font_t::rlestring_t &rle)
+{
+    size_t runs = 0;
+    for (uint8_t code : rle)
+    {
+        if ((code & RLE_CODEMASK) == RLE_ONES ||
+            (code & RLE_CODEMASK) == RLE_SHADE)
+            runs++;
+    }
+    return runs;
+}
+
+// Estimate the work done by the decoder to write out each codeword: one
+// step for each codeword and RLE code that it reads, and one for each
+// pixel callback. Runs that are split at the end of a row are counted
+// only once. Reference encoded entries can only contain non-reference
+// codewords, and come after the RLE entries in the sorted dictionary, so
+// the costs of their parts are known when they are reached.
+static void compute_codeword_costs(dict_tree_t &dict, bool fast)
+{
+    std::vector<size_t> &costs = dict.costs;
+    costs.assign(std::max<size_t>(256,
+        entry_codeword(dict.sorted_dict.size(), dict.wide) + 1), 1);
+
+    for (size_t code = 1; code <= 15; code++)
+        costs[code] = 2;
+
+    size_t count = 0;
+    for (const DataFile::dictentry_t &d : dict.sorted_dict)
+    {
+        if (d.replacement.size() == 0)
+            break;
+
+        int code = entry_codeword(count++, dict.wide);
+
+        if (d.ref_encode)
+        {
+            size_t cost;
+            count_ref_cost(d.replacement, dict, false, fast, cost);
+            costs[code] = 1 + cost;
+        }
+        else
+        {
+            encoded_font_t::rlestring_t rle = encode_rle(d.replacement);
+            costs[code] = 1 + rle.size() + count_rle_runs(rle);
+        }
+    }
+
+    for (size_t code = DICT_START + count; code < 256; code++)
+        costs[code] = 1 + count_bit_runs(code);
+}
+
+// Encode the dictionary entries, using either RLE or reference method.
+static void encode_dictionary(const dict_tree_t &dict, bool fast,
+                              encoded_font_t &result)
+{
+    for (const DataFile::dictentry_t &d : dict.sorted_dict)
     {
         if (d.replacement.size() == 0)
         {
@@ -582,41 +1122,365 @@ std::unique_ptr<encoded_font_t> encode_font(const DataFile &datafile,
         }
         else if (d.ref_encode)
         {
-            result->ref_dictionary.push_back(encode_ref(d.replacement, tree, false, fast));
+            result.ref_dictionary.push_back(encode_ref(d.replacement, dict, false, fast));
         }
         else
         {
-            result->rle_dictionary.push_back(encode_rle(d.replacement));
+            result.rle_dictionary.push_back(encode_rle(d.replacement));
         }
     }
+}
 
-    // Then reference-encode the glyphs
-    for (const DataFile::glyphentry_t &g : datafile.GetGlyphTable())
+// Total size of the encoded dictionary, including the offset table.
+// Only counts the bytes, without storing the encoded data.
+static size_t get_dictionary_size(const dict_tree_t &dict, bool fast)
+{
+    size_t total = 0;
+    for (const DataFile::dictentry_t &d : dict.sorted_dict)
     {
-        result->glyphs.push_back(encode_ref(g.data, tree, true, fast));
+        size_t size;
+        if (d.replacement.size() == 0)
+        {
+            continue;
+        }
+        else if (d.ref_encode)
+        {
+            size = count_ref(d.replacement, dict, false, fast);
+        }
+        else
+        {
+            byte_counter_t counter;
+            encode_rle(d.replacement, counter);
+            size = counter.count;
+        }
+
+        total += size;
+
+        if (size != 0)
+            total += 2; // Offset table entry
     }
+    return total;
+}
 
-    // Optionally verify that the encoding was correct.
-    if (!fast)
+// Size of an encoded glyph, including the offset and width table entries.
+static size_t get_glyph_size(const DataFile::pixels_t &pixels,
+                             const dict_tree_t &dict, bool fast)
+{
+    return count_ref(pixels, dict, true, fast) + 3;
+}
+
+// Same as above, but also computes the decoding cost of the glyph. The dict
+// must have been requested with the costs.
+static size_t get_glyph_size(const DataFile::pixels_t &pixels,
+                             const dict_tree_t &dict, bool fast, size_t &cost)
+{
+    return count_ref_cost(pixels, dict, true, fast, cost) + 3;
+}
+
+std::unique_ptr<encoded_font_t> encode_font(const DataFile &datafile,
+                                            bool fast, ThreadPool *pool,
+                                            tree_layout_t layout)
+{
+    std::unique_ptr<encoded_font_t> result(new encoded_font_t);
+
+    const dict_tree_t &dict = get_dict_tree(datafile.GetDictionary(), fast,
+                                            layout);
+    encode_dictionary(dict, fast, *result);
+
+    // Then reference-encode the glyphs. The tree is only read, so the
+    // workers can share it.
+    const std::vector<DataFile::glyphentry_t> &glyphs = datafile.GetGlyphTable();
+    result->glyphs.resize(glyphs.size());
+    auto encode = [&](size_t i)
     {
-        for (size_t i = 0; i < datafile.GetGlyphCount(); i++)
+        result->glyphs.at(i) = encode_ref(glyphs.at(i).data, dict, true, fast);
+
+        // Optionally verify that the encoding was correct.
+        if (!fast)
         {
             std::unique_ptr<DataFile::pixels_t> decoded =
                 decode_glyph(*result, i, datafile.GetFontInfo());
-            if (*decoded != datafile.GetGlyphEntry(i).data)
+            if (*decoded != glyphs.at(i).data)
             {
                 auto iter = std::mismatch(decoded->begin(), decoded->end(),
-                                          datafile.GetGlyphEntry(i).data.begin());
+                                          glyphs.at(i).data.begin());
                 size_t pos = iter.first - decoded->begin();
                 throw std::logic_error("verification of glyph " + std::to_string(i) +
                     " failed at position " + std::to_string(pos));
             }
         }
+    };
+
+    if (pool)
+    {
+        pool->Run(glyphs.size(), encode);
+    }
+    else
+    {
+        for (size_t i = 0; i < glyphs.size(); i++)
+            encode(i);
     }
 
     return result;
 }
 
+std::unique_ptr<encoded_font_t> encode_glyph(const DataFile &datafile,
+                                             size_t index, bool fast,
+                                             tree_layout_t layout)
+{
+    std::unique_ptr<encoded_font_t> result(new encoded_font_t);
+
+    const dict_tree_t &dict = get_dict_tree(datafile.GetDictionary(), fast,
+                                            layout);
+    encode_dictionary(dict, fast, *result);
+
+    const DataFile::pixels_t &pixels = datafile.GetGlyphEntry(index).data;
+    result->glyphs.push_back(encode_ref(pixels, dict, true, fast));
+    return result;
+}
+
+// Length of the pixel substrings used as keys in the glyph index.
+// Eight 4-bit pixels pack exactly into the 32-bit key.
+#define GLYPHINDEX_GRAM 8
+
+// Index from pixel substrings to the glyphs that contain them.
+class SizeEvaluator::GlyphIndex
+{
+public:
+    GlyphIndex(const std::vector<DataFile::glyphentry_t> &glyphs)
+    {
+        m_count = glyphs.size();
+
+        std::vector<uint32_t> keys;
+        for (size_t i = 0; i < glyphs.size(); i++)
+        {
+            get_keys(glyphs[i].data, keys);
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+            for (uint32_t key : keys)
+                m_postings[key].push_back(i);
+        }
+    }
+
+    // Append the indices of all glyphs containing the pattern to result.
+    void Find(const std::vector<DataFile::glyphentry_t> &glyphs,
+              const DataFile::pixels_t &pattern,
+              std::vector<size_t> &result) const
+    {
+        if (pattern.size() == 0)
+            return;
+
+        // Select the substring of the pattern that occurs in fewest glyphs.
+        const std::vector<uint32_t> *candidates = nullptr;
+        if (pattern.size() >= GLYPHINDEX_GRAM)
+        {
+            std::vector<uint32_t> keys;
+            get_keys(pattern, keys);
+            for (uint32_t key : keys)
+            {
+                auto iter = m_postings.find(key);
+                if (iter == m_postings.end())
+                    return; // No glyph contains the pattern.
+
+                if (!candidates || iter->second.size() < candidates->size())
+                    candidates = &iter->second;
+            }
+        }
+
+        // Verify the candidates, or all glyphs for short patterns.
+        size_t count = candidates ? candidates->size() : m_count;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t index = candidates ? candidates->at(i) : i;
+            const DataFile::pixels_t &data = glyphs.at(index).data;
+            if (std::search(data.begin(), data.end(),
+                            pattern.begin(), pattern.end()) != data.end())
+            {
+                result.push_back(index);
+            }
+        }
+    }
+
+private:
+    size_t m_count;
+    std::unordered_map<uint32_t, std::vector<uint32_t> > m_postings;
+
+    static void get_keys(const DataFile::pixels_t &pixels,
+                         std::vector<uint32_t> &keys)
+    {
+        keys.clear();
+        uint32_t key = 0;
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            key = (key << 4) | pixels[i];
+            if (i + 1 >= GLYPHINDEX_GRAM)
+                keys.push_back(key);
+        }
+    }
+};
+
+
+SizeEvaluator::SizeEvaluator(const DataFile &datafile, bool fast,
+                             double decode_weight, tree_layout_t layout):
+    m_index(new GlyphIndex(datafile.GetGlyphTable())),
+    m_dictionary(datafile.GetDictionary()),
+    m_glyphtotal(0),
+    m_costtotal(0),
+    m_fast(fast),
+    m_weight(decode_weight),
+    m_layout(layout),
+    m_work(0)
+{
+    const dict_tree_t &dict = get_dict_tree(datafile.GetDictionary(), fast,
+                                            layout, m_weight > 0);
+
+    for (const DataFile::glyphentry_t &g : datafile.GetGlyphTable())
+    {
+        size_t cost = 0;
+        if (m_weight > 0)
+            m_glyphsizes.push_back(get_glyph_size(g.data, dict, fast, cost));
+        else
+            m_glyphsizes.push_back(get_glyph_size(g.data, dict, fast));
+
+        m_glyphcosts.push_back(cost);
+        m_glyphtotal += m_glyphsizes.back();
+        m_costtotal += cost;
+    }
+
+    m_size = Objective(get_dictionary_size(dict, fast) + m_glyphtotal,
+                       m_costtotal);
+}
+
+size_t SizeEvaluator::Objective(size_t bytes, size_t cost) const
+{
+    if (m_weight <= 0 || m_glyphsizes.empty())
+        return bytes;
+
+    return bytes + (size_t)std::llround(m_weight * cost / m_glyphsizes.size());
+}
+
+size_t SizeEvaluator::Compute(const DataFile &trial, size_t index,
+                              std::vector<size_t> &affected,
+                              std::vector<size_t> &newsizes,
+                              std::vector<size_t> &newcosts,
+                              size_t &work) const
+{
+    const std::vector<DataFile::glyphentry_t> &glyphs = trial.GetGlyphTable();
+    const DataFile::dictentry_t &old_entry = m_dictionary.at(index);
+    const DataFile::dictentry_t &new_entry = trial.GetDictionaryEntry(index);
+
+    const dict_tree_t &dict = get_dict_tree(trial.GetDictionary(), m_fast,
+                                            m_layout, m_weight > 0);
+
+    // With the two-byte codewords, the position of each entry in the sorted
+    // dictionary decides the length of its codeword. Moving the entry to
+    // another group of the sort, or changing between the narrow and the
+    // wide mode, can change the size of any glyph.
+    if ((dict.wide || is_wide(m_dictionary)) &&
+        (cmp_dict_coding(old_entry, new_entry) ||
+         cmp_dict_coding(new_entry, old_entry)))
+    {
+        for (size_t i = 0; i < glyphs.size(); i++)
+            affected.push_back(i);
+    }
+    else
+    {
+        // Otherwise only glyphs that contain either the removed or the
+        // added string can have a different encoding.
+        m_index->Find(glyphs, old_entry.replacement, affected);
+        m_index->Find(glyphs, new_entry.replacement, affected);
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()),
+                       affected.end());
+    }
+
+    work += affected.size() + 1;
+
+    size_t total = m_glyphtotal;
+    size_t costtotal = m_costtotal;
+    for (size_t i : affected)
+    {
+        size_t size, cost = 0;
+        if (m_weight > 0)
+            size = get_glyph_size(glyphs[i].data, dict, m_fast, cost);
+        else
+            size = get_glyph_size(glyphs[i].data, dict, m_fast);
+
+        newsizes.push_back(size);
+        newcosts.push_back(cost);
+        total = total - m_glyphsizes[i] + size;
+        costtotal = costtotal - m_glyphcosts[i] + cost;
+    }
+
+    return Objective(total + get_dictionary_size(dict, m_fast), costtotal);
+}
+
+size_t SizeEvaluator::Evaluate(const DataFile &trial, size_t index) const
+{
+    std::vector<size_t> affected, newsizes, newcosts;
+    return Compute(trial, index, affected, newsizes, newcosts, m_work);
+}
+
+size_t SizeEvaluator::Evaluate(const DataFile &trial, size_t index,
+                               size_t &work) const
+{
+    std::vector<size_t> affected, newsizes, newcosts;
+    return Compute(trial, index, affected, newsizes, newcosts, work);
+}
+
+size_t SizeEvaluator::Update(const DataFile &trial, size_t index)
+{
+    std::vector<size_t> affected, newsizes, newcosts;
+    m_size = Compute(trial, index, affected, newsizes, newcosts, m_work);
+
+    for (size_t i = 0; i < affected.size(); i++)
+    {
+        m_glyphtotal = m_glyphtotal - m_glyphsizes[affected[i]] + newsizes[i];
+        m_glyphsizes[affected[i]] = newsizes[i];
+        m_costtotal = m_costtotal - m_glyphcosts[affected[i]] + newcosts[i];
+        m_glyphcosts[affected[i]] = newcosts[i];
+    }
+
+    m_dictionary.at(index) = trial.GetDictionaryEntry(index);
+    return m_size;
+}
+
+size_t get_rle_size(const DataFile::pixels_t &pixels)
+{
+    byte_counter_t counter;
+    encode_rle(pixels, counter);
+    return counter.count;
+}
+
+std::vector<std::pair<size_t, size_t> > get_fill_runs(size_t code)
+{
+    if (code < DICT_START || code > 255)
+        throw std::out_of_range("not a fill entry: " + std::to_string(code));
+
+    size_t bitcount = fillentry_bitcount(code);
+    uint8_t byte = code - DICT_START7BIT;
+    std::vector<std::pair<size_t, size_t> > runs;
+
+    for (size_t i = 0; i < bitcount; i++)
+    {
+        if ((byte >> i) & 1)
+        {
+            if (runs.empty())
+                runs.push_back(std::make_pair(0, 0));
+            runs.back().second++;
+        }
+        else
+        {
+            if (runs.empty() || runs.back().second)
+                runs.push_back(std::make_pair(0, 0));
+            runs.back().first++;
+        }
+    }
+
+    return runs;
+}
+
 size_t get_encoded_size(const encoded_font_t &encoded)
 {
     size_t total = 0;
@@ -643,15 +1507,112 @@ size_t get_encoded_size(const encoded_font_t &encoded)
     return total;
 }
 
+size_t get_encoded_size(const DataFile &datafile, bool fast,
+                        tree_layout_t layout)
+{
+    const dict_tree_t &dict = get_dict_tree(datafile.GetDictionary(), fast,
+                                            layout);
+
+    size_t total = get_dictionary_size(dict, fast);
+    for (const DataFile::glyphentry_t &g : datafile.GetGlyphTable())
+    {
+        total += get_glyph_size(g.data, dict, fast);
+    }
+
+    return total;
+}
+
+size_t get_decode_cost(const DataFile &datafile, bool fast,
+                       tree_layout_t layout)
+{
+    const dict_tree_t &dict = get_dict_tree(datafile.GetDictionary(), fast,
+                                            layout, true);
+
+    size_t total = 0;
+    for (const DataFile::glyphentry_t &g : datafile.GetGlyphTable())
+    {
+        size_t cost;
+        get_glyph_size(g.data, dict, fast, cost);
+        total += cost;
+    }
+
+    return total;
+}
+
+// Check if the encoded font uses the two-byte codewords.
+static bool is_wide(const encoded_font_t &encoded)
+{
+    return is_wide(encoded.rle_dictionary.size() + encoded.ref_dictionary.size());
+}
+
+// Decoding cost of a single codeword in the encoded data.
+static size_t get_codeword_cost(const encoded_font_t &encoded, int ref)
+{
+    size_t rle_count = encoded.rle_dictionary.size();
+    size_t ref_count = encoded.ref_dictionary.size();
+
+    if (ref == 0)
+    {
+        return 1;
+    }
+    else if (ref <= 15)
+    {
+        return 2;
+    }
+    else if (ref < DICT_START)
+    {
+        return 1;
+    }
+    else if (codeword_entry(ref) < rle_count)
+    {
+        const encoded_font_t::rlestring_t &rle =
+            encoded.rle_dictionary.at(codeword_entry(ref));
+        return 1 + rle.size() + count_rle_runs(rle);
+    }
+    else if (codeword_entry(ref) - rle_count < ref_count)
+    {
+        const encoded_font_t::refstring_t &r =
+            encoded.ref_dictionary.at(codeword_entry(ref) - rle_count);
+        size_t cost = 1;
+        for (size_t pos = 0; pos < r.size(); )
+            cost += get_codeword_cost(encoded, read_codeword(r, pos, is_wide(encoded)));
+        return cost;
+    }
+    else
+    {
+        return 1 + count_bit_runs(ref);
+    }
+}
+
+size_t get_decode_cost(const encoded_font_t &encoded)
+{
+    bool wide = is_wide(encoded);
+    size_t total = 0;
+    for (const encoded_font_t::refstring_t &r : encoded.glyphs)
+    {
+        for (size_t pos = 0; pos < r.size(); )
+            total += get_codeword_cost(encoded, read_codeword(r, pos, wide));
+    }
+    return total;
+}
+
+size_t get_codeword_size(const encoded_font_t &encoded, uint8_t first)
+{
+    return (is_wide(encoded) && first >= ESCAPE_START) ? 2 : 1;
+}
+
 std::unique_ptr<DataFile::pixels_t> decode_glyph(
     const encoded_font_t &encoded,
     const encoded_font_t::refstring_t &refstring,
     const DataFile::fontinfo_t &fontinfo)
 {
     std::unique_ptr<DataFile::pixels_t> result(new DataFile::pixels_t);
+    size_t rle_count = encoded.rle_dictionary.size();
+    bool wide = is_wide(encoded);
 
-    for (uint8_t ref : refstring)
+    for (size_t pos = 0; pos < refstring.size(); )
     {
+        int ref = read_codeword(refstring, pos, wide);
         if (ref <= 15)
         {
             result->push_back(ref);
@@ -664,9 +1625,9 @@ std::unique_ptr<DataFile::pixels_t> decode_glyph(
         {
             throw std::logic_error("unknown code: " + std::to_string(ref));
         }
-        else if (ref - DICT_START < (int)encoded.rle_dictionary.size())
+        else if (codeword_entry(ref) < rle_count)
         {
-            for (uint8_t rle : encoded.rle_dictionary.at(ref - DICT_START))
+            for (uint8_t rle : encoded.rle_dictionary.at(codeword_entry(ref)))
             {
                 if ((rle & RLE_CODEMASK) == RLE_ZEROS)
                 {
@@ -701,15 +1662,15 @@ std::unique_ptr<DataFile::pixels_t> decode_glyph(
                 }
             }
         }
-        else if (ref - DICT_START - encoded.rle_dictionary.size() < encoded.ref_dictionary.size())
+        else if (codeword_entry(ref) - rle_count < encoded.ref_dictionary.size())
         {
-            size_t index = ref - DICT_START - encoded.rle_dictionary.size();
+            size_t index = codeword_entry(ref) - rle_count;
             std::unique_ptr<DataFile::pixels_t> part =
                 decode_glyph(encoded, encoded.ref_dictionary.at(index),
                              fontinfo);
             result->insert(result->end(), part->begin(), part->end());
         }
-        else
+        else if (ref < 256)
         {
             size_t bitcount = fillentry_bitcount(ref);
 
@@ -720,6 +1681,10 @@ std::unique_ptr<DataFile::pixels_t> decode_glyph(
                 result->push_back(p);
             }
         }
+        else
+        {
+            throw std::logic_error("unknown code: " + std::to_string(ref));
+        }
     }
 
     return result;
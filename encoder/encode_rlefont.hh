@@ -3,8 +3,10 @@
 #pragma once
 
 #include "datafile.hh"
+#include "threadpool.hh"
 #include <vector>
 #include <memory>
+#include <utility>
 
 namespace mcufont {
 namespace rlefont {
@@ -20,6 +22,7 @@ struct encoded_font_t
     // Each item is a reference to the dictionary.
     // Values 0 and 1 are hardcoded to mean 0 and 1.
     // All other values mean dictionary entry at (i-2).
+    // Large dictionaries use two-byte codewords, see get_codeword_size().
     typedef std::vector<uint8_t> refstring_t;
 
     std::vector<rlestring_t> rle_dictionary;
@@ -27,18 +30,133 @@ struct encoded_font_t
     std::vector<refstring_t> glyphs;
 };
 
-// Encode all the glyphs.
+// Memory layout of the dictionary lookup tree used by the encoder. Both give
+// the same results, so the layout only affects the speed. The flat layout
+// has smaller nodes, but has to be built from the pointer tree, which does
+// not pay off when a tree is used for only a few glyphs as in the optimizer.
+// The layout is given to each call, and the tree that each thread keeps
+// between calls is rebuilt when it changes.
+enum tree_layout_t
+{
+    TREE_POINTERS, // Nodes linked by pointers
+    TREE_FLAT      // Breadth-first array of nodes linked by 32-bit indices
+};
+
+// Encode all the glyphs. If pool is given, the glyphs are encoded in
+// parallel, with the same result.
 std::unique_ptr<encoded_font_t> encode_font(const DataFile &datafile,
-                                            bool fast = true);
+                                            bool fast = true,
+                                            ThreadPool *pool = nullptr,
+                                            tree_layout_t layout = TREE_POINTERS);
 
 // Sum up the total size of the encoded glyphs + dictionary.
 size_t get_encoded_size(const encoded_font_t &encoded);
 
-inline size_t get_encoded_size(const DataFile &datafile, bool fast = true)
+// Compute the same size as get_encoded_size(*encode_font(datafile, fast)),
+// but only count the bytes instead of storing the encoded data. Unlike
+// encode_font(), does not verify the encoding.
+size_t get_encoded_size(const DataFile &datafile, bool fast = true,
+                        tree_layout_t layout = TREE_POINTERS);
+
+// Estimate the work done by the decoder to render all the glyphs once. Each
+// codeword and RLE code read by the decoder counts as one step, and so does
+// each call of the pixel callback. Runs continuing over the end of a row are
+// counted as a single call.
+size_t get_decode_cost(const encoded_font_t &encoded);
+
+// Compute the same as get_decode_cost(*encode_font(datafile, fast)), but
+// without storing the encoded data.
+size_t get_decode_cost(const DataFile &datafile, bool fast = true,
+                       tree_layout_t layout = TREE_POINTERS);
+
+// Get the number of bytes in the codeword that starts with the given byte.
+// Fonts with more dictionary entries than DataFile::dictionarysize use
+// escape bytes followed by a second byte for the entries that do not fit
+// into a single byte.
+size_t get_codeword_size(const encoded_font_t &encoded, uint8_t first);
+
+// Get the size of the pixels encoded as an RLE dictionary entry, excluding
+// the offset table entry.
+size_t get_rle_size(const DataFile::pixels_t &pixels);
+
+// Get the pixels of a fill entry codeword, i.e. one that is at least
+// DICT_START + number of dictionary entries, as runs in the order the
+// decoder writes them. Each run is a number of transparent pixels followed
+// by a number of opaque pixels, and there are at most 4 of them.
+std::vector<std::pair<size_t, size_t> > get_fill_runs(size_t code);
+
+// Encode the dictionary and a single glyph. The glyphs vector of the result
+// contains only the requested glyph.
+std::unique_ptr<encoded_font_t> encode_glyph(const DataFile &datafile,
+                                             size_t index, bool fast = true,
+                                             tree_layout_t layout = TREE_POINTERS);
+
+// Keeps track of the encoded size of each glyph, so that the effect of
+// changing a single dictionary entry can be computed by re-encoding only the
+// glyphs that contain either the old or the new replacement string.
+//
+// With a non-zero decode_weight, the sizes are instead the encoded size plus
+// decode_weight bytes for each step of the average decoding cost per glyph,
+// see get_decode_cost(). This trades size for rendering speed.
+class SizeEvaluator
 {
-    std::unique_ptr<encoded_font_t> e = encode_font(datafile, fast);
-    return get_encoded_size(*e);
-}
+public:
+    // Encodes the whole datafile once to initialize the glyph sizes.
+    SizeEvaluator(const DataFile &datafile, bool fast = true,
+                  double decode_weight = 0,
+                  tree_layout_t layout = TREE_POINTERS);
+
+    // Get the total encoded size of the current state.
+    size_t GetSize() const { return m_size; }
+
+    // Get the decoding cost of the current state, if decode_weight is
+    // non-zero.
+    size_t GetDecodeCost() const { return m_costtotal; }
+
+    // Get the tree layout used for the evaluations.
+    tree_layout_t GetTreeLayout() const { return m_layout; }
+
+    // Compute the encoded size of the trial datafile. The trial must be equal
+    // to the current state except for the dictionary entry at index.
+    size_t Evaluate(const DataFile &trial, size_t index) const;
+
+    // Same as Evaluate(), but adds the work done to the work parameter
+    // instead of GetWork(), so that several threads can call it at once.
+    size_t Evaluate(const DataFile &trial, size_t index, size_t &work) const;
+
+    // Add work done by the above to GetWork().
+    void AddWork(size_t work) { m_work += work; }
+
+    // Same as Evaluate(), but also makes the trial the current state.
+    size_t Update(const DataFile &trial, size_t index);
+
+    // Amount of work done by Evaluate() and Update() so far, counted in
+    // encoded glyphs and dictionaries. Unlike timing, this is deterministic.
+    size_t GetWork() const { return m_work; }
+
+private:
+    class GlyphIndex;
+
+    std::shared_ptr<const GlyphIndex> m_index;
+    std::vector<DataFile::dictentry_t> m_dictionary;
+    std::vector<size_t> m_glyphsizes;
+    std::vector<size_t> m_glyphcosts;
+    size_t m_glyphtotal;
+    size_t m_costtotal;
+    size_t m_size;
+    bool m_fast;
+    double m_weight;
+    tree_layout_t m_layout;
+    mutable size_t m_work;
+
+    size_t Objective(size_t bytes, size_t cost) const;
+
+    size_t Compute(const DataFile &trial, size_t index,
+                   std::vector<size_t> &affected,
+                   std::vector<size_t> &newsizes,
+                   std::vector<size_t> &newcosts,
+                   size_t &work) const;
+};
 
 // Decode a single glyph (for verification).
 std::unique_ptr<DataFile::pixels_t> decode_glyph(
@@ -56,6 +174,11 @@ std::unique_ptr<DataFile::pixels_t> decode_glyph(
 
 #ifdef CXXTEST_RUNNING
 #include <cxxtest/TestSuite.h>
+#include "bdf_import.hh"
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
 
 using namespace mcufont;
 using namespace mcufont::rlefont;
@@ -92,6 +215,21 @@ public:
         TS_ASSERT_EQUALS(e->glyphs.at(2), glyph2);
     }
 
+    void testParallelEncode()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+        ThreadPool pool(3);
+
+        for (bool fast : {true, false})
+        {
+            std::unique_ptr<encoded_font_t> e1 = encode_font(*f, fast);
+            std::unique_ptr<encoded_font_t> e2 = encode_font(*f, fast, &pool);
+            TS_ASSERT(e1->glyphs == e2->glyphs);
+            TS_ASSERT(e1->ref_dictionary == e2->ref_dictionary);
+        }
+    }
+
     void testDecode()
     {
         std::istringstream s(testfile);
@@ -107,7 +245,246 @@ public:
         }
     }
 
+    void testSizeEvaluator()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+        SizeEvaluator eval(*f);
+
+        TS_ASSERT_EQUALS(eval.GetSize(), get_encoded_size(*f));
+
+        // Replace an entry with a longer one
+        DataFile trial = *f;
+        DataFile::dictentry_t d = trial.GetDictionaryEntry(1);
+        d.replacement = {0,0,0,0,0,0,0,0,0,0,0,14,0,0,0,0,14,14,14,14};
+        trial.SetDictionaryEntry(1, d);
+        TS_ASSERT_EQUALS(eval.Evaluate(trial, 1), get_encoded_size(trial));
+
+        // Remove an entry after committing the previous change
+        eval.Update(trial, 1);
+        DataFile::dictentry_t dummy = {};
+        trial.SetDictionaryEntry(2, dummy);
+        TS_ASSERT_EQUALS(eval.Evaluate(trial, 2), get_encoded_size(trial));
+    }
+
+    void testSizeEvaluatorRealFont()
+    {
+        // A full dictionary, and one with free codes for the fill entries.
+        check_random_trials(DataFile::dictionarysize, DataFile::dictionarysize);
+        check_random_trials(DataFile::dictionarysize, 150);
+    }
+
+    void testWideSizeEvaluator()
+    {
+        // Wide all the time, and starting one entry past the single byte
+        // codewords, so that emptying or filling entries switches between
+        // the narrow and the wide modes.
+        check_random_trials(600, 600);
+        check_random_trials(600, DataFile::dictionarysize + 1);
+    }
+
+    void testEncodedSize()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+
+        for (bool fast : {false, true})
+        {
+            std::unique_ptr<encoded_font_t> e = encode_font(*f, fast);
+            TS_ASSERT_EQUALS(get_encoded_size(*f, fast), get_encoded_size(*e));
+        }
+    }
+
+    void testDecodeCost()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+
+        for (bool fast : {false, true})
+        {
+            std::unique_ptr<encoded_font_t> e = encode_font(*f, fast);
+            TS_ASSERT_EQUALS(get_decode_cost(*f, fast), get_decode_cost(*e));
+        }
+
+        // Glyph 0 is the ref entry {24, 24} three times. Entry 24 is the
+        // RLE entry 0x01, 0xCE, 0x01, 0xCE with two runs of pixels.
+        std::unique_ptr<encoded_font_t> e = encode_glyph(*f, 0, false);
+        TS_ASSERT_EQUALS(get_decode_cost(*e), 3 * (1 + 2 * (1 + 4 + 2)));
+    }
+
+    void testWeightedEvaluator()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+        SizeEvaluator eval(*f, true, 2.0);
+
+        TS_ASSERT_EQUALS(eval.GetDecodeCost(), get_decode_cost(*f));
+        TS_ASSERT_EQUALS(eval.GetSize(), get_encoded_size(*f) +
+                         (size_t)std::llround(2.0 * get_decode_cost(*f) / 3));
+
+        DataFile trial = *f;
+        DataFile::dictentry_t dummy = {};
+        trial.SetDictionaryEntry(3, dummy);
+        eval.Update(trial, 3);
+        TS_ASSERT_EQUALS(eval.GetDecodeCost(), get_decode_cost(trial));
+        TS_ASSERT_EQUALS(eval.GetSize(), get_encoded_size(trial) +
+                         (size_t)std::llround(2.0 * get_decode_cost(trial) / 3));
+    }
+
+    void testTreeReuse()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+        std::unique_ptr<encoded_font_t> e1 = encode_font(*f, false);
+
+        // Encoding with a different dictionary in between must not leave
+        // anything behind in the reused tree.
+        DataFile trial = *f;
+        DataFile::dictentry_t d = trial.GetDictionaryEntry(0);
+        d.replacement = {0,14,0,14,0,14,0,0,0,0,0,0,0,14,14,14,14,14};
+        trial.SetDictionaryEntry(0, d);
+        encode_font(trial, false);
+
+        std::unique_ptr<encoded_font_t> e2 = encode_font(*f, false);
+        TS_ASSERT(e1->ref_dictionary == e2->ref_dictionary);
+        TS_ASSERT(e1->glyphs == e2->glyphs);
+    }
+
+    void testTreeLayouts()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+
+        for (bool fast : {false, true})
+        {
+            std::unique_ptr<encoded_font_t> e1 =
+                encode_font(*f, fast, nullptr, TREE_FLAT);
+            std::unique_ptr<encoded_font_t> e2 =
+                encode_font(*f, fast, nullptr, TREE_POINTERS);
+
+            TS_ASSERT(e1->rle_dictionary == e2->rle_dictionary);
+            TS_ASSERT(e1->ref_dictionary == e2->ref_dictionary);
+            TS_ASSERT(e1->glyphs == e2->glyphs);
+
+            SizeEvaluator eval(*f, fast, 0, TREE_FLAT);
+            TS_ASSERT_EQUALS(eval.GetSize(), get_encoded_size(*e2));
+        }
+    }
+
+    void testWideCodewords()
+    {
+        std::istringstream s(testfile);
+        std::unique_ptr<DataFile> f = DataFile::Load(s);
+        f->SetDictionarySize(400);
+
+        // Fill the dictionary past the single byte codewords, and put the
+        // useful entries at the end.
+        for (size_t i = 4; i < 300; i++)
+        {
+            DataFile::dictentry_t d = {};
+            for (size_t j = 0; j < 9; j++)
+                d.replacement.push_back((i & (1 << j)) ? 15 : 0);
+            f->SetDictionaryEntry(i, d);
+        }
+
+        DataFile::dictentry_t d = {};
+        d.replacement = {0,0,0,0,14,14,14,14,0,0,0,14};
+        f->SetDictionaryEntry(300, d);
+        d.replacement = {14,14,0,0,0,0,14,14,14,14,0,0};
+        f->SetDictionaryEntry(301, d);
+        d.replacement = f->GetGlyphEntry(1).data;
+        d.ref_encode = true;
+        f->SetDictionaryEntry(302, d);
+
+        for (bool fast : {false, true})
+        {
+            std::unique_ptr<encoded_font_t> e = encode_font(*f, fast);
+
+            for (size_t i = 0; i < 3; i++)
+            {
+                std::unique_ptr<DataFile::pixels_t> dec;
+                dec = decode_glyph(*e, i, f->GetFontInfo());
+                TS_ASSERT_EQUALS(*dec, f->GetGlyphEntry(i).data);
+            }
+
+            TS_ASSERT_EQUALS(get_encoded_size(*f, fast), get_encoded_size(*e));
+            TS_ASSERT_EQUALS(get_decode_cost(*f, fast), get_decode_cost(*e));
+        }
+
+        // Glyph 2 is the two entries past the single byte codewords.
+        std::unique_ptr<encoded_font_t> e = encode_font(*f, false);
+        TS_ASSERT_EQUALS(e->glyphs.at(2).size(), 4);
+        TS_ASSERT_EQUALS(get_codeword_size(*e, e->glyphs.at(2).at(0)), 2);
+    }
+
+    void testFillRuns()
+    {
+        typedef std::vector<std::pair<size_t, size_t> > runs_t;
+
+        // 7 bits 0011010 from the lowest up.
+        runs_t expected = {{2, 2}, {1, 1}, {1, 0}};
+        TS_ASSERT(get_fill_runs(4 + 0x2C) == expected);
+
+        // The 2-bit codes only use the lowest bits of the pattern.
+        expected = {{0, 2}};
+        TS_ASSERT(get_fill_runs(255) == expected);
+
+        TS_ASSERT_THROWS(get_fill_runs(23), const std::out_of_range &);
+    }
+
 private:
+    // Load a real font with count dictionary entries taken from random
+    // parts of the glyphs, and compare the sizes from SizeEvaluator with
+    // get_encoded_size() for random changes to the dictionary.
+    void check_random_trials(size_t dict_size, size_t count)
+    {
+        std::ifstream file("../fonts/fixed_5x8.bdf");
+        TS_ASSERT(file.good());
+        std::unique_ptr<DataFile> f = LoadBDF(file);
+        if (dict_size > DataFile::dictionarysize)
+            f->SetDictionarySize(dict_size);
+
+        std::mt19937 rnd(1234);
+        auto random_entry = [&]() {
+            DataFile::dictentry_t d = {};
+            const DataFile::pixels_t &g =
+                f->GetGlyphEntry(rnd() % f->GetGlyphCount()).data;
+            size_t length = 2 + rnd() % 14;
+            size_t begin = rnd() % (g.size() - length);
+            d.replacement.assign(g.begin() + begin, g.begin() + begin + length);
+            d.ref_encode = (rnd() % 4 == 0);
+            return d;
+        };
+
+        DataFile::dictentry_t dummy = {};
+        for (size_t i = 0; i < f->GetDictionarySize(); i++)
+            f->SetDictionaryEntry(i, (i < count) ? random_entry() : dummy);
+
+        SizeEvaluator eval(*f);
+        TS_ASSERT_EQUALS(eval.GetSize(), get_encoded_size(*f));
+
+        for (size_t n = 0; n < 200; n++)
+        {
+            size_t index = rnd() % std::min(count + 8, f->GetDictionarySize());
+            DataFile::dictentry_t d = f->GetDictionaryEntry(index);
+            switch (rnd() % 3)
+            {
+                case 0: d = dummy; break;
+                case 1: d.ref_encode = !d.ref_encode; break;
+                case 2: d = random_entry(); break;
+            }
+
+            DataFile trial = f->MakeTrial(index, d);
+            TS_ASSERT_EQUALS(eval.Evaluate(trial, index), get_encoded_size(trial));
+
+            if (rnd() % 2)
+            {
+                eval.Update(trial, index);
+                *f = trial;
+            }
+        }
+    }
+
     static constexpr const char *testfile =
         "Version 1\n"
         "FontName Sans Serif\n"
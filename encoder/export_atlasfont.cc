@@ -0,0 +1,301 @@
+#include "export_atlasfont.hh"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include "exporttools.hh"
+#include "ccfixes.hh"
+
+#define ATLASFONT_FORMAT_VERSION 1
+
+namespace mcufont {
+namespace atlasfont {
+
+void pack_atlas(std::vector<atlas_rect_t> &rects, size_t align,
+                size_t &width, size_t &height)
+{
+    auto aligned = [=](size_t w) { return (w + align - 1) / align * align; };
+
+    // Aim for a square atlas, but every bitmap must fit on a shelf.
+    size_t area = 0;
+    width = align;
+    for (const atlas_rect_t &r : rects)
+    {
+        area += aligned(r.width) * r.height;
+        width = std::max(width, aligned(r.width));
+    }
+    width = std::max(width, aligned((size_t)std::ceil(std::sqrt((double)area))));
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < rects.size(); i++)
+        order.push_back(i);
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return rects[a].height > rects[b].height;
+    });
+
+    size_t x = 0, y = 0, shelf_height = 0;
+    for (size_t i : order)
+    {
+        atlas_rect_t &r = rects[i];
+
+        // Empty bitmaps take no space at all.
+        if (r.width == 0 || r.height == 0)
+        {
+            r.x = r.y = 0;
+            continue;
+        }
+
+        if (x + r.width > width)
+        {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+
+        r.x = x;
+        r.y = y;
+        x += aligned(r.width);
+        shelf_height = std::max(shelf_height, r.height);
+    }
+
+    height = y + shelf_height;
+}
+
+// Visible part of a glyph, relative to the character bounding box.
+static atlas_rect_t crop_glyph(const DataFile::glyphentry_t &glyph,
+                               const DataFile::fontinfo_t &fontinfo)
+{
+    atlas_rect_t crop = {};
+    size_t x_end = 0, y_end = 0;
+    size_t x_begin = fontinfo.max_width, y_begin = fontinfo.max_height;
+
+    for (int y = 0; y < fontinfo.max_height; y++)
+    {
+        for (int x = 0; x < fontinfo.max_width; x++)
+        {
+            if (glyph.data.at(y * fontinfo.max_width + x))
+            {
+                x_begin = std::min(x_begin, (size_t)x);
+                y_begin = std::min(y_begin, (size_t)y);
+                x_end = std::max(x_end, (size_t)x + 1);
+                y_end = std::max(y_end, (size_t)y + 1);
+            }
+        }
+    }
+
+    if (x_end > 0)
+    {
+        crop.x = x_begin;
+        crop.y = y_begin;
+        crop.width = x_end - x_begin;
+        crop.height = y_end - y_begin;
+    }
+
+    return crop;
+}
+
+// Glyphs of a single font, and their place in the atlas.
+struct fontglyphs_t
+{
+    const DataFile *datafile;
+    std::string name;
+    std::vector<atlas_rect_t> crops;
+    size_t first_rect;
+};
+
+void write_source(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &fonts,
+                  const std::vector<std::string> &names,
+                  size_t bits_per_pixel, size_t kerning_zones)
+{
+    if (bits_per_pixel != 4 && bits_per_pixel != 8)
+        throw std::out_of_range("invalid bits per pixel: " + std::to_string(bits_per_pixel));
+
+    name = filename_to_identifier(name);
+
+    out << std::endl;
+    out << std::endl;
+    out << "/* Start of automatically generated font atlas " << name << ". */" << std::endl;
+    out << std::endl;
+
+    out << "#ifndef MF_ATLASFONT_INTERNALS" << std::endl;
+    out << "#define MF_ATLASFONT_INTERNALS" << std::endl;
+    out << "#endif" << std::endl;
+    out << "#include \"mf_atlasfont.h\"" << std::endl;
+    out << std::endl;
+
+    out << "#ifndef MF_ATLASFONT_VERSION_" << ATLASFONT_FORMAT_VERSION << "_SUPPORTED" << std::endl;
+    out << "#error The font file is not compatible with this version of mcufont." << std::endl;
+    out << "#endif" << std::endl;
+    out << std::endl;
+
+    // Crop the glyphs of all the fonts and pack them together.
+    std::vector<fontglyphs_t> glyphs;
+    std::vector<atlas_rect_t> rects;
+    for (size_t i = 0; i < fonts.size(); i++)
+    {
+        fontglyphs_t g;
+        g.datafile = fonts.at(i);
+        g.name = filename_to_identifier(names.at(i));
+        g.first_rect = rects.size();
+
+        for (const DataFile::glyphentry_t &glyph : g.datafile->GetGlyphTable())
+        {
+            g.crops.push_back(crop_glyph(glyph, g.datafile->GetFontInfo()));
+            rects.push_back(g.crops.back());
+        }
+
+        glyphs.push_back(g);
+    }
+
+    size_t atlas_width, atlas_height;
+    pack_atlas(rects, 8 / bits_per_pixel, atlas_width, atlas_height);
+
+    if (atlas_width > 65535 || atlas_height > 65535)
+        throw std::out_of_range("atlas is too large: " + std::to_string(atlas_width) + "x" + std::to_string(atlas_height));
+
+    // Draw the glyphs into the atlas.
+    size_t stride = (atlas_width * bits_per_pixel + 7) / 8;
+    std::vector<unsigned> data(stride * atlas_height);
+    for (const fontglyphs_t &g : glyphs)
+    {
+        const DataFile::fontinfo_t &fi = g.datafile->GetFontInfo();
+        for (size_t i = 0; i < g.crops.size(); i++)
+        {
+            const atlas_rect_t &crop = g.crops[i];
+            const atlas_rect_t &dest = rects[g.first_rect + i];
+            const DataFile::glyphentry_t &glyph = g.datafile->GetGlyphEntry(i);
+
+            for (size_t y = 0; y < crop.height; y++)
+            {
+                for (size_t x = 0; x < crop.width; x++)
+                {
+                    unsigned v = glyph.data.at((crop.y + y) * fi.max_width + crop.x + x);
+                    size_t ax = dest.x + x;
+                    unsigned &byte = data.at((dest.y + y) * stride + ax * bits_per_pixel / 8);
+
+                    if (bits_per_pixel == 8)
+                        byte = v * 0x11;
+                    else
+                        byte |= (ax & 1) ? v : (v << 4);
+                }
+            }
+        }
+    }
+
+    write_const_table(out, data, "uint8_t", "mf_atlas_" + name + "_data", 1);
+
+    out << "static const struct mf_atlasfont_atlas_s mf_atlas_" << name << " = {" << std::endl;
+    out << "    mf_atlas_" << name << "_data," << std::endl;
+    out << "    " << stride << ", /* stride */" << std::endl;
+    out << "    " << atlas_width << ", /* width */" << std::endl;
+    out << "    " << atlas_height << ", /* height */" << std::endl;
+    out << "    " << bits_per_pixel << ", /* bits per pixel */" << std::endl;
+    out << "};" << std::endl;
+    out << std::endl;
+
+    for (const fontglyphs_t &g : glyphs)
+    {
+        const DataFile &datafile = *g.datafile;
+        const std::string &fontname = g.name;
+
+        // The glyph tables are small compared to the atlas, so the ranges
+        // are only split at gaps in the characters.
+        auto get_glyph_size = [](size_t i) { return (size_t)1; };
+        std::vector<char_range_t> ranges = compute_char_ranges(datafile,
+            get_glyph_size, 65535, 16);
+
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            const char_range_t &range = ranges.at(i);
+            out << "static const struct mf_atlasfont_glyph_s mf_atlasfont_" << fontname << "_glyphs_" << i << "[] = {" << std::endl;
+            for (size_t j = 0; j < range.glyph_indices.size(); j++)
+            {
+                int index = range.glyph_indices[j];
+                out << "    {";
+                if (index < 0)
+                {
+                    out << "0, 0, 0, 0, 0, 0, 0";
+                }
+                else
+                {
+                    const atlas_rect_t &crop = g.crops.at(index);
+                    const atlas_rect_t &dest = rects.at(g.first_rect + index);
+                    out << dest.x << ", " << dest.y << ", "
+                        << crop.width << ", " << crop.height << ", "
+                        << crop.x << ", " << crop.y << ", "
+                        << datafile.GetGlyphEntry(index).width;
+                }
+                out << "}, /* " << range.first_char + j << " */" << std::endl;
+            }
+            out << "};" << std::endl;
+            out << std::endl;
+        }
+
+        out << "static const struct mf_atlasfont_char_range_s mf_atlasfont_" << fontname << "_char_ranges[] = {" << std::endl;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            out << "    {" << ranges.at(i).first_char
+                << ", " << ranges.at(i).char_count
+                << ", mf_atlasfont_" << fontname << "_glyphs_" << i << "}," << std::endl;
+        }
+        out << "};" << std::endl;
+        out << std::endl;
+
+        // Any shade of gray is visible to the kerning.
+        if (kerning_zones)
+        {
+            write_kerning_table(out, "mf_atlasfont_" + fontname, datafile,
+                                ranges, kerning_zones, 1);
+        }
+
+        int flags = datafile.GetFontInfo().flags | EXPORT_FLAG_SORTED_RANGES;
+
+        out << "const struct mf_atlasfont_s mf_atlasfont_" << fontname << " = {" << std::endl;
+        out << "    {" << std::endl;
+        out << "    " << "\"" << datafile.GetFontInfo().name << "\"," << std::endl;
+        out << "    " << "\"" << fontname << "\"," << std::endl;
+        out << "    " << datafile.GetFontInfo().max_width << ", /* width */" << std::endl;
+        out << "    " << datafile.GetFontInfo().max_height << ", /* height */" << std::endl;
+        out << "    " << get_min_x_advance(datafile) << ", /* min x advance */" << std::endl;
+        out << "    " << get_max_x_advance(datafile) << ", /* max x advance */" << std::endl;
+        out << "    " << datafile.GetFontInfo().baseline_x << ", /* baseline x */" << std::endl;
+        out << "    " << datafile.GetFontInfo().baseline_y << ", /* baseline y */" << std::endl;
+        out << "    " << datafile.GetFontInfo().line_height << ", /* line height */" << std::endl;
+        out << "    " << flags << ", /* flags */" << std::endl;
+        out << "    " << select_fallback_char(datafile) << ", /* fallback character */" << std::endl;
+        out << "    " << "&mf_atlasfont_character_width," << std::endl;
+        out << "    " << "&mf_atlasfont_render_character," << std::endl;
+        out << "    " << "&mf_atlasfont_render_character_clipped," << std::endl;
+        if (kerning_zones)
+            out << "    " << "&mf_atlasfont_" << fontname << "_kerning," << std::endl;
+        out << "    }," << std::endl;
+
+        out << "    " << ATLASFONT_FORMAT_VERSION << ", /* version */" << std::endl;
+        out << "    " << "&mf_atlas_" << name << "," << std::endl;
+        out << "    " << ranges.size() << ", /* char range count */" << std::endl;
+        out << "    " << "mf_atlasfont_" << fontname << "_char_ranges," << std::endl;
+        out << "};" << std::endl;
+
+        // Write the font lookup structure
+        out << std::endl;
+        out << "#ifdef MF_INCLUDED_FONTS" << std::endl;
+        out << "/* List entry for searching fonts by name. */" << std::endl;
+        out << "static const struct mf_font_list_s mf_atlasfont_" << fontname << "_listentry = {" << std::endl;
+        out << "    MF_INCLUDED_FONTS," << std::endl;
+        out << "    (struct mf_font_s*)&mf_atlasfont_" << fontname << std::endl;
+        out << "};" << std::endl;
+        out << "#undef MF_INCLUDED_FONTS" << std::endl;
+        out << "#define MF_INCLUDED_FONTS (&mf_atlasfont_" << fontname << "_listentry)" << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
+    }
+
+    out << std::endl;
+    out << "/* End of automatically generated font atlas " << name << ". */" << std::endl;
+    out << std::endl;
+}
+
+}}
@@ -0,0 +1,82 @@
+// Write out the glyphs of one or more fonts as prerendered bitmaps in a
+// shared atlas, for the mf_atlasfont format.
+
+#pragma once
+
+#include "datafile.hh"
+#include <iostream>
+#include <vector>
+
+namespace mcufont {
+namespace atlasfont {
+
+// Location of a bitmap in the atlas.
+struct atlas_rect_t
+{
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+};
+
+// Place the bitmaps of the given sizes in the atlas, filling in x and y.
+// The bitmaps are put on shelves from the tallest down, in an atlas about
+// as wide as it is tall. Each bitmap starts at a multiple of align pixels.
+// Returns the size of the atlas in width and height.
+void pack_atlas(std::vector<atlas_rect_t> &rects, size_t align,
+                size_t &width, size_t &height);
+
+// Write the fonts with a single atlas named after the output file. Each
+// font is named after the corresponding entry in names. bits_per_pixel is
+// either 4 or 8. If kerning_zones is non-zero, the edge profiles of the
+// characters are precomputed for a decoder with MF_KERNING_ZONES equal to
+// it.
+void write_source(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &fonts,
+                  const std::vector<std::string> &names,
+                  size_t bits_per_pixel = 4, size_t kerning_zones = 0);
+
+} }
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+
+using namespace mcufont;
+using namespace mcufont::atlasfont;
+
+class AtlasFontTests: public CxxTest::TestSuite
+{
+public:
+    void testPackAtlas()
+    {
+        std::vector<atlas_rect_t> rects;
+        for (size_t i = 0; i < 40; i++)
+        {
+            atlas_rect_t r = {};
+            r.width = 1 + i % 7;
+            r.height = 1 + (i * 5) % 11;
+            rects.push_back(r);
+        }
+
+        size_t width, height;
+        pack_atlas(rects, 2, width, height);
+        TS_ASSERT(width >= 7);
+
+        for (size_t i = 0; i < rects.size(); i++)
+        {
+            const atlas_rect_t &a = rects[i];
+            TS_ASSERT_EQUALS(a.x % 2, 0);
+            TS_ASSERT(a.x + a.width <= width);
+            TS_ASSERT(a.y + a.height <= height);
+
+            for (size_t j = 0; j < i; j++)
+            {
+                const atlas_rect_t &b = rects[j];
+                bool apart = a.x + a.width <= b.x || b.x + b.width <= a.x ||
+                             a.y + a.height <= b.y || b.y + b.height <= a.y;
+                TS_ASSERT(apart);
+            }
+        }
+    }
+};
+#endif
@@ -15,13 +15,14 @@
 namespace mcufont {
 namespace bwfont {
 
+// Pixels with at least this value are set in the exported glyphs.
+static const int threshold = 8;
+
 static void encode_glyph(const DataFile::glyphentry_t &glyph,
                          const DataFile::fontinfo_t &fontinfo,
                          std::vector<unsigned> &dest,
                          int num_cols)
 {
-    const int threshold = 8;
-
     if (glyph.data.size() == 0)
         return;
 
@@ -59,6 +60,48 @@ static void encode_glyph(const DataFile::glyphentry_t &glyph,
     }
 }
 
+// Same as encode_glyph, but stores each row of pixels as bytes, LSB as the
+// leftmost pixel, instead of each column.
+static void encode_glyph_rows(const DataFile::glyphentry_t &glyph,
+                              const DataFile::fontinfo_t &fontinfo,
+                              std::vector<unsigned> &dest,
+                              int num_cols)
+{
+    if (glyph.data.size() == 0)
+        return;
+
+    if (num_cols == 0)
+    {
+        for (int x = 0; x < fontinfo.max_width; x++)
+        {
+            for (int y = 0; y < fontinfo.max_height; y++)
+            {
+                size_t index = y * fontinfo.max_width + x;
+                if (glyph.data.at(index) >= threshold)
+                    num_cols = x + 1;
+            }
+        }
+    }
+
+    for (int y = 0; y < fontinfo.max_height; y++)
+    {
+        for (int x = 0; x < num_cols; x += 8)
+        {
+            int remain = std::min(8, num_cols - x);
+            uint8_t byte = 0;
+            for (int i = 0; i < remain; i++)
+            {
+                size_t index = y * fontinfo.max_width + x + i;
+                if (glyph.data.at(index) >= threshold)
+                {
+                    byte |= (1 << i);
+                }
+            }
+            dest.push_back(byte);
+        }
+    }
+}
+
 struct cropinfo_t
 {
     size_t offset_x;
@@ -73,7 +116,8 @@ static void encode_character_range(std::ostream &out,
                                    const DataFile &datafile,
                                    const char_range_t &range,
                                    unsigned range_index,
-                                   cropinfo_t &cropinfo)
+                                   cropinfo_t &cropinfo,
+                                   bool rows)
 {
     std::vector<DataFile::glyphentry_t> glyphs;
     bool constant_width = true;
@@ -120,17 +164,22 @@ static void encode_character_range(std::ostream &out,
     cropinfo.height_bytes = (cropinfo.height_pixels + 7) / 8;
     cropinfo.width = width;
 
-    // Then format and write out the glyph data
+    // Then format and write out the glyph data. In the row layout, the
+    // offsets are in units of height_pixels bytes, which makes the
+    // difference of two offsets the number of bytes per row.
     std::vector<unsigned> offsets;
     std::vector<unsigned> data;
     std::vector<unsigned> widths;
-    size_t stride = cropinfo.height_bytes;
+    size_t stride = rows ? cropinfo.height_pixels : cropinfo.height_bytes;
 
     for (const DataFile::glyphentry_t &g : glyphs)
     {
         offsets.push_back(data.size() / stride);
         widths.push_back(g.width);
-        encode_glyph(g, new_fi, data, width);
+        if (rows)
+            encode_glyph_rows(g, new_fi, data, width);
+        else
+            encode_glyph(g, new_fi, data, width);
     }
     offsets.push_back(data.size() / stride);
 
@@ -143,7 +192,8 @@ static void encode_character_range(std::ostream &out,
     }
 }
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile)
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  size_t kerning_zones, bool rows)
 {
     name = filename_to_identifier(name);
 
@@ -163,6 +213,14 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#endif" << std::endl;
     out << std::endl;
 
+    if (rows)
+    {
+        out << "#ifndef MF_BWFONT_ROWS_SUPPORTED" << std::endl;
+        out << "#error The font file is not compatible with this version of mcufont." << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
+    }
+
     // Split the characters into ranges
     DataFile::fontinfo_t f = datafile.GetFontInfo();
     size_t glyph_size = f.max_width * ((f.max_height + 7) / 8);
@@ -175,7 +233,8 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     for (size_t i = 0; i < ranges.size(); i++)
     {
         cropinfo_t cropinfo;
-        encode_character_range(out, name, datafile, ranges.at(i), i, cropinfo);
+        encode_character_range(out, name, datafile, ranges.at(i), i, cropinfo,
+                               rows);
         crops.push_back(cropinfo);
     }
 
@@ -202,8 +261,15 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "};" << std::endl;
     out << std::endl;
 
+    if (kerning_zones)
+    {
+        write_kerning_table(out, "mf_bwfont_" + name, datafile, ranges,
+                            kerning_zones, threshold);
+    }
+
     // Fonts in this format are always black & white
     int flags = datafile.GetFontInfo().flags | DataFile::FLAG_BW;
+    flags |= EXPORT_FLAG_SORTED_RANGES;
 
     // Pull it all together in the rlefont_s structure.
     out << "const struct mf_bwfont_s mf_bwfont_" << name << " = {" << std::endl;
@@ -220,7 +286,18 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "    " << flags << ", /* flags */" << std::endl;
     out << "    " << select_fallback_char(datafile) << ", /* fallback character */" << std::endl;
     out << "    " << "&mf_bwfont_character_width," << std::endl;
-    out << "    " << "&mf_bwfont_render_character," << std::endl;
+    if (rows)
+    {
+        out << "    " << "&mf_bwfont_render_character_rows," << std::endl;
+        out << "    " << "&mf_bwfont_render_character_rows_clipped," << std::endl;
+    }
+    else
+    {
+        out << "    " << "&mf_bwfont_render_character," << std::endl;
+        out << "    " << "&mf_bwfont_render_character_clipped," << std::endl;
+    }
+    if (kerning_zones)
+        out << "    " << "&mf_bwfont_" << name << "_kerning," << std::endl;
     out << "    }," << std::endl;
 
     out << "    " << BWFONT_FORMAT_VERSION << ", /* version */" << std::endl;
@@ -10,7 +10,12 @@ namespace bwfont {
 
 void write_header(std::ostream &out, std::string name, const DataFile &datafile);
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile);
+// If kerning_zones is non-zero, the edge profiles of the characters are
+// precomputed for a decoder with MF_KERNING_ZONES equal to it.
+// If rows is true, the glyphs are stored row by row instead of column by
+// column, which is faster to decode on 32-bit processors.
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  size_t kerning_zones = 0, bool rows = false);
 
 } }
 
@@ -6,23 +6,26 @@
 #include <algorithm>
 #include <string>
 #include <cctype>
+#include <stdexcept>
 #include "exporttools.hh"
 #include "ccfixes.hh"
 
 #define RLEFONT_FORMAT_VERSION 4
 
+// Codeword that fills the rest of the glyph with zeros.
+#define REF_FILLZEROS 16
+
+// First codeword of the dictionary entries.
+#define DICT_START 24
+
 namespace mcufont {
 namespace rlefont {
 
-// Encode the dictionary entries and the offsets to them.
-// Generates tables dictionary_data and dictionary_offsets.
-static void encode_dictionary(std::ostream &out,
-                              const std::string &name,
-                              const DataFile &datafile,
-                              const encoded_font_t &encoded)
+// Collect the dictionary entries and the offsets to them.
+static void build_dictionary(const encoded_font_t &encoded,
+                             std::vector<unsigned> &data,
+                             std::vector<unsigned> &offsets)
 {
-    std::vector<unsigned> offsets;
-    std::vector<unsigned> data;
     for (const encoded_font_t::rlestring_t &r : encoded.rle_dictionary)
     {
         offsets.push_back(data.size());
@@ -36,26 +39,148 @@ static void encode_dictionary(std::ostream &out,
     }
     offsets.push_back(data.size());
 
-    write_const_table(out, data, "uint8_t", "mf_rlefont_" + name + "_dictionary_data", 1);
-    write_const_table(out, offsets, "uint16_t", "mf_rlefont_" + name + "_dictionary_offsets", 1, 4);
+    if (data.size() > 65535)
+        throw std::runtime_error("dictionary data does not fit in 16-bit offsets");
 }
 
-// Encode the data tables for a single character range.
-// Generates tables glyph_data_i and glyph_offsets_i.
-static void encode_character_range(std::ostream &out,
+// Encode the dictionary entries and the offsets to them.
+// Generates tables dictionary_data and dictionary_offsets, followed by the
+// suffix.
+static void encode_dictionary(std::ostream &out,
                               const std::string &name,
-                              const DataFile &datafile,
-                              const encoded_font_t& encoded,
-                              const char_range_t& range,
-                              unsigned range_index)
+                              const std::string &suffix,
+                              const encoded_font_t &encoded)
 {
     std::vector<unsigned> offsets;
     std::vector<unsigned> data;
+    build_dictionary(encoded, data, offsets);
+
+    write_const_table(out, data, "uint8_t", "mf_rlefont_" + name + "_dictionary_data" + suffix, 1);
+    write_const_table(out, offsets, "uint16_t", "mf_rlefont_" + name + "_dictionary_offsets" + suffix, 1, 4);
+}
+
+// Check if the encoded font uses the two-byte codewords.
+static bool has_wide_codes(const encoded_font_t &encoded)
+{
+    return encoded.rle_dictionary.size() + encoded.ref_dictionary.size()
+           > DataFile::dictionarysize;
+}
+
+// Combine the glyphs of the blocks into a single data file, for the tables
+// that are shared by the whole font. The glyph indices of block k start at
+// bases[k]. The flags are the ones that all the blocks have.
+static std::unique_ptr<DataFile> merge_blocks(const std::vector<const DataFile*> &blocks,
+                                              std::vector<int> &bases)
+{
+    std::vector<DataFile::glyphentry_t> glyphs;
+    DataFile::fontinfo_t fontinfo = blocks.at(0)->GetFontInfo();
+
+    for (const DataFile *block : blocks)
+    {
+        const DataFile::fontinfo_t &f = block->GetFontInfo();
+        if (f.max_width != fontinfo.max_width ||
+            f.max_height != fontinfo.max_height)
+        {
+            throw std::runtime_error("blocks have different glyph sizes");
+        }
+
+        fontinfo.flags &= f.flags;
+        bases.push_back(glyphs.size());
+        glyphs.insert(glyphs.end(), block->GetGlyphTable().begin(),
+                      block->GetGlyphTable().end());
+    }
+
+    return std::unique_ptr<DataFile>(new DataFile({}, glyphs, fontinfo));
+}
+
+// Get the number of pixels that each codeword of the glyph decodes to, and
+// the number of bytes in each codeword. The fill code covers the rest of the
+// glyph, and the other codewords decode to the same pixels anywhere.
+static std::vector<size_t> get_codeword_lengths(const encoded_font_t &encoded,
+                                                const encoded_font_t::refstring_t &glyph,
+                                                const DataFile::fontinfo_t &fontinfo,
+                                                std::vector<size_t> &bytes)
+{
+    std::vector<size_t> lengths;
+    size_t total = fontinfo.max_width * fontinfo.max_height;
+    size_t pos = 0;
+    for (size_t i = 0; i < glyph.size(); )
+    {
+        size_t size = get_codeword_size(encoded, glyph.at(i));
+        encoded_font_t::refstring_t codeword(glyph.begin() + i,
+                                             glyph.begin() + i + size);
+        i += size;
+
+        size_t length;
+        if (codeword.size() == 1 && codeword.at(0) == REF_FILLZEROS)
+            length = std::max(total, pos) - pos;
+        else
+            length = decode_glyph(encoded, codeword, fontinfo)->size();
+
+        lengths.push_back(length);
+        bytes.push_back(size);
+        pos += length;
+    }
+    return lengths;
+}
+
+// Compute the restart points for every restart_rows'th row of a glyph, in
+// the format described in mf_rlefont.h.
+static std::vector<unsigned> encode_restart_points(const encoded_font_t &encoded,
+                                                   const encoded_font_t::refstring_t &glyph,
+                                                   const DataFile::fontinfo_t &fontinfo,
+                                                   size_t restart_rows)
+{
+    std::vector<unsigned> result;
+    std::vector<size_t> bytes;
+    std::vector<size_t> lengths = get_codeword_lengths(encoded, glyph, fontinfo,
+                                                       bytes);
+
+    size_t count = (fontinfo.max_height - 1) / restart_rows;
+    size_t index = 0, offset = 0, start = 0;
+    for (size_t i = 1; i <= count; i++)
+    {
+        // Find the codeword that contains the first pixel of the row.
+        size_t row_start = i * restart_rows * fontinfo.max_width;
+        while (index < lengths.size() && start + lengths[index] <= row_start)
+        {
+            start += lengths[index];
+            offset += bytes[index];
+            index++;
+        }
+
+        // A glyph without codewords is never decoded past the first one.
+        if (index == lengths.size())
+        {
+            index = 0;
+            offset = 0;
+            start = 0;
+        }
+
+        result.push_back(offset & 0xFF);
+        result.push_back(offset >> 8);
+        result.push_back(start & 0xFF);
+        result.push_back(start >> 8);
+    }
+
+    return result;
+}
+
+// Collect the glyph data and the offsets to it for a single character range.
+// If share is true, characters with the same glyph point to the same data.
+static void build_character_range(const DataFile &datafile,
+                                  const encoded_font_t& encoded,
+                                  const char_range_t& range,
+                                  size_t restart_rows,
+                                  bool share,
+                                  std::vector<unsigned> &data,
+                                  std::vector<unsigned> &offsets)
+{
     std::map<size_t, unsigned> already_encoded;
 
     for (int glyph_index : range.glyph_indices)
     {
-        if (already_encoded.count(glyph_index))
+        if (share && already_encoded.count(glyph_index))
         {
             offsets.push_back(already_encoded[glyph_index]);
         }
@@ -74,18 +199,273 @@ static void encode_character_range(std::ostream &out,
             already_encoded[glyph_index] = data.size();
 
             data.push_back(width);
+
+            if (restart_rows)
+            {
+                std::vector<unsigned> restarts = encode_restart_points(
+                    encoded, r, datafile.GetFontInfo(), restart_rows);
+                data.insert(data.end(), restarts.begin(), restarts.end());
+            }
+
             data.insert(data.end(), r.begin(), r.end());
         }
     }
+}
 
-    write_const_table(out, data, "uint8_t", "mf_rlefont_" + name + "_glyph_data_" + std::to_string(range_index), 1);
-    write_const_table(out, offsets, "uint16_t", "mf_rlefont_" + name + "_glyph_offsets_" + std::to_string(range_index), 1, 4);
+// Try to code the offsets as a base for each group of 1 << shift characters
+// and 8-bit deltas from it. Returns false if some delta does not fit.
+static bool build_delta_offsets(const std::vector<unsigned> &offsets,
+                                size_t shift,
+                                std::vector<unsigned> &bases,
+                                std::vector<unsigned> &deltas)
+{
+    bases.clear();
+    deltas.clear();
+
+    size_t group = (size_t)1 << shift;
+    for (size_t i = 0; i < offsets.size(); i += group)
+    {
+        size_t end = std::min(i + group, offsets.size());
+        unsigned base = *std::min_element(offsets.begin() + i, offsets.begin() + end);
+        bases.push_back(base);
+
+        for (size_t j = i; j < end; j++)
+        {
+            if (offsets.at(j) - base > 255)
+                return false;
+
+            deltas.push_back(offsets.at(j) - base);
+        }
+    }
+
+    return true;
+}
+
+// Data tables for a single character range, in the format chosen for it.
+struct range_tables_t
+{
+    std::vector<unsigned> data;
+    std::vector<unsigned> offsets;
+    std::vector<unsigned> bases;
+    std::vector<unsigned> deltas;
+
+    // Group shift of the delta coding, or -1 for the plain offsets.
+    int shift;
+
+    size_t size() const
+    {
+        return data.size() + 2 * offsets.size() + 4 * bases.size() + deltas.size();
+    }
+};
+
+// Approximate size of struct mf_rlefont_char_range_s on 32-bit targets.
+static const size_t char_range_struct_size = 28;
+
+// Build the data tables for a single character range. If delta_offsets is
+// true, picks the smallest of the plain offsets and the delta coding with
+// the largest groups that work. For the delta coding, characters with the
+// same glyph may need separate copies of it to keep the deltas small.
+static range_tables_t build_range_tables(const DataFile &datafile,
+                                         const encoded_font_t& encoded,
+                                         const char_range_t& range,
+                                         size_t restart_rows,
+                                         bool delta_offsets)
+{
+    range_tables_t best;
+    build_character_range(datafile, encoded, range, restart_rows, true,
+                          best.data, best.offsets);
+    best.shift = -1;
+
+    bool have_best = (best.data.size() <= 65536);
+    if (!delta_offsets)
+        return best;
+
+    for (bool share : {true, false})
+    {
+        range_tables_t t;
+        build_character_range(datafile, encoded, range, restart_rows, share,
+                              t.data, t.offsets);
+
+        // Without sharing, groups of one character always work.
+        for (t.shift = 4; t.shift >= 0; t.shift--)
+        {
+            if (build_delta_offsets(t.offsets, t.shift, t.bases, t.deltas))
+                break;
+        }
+
+        if (t.shift < 0)
+            continue;
+
+        t.offsets.clear();
+        if (!have_best || t.size() < best.size())
+        {
+            best = t;
+            have_best = true;
+        }
+    }
+
+    return best;
 }
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile)
+// Encode the data tables for a single character range.
+// Generates tables glyph_data_i and either glyph_offsets_i, or glyph_bases_i
+// and glyph_deltas_i.
+static void encode_character_range(std::ostream &out,
+                                   const std::string &name,
+                                   const range_tables_t &tables,
+                                   unsigned range_index)
 {
+    std::string suffix = "_" + std::to_string(range_index);
+    write_const_table(out, tables.data, "uint8_t", "mf_rlefont_" + name + "_glyph_data" + suffix, 1);
+
+    if (tables.shift < 0)
+    {
+        write_const_table(out, tables.offsets, "uint16_t", "mf_rlefont_" + name + "_glyph_offsets" + suffix, 1, 4);
+    }
+    else
+    {
+        write_const_table(out, tables.bases, "uint32_t", "mf_rlefont_" + name + "_glyph_bases" + suffix, 1, 8);
+        write_const_table(out, tables.deltas, "uint8_t", "mf_rlefont_" + name + "_glyph_deltas" + suffix, 1);
+    }
+}
+
+// Split the characters of each block into ranges, with at most maximum_size
+// bytes of glyph data each. Returns the ranges sorted by the first character,
+// together with the index of the block they belong to.
+static std::vector<std::pair<char_range_t, size_t> > compute_block_ranges(
+    const std::vector<const DataFile*> &blocks,
+    const std::vector<std::unique_ptr<encoded_font_t> > &encoded,
+    size_t restart_rows, size_t maximum_size)
+{
+    size_t restart_size = 0;
+    if (restart_rows)
+        restart_size = 4 * ((blocks.at(0)->GetFontInfo().max_height - 1) / restart_rows);
+
+    std::vector<std::pair<char_range_t, size_t> > block_ranges;
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+        const encoded_font_t &e = *encoded.at(k);
+        auto get_glyph_size = [&e, restart_size](size_t i)
+        {
+            // +1 byte for glyph width
+            return e.glyphs[i].size() + 1 + restart_size;
+        };
+
+        for (const char_range_t &r : compute_char_ranges(*blocks.at(k),
+                                                         get_glyph_size, maximum_size, 16))
+        {
+            block_ranges.push_back(std::make_pair(r, k));
+        }
+    }
+
+    // The decoder binary searches the ranges, so they must be in order.
+    std::stable_sort(block_ranges.begin(), block_ranges.end(),
+        [](const std::pair<char_range_t, size_t> &a,
+           const std::pair<char_range_t, size_t> &b)
+        { return a.first.first_char < b.first.first_char; });
+
+    for (size_t i = 1; i < block_ranges.size(); i++)
+    {
+        const char_range_t &prev = block_ranges.at(i - 1).first;
+        if (prev.first_char + prev.char_count > block_ranges.at(i).first.first_char)
+            throw std::runtime_error("blocks have overlapping character ranges");
+    }
+
+    return block_ranges;
+}
+
+// Write the parameters of the font as constants for mf_rlefont_decoder.h,
+// together with the pixel runs of the fill entries, and include the decoder.
+// The dictionary sizes are only constant if there is a single block.
+static void write_specialized_decoder(std::ostream &out, const std::string &name,
+    const DataFile &datafile,
+    const std::vector<std::unique_ptr<encoded_font_t> > &encoded,
+    size_t restart_rows)
+{
+    std::string prefix = "mf_rlefont_" + name;
+
+    out << "#ifndef MF_RLEFONT_SPECIALIZED_SUPPORTED" << std::endl;
+    out << "#error The font file needs specialized decoder support from mcufont." << std::endl;
+    out << "#endif" << std::endl;
+    out << std::endl;
+
+    // The fill entries of every block are after its dictionary.
+    size_t bin_start = 256;
+    for (const std::unique_ptr<encoded_font_t> &e : encoded)
+    {
+        size_t count = e->rle_dictionary.size() + e->ref_dictionary.size();
+        bin_start = std::min(bin_start, (size_t)DICT_START + count);
+    }
+
+    if (bin_start < 256)
+    {
+        std::vector<unsigned> runs;
+        for (size_t code = bin_start; code < 256; code++)
+        {
+            std::vector<std::pair<size_t, size_t> > r = get_fill_runs(code);
+            r.resize(4, std::make_pair(0, 0));
+            for (const std::pair<size_t, size_t> &run : r)
+                runs.push_back((run.first << 4) | run.second);
+        }
+
+        write_const_table(out, runs, "uint8_t", prefix + "_bin_runs", 1);
+    }
+
+    out << "/* Decoder specialized for the parameters of this font. */" << std::endl;
+    out << "#define MF_RLEFONT_DECODER(name) " << prefix << "_ ## name" << std::endl;
+    if (encoded.size() == 1)
+    {
+        const encoded_font_t &e = *encoded.at(0);
+        out << "#define MF_RLEFONT_RLE_COUNT(dict) " << e.rle_dictionary.size() << std::endl;
+        out << "#define MF_RLEFONT_DICT_COUNT(dict) " << e.rle_dictionary.size() + e.ref_dictionary.size() << std::endl;
+    }
+    out << "#define MF_RLEFONT_WIDTH(font) " << datafile.GetFontInfo().max_width << std::endl;
+    out << "#define MF_RLEFONT_HEIGHT(font) " << datafile.GetFontInfo().max_height << std::endl;
+    out << "#define MF_RLEFONT_RESTART_ROWS(rlefont) " << restart_rows << std::endl;
+    if (bin_start < 256)
+    {
+        out << "#define MF_RLEFONT_BIN_RUNS " << prefix << "_bin_runs" << std::endl;
+        out << "#define MF_RLEFONT_BIN_START " << bin_start << std::endl;
+    }
+    out << "#include \"mf_rlefont_decoder.h\"" << std::endl;
+    out << std::endl;
+}
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  size_t restart_rows, size_t kerning_zones, bool delta_offsets,
+                  bool specialize, ThreadPool *pool)
+{
+    write_source(out, name, std::vector<const DataFile*>{&datafile},
+                 restart_rows, kerning_zones, delta_offsets, specialize, pool);
+}
+
+void write_source(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &blocks,
+                  size_t restart_rows, size_t kerning_zones, bool delta_offsets,
+                  bool specialize, ThreadPool *pool)
+{
+    if (blocks.empty())
+        throw std::invalid_argument("no blocks to export");
+
     name = filename_to_identifier(name);
-    std::unique_ptr<encoded_font_t> encoded = encode_font(datafile, false);
+
+    std::vector<std::unique_ptr<encoded_font_t> > encoded;
+    bool wide = false;
+    for (const DataFile *block : blocks)
+    {
+        encoded.push_back(encode_font(*block, false, pool));
+        wide = wide || has_wide_codes(*encoded.back());
+    }
+
+    // The tables for the whole font use the glyphs of all the blocks.
+    std::unique_ptr<DataFile> merged;
+    std::vector<int> bases = {0};
+    if (blocks.size() > 1)
+    {
+        bases.clear();
+        merged = merge_blocks(blocks, bases);
+    }
+    const DataFile &datafile = merged ? *merged : *blocks.at(0);
 
     out << std::endl;
     out << std::endl;
@@ -103,35 +483,148 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#endif" << std::endl;
     out << std::endl;
 
-    // Write out the dictionary entries
-    encode_dictionary(out, name, datafile, *encoded);
+    if (wide)
+    {
+        out << "#ifndef MF_RLEFONT_WIDE_SUPPORTED" << std::endl;
+        out << "#error The font file needs two-byte codeword support from mcufont." << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
+    }
+
+    // Write out the dictionary entries. The first block uses the dictionary
+    // of the font, and the others have their own.
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+        std::string suffix = k ? "_" + std::to_string(k) : "";
+        encode_dictionary(out, name, suffix, *encoded.at(k));
+
+        if (k == 0)
+            continue;
 
-    // Split the characters into ranges
-    auto get_glyph_size = [&encoded](size_t i)
+        out << "static const struct mf_rlefont_dict_s mf_rlefont_" << name << "_dictionary" << suffix << " = {" << std::endl;
+        out << "    " << "mf_rlefont_" << name << "_dictionary_data" << suffix << "," << std::endl;
+        out << "    " << "mf_rlefont_" << name << "_dictionary_offsets" << suffix << "," << std::endl;
+        out << "    " << encoded.at(k)->rle_dictionary.size() << ", /* rle dict count */" << std::endl;
+        out << "    " << encoded.at(k)->ref_dictionary.size() + encoded.at(k)->rle_dictionary.size() << ", /* total dict count */" << std::endl;
+        out << "};" << std::endl;
+        out << std::endl;
+    }
+
+    // Split the characters of each block into ranges
+    std::vector<std::pair<char_range_t, size_t> > block_ranges =
+        compute_block_ranges(blocks, encoded, restart_rows, 65536);
+
+    auto build_tables = [&](const std::vector<std::pair<char_range_t, size_t> > &r)
     {
-        return encoded->glyphs[i].size() + 1; // +1 byte for glyph width
+        std::vector<range_tables_t> result;
+        for (const std::pair<char_range_t, size_t> &p : r)
+        {
+            result.push_back(build_range_tables(*blocks.at(p.second),
+                                                *encoded.at(p.second),
+                                                p.first, restart_rows,
+                                                delta_offsets));
+        }
+        return result;
+    };
+
+    auto total_size = [](const std::vector<range_tables_t> &tables)
+    {
+        size_t size = 0;
+        for (const range_tables_t &t : tables)
+            size += t.size() + char_range_struct_size;
+        return size;
     };
-    std::vector<char_range_t> ranges = compute_char_ranges(datafile,
-        get_glyph_size, 65536, 16);
+
+    // With the delta coded offsets, the ranges need not be split at 64 kB.
+    // Use the fewer ranges if they are not larger.
+    std::vector<range_tables_t> tables = build_tables(block_ranges);
+    if (delta_offsets)
+    {
+        std::vector<std::pair<char_range_t, size_t> > merged_ranges =
+            compute_block_ranges(blocks, encoded, restart_rows, 0xFFFFFFFF);
+
+        if (merged_ranges.size() < block_ranges.size())
+        {
+            std::vector<range_tables_t> merged_tables = build_tables(merged_ranges);
+            if (total_size(merged_tables) <= total_size(tables))
+            {
+                block_ranges = merged_ranges;
+                tables = merged_tables;
+            }
+        }
+    }
 
     // Write out glyph data for character ranges
-    for (size_t i = 0; i < ranges.size(); i++)
+    std::vector<char_range_t> ranges;
+    bool any_delta = false;
+    for (size_t i = 0; i < block_ranges.size(); i++)
+    {
+        const char_range_t &r = block_ranges.at(i).first;
+        size_t k = block_ranges.at(i).second;
+        encode_character_range(out, name, tables.at(i), i);
+        any_delta = any_delta || tables.at(i).shift >= 0;
+
+        // Same range with the glyph indices of the merged data file.
+        char_range_t m = r;
+        for (int &index : m.glyph_indices)
+        {
+            if (index >= 0)
+                index += bases.at(k);
+        }
+        ranges.push_back(m);
+    }
+
+    if (any_delta)
     {
-        encode_character_range(out, name, datafile, *encoded, ranges.at(i), i);
+        out << "#ifndef MF_RLEFONT_DELTA_OFFSETS_SUPPORTED" << std::endl;
+        out << "#error The font file needs delta coded offset support from mcufont." << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
     }
 
     // Write out a table describing the character ranges
     out << "static const struct mf_rlefont_char_range_s mf_rlefont_" << name << "_char_ranges[] = {" << std::endl;
     for (size_t i = 0; i < ranges.size(); i++)
     {
+        size_t k = block_ranges.at(i).second;
+        int shift = tables.at(i).shift;
         out << "    {" << ranges.at(i).first_char
-            << ", " << ranges.at(i).char_count
-            << ", mf_rlefont_" << name << "_glyph_offsets_" << i
-            << ", mf_rlefont_" << name << "_glyph_data_" << i << "}," << std::endl;
+            << ", " << ranges.at(i).char_count;
+        if (shift < 0)
+            out << ", mf_rlefont_" << name << "_glyph_offsets_" << i;
+        else
+            out << ", 0";
+        out << ", mf_rlefont_" << name << "_glyph_data_" << i;
+        if (k)
+            out << ", &mf_rlefont_" << name << "_dictionary_" << k;
+        else if (shift >= 0)
+            out << ", 0";
+        if (shift >= 0)
+        {
+            out << ", mf_rlefont_" << name << "_glyph_bases_" << i
+                << ", mf_rlefont_" << name << "_glyph_deltas_" << i
+                << ", " << shift;
+        }
+        out << "}," << std::endl;
     }
     out << "};" << std::endl;
     out << std::endl;
 
+    // Any shade of gray is visible to the kerning.
+    if (kerning_zones)
+    {
+        write_kerning_table(out, "mf_rlefont_" + name, datafile, ranges,
+                            kerning_zones, 1);
+    }
+
+    // The font uses either its own decoder or the generic one.
+    std::string decoder = "mf_rlefont_";
+    if (specialize)
+    {
+        write_specialized_decoder(out, name, datafile, encoded, restart_rows);
+        decoder += name + "_";
+    }
+
     // Pull it all together in the rlefont_s structure.
     out << "const struct mf_rlefont_s mf_rlefont_" << name << " = {" << std::endl;
     out << "    {" << std::endl;
@@ -144,19 +637,30 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "    " << datafile.GetFontInfo().baseline_x << ", /* baseline x */" << std::endl;
     out << "    " << datafile.GetFontInfo().baseline_y << ", /* baseline y */" << std::endl;
     out << "    " << datafile.GetFontInfo().line_height << ", /* line height */" << std::endl;
-    out << "    " << datafile.GetFontInfo().flags << ", /* flags */" << std::endl;
+    int flags = datafile.GetFontInfo().flags | EXPORT_FLAG_SORTED_RANGES;
+    if (wide)
+        flags |= EXPORT_FLAG_WIDE_CODES;
+    out << "    " << flags << ", /* flags */" << std::endl;
     out << "    " << select_fallback_char(datafile) << ", /* fallback character */" << std::endl;
     out << "    " << "&mf_rlefont_character_width," << std::endl;
-    out << "    " << "&mf_rlefont_render_character," << std::endl;
+    out << "    " << "&" << decoder << "render_character," << std::endl;
+    out << "    " << "&" << decoder << "render_character_clipped," << std::endl;
+    if (kerning_zones)
+        out << "    " << "&mf_rlefont_" << name << "_kerning," << std::endl;
+    else
+        out << "    " << "0, /* kerning table */" << std::endl;
+    out << "    " << "&" << decoder << "render_string," << std::endl;
     out << "    }," << std::endl;
 
     out << "    " << RLEFONT_FORMAT_VERSION << ", /* version */" << std::endl;
     out << "    " << "mf_rlefont_" << name << "_dictionary_data," << std::endl;
     out << "    " << "mf_rlefont_" << name << "_dictionary_offsets," << std::endl;
-    out << "    " << encoded->rle_dictionary.size() << ", /* rle dict count */" << std::endl;
-    out << "    " << encoded->ref_dictionary.size() + encoded->rle_dictionary.size() << ", /* total dict count */" << std::endl;
+    out << "    " << encoded.at(0)->rle_dictionary.size() << ", /* rle dict count */" << std::endl;
+    out << "    " << encoded.at(0)->ref_dictionary.size() + encoded.at(0)->rle_dictionary.size() << ", /* total dict count */" << std::endl;
     out << "    " << ranges.size() << ", /* char range count */" << std::endl;
     out << "    " << "mf_rlefont_" << name << "_char_ranges," << std::endl;
+    if (restart_rows)
+        out << "    " << restart_rows << ", /* restart rows */" << std::endl;
     out << "};" << std::endl;
 
     // Write the font lookup structure
@@ -177,5 +681,171 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << std::endl;
 }
 
-}}
+static void append_u16(std::vector<uint8_t> &out, size_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+}
+
+static void append_u32(std::vector<uint8_t> &out, size_t value)
+{
+    append_u16(out, value & 0xFFFF);
+    append_u16(out, value >> 16);
+}
+
+static void set_u32(std::vector<uint8_t> &out, size_t pos, size_t value)
+{
+    for (size_t i = 0; i < 4; i++)
+        out.at(pos + i) = (value >> (8 * i)) & 0xFF;
+}
+
+// Append the offset table and the data referred to by a table record,
+// and store their positions at record_pos.
+static void append_tables(std::vector<uint8_t> &blob, size_t record_pos,
+                          const std::vector<unsigned> &offsets,
+                          const std::vector<unsigned> &data)
+{
+    set_u32(blob, record_pos, blob.size());
+    for (unsigned offset : offsets)
+        append_u16(blob, offset);
+
+    set_u32(blob, record_pos + 4, blob.size());
+    blob.insert(blob.end(), data.begin(), data.end());
+}
+
+size_t write_blob(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &blocks,
+                  size_t restart_rows, ThreadPool *pool)
+{
+    if (blocks.empty())
+        throw std::invalid_argument("no blocks to export");
+
+    name = filename_to_identifier(name);
+
+    std::vector<std::unique_ptr<encoded_font_t> > encoded;
+    bool wide = false;
+    for (const DataFile *block : blocks)
+    {
+        encoded.push_back(encode_font(*block, false, pool));
+        wide = wide || has_wide_codes(*encoded.back());
+    }
+
+    std::vector<int> bases;
+    std::unique_ptr<DataFile> merged = merge_blocks(blocks, bases);
+    const DataFile::fontinfo_t &fontinfo = merged->GetFontInfo();
+
+    // The end offset of each range must fit in 16 bits as well.
+    std::vector<std::pair<char_range_t, size_t> > block_ranges =
+        compute_block_ranges(blocks, encoded, restart_rows, 65535);
 
+    if (block_ranges.size() > 65535)
+        throw std::runtime_error("too many character ranges for the image header");
+
+    std::vector<std::vector<unsigned> > dict_data(blocks.size());
+    std::vector<std::vector<unsigned> > dict_offsets(blocks.size());
+    size_t max_entries = 0, max_dict_data = 0;
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+        build_dictionary(*encoded.at(k), dict_data.at(k), dict_offsets.at(k));
+        max_entries = std::max(max_entries, dict_offsets.at(k).size() - 1);
+        max_dict_data = std::max(max_dict_data, dict_data.at(k).size());
+    }
+
+    std::vector<std::vector<unsigned> > glyph_data(block_ranges.size());
+    std::vector<std::vector<unsigned> > glyph_offsets(block_ranges.size());
+    size_t max_glyph = 0;
+    for (size_t i = 0; i < block_ranges.size(); i++)
+    {
+        size_t k = block_ranges.at(i).second;
+        std::vector<unsigned> &offsets = glyph_offsets.at(i);
+        std::vector<unsigned> &data = glyph_data.at(i);
+        build_character_range(*blocks.at(k), *encoded.at(k),
+                              block_ranges.at(i).first, restart_rows, false,
+                              data, offsets);
+        offsets.push_back(data.size());
+
+        if (data.size() > 65535)
+            throw std::runtime_error("glyph data does not fit in 16-bit offsets");
+
+        // The glyphs are not shared, so that the decoder can read each one
+        // up to the next offset in the table.
+        for (size_t j = 0; j + 1 < offsets.size(); j++)
+            max_glyph = std::max<size_t>(max_glyph, offsets.at(j + 1) - offsets.at(j));
+    }
+
+    int flags = fontinfo.flags | EXPORT_FLAG_SORTED_RANGES;
+    if (wide)
+        flags |= EXPORT_FLAG_WIDE_CODES;
+
+    // Header, see mf_streamfont.c for the layout.
+    std::vector<uint8_t> blob = {'M', 'F', 'S', 'F', 1, RLEFONT_FORMAT_VERSION};
+    blob.push_back(fontinfo.max_width);
+    blob.push_back(fontinfo.max_height);
+    blob.push_back(get_min_x_advance(*merged));
+    blob.push_back(get_max_x_advance(*merged));
+    blob.push_back(fontinfo.baseline_x & 0xFF);
+    blob.push_back(fontinfo.baseline_y);
+    blob.push_back(fontinfo.line_height);
+    blob.push_back(flags);
+    append_u16(blob, select_fallback_char(*merged));
+    blob.push_back(restart_rows);
+    blob.push_back(0);
+    append_u16(blob, block_ranges.size());
+    append_u16(blob, blocks.size());
+    append_u16(blob, max_glyph);
+    append_u16(blob, max_entries);
+    append_u16(blob, max_dict_data);
+    append_u32(blob, 0);
+    append_u32(blob, 0);
+    append_u32(blob, 0);
+
+    set_u32(blob, 36, blob.size());
+    blob.insert(blob.end(), fontinfo.name.begin(), fontinfo.name.end());
+    blob.push_back(0);
+    blob.insert(blob.end(), name.begin(), name.end());
+    blob.push_back(0);
+
+    // The table records, with the positions filled in below.
+    size_t dicts_pos = blob.size();
+    set_u32(blob, 32, dicts_pos);
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+        append_u16(blob, encoded.at(k)->rle_dictionary.size());
+        append_u16(blob, dict_offsets.at(k).size() - 1);
+        append_u32(blob, 0);
+        append_u32(blob, 0);
+        append_u32(blob, dict_data.at(k).size());
+    }
+
+    size_t ranges_pos = blob.size();
+    set_u32(blob, 28, ranges_pos);
+    for (size_t i = 0; i < block_ranges.size(); i++)
+    {
+        append_u16(blob, block_ranges.at(i).first.first_char);
+        append_u16(blob, block_ranges.at(i).first.char_count);
+        append_u16(blob, block_ranges.at(i).second);
+        append_u16(blob, 0);
+        append_u32(blob, 0);
+        append_u32(blob, 0);
+    }
+
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+        append_tables(blob, dicts_pos + 16 * k + 4,
+                      dict_offsets.at(k), dict_data.at(k));
+    }
+
+    for (size_t i = 0; i < block_ranges.size(); i++)
+    {
+        append_tables(blob, ranges_pos + 16 * i + 8,
+                      glyph_offsets.at(i), glyph_data.at(i));
+    }
+
+    out.write((const char*)blob.data(), blob.size());
+
+    // Same layout as in mf_streamfont_open().
+    return 16 * block_ranges.size() + 2 * (max_entries + 1)
+           + max_dict_data + max_glyph + 1;
+}
+
+}}
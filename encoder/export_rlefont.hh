@@ -5,11 +5,139 @@
 #include "datafile.hh"
 #include "encode_rlefont.hh"
 #include <iostream>
+#include <vector>
 
 namespace mcufont {
 namespace rlefont {
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile);
+// If restart_rows is non-zero, each glyph starts with restart points for
+// every restart_rows'th row, so that the decoder can start from the middle.
+// If kerning_zones is non-zero, the edge profiles of the characters are
+// precomputed for a decoder with MF_KERNING_ZONES equal to it.
+// If delta_offsets is true, the glyph offsets of the character ranges are
+// delta coded where it saves space, and the ranges are not split to keep
+// the offsets within 16 bits.
+// If specialize is true, the font gets its own copy of the decoder with the
+// dictionary sizes and other parameters as compile time constants. It is
+// faster but takes more code space for each font.
+// If pool is given, the glyphs are encoded in parallel. The output is the
+// same regardless of the number of threads.
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  size_t restart_rows = 0, size_t kerning_zones = 0,
+                  bool delta_offsets = false, bool specialize = false,
+                  ThreadPool *pool = nullptr);
+
+// Same as above, for a font split into blocks that each have their own
+// dictionary, see split_blocks(). The blocks must cover separate intervals
+// of characters.
+void write_source(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &blocks,
+                  size_t restart_rows = 0, size_t kerning_zones = 0,
+                  bool delta_offsets = false, bool specialize = false,
+                  ThreadPool *pool = nullptr);
+
+// Write the font as a binary image for mf_streamfont.h, for fonts that are
+// stored in external memory. The blocks are as above, and a single font is
+// one block. Returns the size of the arena that the decoder needs.
+size_t write_blob(std::ostream &out, std::string name,
+                  const std::vector<const DataFile*> &blocks,
+                  size_t restart_rows = 0, ThreadPool *pool = nullptr);
 
 } }
 
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+#include "importtools.hh"
+#include <sstream>
+
+using namespace mcufont;
+using namespace mcufont::rlefont;
+
+class RLEFontExportTests: public CxxTest::TestSuite
+{
+public:
+    void testWriteBlob()
+    {
+        DataFile::fontinfo_t fontinfo = {};
+        fontinfo.name = "Test";
+        fontinfo.max_width = 2;
+        fontinfo.max_height = 2;
+        fontinfo.line_height = 3;
+
+        std::vector<DataFile::glyphentry_t> glyphs(3);
+        glyphs[0].data = {0, 15, 15, 0}; glyphs[0].width = 2; glyphs[0].chars = {'a', 'z'};
+        glyphs[1].data = {15, 0, 0, 15}; glyphs[1].width = 2; glyphs[1].chars = {'b'};
+        glyphs[2].data = {15, 15, 8, 8}; glyphs[2].width = 1; glyphs[2].chars = {'c', 'd'};
+        DataFile f({}, glyphs, fontinfo);
+
+        std::vector<std::unique_ptr<DataFile> > blocks = split_blocks(f, 2);
+        std::vector<const DataFile*> pointers;
+        for (const std::unique_ptr<DataFile> &b : blocks)
+            pointers.push_back(b.get());
+
+        std::ostringstream out;
+        size_t arena = write_blob(out, "test.bin", pointers, 1);
+        std::string s = out.str();
+        std::vector<uint8_t> blob(s.begin(), s.end());
+
+        auto u16 = [&](size_t pos) { return blob.at(pos) | (blob.at(pos + 1) << 8); };
+        auto u32 = [&](size_t pos) { return u16(pos) | ((size_t)u16(pos + 2) << 16); };
+
+        TS_ASSERT_EQUALS(std::string(s, 0, 4), "MFSF");
+        TS_ASSERT_EQUALS(blob.at(4), 1);
+        TS_ASSERT_EQUALS(blob.at(5), 4);
+        TS_ASSERT_EQUALS(blob.at(6), 2);
+        TS_ASSERT_EQUALS(blob.at(7), 2);
+        TS_ASSERT_EQUALS(blob.at(12), 3);
+        TS_ASSERT_EQUALS(blob.at(16), 1);
+
+        size_t range_count = u16(18), dict_count = u16(20);
+        TS_ASSERT_EQUALS(dict_count, 2);
+        TS_ASSERT_EQUALS(arena, 16 * range_count + 2 * (u16(24) + 1)
+                                + u16(26) + u16(22) + 1);
+
+        TS_ASSERT_EQUALS(std::string(s.c_str() + u32(36)), "Test");
+        TS_ASSERT_EQUALS(std::string(s.c_str() + u32(36) + 5), "test");
+
+        // Each table that a record points to lies inside the image, and the
+        // last offset is the size of the data.
+        size_t entries = 0;
+        for (size_t k = 0; k < dict_count; k++)
+        {
+            size_t rec = u32(32) + 16 * k;
+            size_t count = u16(rec + 2);
+            TS_ASSERT(u16(rec) <= count);
+            TS_ASSERT_EQUALS(u32(rec + 8), u32(rec + 4) + 2 * (count + 1));
+            TS_ASSERT_EQUALS(u16(u32(rec + 4) + 2 * count), u32(rec + 12));
+            TS_ASSERT(u32(rec + 8) + u32(rec + 12) <= blob.size());
+            entries = std::max(entries, count);
+        }
+        TS_ASSERT_EQUALS(u16(24), entries);
+
+        std::vector<int> chars;
+        size_t max_glyph = 0;
+        for (size_t i = 0; i < range_count; i++)
+        {
+            size_t rec = u32(28) + 16 * i;
+            size_t count = u16(rec + 2);
+            TS_ASSERT(u16(rec + 4) < dict_count);
+            TS_ASSERT_EQUALS(u16(rec + 6), 0);
+            TS_ASSERT_EQUALS(u32(rec + 12), u32(rec + 8) + 2 * (count + 1));
+
+            for (size_t j = 0; j < count; j++)
+            {
+                size_t start = u16(u32(rec + 8) + 2 * j);
+                size_t end = u16(u32(rec + 8) + 2 * (j + 1));
+                TS_ASSERT(start <= end);
+                TS_ASSERT(u32(rec + 12) + end <= blob.size());
+                max_glyph = std::max(max_glyph, end - start);
+
+                if (end > start)
+                    chars.push_back(u16(rec) + j);
+            }
+        }
+        TS_ASSERT_EQUALS(u16(22), max_glyph);
+        TS_ASSERT_EQUALS(chars, std::vector<int>({'a', 'b', 'c', 'd', 'z'}));
+    }
+};
+#endif
@@ -1,5 +1,5 @@
 #include "exporttools.hh"
-#include <iomanip>
+#include <algorithm>
 #include <set>
 
 namespace mcufont {
@@ -29,28 +29,48 @@ std::string filename_to_identifier(std::string name)
 }
 
 // Write a vector of integers as line-wrapped hex/integer data for initializing const array.
+// The text is formatted by hand into one buffer and written at once, which
+// is much faster than the stream formatting for the megabytes of large fonts.
 void wordwrap_vector(std::ostream &out, const std::vector<unsigned> &data,
                      const std::string &prefix, size_t width)
 {
-    int values_per_column = (width <= 2) ? 16 : 8;
+    static const char digits[] = "0123456789abcdef";
+    size_t values_per_column = (width <= 2) ? 16 : 8;
 
-    std::ios::fmtflags flags(out.flags());
-    out << prefix;
-    out << std::hex << std::setfill('0');
+    std::string text;
+    text.reserve(prefix.size() * (data.size() / values_per_column + 1)
+                 + data.size() * (width + 4));
+    text += prefix;
     for (size_t i = 0; i < data.size(); i++)
     {
         if (i != 0) {
             if (i % values_per_column == 0) {
-                out << std::endl << prefix;
+                text += '\n';
+                text += prefix;
             }
             else {
-                out << " ";
+                text += ' ';
             }
         }
 
-        out << "0x" << std::setw(width) << (int)data.at(i) << ",";
+        // Digits in reverse order, zero padded to the width.
+        char value[16];
+        size_t count = 0;
+        unsigned v = data.at(i);
+        do {
+            value[count++] = digits[v & 15];
+            v >>= 4;
+        } while (v);
+        while (count < width)
+            value[count++] = '0';
+
+        text += "0x";
+        while (count)
+            text += value[--count];
+        text += ',';
     }
-    out.flags(flags);
+
+    out.write(text.data(), text.size());
 }
 
 // Write a vector of integers as a C constant array of given datatype.
@@ -184,5 +204,77 @@ std::vector<char_range_t> compute_char_ranges(const DataFile &datafile,
     return result;
 }
 
+std::vector<unsigned> compute_kerning_edges(const DataFile::glyphentry_t &glyph,
+                                            const DataFile::fontinfo_t &fontinfo,
+                                            size_t zones, int threshold)
+{
+    // Same zone division as mf_compute_kerning() in the decoder.
+    size_t height = fontinfo.max_height;
+    size_t width = fontinfo.max_width;
+    size_t zoneheight = std::max<size_t>(1, (height + zones - 1) / zones);
+    size_t count = (height + zoneheight - 1) / zoneheight;
+
+    std::vector<unsigned> result(2 * count);
+    std::fill(result.begin(), result.begin() + count, 255);
+
+    for (size_t y = 0; y < height && !glyph.data.empty(); y++)
+    {
+        size_t zone = y / zoneheight;
+        for (size_t x = 0; x < width; x++)
+        {
+            if (glyph.data.at(y * width + x) < threshold)
+                continue;
+
+            result.at(zone) = std::min<unsigned>(result.at(zone), x);
+            result.at(count + zone) = std::max<unsigned>(result.at(count + zone), x);
+        }
+    }
+
+    return result;
+}
+
+void write_kerning_table(std::ostream &out, const std::string &prefix,
+                         const DataFile &datafile,
+                         const std::vector<char_range_t> &ranges,
+                         size_t zones, int threshold)
+{
+    // Characters missing from the font are never looked up, because the
+    // decoder checks the character width first.
+    DataFile::glyphentry_t empty;
+    empty.width = 0;
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        std::vector<unsigned> edges;
+        for (int glyph_index : ranges.at(i).glyph_indices)
+        {
+            const DataFile::glyphentry_t &glyph = (glyph_index >= 0) ?
+                datafile.GetGlyphEntry(glyph_index) : empty;
+            std::vector<unsigned> e = compute_kerning_edges(
+                glyph, datafile.GetFontInfo(), zones, threshold);
+            edges.insert(edges.end(), e.begin(), e.end());
+        }
+
+        write_const_table(out, edges, "uint8_t",
+                          prefix + "_kerning_edges_" + std::to_string(i), 1);
+    }
+
+    out << "static const struct mf_kerning_range_s " << prefix << "_kerning_ranges[] = {" << std::endl;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        out << "    {" << ranges.at(i).first_char
+            << ", " << ranges.at(i).char_count
+            << ", " << prefix << "_kerning_edges_" << i << "}," << std::endl;
+    }
+    out << "};" << std::endl;
+    out << std::endl;
+
+    out << "static const struct mf_kerning_table_s " << prefix << "_kerning = {" << std::endl;
+    out << "    " << zones << ", /* zones */" << std::endl;
+    out << "    " << ranges.size() << ", /* range count */" << std::endl;
+    out << "    " << prefix << "_kerning_ranges," << std::endl;
+    out << "};" << std::endl;
+    out << std::endl;
+}
 
 }
@@ -40,7 +40,17 @@ struct char_range_t
     char_range_t(): first_char(0), char_count(0) {}
 };
 
+// Font flag written by the exporters to tell the decoder that the character
+// ranges are in increasing order, so that they can be binary searched.
+// Matches MF_FONT_FLAG_SORTED_RANGES in mf_font.h.
+static const int EXPORT_FLAG_SORTED_RANGES = 0x04;
+
+// Font flag written by the rlefont exporter when the dictionary is too large
+// for single byte codewords. Matches MF_FONT_FLAG_WIDE_CODES in mf_font.h.
+static const int EXPORT_FLAG_WIDE_CODES = 0x08;
+
 // Decide how to best divide the characters in the font into ranges.
+// The ranges are returned in increasing order of characters.
 // Limitations are:
 //  - Gaps longer than minimum_gap should result in separate ranges.
 //  - Each range can have encoded data size of at most maximum_size.
@@ -49,4 +59,55 @@ std::vector<char_range_t> compute_char_ranges(const DataFile &datafile,
     size_t maximum_size,
     size_t minimum_gap);
 
+// Compute the edge profile of a glyph for the decoder's kerning, split into
+// the given number of zones like with MF_KERNING_ZONES. Returns the x of the
+// leftmost visible pixel in each zone (255 if none), followed by the x of
+// the rightmost ones (0 if none). Pixels are visible if their value is at
+// least threshold. Only the zones that overlap the font height are included.
+std::vector<unsigned> compute_kerning_edges(const DataFile::glyphentry_t &glyph,
+                                            const DataFile::fontinfo_t &fontinfo,
+                                            size_t zones, int threshold);
+
+// Write the edge profiles of the characters in the ranges as a
+// struct mf_kerning_table_s called <prefix>_kerning.
+void write_kerning_table(std::ostream &out, const std::string &prefix,
+                         const DataFile &datafile,
+                         const std::vector<char_range_t> &ranges,
+                         size_t zones, int threshold);
+
 }
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+
+using namespace mcufont;
+
+class ExportToolsTests: public CxxTest::TestSuite
+{
+public:
+    void testKerningEdges()
+    {
+        DataFile::fontinfo_t fontinfo = {};
+        fontinfo.max_width = 4;
+        fontinfo.max_height = 5;
+
+        DataFile::glyphentry_t glyph;
+        glyph.width = 4;
+        glyph.data = {0, 0, 0, 0,
+                      0, 3, 9, 0,
+                      0, 0, 0, 0,
+                      15, 0, 0, 1,
+                      0, 0, 0, 0};
+
+        // Two rows per zone, so three zones overlap the font height.
+        std::vector<unsigned> edges = compute_kerning_edges(glyph, fontinfo, 3, 1);
+        std::vector<unsigned> expected = {1, 0, 255, 2, 3, 0};
+        TS_ASSERT_EQUALS(edges, expected);
+
+        // With a higher threshold, only the darker pixels count.
+        edges = compute_kerning_edges(glyph, fontinfo, 5, 8);
+        expected = {255, 2, 255, 0, 255, 0, 2, 0, 0, 0};
+        TS_ASSERT_EQUALS(edges, expected);
+    }
+};
+#endif
@@ -4,6 +4,8 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 #include "ccfixes.hh"
 
 #include <ft2build.h>
@@ -72,54 +74,44 @@ static void readfile(std::istream &file, std::vector<char> &data)
     }
 }
 
-std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw)
-{
-    std::vector<char> data;
-    readfile(file, data);
-
-    _FT_Library lib;
-    _FT_Face face(lib, data);
-
-    checkFT(FT_Set_Pixel_Sizes(face, size, size));
-
-    DataFile::fontinfo_t fontinfo = {};
-    std::vector<DataFile::glyphentry_t> glyphtable;
-    std::vector<DataFile::dictentry_t> dictionary;
-
-    // Convert size to pixels and round to nearest.
-    int u_per_em = face->units_per_EM;
-    auto topx = [size, u_per_em](int s) { return (s * size + u_per_em / 2) / u_per_em; };
-
-    fontinfo.name = std::string(face->family_name) + " " +
-                    std::string(face->style_name) + " " +
-                    std::to_string(size);
-
-    // Reserve 4 pixels on each side for antialiasing + hinting.
-    // They will be cropped off later.
-    fontinfo.max_width = topx(face->bbox.xMax - face->bbox.xMin) + 8;
-    fontinfo.max_height = topx(face->bbox.yMax - face->bbox.yMin) + 8;
-    fontinfo.baseline_x = topx(-face->bbox.xMin) + 4;
-    fontinfo.baseline_y = topx(face->bbox.yMax) + 4;
-    fontinfo.line_height = topx(face->height);
-
-    FT_Int32 loadmode = FT_LOAD_TARGET_NORMAL | FT_LOAD_RENDER;
-
-    if (bw)
-        loadmode = FT_LOAD_TARGET_MONO | FT_LOAD_MONOCHROME | FT_LOAD_RENDER;
+typedef std::vector<std::pair<FT_ULong, FT_UInt> > charmap_t;
 
+// Get the (charcode, glyph index) pairs of the face in charcode order.
+static charmap_t get_charmap(FT_Face face)
+{
+    charmap_t charmap;
     FT_ULong charcode;
     FT_UInt gindex;
     charcode = FT_Get_First_Char(face, &gindex);
     while (gindex)
     {
+        charmap.push_back(std::make_pair(charcode, gindex));
+        charcode = FT_Get_Next_Char(face, charcode, &gindex);
+    }
+    return charmap;
+}
+
+// Render the characters charmap[begin] to charmap[end - 1] and append them
+// to glyphtable. Glyphs that fail to load are reported to log and skipped.
+static void render_glyphs(FT_Face face, FT_Int32 loadmode,
+                          const DataFile::fontinfo_t &fontinfo,
+                          const charmap_t &charmap, size_t begin, size_t end,
+                          std::vector<DataFile::glyphentry_t> &glyphtable,
+                          std::ostream &log)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        FT_ULong charcode = charmap.at(i).first;
+        FT_UInt gindex = charmap.at(i).second;
+
         try
         {
             checkFT(FT_Load_Glyph(face, gindex, loadmode));
         }
         catch (std::runtime_error &e)
         {
-            std::cerr << "Skipping glyph " << gindex << ": " << e.what() << std::endl;
-            charcode = FT_Get_Next_Char(face, charcode, &gindex);
+            log << "Skipping glyph " << gindex << ": " << e.what() << std::endl;
+            continue;
         }
 
         DataFile::glyphentry_t glyph;
@@ -161,17 +153,138 @@ std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw)
             }
         }
         glyphtable.push_back(glyph);
+    }
+}
 
-        charcode = FT_Get_Next_Char(face, charcode, &gindex);
+// Get the font metrics at the given pixel size.
+static DataFile::fontinfo_t get_fontinfo(FT_Face face, int size)
+{
+    DataFile::fontinfo_t fontinfo = {};
+
+    // Convert size to pixels and round to nearest.
+    int u_per_em = face->units_per_EM;
+    auto topx = [size, u_per_em](int s) { return (s * size + u_per_em / 2) / u_per_em; };
+
+    fontinfo.name = std::string(face->family_name) + " " +
+                    std::string(face->style_name) + " " +
+                    std::to_string(size);
+
+    // Reserve 4 pixels on each side for antialiasing + hinting.
+    // They will be cropped off later.
+    fontinfo.max_width = topx(face->bbox.xMax - face->bbox.xMin) + 8;
+    fontinfo.max_height = topx(face->bbox.yMax - face->bbox.yMin) + 8;
+    fontinfo.baseline_x = topx(-face->bbox.xMin) + 4;
+    fontinfo.baseline_y = topx(face->bbox.yMax) + 4;
+    fontinfo.line_height = topx(face->height);
+    return fontinfo;
+}
+
+static FT_Int32 get_loadmode(bool bw)
+{
+    if (bw)
+        return FT_LOAD_TARGET_MONO | FT_LOAD_MONOCHROME | FT_LOAD_RENDER;
+    else
+        return FT_LOAD_TARGET_NORMAL | FT_LOAD_RENDER;
+}
+
+std::vector<std::unique_ptr<DataFile> > LoadFreetype(
+    std::istream &file, const std::vector<import_size_t> &sizes,
+    ThreadPool *pool)
+{
+    if (sizes.empty())
+        return {};
+
+    std::vector<char> data;
+    readfile(file, data);
+
+    _FT_Library lib;
+    _FT_Face face(lib, data);
+
+    charmap_t charmap = get_charmap(face);
+    std::vector<DataFile::fontinfo_t> fontinfos;
+    for (const import_size_t &s : sizes)
+        fontinfos.push_back(get_fontinfo(face, s.size));
+
+    std::vector<std::vector<DataFile::glyphentry_t> > glyphtables(sizes.size());
+
+    if (!pool || pool->GetThreadCount() == 1)
+    {
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            checkFT(FT_Set_Pixel_Sizes(face, sizes[i].size, sizes[i].size));
+            render_glyphs(face, get_loadmode(sizes[i].bw), fontinfos[i],
+                          charmap, 0, charmap.size(), glyphtables[i], std::cerr);
+        }
     }
+    else
+    {
+        // FreeType objects cannot be shared between threads, so each shard
+        // opens its own library and face on the shared font data. There are
+        // a few shards per thread to even out differences in glyph
+        // complexity. The shards are concatenated in order, which gives the
+        // same result as rendering everything on one face.
+        size_t tasks = pool->GetThreadCount() * 4;
+        size_t shards = (tasks + sizes.size() - 1) / sizes.size();
+        shards = std::max<size_t>(1, std::min(shards, charmap.size()));
 
-    eliminate_duplicates(glyphtable);
-    crop_glyphs(glyphtable, fontinfo);
-    detect_flags(glyphtable, fontinfo);
+        size_t count = sizes.size() * shards;
+        std::vector<std::vector<DataFile::glyphentry_t> > parts(count);
+        std::vector<std::ostringstream> logs(count);
+
+        pool->Run(count, [&](size_t task)
+        {
+            const import_size_t &s = sizes.at(task / shards);
+            size_t shard = task % shards;
+
+            _FT_Library shard_lib;
+            _FT_Face shard_face(shard_lib, data);
+            checkFT(FT_Set_Pixel_Sizes(shard_face, s.size, s.size));
+
+            size_t begin = charmap.size() * shard / shards;
+            size_t end = charmap.size() * (shard + 1) / shards;
+            render_glyphs(shard_face, get_loadmode(s.bw),
+                          fontinfos.at(task / shards), charmap, begin, end,
+                          parts.at(task), logs.at(task));
+        });
+
+        for (size_t task = 0; task < count; task++)
+        {
+            std::vector<DataFile::glyphentry_t> &glyphtable =
+                glyphtables.at(task / shards);
 
-    std::unique_ptr<DataFile> result(new DataFile(
-        dictionary, glyphtable, fontinfo));
-    return result;
+            std::cerr << logs.at(task).str();
+            glyphtable.insert(glyphtable.end(),
+                              parts.at(task).begin(), parts.at(task).end());
+        }
+    }
+
+    std::vector<std::unique_ptr<DataFile> > results(sizes.size());
+    auto finish = [&](size_t i)
+    {
+        std::vector<DataFile::glyphentry_t> &glyphtable = glyphtables.at(i);
+        std::vector<DataFile::dictentry_t> dictionary;
+
+        eliminate_duplicates(glyphtable);
+        crop_glyphs(glyphtable, fontinfos.at(i));
+        detect_flags(glyphtable, fontinfos.at(i));
+
+        results.at(i).reset(new DataFile(dictionary, glyphtable, fontinfos.at(i)));
+    };
+
+    if (pool)
+        pool->Run(sizes.size(), finish);
+    else
+        for (size_t i = 0; i < sizes.size(); i++)
+            finish(i);
+
+    return results;
+}
+
+std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw,
+                                       ThreadPool *pool)
+{
+    std::vector<import_size_t> sizes = {{size, bw}};
+    return std::move(LoadFreetype(file, sizes, pool).at(0));
 }
 
 }
@@ -2,9 +2,26 @@
 
 #pragma once
 #include "datafile.hh"
+#include "threadpool.hh"
 
 namespace mcufont {
 
-std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw);
+// If pool is given, the glyphs are rendered in parallel. The result is the
+// same regardless of the number of threads.
+std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw,
+                                       ThreadPool *pool = nullptr);
+
+struct import_size_t
+{
+    int size;
+    bool bw;
+};
+
+// Import the font at several sizes, reading and parsing the file only once.
+// The sizes are rendered and post-processed in parallel if pool is given.
+// Returns the data files in the same order as sizes.
+std::vector<std::unique_ptr<DataFile> > LoadFreetype(
+    std::istream &file, const std::vector<import_size_t> &sizes,
+    ThreadPool *pool = nullptr);
 
 }
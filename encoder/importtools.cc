@@ -1,25 +1,60 @@
 #include "importtools.hh"
 #include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <stdexcept>
 
 namespace mcufont {
 
+// FNV-1a hash over the glyph width and pixels.
+static size_t glyph_hash(const DataFile::glyphentry_t &glyph)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)glyph.width;
+    for (uint8_t pixel : glyph.data)
+    {
+        hash ^= pixel;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 void eliminate_duplicates(std::vector<DataFile::glyphentry_t> &glyphtable)
 {
-    for (size_t i = 0; i + 1 < glyphtable.size(); i++)
+    // Maps the hash of each kept glyph to its index. The glyphs are
+    // compacted in place, so the kept ones remain in their original order.
+    std::unordered_multimap<size_t, size_t> kept;
+    size_t count = 0;
+
+    for (size_t i = 0; i < glyphtable.size(); i++)
     {
-        for (size_t j = i + 1; j < glyphtable.size(); j++)
+        DataFile::glyphentry_t &glyph = glyphtable.at(i);
+        size_t hash = glyph_hash(glyph);
+
+        bool duplicate = false;
+        auto range = kept.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
         {
-            if (glyphtable.at(i).data == glyphtable.at(j).data &&
-                glyphtable.at(i).width == glyphtable.at(j).width)
+            DataFile::glyphentry_t &original = glyphtable.at(it->second);
+            if (original.data == glyph.data && original.width == glyph.width)
             {
-                for (int c : glyphtable.at(j).chars)
-                    glyphtable.at(i).chars.push_back(c);
-
-                glyphtable.erase(glyphtable.begin() + j);
-                j--;
+                original.chars.insert(original.chars.end(),
+                                      glyph.chars.begin(), glyph.chars.end());
+                duplicate = true;
+                break;
             }
         }
+
+        if (!duplicate)
+        {
+            if (count != i)
+                glyphtable.at(count) = std::move(glyph);
+            kept.emplace(hash, count);
+            count++;
+        }
     }
+
+    glyphtable.resize(count);
 }
 
 struct bbox_t
@@ -56,13 +91,27 @@ void crop_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
         if (glyph.data.size() == 0)
             continue; // Dummy glyph
 
+        int w = fontinfo.max_width;
+        if (glyph.data.size() != (size_t)w * fontinfo.max_height)
+            throw std::out_of_range("glyph size does not match the font");
+
+        // Only the leftmost and rightmost pixel of each row matter.
         for (int y = 0; y < fontinfo.max_height; y++)
         {
-            for (int x = 0; x < fontinfo.max_width; x++)
-            {
-                if (glyph.data.at(y * fontinfo.max_width + x))
-                    bbox.update(x, y);
-            }
+            const uint8_t *row = &glyph.data.at(y * w);
+            int left = 0;
+            while (left < w && !row[left])
+                left++;
+
+            if (left == w)
+                continue; // Empty row
+
+            int right = w - 1;
+            while (!row[right])
+                right--;
+
+            bbox.update(left, y);
+            bbox.update(right, y);
         }
     }
 
@@ -78,19 +127,15 @@ void crop_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
         if (glyph.data.size() == 0)
             continue; // Dummy glyph
 
-        DataFile::pixels_t old = glyph.data;
-        glyph.data.clear();
-
+        DataFile::pixels_t cropped(new_w * new_h);
         for (size_t y = 0; y < new_h; y++)
         {
-            for (size_t x = 0; x < new_w; x++)
-            {
-                size_t old_x = bbox.left + x;
-                size_t old_y = bbox.top + y;
-                size_t old_pos = old_w * old_y + old_x;
-                glyph.data.push_back(old.at(old_pos));
-            }
+            size_t old_pos = old_w * (bbox.top + y) + bbox.left;
+            std::copy(glyph.data.begin() + old_pos,
+                      glyph.data.begin() + old_pos + new_w,
+                      cropped.begin() + y * new_w);
         }
+        glyph.data.swap(cropped);
     }
 
     fontinfo.max_width = new_w;
@@ -139,5 +184,49 @@ void detect_flags(const std::vector<DataFile::glyphentry_t> &glyphtable,
         fontinfo.flags |= DataFile::FLAG_BW;
 }
 
+std::vector<std::unique_ptr<DataFile> > split_blocks(const DataFile &datafile,
+                                                     size_t block_size)
+{
+    if (block_size == 0)
+        throw std::invalid_argument("block size must be non-zero");
+
+    std::vector<std::unique_ptr<DataFile> > result;
+    std::vector<DataFile::glyphentry_t> glyphs;
+    std::map<size_t, size_t> block_index; // Glyph index -> index in block
+
+    auto finish_block = [&]()
+    {
+        std::unique_ptr<DataFile> block(new DataFile(
+            datafile.GetDictionary(), glyphs, datafile.GetFontInfo()));
+        block->SetSeed(datafile.GetSeed());
+        result.push_back(std::move(block));
+        glyphs.clear();
+        block_index.clear();
+    };
+
+    // Go through the characters in increasing order, so that each block
+    // covers a separate interval of them.
+    for (auto iter : datafile.GetCharToGlyphMap())
+    {
+        if (!block_index.count(iter.second))
+        {
+            if (glyphs.size() == block_size)
+                finish_block();
+
+            DataFile::glyphentry_t g = datafile.GetGlyphEntry(iter.second);
+            g.chars.clear();
+            block_index[iter.second] = glyphs.size();
+            glyphs.push_back(g);
+        }
+
+        glyphs.at(block_index[iter.second]).chars.push_back(iter.first);
+    }
+
+    if (!glyphs.empty())
+        finish_block();
+
+    return result;
+}
+
 
 }
@@ -2,6 +2,7 @@
 
 #pragma once
 #include "datafile.hh"
+#include <memory>
 
 namespace mcufont {
 
@@ -17,4 +18,92 @@ void crop_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
 void detect_flags(const std::vector<DataFile::glyphentry_t> &glyphtable,
                   DataFile::fontinfo_t &fontinfo);
 
+// Split the font into blocks of at most block_size glyphs, which can then
+// be optimized and exported with their own dictionaries. Each block covers
+// a separate interval of characters, in increasing order. A glyph that is
+// shared by characters in several blocks is copied to each of them. The
+// blocks start with a copy of the dictionary of the whole font.
+std::vector<std::unique_ptr<DataFile> > split_blocks(const DataFile &datafile,
+                                                     size_t block_size);
+
 }
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+
+using namespace mcufont;
+
+class ImportToolsTests: public CxxTest::TestSuite
+{
+public:
+    void testEliminateDuplicates()
+    {
+        std::vector<DataFile::glyphentry_t> glyphs(5);
+        glyphs[0].data = {0, 15, 0, 15}; glyphs[0].width = 2; glyphs[0].chars = {'a'};
+        glyphs[1].data = {15, 0, 0, 15}; glyphs[1].width = 2; glyphs[1].chars = {'b'};
+        glyphs[2].data = {0, 15, 0, 15}; glyphs[2].width = 3; glyphs[2].chars = {'c'};
+        glyphs[3].data = {0, 15, 0, 15}; glyphs[3].width = 2; glyphs[3].chars = {'d'};
+        glyphs[4].data = {15, 0, 0, 15}; glyphs[4].width = 2; glyphs[4].chars = {'e', 'f'};
+
+        eliminate_duplicates(glyphs);
+
+        TS_ASSERT_EQUALS(glyphs.size(), 3);
+        TS_ASSERT_EQUALS(glyphs[0].chars, std::vector<int>({'a', 'd'}));
+        TS_ASSERT_EQUALS(glyphs[1].chars, std::vector<int>({'b', 'e', 'f'}));
+        TS_ASSERT_EQUALS(glyphs[2].chars, std::vector<int>({'c'}));
+        TS_ASSERT_EQUALS(glyphs[2].width, 3);
+    }
+
+    void testCropGlyphs()
+    {
+        DataFile::fontinfo_t fontinfo = {};
+        fontinfo.max_width = 4;
+        fontinfo.max_height = 3;
+        fontinfo.baseline_x = 2;
+        fontinfo.baseline_y = 2;
+
+        std::vector<DataFile::glyphentry_t> glyphs(3);
+        glyphs[0].data = {0,  0, 0, 0,
+                          0, 15, 0, 0,
+                          0,  0, 0, 0};
+        glyphs[2].data = {0, 0, 0, 0,
+                          0, 0, 7, 0,
+                          0, 0, 3, 0};
+
+        crop_glyphs(glyphs, fontinfo);
+
+        TS_ASSERT_EQUALS(fontinfo.max_width, 2);
+        TS_ASSERT_EQUALS(fontinfo.max_height, 2);
+        TS_ASSERT_EQUALS(fontinfo.baseline_x, 1);
+        TS_ASSERT_EQUALS(fontinfo.baseline_y, 1);
+        TS_ASSERT_EQUALS(glyphs[0].data, DataFile::pixels_t({15, 0, 0, 0}));
+        TS_ASSERT(glyphs[1].data.empty());
+        TS_ASSERT_EQUALS(glyphs[2].data, DataFile::pixels_t({0, 7, 0, 3}));
+    }
+
+    void testSplitBlocks()
+    {
+        DataFile::fontinfo_t fontinfo = {};
+        fontinfo.max_width = 2;
+        fontinfo.max_height = 1;
+
+        std::vector<DataFile::glyphentry_t> glyphs(3);
+        glyphs[0].data = {0, 15}; glyphs[0].width = 2; glyphs[0].chars = {'a', 'z'};
+        glyphs[1].data = {15, 0}; glyphs[1].width = 2; glyphs[1].chars = {'b'};
+        glyphs[2].data = {15, 15}; glyphs[2].width = 2; glyphs[2].chars = {'c', 'd'};
+        DataFile f({}, glyphs, fontinfo);
+
+        std::vector<std::unique_ptr<DataFile> > blocks = split_blocks(f, 2);
+
+        // The glyph of 'a' and 'z' is needed in both blocks.
+        TS_ASSERT_EQUALS(blocks.size(), 2);
+        TS_ASSERT_EQUALS(blocks[0]->GetGlyphCount(), 2);
+        TS_ASSERT_EQUALS(blocks[0]->GetGlyphEntry(0).chars, std::vector<int>({'a'}));
+        TS_ASSERT_EQUALS(blocks[0]->GetGlyphEntry(1).chars, std::vector<int>({'b'}));
+        TS_ASSERT_EQUALS(blocks[1]->GetGlyphCount(), 2);
+        TS_ASSERT_EQUALS(blocks[1]->GetGlyphEntry(0).chars, std::vector<int>({'c', 'd'}));
+        TS_ASSERT_EQUALS(blocks[1]->GetGlyphEntry(1).chars, std::vector<int>({'z'}));
+        TS_ASSERT_EQUALS(blocks[1]->GetGlyphEntry(1).data, glyphs[0].data);
+    }
+};
+#endif
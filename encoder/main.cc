@@ -6,6 +6,7 @@
 #include "encode_rlefont.hh"
 #include "optimize_rlefont.hh"
 #include "export_bwfont.hh"
+#include "export_atlasfont.hh"
 #include <vector>
 #include <string>
 #include <set>
@@ -14,6 +15,7 @@
 #include <iomanip>
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
 #include <map>
 #include "ccfixes.hh"
 #include "gb2312_in_ucs2.h"
@@ -34,9 +36,11 @@ static std::string strip_extension(std::string filename)
     }
 }
 
-static std::unique_ptr<DataFile> load_dat(std::string src)
+// Load a .dat file in either format. If binary is given, it is set to
+// tell which format the file was in.
+static std::unique_ptr<DataFile> load_dat(std::string src, bool *binary = nullptr)
 {
-    std::ifstream infile(src);
+    std::ifstream infile(src, std::ios::binary);
 
     if (!infile.good())
     {
@@ -44,6 +48,9 @@ static std::unique_ptr<DataFile> load_dat(std::string src)
         return nullptr;
     }
 
+    if (binary)
+        *binary = DataFile::IsBinary(infile);
+
     std::unique_ptr<DataFile> f = DataFile::Load(infile);
     if (!f)
     {
@@ -54,9 +61,9 @@ static std::unique_ptr<DataFile> load_dat(std::string src)
     return f;
 }
 
-static bool save_dat(std::string dest, DataFile *f)
+static bool save_dat(std::string dest, DataFile *f, bool binary = false)
 {
-    std::ofstream outfile(dest);
+    std::ofstream outfile(dest, binary ? std::ios::binary : std::ios::out);
 
     if (!outfile.good())
     {
@@ -64,7 +71,10 @@ static bool save_dat(std::string dest, DataFile *f)
         return false;
     }
 
-    f->Save(outfile);
+    if (binary)
+        f->SaveBinary(outfile);
+    else
+        f->Save(outfile);
 
     if (!outfile.good())
     {
@@ -75,6 +85,100 @@ static bool save_dat(std::string dest, DataFile *f)
     return true;
 }
 
+// Remove the flag from the argument list. Returns true if it was present.
+static bool take_flag(std::vector<std::string> &args, std::string name)
+{
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args.at(i) == name)
+        {
+            args.erase(args.begin() + i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Remove "<name> <value>" from the argument list, if present.
+// Returns false if the option is given without a value.
+static bool take_option(std::vector<std::string> &args, std::string name,
+                        std::string &value)
+{
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args.at(i) == name)
+        {
+            if (i + 1 >= args.size())
+                return false;
+
+            value = args.at(i + 1);
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            return true;
+        }
+    }
+
+    return true;
+}
+
+// Parse the name of a dictionary initialization mode.
+static bool parse_init_mode(const std::string &value,
+                            mcufont::rlefont::init_mode_t &mode)
+{
+    if (value == "random")
+        mode = mcufont::rlefont::INIT_RANDOM;
+    else if (value == "frequency")
+        mode = mcufont::rlefont::INIT_FREQUENCY;
+    else
+        return false;
+
+    return true;
+}
+
+// Remove "--init-dict random|frequency" from the argument list, if present.
+// Returns false if the value is missing or invalid.
+static bool take_init_mode(std::vector<std::string> &args,
+                           mcufont::rlefont::init_mode_t &mode)
+{
+    std::string value = "random";
+    return take_option(args, "--init-dict", value) &&
+           parse_init_mode(value, mode);
+}
+
+// Remove "--kerning-zones N" from the argument list, if present.
+// Returns false if the value is missing or out of range.
+static bool take_kerning_zones(std::vector<std::string> &args, size_t &zones)
+{
+    std::string value = "0";
+    if (!take_option(args, "--kerning-zones", value))
+        return false;
+
+    int n = std::stoi(value);
+    if (n < 0 || n > 255)
+        return false;
+
+    zones = n;
+    return true;
+}
+
+// Remove "--dict-size N" from the argument list, if present. Size is left
+// at 0 if the option is not given.
+// Returns false if the value is missing or out of range.
+static bool take_dict_size(std::vector<std::string> &args, size_t &size)
+{
+    std::string value = "0";
+    if (!take_option(args, "--dict-size", value))
+        return false;
+
+    int n = std::stoi(value);
+    if (n != 0 && (n < (int)DataFile::dictionarysize ||
+                   n > (int)DataFile::maxdictionarysize))
+        return false;
+
+    size = n;
+    return true;
+}
+
 enum status_t
 {
     STATUS_OK = 0, // All good
@@ -82,11 +186,24 @@ enum status_t
     STATUS_ERROR = 2 // Error when executing command
 };
 
-static status_t cmd_import_ttf(const std::vector<std::string> &args)
+static status_t cmd_import_ttf(const std::vector<std::string> &cmdline)
 {
+    std::vector<std::string> args = cmdline;
+    std::string threads = "0";
+    mcufont::rlefont::init_mode_t init_mode = mcufont::rlefont::INIT_RANDOM;
+    size_t dict_size = 0;
+    if (!take_option(args, "--threads", threads) ||
+        !take_init_mode(args, init_mode) ||
+        !take_dict_size(args, dict_size))
+        return STATUS_INVALID;
+
     if (args.size() != 3 && args.size() != 4)
         return STATUS_INVALID;
 
+    int num_threads = std::stoi(threads);
+    if (num_threads < 0)
+        return STATUS_INVALID;
+
     std::string src = args.at(1);
     int size = std::stoi(args.at(2));
     bool bw = (args.size() == 4 && args.at(3) == "bw");
@@ -101,9 +218,12 @@ static status_t cmd_import_ttf(const std::vector<std::string> &args)
 
     std::cout << "Importing " << src << " to " << dest << std::endl;
 
-    std::unique_ptr<DataFile> f = LoadFreetype(infile, size, bw);
+    ThreadPool pool(num_threads);
+    std::unique_ptr<DataFile> f = LoadFreetype(infile, size, bw, &pool);
 
-    mcufont::rlefont::init_dictionary(*f);
+    if (dict_size)
+        f->SetDictionarySize(dict_size);
+    mcufont::rlefont::init_dictionary(*f, init_mode);
 
     if (!save_dat(dest, f.get()))
         return STATUS_ERROR;
@@ -112,8 +232,84 @@ static status_t cmd_import_ttf(const std::vector<std::string> &args)
     return STATUS_OK;
 }
 
-static status_t cmd_import_bdf(const std::vector<std::string> &args)
+static status_t cmd_import_ttf_batch(const std::vector<std::string> &cmdline)
+{
+    std::vector<std::string> args = cmdline;
+    std::string threads = "0";
+    mcufont::rlefont::init_mode_t init_mode = mcufont::rlefont::INIT_RANDOM;
+    size_t dict_size = 0;
+    if (!take_option(args, "--threads", threads) ||
+        !take_init_mode(args, init_mode) ||
+        !take_dict_size(args, dict_size))
+        return STATUS_INVALID;
+
+    if (args.size() < 3)
+        return STATUS_INVALID;
+
+    int num_threads = std::stoi(threads);
+    if (num_threads < 0)
+        return STATUS_INVALID;
+
+    // Each size is given as a number, optionally followed by "bw".
+    std::vector<mcufont::import_size_t> sizes;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        size_t pos;
+        int size = std::stoi(args.at(i), &pos);
+        std::string suffix = args.at(i).substr(pos);
+        if (size <= 0 || (suffix != "" && suffix != "bw"))
+            return STATUS_INVALID;
+
+        sizes.push_back({size, suffix == "bw"});
+    }
+
+    std::string src = args.at(1);
+    std::ifstream infile(src);
+
+    if (!infile.good())
+    {
+        std::cerr << "Could not open " << src << std::endl;
+        return STATUS_ERROR;
+    }
+
+    std::cout << "Importing " << src << " at " << sizes.size()
+              << " sizes" << std::endl;
+
+    ThreadPool pool(num_threads);
+    std::vector<std::unique_ptr<DataFile> > fonts =
+        LoadFreetype(infile, sizes, &pool);
+
+    pool.Run(fonts.size(), [&](size_t i)
+    {
+        if (dict_size)
+            fonts.at(i)->SetDictionarySize(dict_size);
+        mcufont::rlefont::init_dictionary(*fonts.at(i), init_mode);
+    });
+
+    for (size_t i = 0; i < fonts.size(); i++)
+    {
+        std::string dest = strip_extension(src) + std::to_string(sizes[i].size)
+                           + (sizes[i].bw ? "bw" : "") + ".dat";
+
+        if (!save_dat(dest, fonts.at(i).get()))
+            return STATUS_ERROR;
+
+        std::cout << "Wrote " << dest << ": " << fonts.at(i)->GetGlyphCount()
+                  << " unique glyphs." << std::endl;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t cmd_import_bdf(const std::vector<std::string> &cmdline)
 {
+    std::vector<std::string> args = cmdline;
+    mcufont::rlefont::init_mode_t init_mode = mcufont::rlefont::INIT_RANDOM;
+    size_t dict_size = 0;
+    if (!take_init_mode(args, init_mode) ||
+        !take_dict_size(args, dict_size))
+        return STATUS_INVALID;
+
     if (args.size() != 2)
         return STATUS_INVALID;
 
@@ -131,7 +327,9 @@ static status_t cmd_import_bdf(const std::vector<std::string> &args)
 
     std::unique_ptr<DataFile> f = LoadBDF(infile);
 
-    mcufont::rlefont::init_dictionary(*f);
+    if (dict_size)
+        f->SetDictionarySize(dict_size);
+    mcufont::rlefont::init_dictionary(*f, init_mode);
 
     if (!save_dat(dest, f.get()))
         return STATUS_ERROR;
@@ -177,7 +375,8 @@ static status_t cmd_filter(const std::vector<std::string> &args)
     }
 
     std::string src = args.at(1);
-    std::unique_ptr<DataFile> f = load_dat(src);
+    bool binary;
+    std::unique_ptr<DataFile> f = load_dat(src, &binary);
     if (!f)
         return STATUS_ERROR;
 
@@ -211,9 +410,34 @@ static status_t cmd_filter(const std::vector<std::string> &args)
     f.reset(new DataFile(f->GetDictionary(), newglyphs, fontinfo));
     std::cout << "After filtering, " << f->GetGlyphCount() << " glyphs remain." << std::endl;
 
-    if (!save_dat(src, f.get()))
+    if (!save_dat(src, f.get(), binary))
+        return STATUS_ERROR;
+
+    return STATUS_OK;
+}
+
+static status_t cmd_convert(const std::vector<std::string> &args)
+{
+    if (args.size() != 3 && args.size() != 4)
+        return STATUS_INVALID;
+
+    bool binary = false;
+    if (args.size() == 4)
+    {
+        if (args.at(3) == "binary")
+            binary = true;
+        else if (args.at(3) != "text")
+            return STATUS_INVALID;
+    }
+
+    std::unique_ptr<DataFile> f = load_dat(args.at(1));
+    if (!f)
+        return STATUS_ERROR;
+
+    if (!save_dat(args.at(2), f.get(), binary))
         return STATUS_ERROR;
 
+    std::cout << "Wrote " << args.at(2) << std::endl;
     return STATUS_OK;
 }
 
@@ -267,11 +491,27 @@ static status_t cmd_show_glyph(const std::vector<std::string> &args)
     return STATUS_OK;
 }
 
-static status_t cmd_rlefont_export(const std::vector<std::string> &args)
+static status_t cmd_rlefont_export(const std::vector<std::string> &cmdline)
 {
+    std::vector<std::string> args = cmdline;
+    std::string restart_rows = "0";
+    std::string threads = "0";
+    size_t kerning_zones = 0;
+    bool delta_offsets = take_flag(args, "--delta-offsets");
+    bool specialize = take_flag(args, "--specialize");
+    if (!take_option(args, "--restart-rows", restart_rows) ||
+        !take_option(args, "--threads", threads) ||
+        !take_kerning_zones(args, kerning_zones))
+        return STATUS_INVALID;
+
     if (args.size() != 2 && args.size() != 3)
         return STATUS_INVALID;
 
+    int rows = std::stoi(restart_rows);
+    int num_threads = std::stoi(threads);
+    if (rows < 0 || rows > 255 || num_threads < 0)
+        return STATUS_INVALID;
+
     std::string src = args.at(1);
     std::string dst = (args.size() == 2) ? strip_extension(src) + ".c" : args.at(2);
     std::unique_ptr<DataFile> f = load_dat(src);
@@ -279,9 +519,11 @@ static status_t cmd_rlefont_export(const std::vector<std::string> &args)
     if (!f)
         return STATUS_ERROR;
 
+    ThreadPool pool(num_threads);
     {
         std::ofstream source(dst);
-        mcufont::rlefont::write_source(source, dst, *f);
+        mcufont::rlefont::write_source(source, dst, *f, rows, kerning_zones,
+                                       delta_offsets, specialize, &pool);
         std::cout << "Wrote " << dst << std::endl;
     }
 
@@ -309,57 +551,356 @@ static status_t cmd_rlefont_size(const std::vector<std::string> &args)
         << " bytes" << std::endl;
     std::cout << "Compressed size:   " << size << " bytes" << std::endl;
     std::cout << "Bytes per glyph:   " << size / f->GetGlyphCount() << std::endl;
+    std::cout << "Decoding cost:     " << mcufont::rlefont::get_decode_cost(*f) /
+        f->GetGlyphCount() << " steps per glyph" << std::endl;
     return STATUS_OK;
 }
 
-static status_t cmd_rlefont_optimize(const std::vector<std::string> &args)
+static status_t cmd_rlefont_optimize(const std::vector<std::string> &cmdline)
 {
+    std::vector<std::string> args = cmdline;
+    std::string threads = "4";
+    if (!take_option(args, "--threads", threads))
+        return STATUS_INVALID;
+
+    std::string strategy = "hillclimb";
+    std::string temperature;
+    std::string schedule = "adaptive";
+    if (!take_option(args, "--strategy", strategy) ||
+        !take_option(args, "--temperature", temperature) ||
+        !take_option(args, "--schedule", schedule))
+        return STATUS_INVALID;
+
+    std::string time_budget, target_size, checkpoint_interval;
+    if (!take_option(args, "--time-budget", time_budget) ||
+        !take_option(args, "--target-size", target_size) ||
+        !take_option(args, "--checkpoint-interval", checkpoint_interval))
+        return STATUS_INVALID;
+
+    std::string decode_weight;
+    if (!take_option(args, "--decode-weight", decode_weight))
+        return STATUS_INVALID;
+
+    std::string tree_layout = "pointers";
+    if (!take_option(args, "--tree-layout", tree_layout))
+        return STATUS_INVALID;
+
+    std::string init_dict;
+    mcufont::rlefont::init_mode_t init_mode = mcufont::rlefont::INIT_RANDOM;
+    if (!take_option(args, "--init-dict", init_dict) ||
+        (!init_dict.empty() && !parse_init_mode(init_dict, init_mode)))
+        return STATUS_INVALID;
+
+    size_t dict_size = 0;
+    if (!take_dict_size(args, dict_size))
+        return STATUS_INVALID;
+
+    bool verbose = take_flag(args, "--verbose");
+
     if (args.size() != 2 && args.size() != 3)
         return STATUS_INVALID;
 
+    int num_threads = std::stoi(threads);
+    if (num_threads < 0)
+        return STATUS_INVALID;
+
+    mcufont::rlefont::optimize_options_t options;
+    options.verbose = verbose;
+    if (strategy == "anneal")
+        options.strategy = mcufont::rlefont::STRATEGY_ANNEAL;
+    else if (strategy != "hillclimb")
+        return STATUS_INVALID;
+
+    if (!temperature.empty())
+        options.temperature = std::stod(temperature);
+
+    if (!decode_weight.empty())
+        options.decode_weight = std::stod(decode_weight);
+
+    if (options.decode_weight < 0)
+        return STATUS_INVALID;
+
+    if (schedule == "fixed")
+        options.schedule = mcufont::rlefont::SCHEDULE_FIXED;
+    else if (schedule == "adaptive")
+        options.schedule = mcufont::rlefont::SCHEDULE_ADAPTIVE;
+    else
+        return STATUS_INVALID;
+
+    if (tree_layout == "flat")
+        options.tree_layout = mcufont::rlefont::TREE_FLAT;
+    else if (tree_layout != "pointers")
+        return STATUS_INVALID;
+
+    ThreadPool pool(num_threads);
+
     std::string src = args.at(1);
-    std::unique_ptr<DataFile> f = load_dat(src);
+    bool binary;
+    std::unique_ptr<DataFile> f = load_dat(src, &binary);
 
     if (!f)
         return STATUS_ERROR;
 
+    if (dict_size)
+        f->SetDictionarySize(dict_size);
+
+    if (!init_dict.empty())
+        mcufont::rlefont::init_dictionary(*f, init_mode);
+
     size_t oldsize = mcufont::rlefont::get_encoded_size(*f);
 
     std::cout << "Original size is " << oldsize << " bytes" << std::endl;
     std::cout << "Press ctrl-C at any time to stop." << std::endl;
-    std::cout << "Results are saved automatically after each iteration." << std::endl;
 
+    // Seconds between writes of the data file, 0 to save every iteration.
+    double interval = 0;
+    if (!checkpoint_interval.empty())
+        interval = std::stod(checkpoint_interval);
+
+    if (interval > 0)
+        std::cout << "Results are saved automatically every " << interval
+                  << " seconds." << std::endl;
+    else
+        std::cout << "Results are saved automatically after each iteration." << std::endl;
+
+    // Without an iteration count, the time and size goals alone decide
+    // when to stop.
     int limit = 100;
     if (args.size() == 3)
     {
         limit = std::stoi(args.at(2));
     }
+    else if (!time_budget.empty() || !target_size.empty())
+    {
+        limit = 0;
+    }
 
     if (limit > 0)
         std::cout << "Limit is " << limit << " iterations" << std::endl;
 
+    double budget = 0;
+    if (!time_budget.empty())
+    {
+        budget = std::stod(time_budget);
+        std::cout << "Time budget is " << budget << " seconds" << std::endl;
+    }
+
+    size_t target = 0;
+    if (!target_size.empty())
+    {
+        target = std::stoul(target_size);
+        std::cout << "Target size is " << target << " bytes" << std::endl;
+    }
+
+    std::cout << "Using " << pool.GetThreadCount() << " threads" << std::endl;
+
+    if (options.strategy == mcufont::rlefont::STRATEGY_ANNEAL)
+        std::cout << "Using simulated annealing, temperature "
+                  << options.temperature << std::endl;
+
+    if (options.decode_weight > 0)
+        std::cout << "Decoding cost weight is " << options.decode_weight
+                  << " bytes per step" << std::endl;
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    clock::time_point saved = start;
+
     int i = 0;
     time_t oldtime = time(NULL);
+    size_t newsize = oldsize;
+    bool unsaved = false;
     while (!limit || i < limit)
     {
-        mcufont::rlefont::optimize(*f);
+        if (target && newsize <= target)
+        {
+            std::cout << "Reached target size" << std::endl;
+            break;
+        }
+
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        if (budget > 0 && elapsed.count() >= budget)
+        {
+            std::cout << "Time budget used" << std::endl;
+            break;
+        }
+
+        mcufont::rlefont::optimize(*f, pool, options);
 
-        size_t newsize = mcufont::rlefont::get_encoded_size(*f);
+        newsize = mcufont::rlefont::get_encoded_size(*f);
         time_t newtime = time(NULL);
 
-        int bytes_per_min = (oldsize - newsize) * 60 / (newtime - oldtime + 1);
+        int bytes_per_min = ((int)oldsize - (int)newsize) * 60 / (int)(newtime - oldtime + 1);
 
         i++;
         std::cout << "iteration " << i << ", size " << newsize
-                  << " bytes, speed " << bytes_per_min << " B/min"
-                  << std::endl;
+                  << " bytes, speed " << bytes_per_min << " B/min";
+        if (options.decode_weight > 0)
+            std::cout << ", decoding cost "
+                      << mcufont::rlefont::get_decode_cost(*f) / f->GetGlyphCount()
+                      << " steps/glyph";
+        std::cout << std::endl;
 
+        unsaved = true;
+        std::chrono::duration<double> since_save = clock::now() - saved;
+        if (since_save.count() >= interval)
         {
-            if (!save_dat(src, f.get()))
+            if (!save_dat(src, f.get(), binary))
                 return STATUS_ERROR;
+
+            saved = clock::now();
+            unsaved = false;
         }
     }
 
+    if (unsaved)
+    {
+        if (!save_dat(src, f.get(), binary))
+            return STATUS_ERROR;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t cmd_rlefont_split(const std::vector<std::string> &cmdline)
+{
+    std::vector<std::string> args = cmdline;
+    std::string threads = "0";
+    if (!take_option(args, "--threads", threads))
+        return STATUS_INVALID;
+
+    if (args.size() != 3 && args.size() != 4)
+        return STATUS_INVALID;
+
+    int block_size = std::stoi(args.at(2));
+    int iterations = (args.size() == 4) ? std::stoi(args.at(3)) : 0;
+    int num_threads = std::stoi(threads);
+    if (block_size <= 0 || iterations < 0 || num_threads < 0)
+        return STATUS_INVALID;
+
+    std::string src = args.at(1);
+    std::unique_ptr<DataFile> f = load_dat(src);
+
+    if (!f)
+        return STATUS_ERROR;
+
+    std::vector<std::unique_ptr<DataFile> > blocks =
+        mcufont::split_blocks(*f, block_size);
+    std::vector<DataFile*> pointers;
+    for (const std::unique_ptr<DataFile> &b : blocks)
+        pointers.push_back(b.get());
+
+    std::cout << "Split into " << blocks.size() << " blocks" << std::endl;
+
+    ThreadPool pool(num_threads);
+    for (int i = 0; i < iterations; i++)
+    {
+        mcufont::rlefont::optimize_blocks(pointers, pool,
+            mcufont::rlefont::optimize_options_t());
+
+        size_t total = 0;
+        for (DataFile *b : pointers)
+            total += mcufont::rlefont::get_encoded_size(*b);
+
+        std::cout << "iteration " << i + 1 << ", size " << total
+                  << " bytes" << std::endl;
+    }
+
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        std::string dest = strip_extension(src) + "_block" + std::to_string(i) + ".dat";
+        if (!save_dat(dest, blocks.at(i).get()))
+            return STATUS_ERROR;
+
+        std::cout << "Wrote " << dest << ": " << blocks.at(i)->GetGlyphCount()
+                  << " glyphs" << std::endl;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t cmd_rlefont_export_blocks(const std::vector<std::string> &cmdline)
+{
+    std::vector<std::string> args = cmdline;
+    std::string restart_rows = "0";
+    std::string threads = "0";
+    size_t kerning_zones = 0;
+    bool delta_offsets = take_flag(args, "--delta-offsets");
+    bool specialize = take_flag(args, "--specialize");
+    if (!take_option(args, "--restart-rows", restart_rows) ||
+        !take_option(args, "--threads", threads) ||
+        !take_kerning_zones(args, kerning_zones))
+        return STATUS_INVALID;
+
+    if (args.size() < 3)
+        return STATUS_INVALID;
+
+    int rows = std::stoi(restart_rows);
+    int num_threads = std::stoi(threads);
+    if (rows < 0 || rows > 255 || num_threads < 0)
+        return STATUS_INVALID;
+
+    std::string dst = args.at(1);
+    std::vector<std::unique_ptr<DataFile> > blocks;
+    std::vector<const DataFile*> pointers;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        blocks.push_back(load_dat(args.at(i)));
+        if (!blocks.back())
+            return STATUS_ERROR;
+
+        pointers.push_back(blocks.back().get());
+    }
+
+    ThreadPool pool(num_threads);
+    {
+        std::ofstream source(dst);
+        mcufont::rlefont::write_source(source, dst, pointers, rows, kerning_zones,
+                                       delta_offsets, specialize, &pool);
+        std::cout << "Wrote " << dst << std::endl;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t cmd_rlefont_export_blob(const std::vector<std::string> &cmdline)
+{
+    std::vector<std::string> args = cmdline;
+    std::string restart_rows = "0";
+    std::string threads = "0";
+    if (!take_option(args, "--restart-rows", restart_rows) ||
+        !take_option(args, "--threads", threads))
+        return STATUS_INVALID;
+
+    if (args.size() < 3)
+        return STATUS_INVALID;
+
+    int rows = std::stoi(restart_rows);
+    int num_threads = std::stoi(threads);
+    if (rows < 0 || rows > 255 || num_threads < 0)
+        return STATUS_INVALID;
+
+    std::string dst = args.at(1);
+    std::vector<std::unique_ptr<DataFile> > blocks;
+    std::vector<const DataFile*> pointers;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        blocks.push_back(load_dat(args.at(i)));
+        if (!blocks.back())
+            return STATUS_ERROR;
+
+        pointers.push_back(blocks.back().get());
+    }
+
+    ThreadPool pool(num_threads);
+    {
+        std::ofstream image(dst, std::ios::binary);
+        size_t arena = mcufont::rlefont::write_blob(image, dst, pointers, rows,
+                                                  &pool);
+        std::cout << "Wrote " << dst << ", needs " << arena
+                  << " bytes of RAM for the decoder" << std::endl;
+    }
+
     return STATUS_OK;
 }
 
@@ -406,8 +947,15 @@ static status_t cmd_rlefont_show_encoded(const std::vector<std::string> &args)
     return STATUS_OK;
 }
 
-static status_t cmd_bwfont_export(const std::vector<std::string> &args)
+static status_t cmd_bwfont_export(const std::vector<std::string> &cmdline)
 {
+    std::vector<std::string> args = cmdline;
+    size_t kerning_zones = 0;
+    if (!take_kerning_zones(args, kerning_zones))
+        return STATUS_INVALID;
+
+    bool rows = take_flag(args, "--rows");
+
     if (args.size() != 2 && args.size() != 3)
         return STATUS_INVALID;
 
@@ -425,7 +973,43 @@ static status_t cmd_bwfont_export(const std::vector<std::string> &args)
 
     {
         std::ofstream source(dst);
-        mcufont::bwfont::write_source(source, dst, *f);
+        mcufont::bwfont::write_source(source, dst, *f, kerning_zones, rows);
+        std::cout << "Wrote " << dst << std::endl;
+    }
+
+    return STATUS_OK;
+}
+
+static status_t cmd_atlas_export(const std::vector<std::string> &cmdline)
+{
+    std::vector<std::string> args = cmdline;
+    std::string bits = "4";
+    size_t kerning_zones = 0;
+    if (!take_option(args, "--bits", bits) ||
+        !take_kerning_zones(args, kerning_zones))
+        return STATUS_INVALID;
+
+    if (args.size() < 3 || (bits != "4" && bits != "8"))
+        return STATUS_INVALID;
+
+    std::string dst = args.at(1);
+    std::vector<std::unique_ptr<DataFile> > fonts;
+    std::vector<const DataFile*> pointers;
+    std::vector<std::string> names;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        fonts.push_back(load_dat(args.at(i)));
+        if (!fonts.back())
+            return STATUS_ERROR;
+
+        pointers.push_back(fonts.back().get());
+        names.push_back(args.at(i));
+    }
+
+    {
+        std::ofstream source(dst);
+        mcufont::atlasfont::write_source(source, dst, pointers, names,
+                                         std::stoi(bits), kerning_zones);
         std::cout << "Wrote " << dst << std::endl;
     }
 
@@ -436,34 +1020,99 @@ static status_t cmd_bwfont_export(const std::vector<std::string> &args)
 static const char *usage_msg =
     "Usage: mcufont <command> [options] ...\n"
     "Commands for importing:\n"
-    "   import_ttf <ttffile> <size> [bw]     Import a .ttf font into a data file.\n"
+    "   import_ttf <ttffile> <size> [bw] [--threads N]\n"
+    "                                        Import a .ttf font into a data file.\n"
+    "                                        Renders on N threads, default all cores.\n"
+    "   import_ttf_batch <ttffile> <size>[bw] ... [--threads N]\n"
+    "                                        Import a .ttf font at several sizes at once.\n"
     "   import_bdf <bdffile>                 Import a .bdf font into a data file.\n"
+    "   All import commands take [--init-dict random|frequency] to choose how\n"
+    "   the initial dictionary is picked, default random, and [--dict-size N]\n"
+    "   for up to 4312 dictionary entries instead of 232, for large fonts.\n"
     "\n"
     "Commands for inspecting and editing data files:\n"
     "   filter <datfile> <range> ...         Remove everything except specified characters.\n"
+    "   convert <datfile> <outfile> [text|binary]\n"
+    "                                        Convert between the data file formats.\n"
     "   show_glyph <datfile> <index>         Show the glyph at index.\n"
     "\n"
     "Commands specific to rlefont format:\n"
     "   rlefont_size <datfile>               Check the encoded size of the data file.\n"
-    "   rlefont_optimize <datfile>           Perform an optimization pass on the data file.\n"
-    "   rlefont_export <datfile> [outfile]   Export to .c source code.\n"
+    "   rlefont_optimize <datfile> [iterations] [--threads N]\n"
+    "                    [--strategy hillclimb|anneal] [--temperature T]\n"
+    "                    [--schedule fixed|adaptive] [--verbose]\n"
+    "                                        Perform an optimization pass on the data file.\n"
+    "                                        N parallel candidates per step, 0 for all cores.\n"
+    "                                        Annealing accepts worse results, starting at\n"
+    "                                        T bytes (default 0.3) and cooling down.\n"
+    "                                        Adaptive schedule favors the moves that save\n"
+    "                                        most, --verbose prints statistics per move.\n"
+    "                    [--time-budget S] [--target-size B] [--checkpoint-interval S]\n"
+    "                                        Stop after S seconds or when the size is at\n"
+    "                                        most B bytes. Save at most every S seconds.\n"
+    "                    [--decode-weight W]\n"
+    "                                        Count each step of decoding cost per glyph\n"
+    "                                        as W bytes, to trade size for speed.\n"
+    "                    [--tree-layout pointers|flat]\n"
+    "                                        Memory layout of the encoder's dictionary\n"
+    "                                        tree. Same result, only the speed differs.\n"
+    "                    [--init-dict random|frequency]\n"
+    "                                        Start over from a new initial dictionary.\n"
+    "                    [--dict-size N]\n"
+    "                                        Resize the dictionary to N entries.\n"
+    "   rlefont_export <datfile> [outfile] [--restart-rows N]\n"
+    "                    [--kerning-zones Z] [--delta-offsets] [--specialize]\n"
+    "                    [--threads N]\n"
+    "                                        Export to .c source code. Store restart\n"
+    "                                        points every N rows for partial redraws.\n"
+    "                                        Precompute kerning for MF_KERNING_ZONES=Z.\n"
+    "                                        Delta code the glyph offsets. Compile a\n"
+    "                                        decoder specialized for the font. Encodes\n"
+    "                                        on N threads, default all cores.\n"
+    "   rlefont_split <datfile> <glyphs> [iterations] [--threads N]\n"
+    "                                        Split into blocks of at most that many\n"
+    "                                        glyphs, each with its own dictionary.\n"
+    "                                        Optimizes the blocks in parallel.\n"
+    "   rlefont_export_blocks <outfile> <datfile> ... [--restart-rows N]\n"
+    "                    [--kerning-zones Z] [--delta-offsets] [--specialize]\n"
+    "                    [--threads N]\n"
+    "                                        Export the blocks as a single font.\n"
+    "   rlefont_export_blob <outfile> <datfile> ... [--restart-rows N]\n"
+    "                    [--threads N]\n"
+    "                                        Export a binary image of the font or\n"
+    "                                        the blocks for mf_streamfont.h.\n"
     "   rlefont_show_encoded <datfile>       Show the encoded data for debugging.\n"
     "\n"
     "Commands specific to bwfont format:\n"
-    "   bwfont_export <datfile> [outfile]    Export to .c source code.\n"
+    "   bwfont_export <datfile> [outfile] [--kerning-zones Z] [--rows]\n"
+    "                                        Export to .c source code. Precompute\n"
+    "                                        kerning for MF_KERNING_ZONES=Z. Store\n"
+    "                                        the glyphs row by row for 32-bit CPUs.\n"
+    "\n"
+    "Commands specific to atlasfont format:\n"
+    "   atlas_export <outfile> <datfile> ... [--bits 4|8] [--kerning-zones Z]\n"
+    "                                        Export the fonts as uncompressed bitmaps\n"
+    "                                        in a shared atlas, e.g. several sizes of\n"
+    "                                        a typeface. Default 4 bits per pixel.\n"
     "";
 
 typedef status_t (*cmd_t)(const std::vector<std::string> &args);
 static const std::map<std::string, cmd_t> command_list {
     {"import_ttf",              cmd_import_ttf},
+    {"import_ttf_batch",        cmd_import_ttf_batch},
     {"import_bdf",              cmd_import_bdf},
     {"filter",                  cmd_filter},
+    {"convert",                 cmd_convert},
     {"show_glyph",              cmd_show_glyph},
     {"rlefont_size",            cmd_rlefont_size},
     {"rlefont_optimize",        cmd_rlefont_optimize},
     {"rlefont_export",          cmd_rlefont_export},
+    {"rlefont_split",           cmd_rlefont_split},
+    {"rlefont_export_blocks",   cmd_rlefont_export_blocks},
+    {"rlefont_export_blob",     cmd_rlefont_export_blob},
     {"rlefont_show_encoded",    cmd_rlefont_show_encoded},
     {"bwfont_export",           cmd_bwfont_export},
+    {"atlas_export",            cmd_atlas_export},
 };
 
 int main(int argc, char **argv)
@@ -1,9 +1,12 @@
 #include "optimize_rlefont.hh"
 #include "encode_rlefont.hh"
+#include "suffixarray.hh"
 #include <random>
+#include <cmath>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <set>
-#include <thread>
 #include <algorithm>
 #include "ccfixes.hh"
 
@@ -32,63 +35,80 @@ std::unique_ptr<DataFile::pixels_t> random_substring(const DataFile &datafile, r
     return result;
 }
 
+// Evaluate replacing the dictionary entry at index with d. If that reduces
+// the encoded size, store the entry along with its score and return true.
+// With a non-zero temperature (in bytes), changes that increase the size are
+// also accepted, with probability exp(-increase / temperature). Changes that
+// keep the size equal are still rejected, as accepting them tends to throw
+// away useful entries.
+static bool try_entry(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                      double temperature, size_t index, DataFile::dictentry_t &d)
+{
+    DataFile trial = datafile.MakeTrial(index, d);
+
+    size_t size = eval.GetSize();
+    size_t newsize = eval.Evaluate(trial, index);
+
+    bool accept = (newsize < size);
+    if (!accept && temperature > 0 && newsize > size)
+    {
+        std::uniform_real_distribution<double> dist(0, 1);
+        double increase = (double)newsize - (double)size;
+        accept = (dist(rnd) < std::exp(-increase / temperature));
+    }
+
+    if (accept)
+    {
+        d.score = (int)size - (int)newsize;
+        datafile.SetDictionaryEntry(index, d);
+        eval.Update(datafile, index);
+        return true;
+    }
+
+    return false;
+}
+
 // Try to replace the worst dictionary entry with a better one.
-void optimize_worst(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_worst(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                    double temperature, bool verbose)
 {
     std::uniform_int_distribution<size_t> dist(0, 1);
 
-    DataFile trial = datafile;
-    size_t worst = trial.GetLowScoreIndex();
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(worst);
+    size_t worst = datafile.GetLowScoreIndex();
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(worst);
     d.replacement = *random_substring(datafile, rnd);
     d.ref_encode = dist(rnd);
-    trial.SetDictionaryEntry(worst, d);
-
-    size_t newsize = get_encoded_size(trial);
 
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, worst, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(worst, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_worst: replaced " << worst
-                      << " score " << d.score << std::endl;
+        std::cout << "optimize_worst: replaced " << worst
+                  << " score " << d.score << std::endl;
     }
 }
 
 // Try to replace random dictionary entry with another one.
-void optimize_any(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_any(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                  double temperature, bool verbose)
 {
-    DataFile trial = datafile;
-    std::uniform_int_distribution<size_t> dist(0, DataFile::dictionarysize - 1);
+    std::uniform_int_distribution<size_t> dist(0, datafile.GetDictionarySize() - 1);
     size_t index = dist(rnd);
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(index);
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(index);
     d.replacement = *random_substring(datafile, rnd);
-    trial.SetDictionaryEntry(index, d);
 
-    size_t newsize = get_encoded_size(trial);
-
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, index, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(index, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_any: replaced " << index
-                      << " score " << d.score << std::endl;
+        std::cout << "optimize_any: replaced " << index
+                  << " score " << d.score << std::endl;
     }
 }
 
 // Try to append or prepend random dictionary entry.
-void optimize_expand(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose, bool binary_only)
+void optimize_expand(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                     double temperature, bool verbose, bool binary_only)
 {
-    DataFile trial = datafile;
-    std::uniform_int_distribution<size_t> dist1(0, DataFile::dictionarysize - 1);
+    std::uniform_int_distribution<size_t> dist1(0, datafile.GetDictionarySize() - 1);
     size_t index = dist1(rnd);
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(index);
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(index);
 
     std::uniform_int_distribution<size_t> dist3(1, 3);
     size_t count = dist3(rnd);
@@ -120,29 +140,20 @@ void optimize_expand(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose,
         }
     }
 
-    trial.SetDictionaryEntry(index, d);
-
-    size_t newsize = get_encoded_size(trial);
-
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, index, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(index, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_expand: expanded " << index
-                      << " by " << count << " pixels, score " << d.score << std::endl;
+        std::cout << "optimize_expand: expanded " << index
+                  << " by " << count << " pixels, score " << d.score << std::endl;
     }
 }
 
 // Try to trim random dictionary entry.
-void optimize_trim(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_trim(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                   double temperature, bool verbose)
 {
-    DataFile trial = datafile;
-    std::uniform_int_distribution<size_t> dist1(0, DataFile::dictionarysize - 1);
+    std::uniform_int_distribution<size_t> dist1(0, datafile.GetDictionarySize() - 1);
     size_t index = dist1(rnd);
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(index);
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(index);
 
     if (d.replacement.size() <= 2) return;
 
@@ -160,55 +171,37 @@ void optimize_trim(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
         d.replacement.erase(d.replacement.end() - end, d.replacement.end() - 1);
     }
 
-    trial.SetDictionaryEntry(index, d);
-
-    size_t newsize = get_encoded_size(trial);
-
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, index, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(index, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_trim: trimmed " << index
-                      << " by " << start << " pixels from start and "
-                      << end << " pixels from end, score " << d.score << std::endl;
+        std::cout << "optimize_trim: trimmed " << index
+                  << " by " << start << " pixels from start and "
+                  << end << " pixels from end, score " << d.score << std::endl;
     }
 }
 
 // Switch random dictionary entry to use ref encoding or back to rle.
-void optimize_refdict(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_refdict(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                      double temperature, bool verbose)
 {
-    DataFile trial = datafile;
-    std::uniform_int_distribution<size_t> dist1(0, DataFile::dictionarysize - 1);
+    std::uniform_int_distribution<size_t> dist1(0, datafile.GetDictionarySize() - 1);
     size_t index = dist1(rnd);
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(index);
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(index);
 
     d.ref_encode = !d.ref_encode;
 
-    trial.SetDictionaryEntry(index, d);
-
-    size_t newsize = get_encoded_size(trial);
-
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, index, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(index, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_refdict: switched " << index
-                      << " to " << (d.ref_encode ? "ref" : "RLE")
-                      << ", score " << d.score << std::endl;
+        std::cout << "optimize_refdict: switched " << index
+                  << " to " << (d.ref_encode ? "ref" : "RLE")
+                  << ", score " << d.score << std::endl;
     }
 }
 
 // Combine two random dictionary entries.
-void optimize_combine(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_combine(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                      double temperature, bool verbose)
 {
-    DataFile trial = datafile;
-    std::uniform_int_distribution<size_t> dist1(0, DataFile::dictionarysize - 1);
+    std::uniform_int_distribution<size_t> dist1(0, datafile.GetDictionarySize() - 1);
     size_t worst = datafile.GetLowScoreIndex();
     size_t index1 = dist1(rnd);
     size_t index2 = dist1(rnd);
@@ -220,151 +213,311 @@ void optimize_combine(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose
     d.replacement = part1;
     d.replacement.insert(d.replacement.end(), part2.begin(), part2.end());
     d.ref_encode = true;
-    trial.SetDictionaryEntry(worst, d);
-
-    size_t newsize = get_encoded_size(trial);
 
-    if (newsize < size)
+    if (try_entry(datafile, eval, rnd, temperature, worst, d) && verbose)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(worst, d);
-        size = newsize;
-
-        if (verbose)
-            std::cout << "optimize_combine: combined " << index1
-                      << " and " << index2 << " to replace " << worst
-                      << ", score " << d.score << std::endl;
+        std::cout << "optimize_combine: combined " << index1
+                  << " and " << index2 << " to replace " << worst
+                  << ", score " << d.score << std::endl;
     }
 }
 
 // Pick a random part of an encoded glyph and encode it as a ref dict.
-void optimize_encpart(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
+void optimize_encpart(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                      double temperature, bool verbose)
 {
-    std::unique_ptr<encoded_font_t> e = encode_font(datafile);
-
     // Pick a random encoded glyph
     std::uniform_int_distribution<size_t> dist1(0, datafile.GetGlyphCount() - 1);
     size_t index = dist1(rnd);
-    const encoded_font_t::refstring_t &refstr = e->glyphs.at(index);
+    std::unique_ptr<encoded_font_t> e = encode_glyph(datafile, index, true,
+                                                     eval.GetTreeLayout());
+    const encoded_font_t::refstring_t &refstr = e->glyphs.at(0);
+
+    // Find the codeword boundaries, which are all the bytes unless the
+    // dictionary is large enough for two-byte codewords.
+    std::vector<size_t> bounds;
+    for (size_t pos = 0; pos < refstr.size(); )
+    {
+        bounds.push_back(pos);
+        pos += get_codeword_size(*e, refstr.at(pos));
+    }
+    bounds.push_back(refstr.size());
 
-    if (refstr.size() < 2)
+    const size_t codewords = bounds.size() - 1;
+    if (codewords < 2)
         return;
 
     // Pick a random part of it
-    std::uniform_int_distribution<size_t> dist2(2, refstr.size());
+    std::uniform_int_distribution<size_t> dist2(2, codewords);
     size_t length = dist2(rnd);
-    std::uniform_int_distribution<size_t> dist3(0, refstr.size() - length);
+    std::uniform_int_distribution<size_t> dist3(0, codewords - length);
     size_t start = dist3(rnd);
 
     // Decode that part
-    encoded_font_t::refstring_t substr(refstr.begin() + start,
-                                       refstr.begin() + start + length);
+    encoded_font_t::refstring_t substr(refstr.begin() + bounds.at(start),
+                                       refstr.begin() + bounds.at(start + length));
     std::unique_ptr<DataFile::pixels_t> decoded =
         decode_glyph(*e, substr, datafile.GetFontInfo());
 
     // Add that as a new dictionary entry
-    DataFile trial = datafile;
-    size_t worst = trial.GetLowScoreIndex();
-    DataFile::dictentry_t d = trial.GetDictionaryEntry(worst);
+    size_t worst = datafile.GetLowScoreIndex();
+    DataFile::dictentry_t d = datafile.GetDictionaryEntry(worst);
     d.replacement = *decoded;
     d.ref_encode = true;
-    trial.SetDictionaryEntry(worst, d);
 
-    size_t newsize = get_encoded_size(trial);
+    if (try_entry(datafile, eval, rnd, temperature, worst, d) && verbose)
+    {
+        std::cout << "optimize_encpart: replaced " << worst
+                  << " score " << d.score << std::endl;
+    }
+}
+
+static void optimize_expand_any(DataFile &datafile, SizeEvaluator &eval,
+                                rnd_t &rnd, double temperature, bool verbose)
+{
+    optimize_expand(datafile, eval, rnd, temperature, verbose, false);
+}
+
+static void optimize_expand_binary(DataFile &datafile, SizeEvaluator &eval,
+                                   rnd_t &rnd, double temperature, bool verbose)
+{
+    optimize_expand(datafile, eval, rnd, temperature, verbose, true);
+}
+
+typedef void (*move_func_t)(DataFile &datafile, SizeEvaluator &eval,
+                            rnd_t &rnd, double temperature, bool verbose);
 
-    if (newsize < size)
+struct move_t
+{
+    const char *name;
+    move_func_t func;
+};
+
+// All the optimization algorithms, in the order of a fixed schedule pass.
+static const move_t moves[] = {
+    {"worst",           optimize_worst},
+    {"any",             optimize_any},
+    {"expand",          optimize_expand_any},
+    {"expand_binary",   optimize_expand_binary},
+    {"trim",            optimize_trim},
+    {"refdict",         optimize_refdict},
+    {"combine",         optimize_combine},
+    {"encpart",         optimize_encpart},
+};
+
+static const size_t move_count = sizeof(moves) / sizeof(moves[0]);
+
+// Accumulated statistics for one type of move.
+struct move_stats_t
+{
+    size_t calls;
+    size_t accepted;
+    int saved; // Reduction in encoded size, in bytes
+    size_t work; // Evaluator work units, see SizeEvaluator::GetWork()
+    double seconds; // Wall-clock time, only for display
+
+    move_stats_t(): calls(0), accepted(0), saved(0), work(0), seconds(0) {}
+};
+
+typedef std::vector<move_stats_t> move_table_t;
+
+// Choose the moves for an adaptive pass. Each move is picked with a
+// probability proportional to the bytes it has saved per unit of work so far.
+// The estimates are shrunk towards the average over all moves, so that a few
+// lucky results do not starve the other moves, and half of the picks are
+// uniform so that every move gets retried.
+static std::vector<size_t> schedule_moves(const move_table_t &history, rnd_t &rnd)
+{
+    double total_saved = 0, total_work = 0;
+    for (const move_stats_t &s : history)
     {
-        d.score = size - newsize;
-        datafile.SetDictionaryEntry(worst, d);
-        size = newsize;
+        total_saved += std::max(s.saved, 0);
+        total_work += s.work;
+    }
+
+    double prior_saved = total_saved / move_count + 1.0;
+    double prior_work = total_work / move_count + 100.0;
 
-        if (verbose)
-            std::cout << "optimize_encpart: replaced " << worst
-                      << " score " << d.score << std::endl;
+    std::vector<double> rates(move_count);
+    double total = 0;
+    for (size_t i = 0; i < move_count; i++)
+    {
+        double saved = std::max(history.at(i).saved, 0);
+        rates[i] = (saved + prior_saved) / (history.at(i).work + prior_work);
+        total += rates[i];
     }
-}
 
-// Execute all the optimization algorithms once.
-void optimize_pass(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose)
-{
-    optimize_worst(datafile, size, rnd, verbose);
-    optimize_any(datafile, size, rnd, verbose);
-    optimize_expand(datafile, size, rnd, verbose, false);
-    optimize_expand(datafile, size, rnd, verbose, true);
-    optimize_trim(datafile, size, rnd, verbose);
-    optimize_refdict(datafile, size, rnd, verbose);
-    optimize_combine(datafile, size, rnd, verbose);
-    optimize_encpart(datafile, size, rnd, verbose);
+    std::vector<double> weights(move_count);
+    for (size_t i = 0; i < move_count; i++)
+        weights[i] = 0.5 / move_count + 0.5 * rates[i] / total;
+
+    std::discrete_distribution<size_t> dist(weights.begin(), weights.end());
+    std::vector<size_t> result(move_count);
+    for (size_t &m : result)
+        m = dist(rnd);
+    return result;
 }
 
-// Execute multiple passes in parallel and take the one with the best result.
-// The amount of parallelism is hardcoded in order to retain deterministic
-// behaviour.
-void optimize_parallel(DataFile &datafile, size_t &size, rnd_t &rnd, bool verbose, int num_threads = 4)
+// Execute the optimization algorithms once, either each once in fixed order
+// or as chosen by schedule_moves() if history is given. Statistics of the
+// executed moves are added to stats.
+void optimize_pass(DataFile &datafile, SizeEvaluator &eval, rnd_t &rnd,
+                   double temperature, const move_table_t *history,
+                   move_table_t &stats, bool verbose)
 {
-    std::vector<DataFile> datafiles;
-    std::vector<size_t> sizes;
-    std::vector<rnd_t> rnds;
-    std::vector<std::unique_ptr<std::thread> > threads;
+    std::vector<size_t> schedule;
+    if (history)
+    {
+        schedule = schedule_moves(*history, rnd);
+    }
+    else
+    {
+        for (size_t i = 0; i < move_count; i++)
+            schedule.push_back(i);
+    }
 
-    for (int i = 0; i < num_threads; i++)
+    for (size_t m : schedule)
     {
-        datafiles.emplace_back(datafile);
-        sizes.emplace_back(size);
-        rnds.emplace_back(rnd());
+        size_t size = eval.GetSize();
+        size_t work = eval.GetWork();
+        auto start = std::chrono::steady_clock::now();
+
+        moves[m].func(datafile, eval, rnd, temperature, verbose);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        move_stats_t &s = stats.at(m);
+        s.calls++;
+        s.accepted += (eval.GetSize() != size);
+        s.saved += (int)size - (int)eval.GetSize();
+        s.work += eval.GetWork() - work;
+        s.seconds += elapsed.count();
     }
+}
+
+// Execute multiple passes in parallel and take the one with the best result.
+// Each candidate has its own random generator, so the result depends only on
+// the number of candidates and not on how the pool schedules them.
+// The move statistics of all the candidates are added to history.
+void optimize_parallel(DataFile &datafile, SizeEvaluator &eval,
+                       std::vector<rnd_t> &rnds, ThreadPool &pool,
+                       double temperature, bool adaptive,
+                       move_table_t &history, bool verbose)
+{
+    std::vector<DataFile> datafiles(rnds.size(), datafile);
+    std::vector<SizeEvaluator> evals(rnds.size(), eval);
+    std::vector<move_table_t> stats(rnds.size(), move_table_t(move_count));
+
+    pool.Run(rnds.size(), [&](size_t i) {
+        optimize_pass(datafiles.at(i), evals.at(i), rnds.at(i), temperature,
+                      adaptive ? &history : nullptr, stats.at(i), verbose);
+    });
 
-    for (int i = 0; i < num_threads; i++)
+    size_t best = 0;
+    for (size_t i = 1; i < rnds.size(); i++)
     {
-        threads.emplace_back(new std::thread(optimize_pass,
-                                             std::ref(datafiles.at(i)),
-                                             std::ref(sizes.at(i)),
-                                             std::ref(rnds.at(i)),
-                                             verbose));
+        if (evals.at(i).GetSize() < evals.at(best).GetSize())
+            best = i;
     }
 
-    for (int i = 0; i < num_threads; i++)
+    for (const move_table_t &t : stats)
     {
-        threads.at(i)->join();
+        for (size_t m = 0; m < move_count; m++)
+        {
+            history.at(m).calls += t.at(m).calls;
+            history.at(m).accepted += t.at(m).accepted;
+            history.at(m).saved += t.at(m).saved;
+            history.at(m).work += t.at(m).work;
+            history.at(m).seconds += t.at(m).seconds;
+        }
     }
 
-    int best = std::min_element(sizes.begin(), sizes.end()) - sizes.begin();
-    size = sizes.at(best);
     datafile = datafiles.at(best);
+    eval = evals.at(best);
 }
 
-// Go through all the dictionary entries and check what it costs to remove
-// them. Removes any entries with negative or zero score.
-void update_scores(DataFile &datafile, bool verbose)
+// Print the move statistics of an optimize() call.
+static void print_move_stats(const move_table_t &history)
 {
-    size_t oldsize = get_encoded_size(datafile);
+    std::cout << "move            calls  accepted  saved      work   time"
+              << std::endl;
 
-    for (size_t i = 0; i < DataFile::dictionarysize; i++)
+    for (size_t m = 0; m < move_count; m++)
     {
-        DataFile trial = datafile;
-        DataFile::dictentry_t dummy = {};
-        trial.SetDictionaryEntry(i, dummy);
-        size_t newsize = get_encoded_size(trial);
+        const move_stats_t &s = history.at(m);
+        std::cout << std::left << std::setw(14) << moves[m].name
+                  << std::right << std::setw(7) << s.calls
+                  << std::setw(10) << s.accepted
+                  << std::setw(7) << s.saved
+                  << std::setw(10) << s.work
+                  << std::setw(6) << std::fixed << std::setprecision(2)
+                  << s.seconds << " s" << std::endl;
+    }
+    std::cout.unsetf(std::ios::floatfield);
+}
 
-        DataFile::dictentry_t d = datafile.GetDictionaryEntry(i);
-        d.score = newsize - oldsize;
+// Go through all the dictionary entries and check what it costs to remove
+// them. Removes any entries with negative or zero score.
+//
+// The removal trials are evaluated in parallel, one batch of entries per
+// round. Dropping a non-empty entry makes the remaining results of the batch
+// stale, so the next round starts right after it. This gives the same result
+// as going through the entries one at a time.
+//
+// Each score is measured against the size before the first entry was
+// dropped, not the size after the previous drops.
+void update_scores(DataFile &datafile, SizeEvaluator &eval, ThreadPool &pool,
+                   bool verbose)
+{
+    const DataFile::dictentry_t dummy = {};
+    const size_t oldsize = eval.GetSize();
+    const size_t batch = pool.GetThreadCount();
+    std::vector<size_t> newsizes(batch), works(batch);
+    size_t i = 0;
 
-        if (d.score > 0)
-        {
-            datafile.SetDictionaryEntry(i, d);
-        }
-        else
+    while (i < datafile.GetDictionarySize())
+    {
+        const size_t first = i;
+        const size_t count = std::min(batch, datafile.GetDictionarySize() - first);
+        pool.Run(count, [&](size_t j) {
+            DataFile trial = datafile.MakeTrial(first + j, dummy);
+            works.at(j) = 0;
+            newsizes.at(j) = eval.Evaluate(trial, first + j, works.at(j));
+        });
+
+        for (size_t j = 0; j < count; j++)
+            eval.AddWork(works.at(j));
+
+        for (; i < first + count; i++)
         {
-            datafile.SetDictionaryEntry(i, dummy);
-
-            if (verbose && d.replacement.size() != 0)
-                std::cout << "update_scores: dropped " << i
-                        << " score " << -d.score << std::endl;
+            DataFile::dictentry_t d = datafile.GetDictionaryEntry(i);
+            d.score = newsizes.at(i - first) - oldsize;
+
+            if (d.score > 0)
+            {
+                datafile.SetDictionaryEntry(i, d);
+            }
+            else
+            {
+                datafile.SetDictionaryEntry(i, dummy);
+                eval.Update(datafile, i);
+
+                if (d.replacement.size() != 0)
+                {
+                    if (verbose)
+                        std::cout << "update_scores: dropped " << i
+                                << " score " << -d.score << std::endl;
+
+                    i++;
+                    break;
+                }
+            }
         }
     }
 }
 
-void init_dictionary(DataFile &datafile)
+static void init_random(DataFile &datafile)
 {
     rnd_t rnd(datafile.GetSeed());
 
@@ -375,7 +528,7 @@ void init_dictionary(DataFile &datafile)
     std::set<DataFile::pixels_t> added_substrings;
 
     size_t i = 0;
-    while (i < DataFile::dictionarysize)
+    while (i < datafile.GetDictionarySize())
     {
         DataFile::pixels_t substring = *random_substring(datafile, rnd);
 
@@ -396,22 +549,341 @@ void init_dictionary(DataFile &datafile)
     }
 }
 
-void optimize(DataFile &datafile, size_t iterations)
+// Repeated substring found in the glyph data. It occurs at the starting
+// positions of the suffixes sa[first] to sa[last - 1].
+struct candidate_t
+{
+    size_t first;
+    size_t last;
+    size_t length;
+    double score; // Estimated saving in bytes
+};
+
+// Estimate the size of a pixel when encoded without the dictionary. Pixels
+// of other shades take a byte each. Full and empty pixels only take a byte
+// each when the dictionary is full, as otherwise the fill entries pack
+// several of them in a byte, but their runs are usually covered by other
+// entries anyway. Counting them as a fraction of a byte works best in
+// practice.
+static double raw_size(uint32_t pixel)
+{
+    return (pixel == 0 || pixel == 15) ? 0.2 : 1.0;
+}
+
+// Get the shortest period of the string, equal to its length if the string
+// does not repeat itself.
+static size_t get_period(const uint32_t *pixels, size_t length)
+{
+    // Knuth-Morris-Pratt failure function
+    std::vector<size_t> border(length + 1);
+    border[0] = 0;
+    size_t k = 0;
+    for (size_t i = 1; i < length; i++)
+    {
+        while (k > 0 && pixels[i] != pixels[k])
+            k = border[k];
+        if (pixels[i] == pixels[k])
+            k++;
+        border[i + 1] = k;
+    }
+    return length - border[length];
+}
+
+// Finds the repeated substrings with the largest estimated saving, taking
+// into account the pixels already covered by the chosen ones.
+class SubstringSelector
+{
+public:
+    SubstringSelector(const DataFile &datafile);
+
+    // Choose the next substring, or return false if none of them saves
+    // anything anymore.
+    bool Choose(DataFile::dictentry_t &entry);
+
+private:
+    std::vector<uint32_t> m_text;
+    std::vector<uint32_t> m_sa;
+    std::vector<double> m_rawsum; // Prefix sums of raw_size() over m_text
+    std::vector<bool> m_covered;
+    std::vector<candidate_t> m_queue; // Heap, best candidate first
+
+    static bool Worse(const candidate_t &a, const candidate_t &b)
+    {
+        return a.score < b.score || (a.score == b.score && a.first > b.first);
+    }
+
+    double Evaluate(const candidate_t &c, bool &ref_encode) const;
+    void Cover(const candidate_t &c);
+};
+
+SubstringSelector::SubstringSelector(const DataFile &datafile)
+{
+    // Concatenate the glyphs with a unique separator after each, so that
+    // no repeated substring crosses a glyph boundary.
+    for (size_t i = 0; i < datafile.GetGlyphCount(); i++)
+    {
+        const DataFile::pixels_t &pixels = datafile.GetGlyphEntry(i).data;
+        m_text.insert(m_text.end(), pixels.begin(), pixels.end());
+        m_text.push_back(16 + i);
+    }
+
+    m_sa = build_suffix_array(m_text, 16 + datafile.GetGlyphCount());
+    std::vector<uint32_t> lcp = build_lcp_array(m_text, m_sa);
+    lcp.push_back(0);
+
+    m_rawsum.push_back(0);
+    for (uint32_t pixel : m_text)
+        m_rawsum.push_back(m_rawsum.back() + raw_size(pixel));
+
+    m_covered.resize(m_text.size());
+
+    // Each interval of the suffix array with a common prefix longer than
+    // the LCP at its boundaries is a repeated substring that cannot be
+    // extended to the right without losing occurrences. Find them all with
+    // a stack and keep the best candidates. Longer ones do not make better
+    // starting points, so the length is limited to one row of the glyph.
+    const size_t max_length = datafile.GetFontInfo().max_width;
+    const size_t max_candidates = 16 * datafile.GetDictionarySize();
+
+    // While collecting, the heap has the worst candidate first.
+    auto better = [](const candidate_t &a, const candidate_t &b) {
+        return Worse(b, a);
+    };
+
+    std::vector<std::pair<size_t, size_t> > stack; // (length, first)
+    stack.push_back(std::make_pair(0, 0));
+    for (size_t i = 1; i < lcp.size(); i++)
+    {
+        size_t first = i - 1;
+        while (stack.back().first > lcp[i])
+        {
+            size_t length = stack.back().first;
+            first = stack.back().second;
+            stack.pop_back();
+
+            if (length < 2 || length > max_length)
+                continue;
+
+            // Skip the candidates that could not make it to the queue even
+            // if all their occurrences were replaceable.
+            size_t start = m_sa[first];
+            double raw = m_rawsum[start + length] - m_rawsum[start];
+            double bound = (i - first) * (raw - 1);
+            if (m_queue.size() == max_candidates && bound <= m_queue.front().score)
+                continue;
+
+            bool ref_encode;
+            candidate_t c = {first, i, length, 0};
+            c.score = Evaluate(c, ref_encode);
+            if (c.score <= 0)
+                continue;
+
+            m_queue.push_back(c);
+            std::push_heap(m_queue.begin(), m_queue.end(), better);
+            if (m_queue.size() > max_candidates)
+            {
+                std::pop_heap(m_queue.begin(), m_queue.end(), better);
+                m_queue.pop_back();
+            }
+        }
+
+        if (stack.back().first < lcp[i])
+            stack.push_back(std::make_pair(lcp[i], first));
+    }
+
+    std::make_heap(m_queue.begin(), m_queue.end(), Worse);
+}
+
+// Estimate the saving of adding the candidate to the dictionary. Only the
+// occurrences that do not overlap the covered pixels can be replaced, and
+// a string with period p occurs at every p'th position inside a run of
+// itself, of which only every length/p'th can be replaced. Candidates with
+// many occurrences are estimated from a sample of them.
+double SubstringSelector::Evaluate(const candidate_t &c, bool &ref_encode) const
+{
+    const size_t max_samples = 256;
+    size_t total = c.last - c.first;
+    size_t step = (total + max_samples - 1) / max_samples;
+
+    size_t samples = 0, free = 0;
+    for (size_t i = c.first; i < c.last; i += step)
+    {
+        size_t start = m_sa[i];
+        auto begin = m_covered.begin() + start;
+        if (std::find(begin, begin + c.length, true) == begin + c.length)
+            free++;
+        samples++;
+    }
+
+    const uint32_t *pixels = &m_text[m_sa[c.first]];
+    double period = get_period(pixels, c.length);
+    double count = total * (double)free / samples * period / c.length;
+
+    // The entry itself is stored with either RLE or references to other
+    // entries, whichever is smaller.
+    size_t start = m_sa[c.first];
+    double raw = m_rawsum[start + c.length] - m_rawsum[start];
+    double rle = get_rle_size(DataFile::pixels_t(pixels, pixels + c.length));
+    ref_encode = raw < rle;
+    double entry_size = std::min(raw, rle) + 2; // Data and offset table
+
+    return count * (raw - 1) - entry_size;
+}
+
+// Mark the pixels of the non-overlapping occurrences of the candidate that
+// are still free as covered.
+void SubstringSelector::Cover(const candidate_t &c)
+{
+    std::vector<uint32_t> positions(m_sa.begin() + c.first, m_sa.begin() + c.last);
+    std::sort(positions.begin(), positions.end());
+
+    size_t end = 0;
+    for (size_t start : positions)
+    {
+        if (start < end)
+            continue;
+
+        auto begin = m_covered.begin() + start;
+        if (std::find(begin, begin + c.length, true) != begin + c.length)
+            continue;
+
+        std::fill(begin, begin + c.length, true);
+        end = start + c.length;
+    }
+}
+
+bool SubstringSelector::Choose(DataFile::dictentry_t &entry)
+{
+    // The scores only decrease as more pixels get covered, so a candidate
+    // can be chosen when its current score is still the best one.
+    while (!m_queue.empty())
+    {
+        std::pop_heap(m_queue.begin(), m_queue.end(), Worse);
+        candidate_t c = m_queue.back();
+        m_queue.pop_back();
+
+        bool ref_encode;
+        double score = Evaluate(c, ref_encode);
+        if (score < c.score)
+        {
+            c.score = score;
+            if (score > 0)
+            {
+                m_queue.push_back(c);
+                std::push_heap(m_queue.begin(), m_queue.end(), Worse);
+            }
+            continue;
+        }
+
+        Cover(c);
+
+        const uint32_t *pixels = &m_text[m_sa[c.first]];
+        entry = DataFile::dictentry_t();
+        entry.replacement.assign(pixels, pixels + c.length);
+        entry.ref_encode = ref_encode;
+        return true;
+    }
+
+    return false;
+}
+
+static void init_frequency(DataFile &datafile)
+{
+    SubstringSelector selector(datafile);
+
+    // If there are not enough substrings worth adding, the rest of the
+    // entries are left empty for the optimizer to fill.
+    for (size_t i = 0; i < datafile.GetDictionarySize(); i++)
+    {
+        DataFile::dictentry_t d;
+        selector.Choose(d);
+        datafile.SetDictionaryEntry(i, d);
+    }
+}
+
+void init_dictionary(DataFile &datafile, init_mode_t mode)
+{
+    if (mode == INIT_FREQUENCY)
+        init_frequency(datafile);
+    else
+        init_random(datafile);
+}
+
+void optimize(DataFile &datafile, ThreadPool &pool,
+              const optimize_options_t &options, size_t iterations)
 {
     bool verbose = false;
     rnd_t rnd(datafile.GetSeed());
 
-    update_scores(datafile, verbose);
+    // One candidate per thread, seeded from the font seed and its index.
+    std::vector<rnd_t> rnds;
+    for (size_t i = 0; i < pool.GetThreadCount(); i++)
+    {
+        std::seed_seq seq {datafile.GetSeed(), (uint32_t)i};
+        rnds.emplace_back(seq);
+    }
 
-    size_t size = get_encoded_size(datafile);
+    SizeEvaluator eval(datafile, true, options.decode_weight,
+                       options.tree_layout);
+    update_scores(datafile, eval, pool, verbose);
+
+    // Annealing may move to worse states, so remember the best one seen.
+    DataFile best = datafile;
+    size_t bestsize = eval.GetSize();
+
+    move_table_t history(move_count);
 
     for (size_t i = 0; i < iterations; i++)
     {
-        optimize_parallel(datafile, size, rnd, verbose);
+        double temperature = 0;
+        if (options.strategy == STRATEGY_ANNEAL)
+        {
+            // Cool down linearly towards plain hill climbing.
+            temperature = options.temperature * (iterations - i) / iterations;
+        }
+
+        optimize_parallel(datafile, eval, rnds, pool, temperature,
+                          options.schedule == SCHEDULE_ADAPTIVE, history,
+                          verbose);
+
+        if (eval.GetSize() < bestsize)
+        {
+            best = datafile;
+            bestsize = eval.GetSize();
+        }
     }
 
+    datafile = best;
+
+    if (options.verbose)
+        print_move_stats(history);
+
     std::uniform_int_distribution<size_t> dist(0, std::numeric_limits<uint32_t>::max());
     datafile.SetSeed(dist(rnd));
 }
 
+void optimize(DataFile &datafile, ThreadPool &pool, size_t iterations)
+{
+    optimize(datafile, pool, optimize_options_t(), iterations);
+}
+
+void optimize(DataFile &datafile, size_t iterations)
+{
+    ThreadPool pool(4);
+    optimize(datafile, pool, iterations);
+}
+
+void optimize_blocks(const std::vector<DataFile*> &blocks, ThreadPool &pool,
+                     const optimize_options_t &options, size_t iterations)
+{
+    optimize_options_t quiet = options;
+    quiet.verbose = false;
+
+    pool.Run(blocks.size(), [&](size_t i)
+    {
+        ThreadPool single(1);
+        optimize(*blocks.at(i), single, quiet, iterations);
+    });
+}
+
 }}
@@ -1,15 +1,101 @@
 // This implements the actual optimization passes of the compressor.
 
 #include "datafile.hh"
+#include "encode_rlefont.hh"
+#include "threadpool.hh"
 
 namespace mcufont {
 namespace rlefont {
 
+enum init_mode_t
+{
+    // Pick random substrings that occur at least twice.
+    INIT_RANDOM,
+
+    // Pick the repeated substrings with the largest estimated saving, found
+    // using a suffix array over all the glyphs. Does not use the seed.
+    INIT_FREQUENCY
+};
+
 // Initialize the dictionary table with reasonable guesses.
-void init_dictionary(DataFile &datafile);
+void init_dictionary(DataFile &datafile, init_mode_t mode = INIT_RANDOM);
+
+class SizeEvaluator;
+
+// Compute the score of each dictionary entry, which is the number of bytes
+// saved by it, and remove the entries that do not save anything. The eval
+// must match the current state of datafile, and is kept up to date.
+void update_scores(DataFile &datafile, SizeEvaluator &eval, ThreadPool &pool,
+                   bool verbose = false);
+
+enum strategy_t
+{
+    // Accept only changes that reduce the encoded size.
+    STRATEGY_HILLCLIMB,
+
+    // Simulated annealing: also accept changes that increase the size, with
+    // a probability that decreases with the increase and the iteration count.
+    // Each optimize() call restarts from the hottest temperature and returns
+    // the best state that it found.
+    STRATEGY_ANNEAL
+};
+
+enum schedule_t
+{
+    // Run each type of move once per pass.
+    SCHEDULE_FIXED,
+
+    // Choose the moves for each pass randomly, favoring the ones that have
+    // saved the most bytes per evaluation work during this optimize() call.
+    SCHEDULE_ADAPTIVE
+};
+
+struct optimize_options_t
+{
+    strategy_t strategy;
+    schedule_t schedule;
+
+    // Print statistics for each type of move at the end of optimize().
+    bool verbose;
+
+    // Initial temperature for STRATEGY_ANNEAL, in bytes. An increase of this
+    // many bytes is accepted with probability 1/e.
+    double temperature;
+
+    // Number of bytes that reducing the average decoding cost of a glyph by
+    // one step is worth, see get_decode_cost(). The optimizer minimizes the
+    // size plus the weighted cost. Zero optimizes for size only.
+    double decode_weight;
+
+    // Layout of the dictionary tree used to evaluate the moves. Does not
+    // change the result, see tree_layout_t.
+    tree_layout_t tree_layout;
+
+    optimize_options_t():
+        strategy(STRATEGY_HILLCLIMB), schedule(SCHEDULE_ADAPTIVE),
+        verbose(false), temperature(0.3), decode_weight(0),
+        tree_layout(TREE_POINTERS) {}
+};
 
 // Perform a single optimization step, consisting itself of multiple passes
-// of each of the optimization algorithms.
+// of each of the optimization algorithms. Each iteration runs one candidate
+// pass per thread of the pool, so the result is deterministic for a given
+// thread count.
+void optimize(DataFile &datafile, ThreadPool &pool,
+              const optimize_options_t &options, size_t iterations = 50);
+
+// Same as above, using the default options.
+void optimize(DataFile &datafile, ThreadPool &pool, size_t iterations = 50);
+
+// Same as above, using a temporary pool of 4 threads.
 void optimize(DataFile &datafile, size_t iterations = 50);
 
+// Optimize several independent data files, such as the blocks from
+// split_blocks(), one on each thread of the pool. Each one is optimized
+// with a single candidate per step, so the result does not depend on the
+// thread count. The verbose option is ignored.
+void optimize_blocks(const std::vector<DataFile*> &blocks, ThreadPool &pool,
+                     const optimize_options_t &options,
+                     size_t iterations = 50);
+
 }}
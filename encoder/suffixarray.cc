@@ -0,0 +1,102 @@
+#include "suffixarray.hh"
+
+namespace mcufont {
+
+// Prefix doubling: after each round, the suffixes are sorted by their first
+// 2k symbols. Each round is a stable counting sort of the suffixes by the
+// rank of their first half, taken in the order of the rank of their second
+// half, so the total time is O(n log n).
+std::vector<uint32_t> build_suffix_array(const std::vector<uint32_t> &text,
+                                         size_t alphabet_size)
+{
+    size_t n = text.size();
+    std::vector<uint32_t> sa(n), rank(text), order(n), newrank(n);
+    std::vector<size_t> counts;
+
+    if (n == 0)
+        return sa;
+
+    auto counting_sort = [&](size_t classes)
+    {
+        counts.assign(classes + 1, 0);
+        for (size_t i = 0; i < n; i++)
+            counts[rank[i] + 1]++;
+        for (size_t c = 1; c <= classes; c++)
+            counts[c] += counts[c - 1];
+        for (size_t i = 0; i < n; i++)
+            sa[counts[rank[order[i]]]++] = order[i];
+    };
+
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    counting_sort(alphabet_size);
+
+    size_t classes = alphabet_size;
+    for (size_t k = 1; k < n; k *= 2)
+    {
+        // Suffixes without a second half come first, then the rest in the
+        // order of their second half.
+        size_t p = 0;
+        for (size_t i = n - k; i < n; i++)
+            order[p++] = i;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (sa[i] >= k)
+                order[p++] = sa[i] - k;
+        }
+
+        counting_sort(classes);
+
+        auto second = [&](uint32_t i) -> int64_t {
+            return (i + k < n) ? rank[i + k] : -1;
+        };
+
+        newrank[sa[0]] = 0;
+        for (size_t i = 1; i < n; i++)
+        {
+            bool same = rank[sa[i]] == rank[sa[i - 1]] &&
+                        second(sa[i]) == second(sa[i - 1]);
+            newrank[sa[i]] = newrank[sa[i - 1]] + (same ? 0 : 1);
+        }
+        rank.swap(newrank);
+
+        classes = rank[sa[n - 1]] + 1;
+        if (classes == n)
+            break;
+    }
+
+    return sa;
+}
+
+// Kasai's algorithm: the common prefix shrinks by at most one when moving
+// from a suffix to the one starting after it.
+std::vector<uint32_t> build_lcp_array(const std::vector<uint32_t> &text,
+                                      const std::vector<uint32_t> &sa)
+{
+    size_t n = text.size();
+    std::vector<uint32_t> rank(n), lcp(n);
+    for (size_t i = 0; i < n; i++)
+        rank[sa[i]] = i;
+
+    size_t h = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (rank[i] == 0)
+        {
+            h = 0;
+            continue;
+        }
+
+        size_t j = sa[rank[i] - 1];
+        while (i + h < n && j + h < n && text[i + h] == text[j + h])
+            h++;
+
+        lcp[rank[i]] = h;
+        if (h > 0)
+            h--;
+    }
+
+    return lcp;
+}
+
+}
@@ -0,0 +1,60 @@
+// Suffix array construction, used for finding the repeated substrings in
+// the glyph data.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mcufont {
+
+// Sort the suffixes of text. Returns the start positions of the suffixes in
+// lexicographic order. All symbols must be less than alphabet_size.
+std::vector<uint32_t> build_suffix_array(const std::vector<uint32_t> &text,
+                                         size_t alphabet_size);
+
+// Compute the length of the common prefix of each suffix in the suffix array
+// and the one before it. The first element is 0.
+std::vector<uint32_t> build_lcp_array(const std::vector<uint32_t> &text,
+                                      const std::vector<uint32_t> &sa);
+
+}
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+#include <algorithm>
+
+using namespace mcufont;
+
+class SuffixArrayTests: public CxxTest::TestSuite
+{
+public:
+    void testSuffixArray()
+    {
+        // "banana" with a=0, b=1, n=2
+        std::vector<uint32_t> text = {1, 0, 2, 0, 2, 0};
+        std::vector<uint32_t> sa = build_suffix_array(text, 3);
+        std::vector<uint32_t> lcp = build_lcp_array(text, sa);
+
+        TS_ASSERT_EQUALS(sa, std::vector<uint32_t>({5, 3, 1, 0, 4, 2}));
+        TS_ASSERT_EQUALS(lcp, std::vector<uint32_t>({0, 1, 3, 0, 0, 2}));
+    }
+
+    void testLongRuns()
+    {
+        std::vector<uint32_t> text(100, 0);
+        text[50] = 1;
+        std::vector<uint32_t> sa = build_suffix_array(text, 2);
+
+        std::vector<uint32_t> expected(text.size());
+        for (size_t i = 0; i < expected.size(); i++)
+            expected[i] = i;
+        std::sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+            return std::lexicographical_compare(text.begin() + a, text.end(),
+                                                text.begin() + b, text.end());
+        });
+
+        TS_ASSERT_EQUALS(sa, expected);
+    }
+};
+#endif
@@ -0,0 +1,113 @@
+#include "threadpool.hh"
+
+namespace mcufont {
+
+// True while the current thread is executing tasks of a pool. Nested calls
+// to Run() are then executed serially instead of deadlocking the pool.
+static thread_local bool in_pool = false;
+
+ThreadPool::ThreadPool(size_t num_threads):
+    m_func(nullptr), m_count(0), m_next(0), m_busy(0),
+    m_generation(0), m_quit(false)
+{
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+
+    for (size_t i = 1; i < num_threads; i++)
+        m_threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_start.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+}
+
+void ThreadPool::Run(size_t count, const std::function<void(size_t)> &func)
+{
+    if (in_pool || m_threads.empty())
+    {
+        for (size_t i = 0; i < count; i++)
+            func(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_func = &func;
+        m_count = count;
+        m_next = 0;
+        m_busy = m_threads.size();
+        m_error = nullptr;
+        m_generation++;
+    }
+    m_start.notify_all();
+
+    Process();
+
+    // Every worker acknowledges every operation, so none of them can be
+    // left looking at the state of this one when we return.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_func = nullptr;
+
+    if (m_error)
+        std::rethrow_exception(m_error);
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&] { return m_quit || m_generation != seen; });
+
+            if (m_quit)
+                return;
+
+            seen = m_generation;
+        }
+
+        Process();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy--;
+        }
+        m_done.notify_all();
+    }
+}
+
+// Take indices from the shared counter until all have been processed.
+void ThreadPool::Process()
+{
+    in_pool = true;
+
+    size_t i;
+    while ((i = m_next++) < m_count)
+    {
+        try
+        {
+            (*m_func)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+    }
+
+    in_pool = false;
+}
+
+}
@@ -0,0 +1,97 @@
+// Pool of worker threads that is kept alive between parallel operations,
+// so that short parallel steps do not pay for thread creation.
+
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <vector>
+
+namespace mcufont {
+
+class ThreadPool
+{
+public:
+    // Start a pool with the given total number of threads, including the
+    // calling thread. Zero selects the number of hardware threads.
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    // Get the total number of threads, including the calling thread.
+    size_t GetThreadCount() const { return m_threads.size() + 1; }
+
+    // Call func(i) for each i in 0 to count - 1 and wait until all the calls
+    // have finished. The calls are distributed dynamically among the threads,
+    // so the result must not depend on which thread executes which index.
+    // If any call throws, the first exception is rethrown here.
+    void Run(size_t count, const std::function<void(size_t)> &func);
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    // State of the currently running operation.
+    const std::function<void(size_t)> *m_func;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    size_t m_busy;
+    unsigned m_generation;
+    bool m_quit;
+    std::exception_ptr m_error;
+
+    void WorkerLoop();
+    void Process();
+};
+
+}
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+#include <stdexcept>
+
+using namespace mcufont;
+
+class ThreadPoolTests: public CxxTest::TestSuite
+{
+public:
+    void testRun()
+    {
+        ThreadPool pool(4);
+        TS_ASSERT_EQUALS(pool.GetThreadCount(), 4);
+
+        for (int pass = 0; pass < 10; pass++)
+        {
+            std::vector<int> result(100, 0);
+            pool.Run(result.size(), [&](size_t i) {
+                // Nested calls execute serially on the current thread.
+                pool.Run(2, [&](size_t j) { result.at(i) += i + j; });
+            });
+
+            for (size_t i = 0; i < result.size(); i++)
+                TS_ASSERT_EQUALS(result.at(i), 2 * i + 1);
+        }
+    }
+
+    void testException()
+    {
+        ThreadPool pool(3);
+        TS_ASSERT_THROWS_ANYTHING(pool.Run(10, [](size_t i) {
+            if (i == 5) throw std::runtime_error("fail");
+        }));
+
+        size_t count = 0;
+        pool.Run(1, [&](size_t) { count++; });
+        TS_ASSERT_EQUALS(count, 1);
+    }
+};
+
+#endif
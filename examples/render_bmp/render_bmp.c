@@ -13,16 +13,33 @@
 
 typedef struct {
     const char *fontname;
+    const char *fallback_fontname;
+    const char *image_filename;
     const char *filename;
     const char *text;
+    const char *old_text;
     bool justify;
     enum mf_align_t alignment;
     int width;
     int margin;
     int anchor;
     int scale;
+    int bands;
+    bool use_clip;
+    struct mf_rect_s clip;
+    bool framebuffer;
+    bool spans;
+    bool layout;
+    int cache_bits;
+    int cache_size;
+    bool blocks;
+    bool string;
+    int resume_step;
 } options_t;
 
+/* Memory for the optional glyph cache. */
+static uint32_t cache_arena[4096];
+
 static const char default_text[] =
     "The quick brown fox jumps over the lazy dog. "
     "The quick brown fox jumps over the lazy dog. "
@@ -34,11 +51,25 @@ static const char usage_text[] =
     "Usage: ./render_bmp [options] string\n"
     "Options:\n"
     "    -f font     Specify the font name to use.\n"
+    "    -Z font     Use another font for characters missing from the first.\n"
+    "    -T font.bin Read the font from an image file instead (mf_streamfont).\n"
     "    -o out.bmp  Specify the output bmp file name.\n"
     "    -a l|c|r|j  Align left/center/right/justify.\n"
     "    -w width    Width of the image to render.\n"
     "    -m margin   Margin in the image.\n"
-    "    -s scale    Scale the font.\n";
+    "    -s scale    Scale the font.\n"
+    "    -b rows     Render in bands of given height (rlefont only).\n"
+    "    -c x,y,w,h  Only render the pixels inside the given rectangle.\n"
+    "    -F          Render to the built-in 8bpp framebuffer target.\n"
+    "    -S          Deliver the pixels in batches of spans per row.\n"
+    "    -L          Lay out each line into positions before rendering.\n"
+    "    -C b,bytes  Render through a cache of b bits per pixel glyphs.\n"
+    "    -B          Render scaled fonts as blocks of pixels.\n"
+    "    -R          Render each line in one call (left alignment only).\n"
+    "    -U old      Render old text first and then update only the changed\n"
+    "                area to the new text (not with justify).\n"
+    "    -I step     Word wrap the text as it grows by step characters at a\n"
+    "                time, resuming from the last stable line break.\n";
 
 /* Parse the command line options */
 static bool parse_options(int argc, const char **argv, options_t *options)
@@ -62,6 +93,14 @@ static bool parse_options(int argc, const char **argv, options_t *options)
         {
             options->fontname = *argv++;
         }
+        else if (strcmp(cmd, "-Z") == 0 && argc)
+        {
+            options->fallback_fontname = *argv++;
+        }
+        else if (strcmp(cmd, "-T") == 0 && argc)
+        {
+            options->image_filename = *argv++;
+        }
         else if (strcmp(cmd, "-o") == 0 && argc)
         {
             options->filename = *argv++;
@@ -82,6 +121,65 @@ static bool parse_options(int argc, const char **argv, options_t *options)
         {
             options->scale = atoi(*argv++);
         }
+        else if (strcmp(cmd, "-b") == 0 && argc)
+        {
+            options->bands = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-c") == 0 && argc)
+        {
+            struct mf_rect_s *c = &options->clip;
+            if (sscanf(*argv++, "%hd,%hd,%hd,%hd",
+                       &c->x, &c->y, &c->width, &c->height) != 4)
+            {
+                printf("Invalid clip rectangle.\n");
+                return false;
+            }
+            options->use_clip = true;
+        }
+        else if (strcmp(cmd, "-F") == 0)
+        {
+            options->framebuffer = true;
+        }
+        else if (strcmp(cmd, "-S") == 0)
+        {
+            options->spans = true;
+        }
+        else if (strcmp(cmd, "-B") == 0)
+        {
+            options->blocks = true;
+        }
+        else if (strcmp(cmd, "-L") == 0)
+        {
+            options->layout = true;
+        }
+        else if (strcmp(cmd, "-R") == 0)
+        {
+            options->string = true;
+        }
+        else if (strcmp(cmd, "-U") == 0 && argc)
+        {
+            options->old_text = *argv++;
+        }
+        else if (strcmp(cmd, "-I") == 0 && argc)
+        {
+            options->resume_step = atoi(*argv++);
+            if (options->resume_step <= 0)
+            {
+                printf("Invalid step: %d\n", options->resume_step);
+                return false;
+            }
+        }
+        else if (strcmp(cmd, "-C") == 0 && argc)
+        {
+            if (sscanf(*argv++, "%d,%d", &options->cache_bits,
+                       &options->cache_size) != 2 ||
+                options->cache_size < 0 ||
+                options->cache_size > (int)sizeof(cache_arena))
+            {
+                printf("Invalid cache parameters.\n");
+                return false;
+            }
+        }
         else if (strcmp(cmd, "-h") == 0 || strcmp(cmd, "--help") == 0)
         {
             return false;
@@ -124,6 +222,12 @@ static bool parse_options(int argc, const char **argv, options_t *options)
         return false;
     }
 
+    if (options->old_text && options->justify)
+    {
+        printf("Updates are not supported for justified text.\n");
+        return false;
+    }
+
     if (options->width <= 0)
     {
         printf("Invalid width: %d\n", options->width);
@@ -148,6 +252,11 @@ typedef struct {
     uint16_t height;
     uint16_t y;
     const struct mf_font_s *font;
+    const struct mf_scaledfont_s *scaledfont;
+    struct mf_framebuffer_s fb;
+    struct mf_span_buffer_s spans;
+    struct mf_span_s span_storage[16];
+    struct mf_glyph_pos_s glyphs[256];
 } state_t;
 
 /* Callback to write to a memory buffer. */
@@ -173,35 +282,218 @@ static void pixel_callback(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
     }
 }
 
+/* Callback to write a batch of spans to the memory buffer. */
+static void span_callback(const struct mf_span_s *spans, uint8_t count,
+                          void *state)
+{
+    while (count--)
+    {
+        pixel_callback(spans->x, spans->y, spans->count, spans->alpha, state);
+        spans++;
+    }
+}
+
+/* Callback to write a block of pixels to the memory buffer. */
+static void block_callback(int16_t x, int16_t y, uint16_t width,
+                           uint8_t height, uint8_t alpha, void *state)
+{
+    uint8_t dy;
+    for (dy = 0; dy < height; dy++)
+        pixel_callback(x, y + dy, width, alpha, state);
+}
+
 /* Callback to render characters. */
 static uint8_t character_callback(int16_t x, int16_t y, mf_char character,
                                   void *state)
 {
     state_t *s = (state_t*)state;
-    return mf_render_character(s->font, x, y, character, pixel_callback, state);
+    int row, end, bands = s->options->bands;
+    uint8_t width = 0;
+
+    if (s->options->framebuffer)
+        return mf_render_character_fb(s->font, x, y, character, &s->fb);
+
+    if (s->options->blocks && s->scaledfont)
+    {
+        return mf_render_scaled_blocks(s->scaledfont, x, y, character,
+                                       s->options->use_clip ?
+                                          &s->options->clip : 0,
+                                       block_callback, state);
+    }
+
+    if (s->options->spans)
+    {
+        return mf_render_character_spans(s->font, x, y, character,
+                                         s->options->use_clip ?
+                                            &s->options->clip : 0,
+                                         &s->spans);
+    }
+
+    if (s->options->use_clip)
+    {
+        return mf_render_character_clipped(s->font, x, y, character,
+                                           &s->options->clip,
+                                           pixel_callback, state);
+    }
+
+    if (bands <= 0)
+        return mf_render_character(s->font, x, y, character, pixel_callback, state);
+
+    if (!s->font->character_width(s->font, character))
+        character = s->font->fallback_character;
+
+    /* Render each band separately, like a partial redraw would. */
+    for (row = 0; row < s->font->height; row += bands)
+    {
+        end = (row + bands < s->font->height) ? row + bands : s->font->height;
+        width = mf_rlefont_render_rows(s->font, x, y, character, row, end,
+                                       pixel_callback, state);
+    }
+    return width;
 }
 
 /* Callback to render lines. */
 static bool line_callback(const char *line, uint16_t count, void *state)
 {
     state_t *s = (state_t*)state;
+    const struct mf_rect_s *clip = 0;
+
+    if (s->options->use_clip)
+        clip = &s->options->clip;
+
+    if (s->options->layout)
+    {
+        if (s->options->justify)
+        {
+            count = mf_layout_justified(s->font,
+                                        s->width - s->options->margin * 2,
+                                        line, count, s->glyphs, 256);
+        }
+        else
+        {
+            count = mf_layout_aligned(s->font, s->options->alignment,
+                                      line, count, s->glyphs, 256);
+        }
 
-    if (s->options->justify)
+        mf_render_layout(s->font, s->options->anchor, s->y, s->glyphs, count,
+                         clip, character_callback, state);
+    }
+    else if (s->options->string)
+    {
+        mf_render_string(s->font, s->options->anchor, s->y, line, count, true,
+                         clip, pixel_callback, state);
+    }
+    else if (s->options->justify)
     {
-        mf_render_justified(s->font, s->options->anchor, s->y,
-                            s->width - s->options->margin * 2,
-                            line, count, character_callback, state);
+        mf_render_justified_clipped(s->font, s->options->anchor, s->y,
+                                    s->width - s->options->margin * 2,
+                                    line, count, clip,
+                                    character_callback, state);
     }
     else
     {
-        mf_render_aligned(s->font, s->options->anchor, s->y,
-                          s->options->alignment, line, count,
-                          character_callback, state);
+        mf_render_aligned_clipped(s->font, s->options->anchor, s->y,
+                                  s->options->alignment, line, count, clip,
+                                  character_callback, state);
     }
     s->y += s->font->line_height;
     return true;
 }
 
+/* Callback to clear the area that is updated. */
+static void clear_callback(const struct mf_rect_s *rect, void *state)
+{
+    state_t *s = (state_t*)state;
+    int x, y;
+
+    for (y = rect->y; y < rect->y + rect->height; y++)
+    {
+        if (y < 0 || y >= s->height) continue;
+
+        for (x = rect->x; x < rect->x + rect->width; x++)
+        {
+            if (x < 0 || x >= s->width) continue;
+            s->buffer[y * s->width + x] = 255;
+        }
+    }
+}
+
+/* Lines collected by the incremental word wrap. */
+typedef struct {
+    const char **starts;
+    uint16_t *counts;
+    int capacity;
+    int count;
+} lines_t;
+
+/* Callback to store the line with the next index. */
+static bool store_line(const char *line, uint16_t count, void *state)
+{
+    lines_t *l = (lines_t*)state;
+
+    if (l->count < l->capacity)
+    {
+        l->starts[l->count] = line;
+        l->counts[l->count] = count;
+    }
+    l->count++;
+    return true;
+}
+
+/* Word wrap the text as if it was typed in step characters at a time, like
+ * a log console would. Each prefix only replaces the lines after the last
+ * stable line break, so drawing the stored lines at the end checks that the
+ * lines before it came out the same as from wrapping the whole text. */
+static void render_incremental(state_t *s)
+{
+    const char *text = s->options->text;
+    int16_t width = s->options->width - 2 * s->options->margin;
+    size_t length = strlen(text), end = 0;
+    struct mf_wordwrap_state_s wrap;
+    lines_t lines;
+    char *buffer;
+    int i;
+
+    /* Every line takes at least one character, and the last may be empty. */
+    lines.capacity = length + 1;
+    lines.starts = malloc(lines.capacity * sizeof(const char*));
+    lines.counts = malloc(lines.capacity * sizeof(uint16_t));
+    buffer = malloc(length + 1);
+    buffer[0] = '\0';
+
+    mf_wordwrap_init(&wrap, buffer);
+    while (end < length)
+    {
+        end += s->options->resume_step;
+        if (end > length) end = length;
+
+        /* Do not cut the UTF-8 sequence of a character. */
+        while (end < length && (text[end] & 0xC0) == 0x80) end++;
+
+        memcpy(buffer, text, end);
+        buffer[end] = '\0';
+
+        lines.count = wrap.line;
+        mf_wordwrap_resume(s->font, width, &wrap, store_line, &lines);
+    }
+
+    for (i = 0; i < lines.count && i < lines.capacity; i++)
+        line_callback(lines.starts[i], lines.counts[i], s);
+
+    free(buffer);
+    free(lines.counts);
+    free(lines.starts);
+}
+
+/* Callback to read the font image from a file. */
+static bool read_callback(uint32_t offset, uint8_t *buffer, uint16_t length,
+                          void *state)
+{
+    FILE *file = (FILE*)state;
+    return fseek(file, offset, SEEK_SET) == 0 &&
+           fread(buffer, 1, length, file) == length;
+}
+
 /* Callback to just count the lines.
  * Used to decide the image height */
 bool count_lines(const char *line, uint16_t count, void *state)
@@ -216,6 +508,13 @@ int main(int argc, const char **argv)
     int height;
     const struct mf_font_s *font;
     struct mf_scaledfont_s scaledfont;
+    struct mf_cachedfont_s cachedfont;
+    struct mf_fallbackfont_s fallbackfont;
+    struct mf_streamfont_s streamfont;
+    FILE *image = 0;
+    void *arena = 0;
+    uint32_t arena_size;
+    const struct mf_font_s *fonts[2];
     options_t options;
     state_t state = {};
 
@@ -225,18 +524,66 @@ int main(int argc, const char **argv)
         return 1;
     }
 
-    font = mf_find_font(options.fontname);
+    if (options.image_filename)
+    {
+        image = fopen(options.image_filename, "rb");
+        if (!image)
+        {
+            printf("Could not open %s\n", options.image_filename);
+            return 2;
+        }
+
+        arena_size = mf_streamfont_arena_size(&read_callback, image);
+        if (arena_size)
+            arena = malloc(arena_size);
+
+        if (!arena || !mf_streamfont_open(&streamfont, &read_callback, image,
+                                          arena, arena_size))
+        {
+            printf("Invalid font image: %s\n", options.image_filename);
+            return 2;
+        }
+
+        font = &streamfont.font;
+    }
+    else
+    {
+        font = mf_find_font(options.fontname);
+
+        if (!font)
+        {
+            printf("No such font: %s\n", options.fontname);
+            return 2;
+        }
+    }
 
-    if (!font)
+    if (options.fallback_fontname)
     {
-        printf("No such font: %s\n", options.fontname);
-        return 2;
+        fonts[0] = font;
+        fonts[1] = mf_find_font(options.fallback_fontname);
+
+        if (!fonts[1])
+        {
+            printf("No such font: %s\n", options.fallback_fontname);
+            return 2;
+        }
+
+        mf_fallback_font(&fallbackfont, fonts, 2);
+        font = &fallbackfont.font;
     }
 
     if (options.scale > 1)
     {
         mf_scale_font(&scaledfont, font, options.scale, options.scale);
         font = &scaledfont.font;
+        state.scaledfont = &scaledfont;
+    }
+
+    if (options.cache_bits)
+    {
+        mf_cache_font(&cachedfont, font, options.cache_bits,
+                      cache_arena, options.cache_size);
+        font = &cachedfont.font;
     }
 
     /* Count the number of lines that we need. */
@@ -253,19 +600,65 @@ int main(int argc, const char **argv)
     state.buffer = malloc(options.width * height);
     state.y = 2;
     state.font = font;
+    state.fb.data = state.buffer;
+    state.fb.stride = state.width;
+    state.fb.width = state.width;
+    state.fb.height = state.height;
+    state.fb.format = MF_FRAMEBUFFER_GRAY8;
+    state.fb.color = 0;
+    mf_span_buffer_init(&state.spans, state.span_storage, 16, false,
+                        span_callback, &state);
 
     /* Initialize image to white */
     memset(state.buffer, 255, options.width * height);
 
     /* Render the text */
-    mf_wordwrap(font, options.width - 2 * options.margin,
-                options.text, line_callback, &state);
+    if (options.old_text)
+    {
+        /* Draw the old text, and then only what changed on top of it, to
+         * check that the result matches drawing the new text directly. */
+        mf_wordwrap(font, options.width - 2 * options.margin,
+                    options.old_text, line_callback, &state);
+
+        options.use_clip = true;
+        if (mf_update_text(font, options.anchor, 2,
+                           options.width - 2 * options.margin,
+                           options.alignment, options.old_text, options.text,
+                           state.glyphs, 128, clear_callback,
+                           character_callback, &state, &options.clip))
+        {
+            printf("Updated %d,%d,%d,%d\n", options.clip.x, options.clip.y,
+                   options.clip.width, options.clip.height);
+        }
+    }
+    else if (options.resume_step)
+    {
+        render_incremental(&state);
+    }
+    else
+    {
+        mf_wordwrap(font, options.width - 2 * options.margin,
+                    options.text, line_callback, &state);
+    }
 
     /* Write out the bitmap */
     write_bmp(options.filename, state.buffer, state.width, state.height);
 
     printf("Wrote %s\n", options.filename);
 
+    if (options.cache_bits)
+    {
+        printf("Glyph cache: %lu hits, %lu misses\n",
+               (unsigned long)cachedfont.hits,
+               (unsigned long)cachedfont.misses);
+    }
+
+    if (image)
+    {
+        fclose(image);
+        free(arena);
+    }
+
     free(state.buffer);
     return 0;
 }
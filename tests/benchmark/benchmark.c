@@ -0,0 +1,339 @@
+/* Benchmark for the decoder. Renders and lays out the given text with each
+ * of the included fonts, and reports the time and the number of pixel
+ * callbacks per glyph. */
+
+#include <mcufont.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Width of the text area for word wrapping and justification. */
+#define TEXT_WIDTH 400
+
+typedef struct {
+    const char *fontname;
+    double min_time;
+    double mhz;
+    bool json;
+} options_t;
+
+static const char usage_text[] =
+    "Usage: ./benchmark [options] textfile\n"
+    "Options:\n"
+    "    -f font     Only benchmark the given font.\n"
+    "    -t seconds  Minimum time to run each test, default 0.2.\n"
+    "    -m MHz      Also report cycles per glyph at the given clock rate.\n"
+    "    -j          Output the results as JSON.\n";
+
+/************************************
+ * Callbacks used by the benchmarks *
+ ************************************/
+
+typedef struct {
+    const struct mf_font_s *font;
+    struct mf_framebuffer_s fb;
+    uint8_t *pixels;
+    unsigned long callbacks;
+    mf_pixel_callback_t pixel_callback;
+    void *pixel_state;
+} state_t;
+
+/* Pixel callback that only counts the calls. */
+static void null_callback(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
+                          void *state)
+{
+    state_t *s = (state_t*)state;
+    s->callbacks++;
+}
+
+static uint8_t character_callback(int16_t x, int16_t y, mf_char character,
+                                  void *state)
+{
+    state_t *s = (state_t*)state;
+    return mf_render_character(s->font, x, y, character,
+                               s->pixel_callback, s->pixel_state);
+}
+
+static bool line_callback(mf_str line, uint16_t count, void *state)
+{
+    state_t *s = (state_t*)state;
+    mf_render_justified(s->font, 0, 0, TEXT_WIDTH, line, count,
+                        character_callback, state);
+    return true;
+}
+
+static bool count_lines(mf_str line, uint16_t count, void *state)
+{
+    state_t *s = (state_t*)state;
+    s->callbacks++;
+    return true;
+}
+
+/*******************
+ * The benchmarks  *
+ *******************/
+
+typedef void (*test_func_t)(state_t *s, mf_str text);
+
+static void test_render_null(state_t *s, mf_str text)
+{
+    while (*text)
+        mf_render_character(s->font, 0, 0, mf_getchar(&text),
+                            null_callback, s);
+}
+
+static void test_render_fb(state_t *s, mf_str text)
+{
+    while (*text)
+        mf_render_character(s->font, 0, 0, mf_getchar(&text),
+                            mf_framebuffer_callback, &s->fb);
+}
+
+static void test_string_width(state_t *s, mf_str text)
+{
+    mf_get_string_width(s->font, text, 0, true);
+}
+
+static void test_kerning(state_t *s, mf_str text)
+{
+    mf_char c1, c2;
+
+    c1 = mf_getchar(&text);
+    while (*text)
+    {
+        c2 = mf_getchar(&text);
+        mf_compute_kerning(s->font, c1, c2);
+        c1 = c2;
+    }
+}
+
+static void test_wordwrap(state_t *s, mf_str text)
+{
+    mf_wordwrap(s->font, TEXT_WIDTH, text, count_lines, s);
+}
+
+static void test_justify_null(state_t *s, mf_str text)
+{
+    s->pixel_callback = null_callback;
+    s->pixel_state = s;
+    mf_wordwrap(s->font, TEXT_WIDTH, text, line_callback, s);
+}
+
+static void test_justify_fb(state_t *s, mf_str text)
+{
+    s->pixel_callback = mf_framebuffer_callback;
+    s->pixel_state = &s->fb;
+    mf_wordwrap(s->font, TEXT_WIDTH, text, line_callback, s);
+}
+
+static const struct {
+    const char *name;
+    test_func_t func;
+    bool count_callbacks;
+} tests[] = {
+    {"render_null", test_render_null, true},
+    {"render_fb", test_render_fb, false},
+    {"string_width", test_string_width, false},
+    {"kerning", test_kerning, false},
+    {"wordwrap", test_wordwrap, false},
+    {"justify_null", test_justify_null, true},
+    {"justify_fb", test_justify_fb, false},
+};
+
+#define TEST_COUNT (sizeof(tests) / sizeof(tests[0]))
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run the test repeatedly for at least min_time seconds. Returns the time
+ * per glyph in nanoseconds. */
+static double run_test(test_func_t func, state_t *s, mf_str text,
+                       unsigned long glyphs, double min_time,
+                       double *callbacks_per_glyph)
+{
+    unsigned long rounds = 0;
+    double start, elapsed;
+
+    func(s, text); /* Warm up */
+
+    s->callbacks = 0;
+    start = get_time();
+    do
+    {
+        func(s, text);
+        rounds++;
+        elapsed = get_time() - start;
+    } while (elapsed < min_time);
+
+    *callbacks_per_glyph = (double)s->callbacks / rounds / glyphs;
+    return elapsed * 1e9 / rounds / glyphs;
+}
+
+static void benchmark_font(const struct mf_font_s *font, mf_str text,
+                           const options_t *options, bool first)
+{
+    state_t state;
+    unsigned long glyphs = 0;
+    mf_str p = text;
+    size_t i;
+
+    while (*p)
+    {
+        mf_getchar(&p);
+        glyphs++;
+    }
+
+    /* The framebuffer covers the area of the text, so that all the
+     * rendering tests write the same number of pixels. */
+    memset(&state, 0, sizeof(state));
+    state.font = font;
+    state.fb.width = TEXT_WIDTH + font->width;
+    state.fb.height = font->height;
+    state.fb.stride = state.fb.width;
+    state.fb.format = MF_FRAMEBUFFER_GRAY8;
+    state.fb.color = 0;
+    state.pixels = calloc(state.fb.stride, state.fb.height);
+    state.fb.data = state.pixels;
+
+    if (options->json)
+    {
+        printf("%s    {\"font\": \"%s\", \"glyphs\": %lu, \"results\": {",
+               first ? "" : ",\n", font->short_name, glyphs);
+    }
+
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+        double ns, callbacks;
+        ns = run_test(tests[i].func, &state, text, glyphs,
+                      options->min_time, &callbacks);
+
+        if (options->json)
+        {
+            printf("%s\n        \"%s\": {\"ns_per_glyph\": %.1f",
+                   i ? "," : "", tests[i].name, ns);
+            if (tests[i].count_callbacks)
+                printf(", \"callbacks_per_glyph\": %.2f", callbacks);
+            if (options->mhz > 0)
+                printf(", \"cycles_per_glyph\": %.0f", ns * options->mhz / 1000);
+            printf("}");
+        }
+        else
+        {
+            printf("%-24s %-14s %10.1f", font->short_name, tests[i].name, ns);
+            if (tests[i].count_callbacks)
+                printf(" %11.2f", callbacks);
+            else
+                printf(" %11s", "-");
+            if (options->mhz > 0)
+                printf(" %12.0f", ns * options->mhz / 1000);
+            printf("\n");
+        }
+    }
+
+    if (options->json)
+        printf("\n    }}");
+
+    free(state.pixels);
+}
+
+static char *read_file(const char *filename)
+{
+    FILE *f;
+    char *buf;
+    long size;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = malloc(size + 1);
+    if (fread(buf, 1, size, f) != (size_t)size)
+    {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+
+    buf[size] = '\0';
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, const char **argv)
+{
+    options_t options = {NULL, 0.2, 0, false};
+    const char *filename = NULL;
+    const struct mf_font_list_s *f;
+    char *text;
+    bool first = true;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            options.fontname = argv[++i];
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            options.min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            options.mhz = atof(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0)
+            options.json = true;
+        else if (argv[i][0] != '-' && !filename)
+            filename = argv[i];
+        else
+        {
+            printf(usage_text);
+            return 1;
+        }
+    }
+
+    if (!filename)
+    {
+        printf(usage_text);
+        return 1;
+    }
+
+    text = read_file(filename);
+    if (!text)
+    {
+        printf("Could not read %s\n", filename);
+        return 2;
+    }
+
+    if (options.fontname && !mf_find_font(options.fontname))
+    {
+        printf("No such font: %s\n", options.fontname);
+        return 2;
+    }
+
+    if (options.json)
+        printf("{\"text\": \"%s\", \"results\": [\n", filename);
+    else
+        printf("%-24s %-14s %10s %11s%s\n", "Font", "Test", "ns/glyph",
+               "calls/glyph", options.mhz > 0 ? " cycles/glyph" : "");
+
+    for (f = mf_get_font_list(); f; f = f->next)
+    {
+        if (options.fontname &&
+            strcmp(options.fontname, f->font->short_name) != 0)
+            continue;
+
+        benchmark_font(f->font, text, &options, first);
+        first = false;
+    }
+
+    if (options.json)
+        printf("\n]}\n");
+
+    free(text);
+    return 0;
+}
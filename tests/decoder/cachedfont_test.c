@@ -0,0 +1,155 @@
+/* Test of the glyph cache. The base font is wrapped in a font that counts
+ * the glyphs it decodes, and that has a bounding box too narrow for the
+ * widest characters, so that those cannot be stored in the cache. */
+
+#include <mcufont.h>
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+/* Report a failed check, printing only the first few. */
+#define CHECK(cond, ...) do { \
+    if (!(cond) && failures++ < 10) { \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } } while (0)
+
+struct counting_font_s
+{
+    struct mf_font_s font;
+    const struct mf_font_s *base;
+    unsigned renders;
+};
+
+static uint8_t counting_character_width(const struct mf_font_s *font,
+                                        mf_char character)
+{
+    const struct counting_font_s *f = (const struct counting_font_s*)font;
+    return f->base->character_width(f->base, character);
+}
+
+static uint8_t counting_render_character(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         mf_char character,
+                                         mf_pixel_callback_t callback,
+                                         void *state)
+{
+    struct counting_font_s *f = (struct counting_font_s*)font;
+    f->renders++;
+    return f->base->render_character(f->base, x0, y0, character,
+                                     callback, state);
+}
+
+/* Image of a single rendered glyph. */
+#define CANVAS_SIZE 64
+typedef uint8_t canvas_t[CANVAS_SIZE][CANVAS_SIZE];
+
+static void canvas_callback(int16_t x, int16_t y, uint8_t count,
+                            uint8_t alpha, void *state)
+{
+    uint8_t (*canvas)[CANVAS_SIZE] = state;
+
+    for (; count > 0; count--, x++)
+    {
+        if (x >= 0 && y >= 0 && x < CANVAS_SIZE && y < CANVAS_SIZE)
+            canvas[y][x] = alpha;
+    }
+}
+
+/* Render a character through the cache, and check that it looks the same
+ * as when rendered from the base font and took the given number of
+ * decodes. */
+static void check_render(struct mf_cachedfont_s *cfont,
+                         struct counting_font_s *counter, mf_char character,
+                         unsigned decodes)
+{
+    static canvas_t cached, direct;
+    unsigned renders = counter->renders;
+
+    memset(cached, 0, sizeof(cached));
+    memset(direct, 0, sizeof(direct));
+
+    mf_render_character(&cfont->font, 4, 4, character, canvas_callback,
+                        cached);
+    CHECK(counter->renders - renders == decodes,
+          "'%c' was decoded %u times, expected %u", (char)character,
+          counter->renders - renders, decodes);
+
+    mf_render_character(counter->base, 4, 4, character, canvas_callback,
+                        direct);
+    CHECK(memcmp(cached, direct, sizeof(cached)) == 0,
+          "'%c' differs from the base font", (char)character);
+}
+
+/* Glyphs that do not fit in the cache are decoded twice the first time,
+ * once to find that out and once to render them. After that they are
+ * rendered directly, and the cached glyphs are kept. */
+static void test_oversized(void)
+{
+    static uint32_t arena[1024];
+    struct counting_font_s counter;
+    struct mf_cachedfont_s cfont;
+    uint16_t size;
+
+    counter.base = mf_find_font("DejaVuSans12");
+    CHECK(counter.base, "font not found");
+    if (!counter.base)
+        return;
+
+    counter.font = *counter.base;
+    counter.font.width = counter.base->width / 2;
+    counter.font.character_width = &counting_character_width;
+    counter.font.render_character = &counting_render_character;
+    counter.font.render_character_clipped = 0;
+    counter.font.render_string = 0;
+    counter.renders = 0;
+
+    /* Room for exactly two glyphs. */
+    size = 0;
+    do {
+        mf_cache_font(&cfont, &counter.font, 4, arena, ++size);
+    } while (cfont.slot_count < 2);
+
+    check_render(&cfont, &counter, 'i', 1);
+    check_render(&cfont, &counter, 'l', 1);
+    check_render(&cfont, &counter, 'i', 0);
+    check_render(&cfont, &counter, 'l', 0);
+
+    /* Replaces 'i', the least recently used. */
+    check_render(&cfont, &counter, 'W', 2);
+    check_render(&cfont, &counter, 'W', 1);
+    check_render(&cfont, &counter, 'W', 1);
+    check_render(&cfont, &counter, 'l', 0);
+    check_render(&cfont, &counter, 'i', 1);
+
+    CHECK(cfont.hits == 3, "%lu hits, expected 3", (unsigned long)cfont.hits);
+    CHECK(cfont.misses == 6, "%lu misses, expected 6",
+          (unsigned long)cfont.misses);
+
+    mf_clear_font_cache(&cfont);
+    check_render(&cfont, &counter, 'l', 1);
+    check_render(&cfont, &counter, 'W', 2);
+
+    /* Too small for even one glyph and the spare, everything is rendered
+     * directly. */
+    mf_cache_font(&cfont, &counter.font, 4, arena, size / 2);
+    CHECK(cfont.slot_count == 0, "%u slots, expected 0", cfont.slot_count);
+    check_render(&cfont, &counter, 'l', 1);
+    check_render(&cfont, &counter, 'l', 1);
+}
+
+int main(void)
+{
+    test_oversized();
+
+    if (failures)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All cachedfont tests passed\n");
+    return 0;
+}
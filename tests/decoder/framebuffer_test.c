@@ -0,0 +1,390 @@
+/* Test of the built-in framebuffer targets. The results of each pixel
+ * format are compared with alpha blending by exact division: equal for the
+ * grayscale formats and within one LSB per channel for RGB565. The writers
+ * are first run for every combination of background, color and alpha, and
+ * then through the direct path of the decoders for every glyph of the
+ * included fonts. */
+
+#include <mcufont.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+/* Report a failed check, printing only the first few. */
+#define CHECK(cond, ...) do { \
+    if (!(cond) && failures++ < 10) { \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } } while (0)
+
+static const char *format_names[] = {"mono_paged", "gray4", "gray8", "rgb565"};
+
+/*************************************
+ * Reference pixel access and blends *
+ *************************************/
+
+static uint16_t get_pixel(const struct mf_framebuffer_s *fb, int x, int y)
+{
+    const uint8_t *row = fb->data + (uint32_t)y * fb->stride;
+
+    switch (fb->format)
+    {
+        case MF_FRAMEBUFFER_MONO_PAGED:
+            return (fb->data[(y >> 3) * fb->stride + x] >> (y & 7)) & 1;
+        case MF_FRAMEBUFFER_GRAY4:
+            return (x & 1) ? (row[x >> 1] & 0x0F) : (row[x >> 1] >> 4);
+        case MF_FRAMEBUFFER_GRAY8:
+            return row[x];
+        default:
+            return ((const uint16_t*)row)[x];
+    }
+}
+
+static void set_pixel(const struct mf_framebuffer_s *fb, int x, int y,
+                      uint16_t value)
+{
+    uint8_t *row = fb->data + (uint32_t)y * fb->stride;
+    uint8_t *p;
+
+    switch (fb->format)
+    {
+        case MF_FRAMEBUFFER_MONO_PAGED:
+            p = &fb->data[(y >> 3) * fb->stride + x];
+            *p = (*p & ~(1 << (y & 7))) | (value << (y & 7));
+            break;
+        case MF_FRAMEBUFFER_GRAY4:
+            p = &row[x >> 1];
+            if (x & 1)
+                *p = (*p & 0xF0) | value;
+            else
+                *p = (*p & 0x0F) | (value << 4);
+            break;
+        case MF_FRAMEBUFFER_GRAY8:
+            row[x] = value;
+            break;
+        default:
+            ((uint16_t*)row)[x] = value;
+            break;
+    }
+}
+
+/* Round (bg * (max - alpha) + fg * alpha) / max to nearest. */
+static unsigned exact_blend(unsigned bg, unsigned fg, unsigned alpha,
+                            unsigned max)
+{
+    return (bg * (max - alpha) + fg * alpha + max / 2) / max;
+}
+
+/* The expected value of a pixel after writing a run over it. */
+static uint16_t blend_pixel(uint8_t format, uint16_t bg, uint16_t color,
+                            uint8_t alpha)
+{
+    switch (format)
+    {
+        case MF_FRAMEBUFFER_MONO_PAGED:
+            return (alpha >= 128) ? color : bg;
+        case MF_FRAMEBUFFER_GRAY4:
+            /* The format only has 4 bits of alpha. */
+            return exact_blend(bg, color, alpha >> 4, 15);
+        case MF_FRAMEBUFFER_GRAY8:
+            return exact_blend(bg, color, alpha, 255);
+        default:
+            return (exact_blend(bg >> 11, color >> 11, alpha, 255) << 11) |
+                   (exact_blend((bg >> 5) & 63, (color >> 5) & 63,
+                                alpha, 255) << 5) |
+                   exact_blend(bg & 31, color & 31, alpha, 255);
+    }
+}
+
+static int channel_diff(uint16_t a, uint16_t b, int shift, int mask)
+{
+    return abs(((a >> shift) & mask) - ((b >> shift) & mask));
+}
+
+static bool pixel_matches(uint8_t format, uint16_t got, uint16_t want)
+{
+    if (format != MF_FRAMEBUFFER_RGB565)
+        return got == want;
+
+    return channel_diff(got, want, 11, 31) <= 1 &&
+           channel_diff(got, want, 5, 63) <= 1 &&
+           channel_diff(got, want, 0, 31) <= 1;
+}
+
+/**************************************************
+ * Every background, color and alpha of each run *
+ **************************************************/
+
+/* Background of the test buffers: every pixel value along the rows, and
+ * for RGB565 every value in the whole buffer. */
+static uint16_t background(const struct mf_framebuffer_s *fb, int x, int y)
+{
+    if (fb->format == MF_FRAMEBUFFER_RGB565)
+        return y * fb->width + x;
+    else if (fb->format == MF_FRAMEBUFFER_MONO_PAGED)
+        return (x ^ y) & 1;
+    else if (fb->format == MF_FRAMEBUFFER_GRAY4)
+        return x % 16;
+    else
+        return x % 256;
+}
+
+/* Fill the buffer with the background, write two runs on each row and
+ * compare the result with the exact blend. A negative alpha means that
+ * each row has the alpha of its row number. */
+static void check_blends(struct mf_framebuffer_s *fb, uint16_t color,
+                         int alpha)
+{
+    int x, y;
+    uint16_t bg, want, got;
+    uint8_t a;
+
+    fb->color = color;
+    for (y = 0; y < fb->height; y++)
+    {
+        for (x = 0; x < fb->width; x++)
+            set_pixel(fb, x, y, background(fb, x, y));
+    }
+
+    for (y = 0; y < fb->height; y++)
+    {
+        a = (alpha < 0) ? y : alpha;
+        mf_framebuffer_callback(0, y, fb->width / 2, a, fb);
+        mf_framebuffer_callback(fb->width / 2, y, fb->width / 2, a, fb);
+    }
+
+    for (y = 0; y < fb->height; y++)
+    {
+        for (x = 0; x < fb->width; x++)
+        {
+            a = (alpha < 0) ? y : alpha;
+            bg = background(fb, x, y);
+            want = blend_pixel(fb->format, bg, color, a);
+            got = get_pixel(fb, x, y);
+            if (!pixel_matches(fb->format, got, want))
+            {
+                CHECK(false, "%s: background %u, color %u, alpha %u: "
+                      "got %u, expected %u", format_names[fb->format],
+                      bg, color, a, got, want);
+                return;
+            }
+        }
+    }
+}
+
+static void test_blends(void)
+{
+    static uint16_t buffer[256 * 256];
+    static const uint16_t colors565[] = {
+        0x0000, 0xFFFF, 0xF800, 0x07E0, 0x001F, 0x5AA5, 0x8410, 0x7BEF
+    };
+    struct mf_framebuffer_s fb;
+    unsigned color, i;
+    int alpha;
+
+    fb.data = (uint8_t*)buffer;
+    fb.height = 256;
+
+    fb.format = MF_FRAMEBUFFER_MONO_PAGED;
+    fb.width = 256;
+    fb.stride = 256;
+    for (color = 0; color <= 1; color++)
+        check_blends(&fb, color, -1);
+
+    fb.format = MF_FRAMEBUFFER_GRAY4;
+    fb.width = 16;
+    fb.stride = 8;
+    for (color = 0; color <= 15; color++)
+        check_blends(&fb, color, -1);
+
+    fb.format = MF_FRAMEBUFFER_GRAY8;
+    fb.width = 256;
+    fb.stride = 256;
+    for (color = 0; color <= 255; color++)
+        check_blends(&fb, color, -1);
+
+    fb.format = MF_FRAMEBUFFER_RGB565;
+    fb.width = 256;
+    fb.stride = 512;
+    for (i = 0; i < sizeof(colors565) / sizeof(colors565[0]); i++)
+    {
+        for (alpha = 0; alpha <= 255; alpha++)
+            check_blends(&fb, colors565[i], alpha);
+    }
+}
+
+/*************************************************
+ * Runs that cross the edges of the framebuffer *
+ *************************************************/
+
+/* Write runs that start and end outside a small framebuffer, in the middle
+ * of a larger memory area, and check that only the visible part changes. */
+static void test_clipping(void)
+{
+    static uint16_t memory16[32 * 32], expected16[32 * 32];
+    uint8_t *memory = (uint8_t*)memory16, *expected = (uint8_t*)expected16;
+    struct mf_framebuffer_s fb, ref;
+    uint8_t format;
+    int x, y, i;
+    static const int16_t runs[][3] = {
+        /* x, y, count */
+        {-5, 0, 10}, {3, 1, 255}, {-300, 2, 255}, {-2, -1, 20},
+        {0, 16, 20}, {9, 15, 1}, {10, 3, 5}, {-10, 4, 10}
+    };
+
+    for (format = 0; format <= MF_FRAMEBUFFER_RGB565; format++)
+    {
+        memset(memory, 0xA5, sizeof(memory16));
+        memset(expected, 0xA5, sizeof(expected16));
+
+        /* A 10x16 buffer at byte 8 of each 64 byte row, or of each page
+         * of 8 rows for MONO_PAGED. */
+        fb.data = memory + 64 + 8;
+        fb.stride = 64;
+        fb.width = 10;
+        fb.height = 16;
+        fb.format = format;
+        fb.color = 1;
+        ref = fb;
+        ref.data = expected + 64 + 8;
+
+        for (i = 0; i < (int)(sizeof(runs) / sizeof(runs[0])); i++)
+        {
+            mf_framebuffer_callback(runs[i][0], runs[i][1], runs[i][2],
+                                    255, &fb);
+
+            for (x = runs[i][0]; x < runs[i][0] + runs[i][2]; x++)
+            {
+                y = runs[i][1];
+                if (x >= 0 && x < fb.width && y >= 0 && y < fb.height)
+                    set_pixel(&ref, x, y, 1);
+            }
+        }
+
+        CHECK(memcmp(memory, expected, sizeof(memory16)) == 0,
+              "%s: runs were not clipped to the framebuffer",
+              format_names[format]);
+    }
+}
+
+/***************************************
+ * Every glyph through the decoders *
+ ***************************************/
+
+/* Pixel callback that blends into a framebuffer with the exact reference,
+ * for the glyphs rendered through the normal callback path. */
+static void reference_callback(int16_t x, int16_t y, uint8_t count,
+                               uint8_t alpha, void *state)
+{
+    const struct mf_framebuffer_s *fb = state;
+    uint16_t bg;
+
+    for (; count > 0; count--, x++)
+    {
+        if (x < 0 || y < 0 || x >= fb->width || y >= fb->height || !alpha)
+            continue;
+
+        bg = get_pixel(fb, x, y);
+        set_pixel(fb, x, y, blend_pixel(fb->format, bg, fb->color, alpha));
+    }
+}
+
+/* Render every character on the same background with the direct path and
+ * with the reference, and return the number of glyphs compared. */
+static unsigned check_glyphs(const struct mf_font_s *font, uint8_t format,
+                             uint16_t color)
+{
+    static uint16_t direct[128 * 128], reference[128 * 128];
+    struct mf_framebuffer_s fb, ref;
+    unsigned count = 0;
+    int x, y;
+    mf_char c;
+    uint16_t got, want;
+
+    fb.data = (uint8_t*)direct;
+    fb.width = font->width + 4;
+    fb.height = ((font->height + 4 + 7) / 8) * 8;
+    fb.stride = (format == MF_FRAMEBUFFER_GRAY4) ? (fb.width + 1) / 2 :
+                (format == MF_FRAMEBUFFER_RGB565) ? 2 * fb.width : fb.width;
+    fb.format = format;
+    fb.color = color;
+    ref = fb;
+    ref.data = (uint8_t*)reference;
+
+    if (fb.width > 128 || fb.height > 128)
+        return 0;
+
+    for (c = 32; c < 0x2100; c++)
+    {
+        if (!font->character_width(font, c))
+            continue;
+
+        for (y = 0; y < fb.height; y++)
+        {
+            for (x = 0; x < fb.width; x++)
+            {
+                set_pixel(&fb, x, y, background(&fb, x, y));
+                set_pixel(&ref, x, y, background(&ref, x, y));
+            }
+        }
+
+        /* Start left of the buffer, so that the writers also clip. */
+        mf_render_character(font, -1, 2, c, mf_framebuffer_callback, &fb);
+        mf_render_character(font, -1, 2, c, reference_callback, &ref);
+        count++;
+
+        for (y = 0; y < fb.height; y++)
+        {
+            for (x = 0; x < fb.width; x++)
+            {
+                got = get_pixel(&fb, x, y);
+                want = get_pixel(&ref, x, y);
+                if (!pixel_matches(format, got, want))
+                {
+                    CHECK(false, "%s: %s, character %u at %d,%d: got %u, "
+                          "expected %u", format_names[format],
+                          font->short_name, (unsigned)c, x, y, got, want);
+                    return count;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+static void test_glyphs(void)
+{
+    const struct mf_font_list_s *f;
+    unsigned glyphs = 0;
+
+    for (f = mf_get_font_list(); f; f = f->next)
+    {
+        glyphs += check_glyphs(f->font, MF_FRAMEBUFFER_MONO_PAGED, 1);
+        glyphs += check_glyphs(f->font, MF_FRAMEBUFFER_GRAY4, 3);
+        glyphs += check_glyphs(f->font, MF_FRAMEBUFFER_GRAY8, 40);
+        glyphs += check_glyphs(f->font, MF_FRAMEBUFFER_RGB565, 0x5AA5);
+    }
+
+    CHECK(glyphs > 0, "no glyphs were rendered");
+    printf("Compared %u glyphs\n", glyphs);
+}
+
+int main(void)
+{
+    test_blends();
+    test_clipping();
+    test_glyphs();
+
+    if (failures)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All framebuffer tests passed\n");
+    return 0;
+}